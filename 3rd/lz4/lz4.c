@@ -0,0 +1,215 @@
+#include "lz4.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+	sequence : token (literal length 4 bits, match length - 4 4 bits) , [literal length + 15 ...] , literals ,
+		offset (2 bytes little-endian) , [match length + 19 ...]
+	The last sequence is literals only. The last match starts MFLIMIT bytes before the end of block at least,
+	and the last LASTLITERALS bytes are always literals.
+ */
+
+#define MINMATCH 4
+#define LASTLITERALS 5
+#define MFLIMIT 12
+#define MAX_DISTANCE 65535
+#define HASH_LOG 12
+#define SKIP_TRIGGER 6	// search faster in the incompressible data
+
+static inline uint32_t
+read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t
+hash32(uint32_t v) {
+	return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// the common bytes of p and r, until limit
+static inline const uint8_t *
+match_end(const uint8_t *p, const uint8_t *r, const uint8_t *limit) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (p + 8 <= limit) {
+		uint64_t a, b;
+		memcpy(&a, p, 8);
+		memcpy(&b, r, 8);
+		uint64_t diff = a ^ b;
+		if (diff) {
+			return p + (__builtin_ctzll(diff) >> 3);
+		}
+		p += 8;
+		r += 8;
+	}
+#endif
+	while (p < limit && *p == *r) {
+		++p;
+		++r;
+	}
+	return p;
+}
+
+static inline uint8_t *
+write_length(uint8_t *op, int len) {
+	for (; len >= 255; len -= 255) {
+		*op++ = 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+int
+LZ4_compressBound(int inputSize) {
+	return LZ4_COMPRESSBOUND(inputSize);
+}
+
+int
+LZ4_compress_default(const char* source, char* dest, int srcSize, int dstCapacity) {
+	if (srcSize < 0 || srcSize > LZ4_MAX_INPUT_SIZE)
+		return 0;
+	const uint8_t * src = (const uint8_t *)source;
+	const uint8_t * ip = src;
+	const uint8_t * anchor = src;
+	const uint8_t * iend = src + srcSize;
+	const uint8_t * mflimit = iend - MFLIMIT;
+	const uint8_t * matchlimit = iend - LASTLITERALS;
+	uint8_t * op = (uint8_t *)dest;
+	uint8_t * oend = op + dstCapacity;
+	uint32_t table[1 << HASH_LOG];
+
+	if (srcSize > MFLIMIT) {
+		memset(table, 0, sizeof(table));
+		int search = 1 << SKIP_TRIGGER;
+		++ip;
+		while (ip < mflimit) {
+			uint32_t seq = read32(ip);
+			uint32_t h = hash32(seq);
+			const uint8_t * ref = src + table[h];
+			table[h] = (uint32_t)(ip - src);
+			if (ref >= ip || ip - ref > MAX_DISTANCE || read32(ref) != seq) {
+				ip += search++ >> SKIP_TRIGGER;
+				continue;
+			}
+			search = 1 << SKIP_TRIGGER;
+			// extend backward
+			while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				--ip;
+				--ref;
+			}
+			const uint8_t * end = match_end(ip + MINMATCH, ref + MINMATCH, matchlimit);
+			int litlen = (int)(ip - anchor);
+			int matchlen = (int)(end - ip) - MINMATCH;
+			if (oend - op < 1 + litlen + litlen / 255 + 1 + 2 + matchlen / 255 + 1)
+				return 0;
+			uint8_t * token = op++;
+			if (litlen >= 15) {
+				*token = 15 << 4;
+				op = write_length(op, litlen - 15);
+			} else {
+				*token = (uint8_t)(litlen << 4);
+			}
+			memcpy(op, anchor, litlen);
+			op += litlen;
+			uint16_t offset = (uint16_t)(ip - ref);
+			op[0] = offset & 0xff;
+			op[1] = offset >> 8;
+			op += 2;
+			if (matchlen >= 15) {
+				*token |= 15;
+				op = write_length(op, matchlen - 15);
+			} else {
+				*token |= (uint8_t)matchlen;
+			}
+			ip = anchor = end;
+			if (ip < mflimit) {
+				// fill the table for the next search
+				table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+			}
+		}
+	}
+	int litlen = (int)(iend - anchor);
+	if (oend - op < 1 + litlen + litlen / 255 + 1)
+		return 0;
+	if (litlen >= 15) {
+		*op++ = 15 << 4;
+		op = write_length(op, litlen - 15);
+	} else {
+		*op++ = (uint8_t)(litlen << 4);
+	}
+	memcpy(op, anchor, litlen);
+	op += litlen;
+	return (int)(op - (uint8_t *)dest);
+}
+
+// returns NULL if the length is out of the input
+static inline const uint8_t *
+read_length(const uint8_t *ip, const uint8_t *iend, size_t *len) {
+	uint8_t s;
+	do {
+		if (ip >= iend)
+			return NULL;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+	return ip;
+}
+
+int
+LZ4_decompress_safe(const char* source, char* dest, int compressedSize, int dstCapacity) {
+	const uint8_t * ip = (const uint8_t *)source;
+	const uint8_t * iend = ip + compressedSize;
+	uint8_t * op = (uint8_t *)dest;
+	uint8_t * oend = op + dstCapacity;
+	if (compressedSize <= 0 || dstCapacity < 0)
+		return -1;
+	if (dstCapacity == 0)
+		return compressedSize == 1 && *ip == 0 ? 0 : -1;	// the empty block is a zero token
+	for (;;) {
+		if (ip >= iend)
+			return -1;
+		uint8_t token = *ip++;
+		size_t litlen = token >> 4;
+		if (litlen == 15) {
+			ip = read_length(ip, iend, &litlen);
+			if (ip == NULL)
+				return -1;
+		}
+		if (litlen > (size_t)(iend - ip) || litlen > (size_t)(oend - op))
+			return -1;
+		memcpy(op, ip, litlen);
+		op += litlen;
+		ip += litlen;
+		if (ip == iend)
+			break;	// the last sequence
+		if (iend - ip < 2)
+			return -1;
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - (uint8_t *)dest))
+			return -1;
+		size_t matchlen = token & 15;
+		if (matchlen == 15) {
+			ip = read_length(ip, iend, &matchlen);
+			if (ip == NULL)
+				return -1;
+		}
+		matchlen += MINMATCH;
+		if (matchlen > (size_t)(oend - op))
+			return -1;
+		const uint8_t * match = op - offset;
+		if (offset >= matchlen) {
+			memcpy(op, match, matchlen);
+			op += matchlen;
+		} else {
+			// overlapped, repeat the pattern
+			uint8_t * end = op + matchlen;
+			while (op < end) {
+				*op++ = *match++;
+			}
+		}
+	}
+	return (int)(op - (uint8_t *)dest);
+}
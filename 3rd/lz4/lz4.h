@@ -0,0 +1,26 @@
+/*
+	A compact implementation of the LZ4 block format
+	( https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md ),
+	the functions are the same subset of the upstream lz4.h, so lz4.c can be replaced by the upstream one.
+
+	The data is compatible with LZ4 (read test/testlz4.lua and lz4_fuzz.c) : LZ4_decompress_safe can decode any LZ4 block,
+	and the blocks of LZ4_compress_default can be decoded by any LZ4 decoder.
+ */
+
+#ifndef LZ4_H_2983827168210
+#define LZ4_H_2983827168210
+
+#define LZ4_MAX_INPUT_SIZE 0x7E000000
+
+#define LZ4_COMPRESSBOUND(isize) ((unsigned)(isize) > (unsigned)LZ4_MAX_INPUT_SIZE ? 0 : (isize) + ((isize)/255) + 16)
+
+// the max size of compressed data in the worst case, 0 if the input is too large
+int LZ4_compressBound(int inputSize);
+
+// returns the size of compressed data in dst, or 0 if it doesn't fit in dstCapacity
+int LZ4_compress_default(const char* src, char* dst, int srcSize, int dstCapacity);
+
+// returns the size of decompressed data in dst, or a negative number if the data is malformed (or dst is too small)
+int LZ4_decompress_safe(const char* src, char* dst, int compressedSize, int dstCapacity);
+
+#endif
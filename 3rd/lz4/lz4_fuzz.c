@@ -0,0 +1,213 @@
+/*
+	The fuzz target of 3rd/lz4, for libFuzzer :
+		clang -g -O1 -fsanitize=fuzzer,address,undefined -I3rd/lz4 3rd/lz4/lz4_fuzz.c 3rd/lz4/lz4.c -ldl -o lz4fuzz
+		./lz4fuzz
+	or without libFuzzer (make lz4fuzz, with ASan and UBSan) :
+		./lz4fuzz [count] [seed]	runs the random and mutated inputs
+		./lz4fuzz file ...	runs the files (the crashes found by libFuzzer)
+
+	For each input :
+	1. LZ4_decompress_safe decodes it as a block with a few capacities, it never reads or writes out of the buffers,
+	   and the result is not larger than the capacity.
+	2. LZ4_compress_default compresses it (the block is not larger than LZ4_compressBound), and LZ4_decompress_safe
+	   gets it back.
+	3. If the upstream liblz4 (LZ4_LIBRARY, liblz4.so.1 by default) can be loaded, the block of 2 is decoded by liblz4,
+	   the input compressed by liblz4 is decoded by 3rd/lz4, and the input as a block is decoded to the same data
+	   by both if 3rd/lz4 decodes it (3rd/lz4 is stricter, it rejects the offset 0).
+ */
+
+#include "lz4.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#define MAX_INPUT 0x20000
+
+typedef int (*lz4_compress_f)(const char* src, char* dst, int srcSize, int dstCapacity);
+typedef int (*lz4_decompress_f)(const char* src, char* dst, int compressedSize, int dstCapacity);
+
+static struct {
+	int init;
+	lz4_compress_f compress;
+	lz4_decompress_f decompress;
+} UPSTREAM;
+
+static void
+upstream_init(void) {
+	if (UPSTREAM.init)
+		return;
+	UPSTREAM.init = 1;
+	const char * name = getenv("LZ4_LIBRARY");
+	void * lib = dlopen(name ? name : "liblz4.so.1", RTLD_NOW | RTLD_LOCAL);
+	if (lib == NULL) {
+		fprintf(stderr, "lz4fuzz: no upstream liblz4 (%s), skip the differential checks\n", dlerror());
+		return;
+	}
+	UPSTREAM.compress = (lz4_compress_f)dlsym(lib, "LZ4_compress_default");
+	UPSTREAM.decompress = (lz4_decompress_f)dlsym(lib, "LZ4_decompress_safe");
+	if (UPSTREAM.compress == NULL || UPSTREAM.decompress == NULL) {
+		UPSTREAM.compress = NULL;
+		UPSTREAM.decompress = NULL;
+	}
+}
+
+static void
+check(int cond, const char * what, size_t sz) {
+	if (!cond) {
+		fprintf(stderr, "lz4fuzz: %s (input %d bytes)\n", what, (int)sz);
+		abort();
+	}
+}
+
+// the capacities are exact in the heap, so ASan finds any access out of them
+static void
+fuzz_block(const uint8_t *data, size_t sz) {
+	static const int CAP[] = { 0, 1, 16, 255, 4096, MAX_INPUT * 4 };
+	int i;
+	for (i=0;i<(int)(sizeof(CAP)/sizeof(CAP[0]));i++) {
+		int cap = CAP[i];
+		char * src = malloc(sz ? sz : 1);
+		memcpy(src, data, sz);
+		char * dst = malloc(cap ? cap : 1);
+		int n = LZ4_decompress_safe(src, dst, (int)sz, cap);
+		check(n <= cap, "decompress beyond the capacity", sz);
+		if (n >= 0 && UPSTREAM.decompress) {
+			char * ref = malloc(cap ? cap : 1);
+			int m = UPSTREAM.decompress(src, ref, (int)sz, cap);
+			check(m == n && memcmp(dst, ref, n) == 0, "3rd/lz4 and liblz4 decode the block differently", sz);
+			free(ref);
+		}
+		free(dst);
+		free(src);
+	}
+}
+
+static void
+fuzz_roundtrip(const uint8_t *data, size_t sz) {
+	int bound = LZ4_compressBound((int)sz);
+	check(bound > 0, "LZ4_compressBound", sz);
+	char * block = malloc(bound);
+	int n = LZ4_compress_default((const char *)data, block, (int)sz, bound);
+	check(n > 0 && n <= bound, "compress", sz);
+	char * out = malloc(sz ? sz : 1);
+	check(LZ4_decompress_safe(block, out, n, (int)sz) == (int)sz && memcmp(out, data, sz) == 0, "roundtrip", sz);
+	// the block without space for the last byte is rejected
+	if (n > 1) {
+		check(LZ4_compress_default((const char *)data, block, (int)sz, n - 1) == 0, "compress into a small buffer", sz);
+	}
+	if (UPSTREAM.decompress) {
+		n = LZ4_compress_default((const char *)data, block, (int)sz, bound);
+		memset(out, 0, sz);
+		check(UPSTREAM.decompress(block, out, n, (int)sz) == (int)sz && memcmp(out, data, sz) == 0,
+			"liblz4 decodes the block of 3rd/lz4", sz);
+		n = UPSTREAM.compress((const char *)data, block, (int)sz, bound);
+		check(n > 0, "liblz4 compress", sz);
+		memset(out, 0, sz);
+		check(LZ4_decompress_safe(block, out, n, (int)sz) == (int)sz && memcmp(out, data, sz) == 0,
+			"3rd/lz4 decodes the block of liblz4", sz);
+	}
+	free(out);
+	free(block);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t sz) {
+	if (sz > MAX_INPUT)
+		return 0;
+	upstream_init();
+	fuzz_block(data, sz);
+	fuzz_roundtrip(data, sz);
+	return 0;
+}
+
+#ifdef LZ4_FUZZ_MAIN
+
+static uint32_t
+rand_next(uint32_t *x) {
+	*x = *x * 1103515245 + 12345;
+	return (*x >> 16) & 0x7fff;
+}
+
+// random bytes, runs of a few symbols (compressible), or a compressed block with some bytes changed
+static size_t
+gen_input(uint8_t *buf, uint32_t *x) {
+	size_t sz = rand_next(x) % 4 == 0 ? rand_next(x) * 4 % MAX_INPUT : rand_next(x) % 512;
+	size_t i;
+	switch (rand_next(x) % 3) {
+	case 0:
+		for (i=0;i<sz;i++) {
+			buf[i] = (uint8_t)rand_next(x);
+		}
+		return sz;
+	case 1: {
+		int symbols = rand_next(x) % 8 + 1;
+		for (i=0;i<sz;) {
+			uint8_t c = (uint8_t)(rand_next(x) % symbols);
+			size_t len = rand_next(x) % 64 + 1;
+			for (;len > 0 && i < sz;len--) {
+				buf[i++] = c;
+			}
+		}
+		return sz;
+	}
+	default: {
+		uint8_t * tmp = malloc(sz ? sz : 1);
+		for (i=0;i<sz;i++) {
+			tmp[i] = (uint8_t)(rand_next(x) % 4 + 'a');
+		}
+		int n = LZ4_compress_default((const char *)tmp, (char *)buf, (int)sz, MAX_INPUT);
+		free(tmp);
+		int changes = rand_next(x) % 4;
+		for (i=0;n > 0 && (int)i<changes;i++) {
+			buf[rand_next(x) % n] = (uint8_t)rand_next(x);
+		}
+		return n > 0 ? (size_t)n : 0;
+	}
+	}
+}
+
+static int
+run_file(const char *filename, uint8_t *buf) {
+	FILE * f = fopen(filename, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "lz4fuzz: can't open %s\n", filename);
+		return 1;
+	}
+	size_t sz = fread(buf, 1, MAX_INPUT, f);
+	fclose(f);
+	LLVMFuzzerTestOneInput(buf, sz);
+	return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+	uint8_t * buf = malloc(MAX_INPUT);
+	if (argc > 1 && (argv[1][0] < '0' || argv[1][0] > '9')) {
+		int i;
+		for (i=1;i<argc;i++) {
+			if (run_file(argv[i], buf))
+				return 1;
+		}
+		printf("lz4fuzz: %d files ok\n", argc - 1);
+		return 0;
+	}
+	int count = argc > 1 ? atoi(argv[1]) : 20000;
+	uint32_t x = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1;
+	int i;
+	for (i=0;i<count;i++) {
+		size_t sz = gen_input(buf, &x);
+		// copy it to a buffer of the exact size, so ASan finds the read out of the input
+		uint8_t * input = malloc(sz ? sz : 1);
+		memcpy(input, buf, sz);
+		LLVMFuzzerTestOneInput(input, sz);
+		free(input);
+	}
+	printf("lz4fuzz: %d inputs ok%s\n", count, UPSTREAM.decompress ? " (checked by liblz4)" : "");
+	free(buf);
+	return 0;
+}
+
+#endif
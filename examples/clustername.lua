@@ -1,2 +1,5 @@
 db = "127.0.0.1:2528"
 db2 = "127.0.0.1:2529"
+-- the node on the same host can use unix domain socket, or shared memory
+-- db3 = "unix:/tmp/skynet_db3.sock"
+-- db4 = "shm:/tmp/skynet_db4.sock"
@@ -33,7 +33,7 @@ function SOCKET.error(fd, msg)
 end
 
 function SOCKET.warning(fd, size)
-	-- size K bytes havn't send out in fd
+	-- size K bytes havn't send out in fd, 0 when the send buffer drains (see socket.watermark)
 	print("socket warning", fd, size)
 end
 
@@ -4,12 +4,14 @@
 #include <assert.h>
 
 #include "skynet.h"
+#include "lz4.h"
 
 /*
 	uint32_t/string addr 
 	uint32_t/session session
 	lightuserdata msg
 	uint32_t sz
+	integer compress (optional)
 
 	return 
 		string request
@@ -18,6 +20,8 @@
 
 #define TEMP_LENGTH 0x8200
 #define MULTI_PART 0x8000
+#define COMPRESSED 0x40
+#define COMPRESSED_MAXSIZE 0x10000
 
 static void
 fill_uint32(uint8_t * buf, uint32_t n) {
@@ -34,6 +38,26 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 	buf[1] = sz & 0xff;
 }
 
+/*
+	Write msg (sz bytes, MULTI_PART at most) to buf, returns the size written.
+	It's compressed if sz is not less than compress (0 : never) and the result is smaller,
+	then *compressed is COMPRESSED.
+ */
+static int
+fill_body(uint8_t *buf, const void *msg, uint32_t sz, int compress, int *compressed) {
+	if (compress > 0 && sz >= (uint32_t)compress && sz > 5) {
+		int n = LZ4_compress_default(msg, (char *)buf + 4, (int)sz, (int)sz - 5);
+		if (n > 0) {
+			fill_uint32(buf, sz);
+			*compressed = COMPRESSED;
+			return n + 4;
+		}
+	}
+	memcpy(buf, msg, sz);
+	*compressed = 0;
+	return (int)sz;
+}
+
 /*
 	The request package :
 	size <= 0x8000 (32K) and address is id
@@ -69,19 +93,24 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 		BYTE 2/3 ; 2:multipart, 3:multipart end
 		DWORD SESSION
 		PADDING msgpart(sz)
+
+	The type 0, 0x80, 2, 3 with COMPRESSED (0x40) : msg (or msgpart) is compressed,
+		DWORD size
+		PADDING lz4 block
  */
 static int
-packreq_number(lua_State *L, int session, void * msg, uint32_t sz) {
+packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int compress) {
 	uint32_t addr = (uint32_t)lua_tointeger(L,1);
 	uint8_t buf[TEMP_LENGTH];
 	if (sz < MULTI_PART) {
-		fill_header(L, buf, sz+9);
-		buf[2] = 0;
+		int compressed;
+		int n = fill_body(buf+11, msg, sz, compress, &compressed);
+		fill_header(L, buf, n+9);
+		buf[2] = compressed;
 		fill_uint32(buf+3, addr);
 		fill_uint32(buf+7, (uint32_t)session);
-		memcpy(buf+11,msg,sz);
 
-		lua_pushlstring(L, (const char *)buf, sz+11);
+		lua_pushlstring(L, (const char *)buf, n+11);
 		return 0;
 	} else {
 		int part = (sz - 1) / MULTI_PART + 1;
@@ -96,7 +125,7 @@ packreq_number(lua_State *L, int session, void * msg, uint32_t sz) {
 }
 
 static int
-packreq_string(lua_State *L, int session, void * msg, uint32_t sz) {
+packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int compress) {
 	size_t namelen = 0;
 	const char *name = lua_tolstring(L, 1, &namelen);
 	if (name == NULL || namelen < 1 || namelen > 255) {
@@ -106,14 +135,15 @@ packreq_string(lua_State *L, int session, void * msg, uint32_t sz) {
 
 	uint8_t buf[TEMP_LENGTH];
 	if (sz < MULTI_PART) {
-		fill_header(L, buf, sz+6+namelen);
-		buf[2] = 0x80;
+		int compressed;
+		int n = fill_body(buf+8+namelen, msg, sz, compress, &compressed);
+		fill_header(L, buf, n+6+namelen);
+		buf[2] = 0x80 | compressed;
 		buf[3] = (uint8_t)namelen;
 		memcpy(buf+4, name, namelen);
 		fill_uint32(buf+4+namelen, (uint32_t)session);
-		memcpy(buf+8+namelen,msg,sz);
 
-		lua_pushlstring(L, (const char *)buf, sz+8+namelen);
+		lua_pushlstring(L, (const char *)buf, n+8+namelen);
 		return 0;
 	} else {
 		int part = (sz - 1) / MULTI_PART + 1;
@@ -130,13 +160,14 @@ packreq_string(lua_State *L, int session, void * msg, uint32_t sz) {
 }
 
 static void
-packreq_multi(lua_State *L, int session, void * msg, uint32_t sz) {
+packreq_multi(lua_State *L, int session, void * msg, uint32_t sz, int compress) {
 	uint8_t buf[TEMP_LENGTH];
 	int part = (sz - 1) / MULTI_PART + 1;
 	int i;
 	char *ptr = msg;
 	for (i=0;i<part;i++) {
 		uint32_t s;
+		int compressed;
 		if (sz > MULTI_PART) {
 			s = MULTI_PART;
 			buf[2] = 2;
@@ -144,10 +175,11 @@ packreq_multi(lua_State *L, int session, void * msg, uint32_t sz) {
 			s = sz;
 			buf[2] = 3;	// the last multi part
 		}
-		fill_header(L, buf, s+5);
+		int n = fill_body(buf+7, ptr, s, compress, &compressed);
+		buf[2] |= compressed;
+		fill_header(L, buf, n+5);
 		fill_uint32(buf+3, (uint32_t)session);
-		memcpy(buf+7, ptr, s);
-		lua_pushlstring(L, (const char *)buf, s+7);
+		lua_pushlstring(L, (const char *)buf, n+7);
 		lua_rawseti(L, -2, i+1);
 		sz -= s;
 		ptr += s;
@@ -166,12 +198,13 @@ lpackrequest(lua_State *L) {
 		skynet_free(msg);
 		return luaL_error(L, "Invalid request session %d", session);
 	}
+	int compress = (int)luaL_optinteger(L,5,0);
 	int addr_type = lua_type(L,1);
 	int multipak;
 	if (addr_type == LUA_TNUMBER) {
-		multipak = packreq_number(L, session, msg, sz);
+		multipak = packreq_number(L, session, msg, sz, compress);
 	} else {
-		multipak = packreq_string(L, session, msg, sz);
+		multipak = packreq_string(L, session, msg, sz, compress);
 	}
 	int current_session = session;
 	if (++session < 0) {
@@ -180,7 +213,7 @@ lpackrequest(lua_State *L) {
 	lua_pushinteger(L, session);
 	if (multipak) {
 		lua_createtable(L, multipak, 0);
-		packreq_multi(L, current_session, msg, sz);
+		packreq_multi(L, current_session, msg, sz, compress);
 		skynet_free(msg);
 		return 3;
 	} else {
@@ -203,8 +236,30 @@ unpack_uint32(const uint8_t * buf) {
 	return buf[0] | buf[1]<<8 | buf[2]<<16 | buf[3]<<24;
 }
 
+// push msg (sz bytes), decompress it if compressed
+static void
+push_body(lua_State *L, const uint8_t * buf, int sz, int compressed) {
+	if (!compressed) {
+		lua_pushlstring(L, (const char *)buf, sz);
+		return;
+	}
+	if (sz < 4) {
+		luaL_error(L, "Invalid compressed cluster message (size=%d)", sz);
+	}
+	uint32_t size = unpack_uint32(buf);
+	if (size > COMPRESSED_MAXSIZE) {
+		luaL_error(L, "Invalid compressed cluster message (size=%d)", (int)size);
+	}
+	luaL_Buffer b;
+	char * ptr = luaL_buffinitsize(L, &b, size);
+	if (LZ4_decompress_safe((const char *)buf+4, ptr, sz-4, (int)size) != (int)size) {
+		luaL_error(L, "Invalid compressed cluster message");
+	}
+	luaL_pushresultsize(&b, size);
+}
+
 static int
-unpackreq_number(lua_State *L, const uint8_t * buf, int sz) {
+unpackreq_number(lua_State *L, const uint8_t * buf, int sz, int compressed) {
 	if (sz < 9) {
 		return luaL_error(L, "Invalid cluster message (size=%d)", sz);
 	}
@@ -212,7 +267,7 @@ unpackreq_number(lua_State *L, const uint8_t * buf, int sz) {
 	uint32_t session = unpack_uint32(buf+5);
 	lua_pushinteger(L, address);
 	lua_pushinteger(L, session);
-	lua_pushlstring(L, (const char *)buf+9, sz-9);
+	push_body(L, buf+9, sz-9, compressed);
 
 	return 3;
 }
@@ -234,22 +289,22 @@ unpackmreq_number(lua_State *L, const uint8_t * buf, int sz) {
 }
 
 static int
-unpackmreq_part(lua_State *L, const uint8_t * buf, int sz) {
+unpackmreq_part(lua_State *L, const uint8_t * buf, int sz, int compressed) {
 	if (sz < 5) {
 		return luaL_error(L, "Invalid cluster multi part message");
 	}
-	int padding = (buf[0] == 2);
+	int padding = ((buf[0] & ~COMPRESSED) == 2);
 	uint32_t session = unpack_uint32(buf+1);
 	lua_pushboolean(L, 0);	// no address
 	lua_pushinteger(L, session);
-	lua_pushlstring(L, (const char *)buf+5, sz-5);
+	push_body(L, buf+5, sz-5, compressed);
 	lua_pushboolean(L, padding);
 
 	return 4;
 }
 
 static int
-unpackreq_string(lua_State *L, const uint8_t * buf, int sz) {
+unpackreq_string(lua_State *L, const uint8_t * buf, int sz, int compressed) {
 	if (sz < 2) {
 		return luaL_error(L, "Invalid cluster message (size=%d)", sz);
 	}
@@ -260,7 +315,7 @@ unpackreq_string(lua_State *L, const uint8_t * buf, int sz) {
 	lua_pushlstring(L, (const char *)buf+2, namesz);
 	uint32_t session = unpack_uint32(buf + namesz + 2);
 	lua_pushinteger(L, (uint32_t)session);
-	lua_pushlstring(L, (const char *)buf+2+namesz+4, sz - namesz - 6);
+	push_body(L, buf+2+namesz+4, sz - namesz - 6, compressed);
 
 	return 3;
 }
@@ -289,17 +344,25 @@ lunpackrequest(lua_State *L) {
 	size_t ssz;
 	const char *msg = luaL_checklstring(L,1,&ssz);
 	int sz = (int)ssz;
-	switch (msg[0]) {
+	if (sz < 1) {
+		return luaL_error(L, "Invalid cluster message (size=%d)", sz);
+	}
+	uint8_t type = (uint8_t)msg[0];
+	switch (type) {
 	case 0:
-		return unpackreq_number(L, (const uint8_t *)msg, sz);
+	case COMPRESSED:
+		return unpackreq_number(L, (const uint8_t *)msg, sz, type & COMPRESSED);
 	case 1:
 		return unpackmreq_number(L, (const uint8_t *)msg, sz);
 	case 2:
 	case 3:
-		return unpackmreq_part(L, (const uint8_t *)msg, sz);
-	case '\x80':
-		return unpackreq_string(L, (const uint8_t *)msg, sz);
-	case '\x81':
+	case 2 | COMPRESSED:
+	case 3 | COMPRESSED:
+		return unpackmreq_part(L, (const uint8_t *)msg, sz, type & COMPRESSED);
+	case 0x80:
+	case 0x80 | COMPRESSED:
+		return unpackreq_string(L, (const uint8_t *)msg, sz, type & COMPRESSED);
+	case 0x81:
 		return unpackmreq_string(L, (const uint8_t *)msg, sz);
 	default:
 		return luaL_error(L, "Invalid req package type %d", msg[0]);
@@ -319,12 +382,14 @@ lunpackrequest(lua_State *L) {
 		type = 1, msg
 		type = 2, DWORD size
 		type = 3/4, msg
+	The type 1, 3, 4 with COMPRESSED (0x40) : msg is compressed (DWORD size + lz4 block)
  */
 /*
 	int session
 	boolean ok
 	lightuserdata msg
 	int sz
+	integer compress (optional)
 	return string response
  */
 static int
@@ -333,6 +398,7 @@ lpackresponse(lua_State *L) {
 	// clusterd.lua:command.socket call lpackresponse,
 	// and the msg/sz is return by skynet.rawcall , so don't free(msg)
 	int ok = lua_toboolean(L,2);
+	int compress = (int)luaL_optinteger(L,5,0);
 	void * msg;
 	size_t sz;
 	
@@ -367,6 +433,7 @@ lpackresponse(lua_State *L) {
 			int i;
 			for (i=0;i<part;i++) {
 				int s;
+				int compressed;
 				if (sz > MULTI_PART) {
 					s = MULTI_PART;
 					buf[6] = 3;
@@ -374,10 +441,11 @@ lpackresponse(lua_State *L) {
 					s = sz;
 					buf[6] = 4;
 				}
-				fill_header(L, buf, s+5);
+				int n = fill_body(buf+7, ptr, s, compress, &compressed);
+				buf[6] |= compressed;
+				fill_header(L, buf, n+5);
 				fill_uint32(buf+2, session);
-				memcpy(buf+7,ptr,s);
-				lua_pushlstring(L, (const char *)buf, s+7);
+				lua_pushlstring(L, (const char *)buf, n+7);
 				lua_rawseti(L, -2, i+2);
 				sz -= s;
 				ptr += s;
@@ -387,12 +455,13 @@ lpackresponse(lua_State *L) {
 	}
 
 	uint8_t buf[TEMP_LENGTH];
-	fill_header(L, buf, sz+5);
+	int compressed;
+	int n = fill_body(buf+7, msg, sz, ok ? compress : 0, &compressed);
+	fill_header(L, buf, n+5);
 	fill_uint32(buf+2, session);
-	buf[6] = ok;
-	memcpy(buf+7,msg,sz);
+	buf[6] = ok | compressed;
 
-	lua_pushlstring(L, (const char *)buf, sz+7);
+	lua_pushlstring(L, (const char *)buf, n+7);
 
 	return 1;
 }
@@ -413,7 +482,9 @@ lunpackresponse(lua_State *L) {
 	}
 	uint32_t session = unpack_uint32((const uint8_t *)buf);
 	lua_pushinteger(L, (lua_Integer)session);
-	switch(buf[4]) {
+	uint8_t type = (uint8_t)buf[4];
+	int compressed = type & COMPRESSED;
+	switch(type & ~COMPRESSED) {
 	case 0:	// error
 		lua_pushboolean(L, 0);
 		lua_pushlstring(L, buf+5, sz-5);
@@ -421,7 +492,7 @@ lunpackresponse(lua_State *L) {
 	case 1:	// ok
 	case 4:	// multi end
 		lua_pushboolean(L, 1);
-		lua_pushlstring(L, buf+5, sz-5);
+		push_body(L, (const uint8_t *)buf+5, sz-5, compressed);
 		return 3;
 	case 2:	// multi begin
 		if (sz != 9) {
@@ -434,7 +505,7 @@ lunpackresponse(lua_State *L) {
 		return 4;
 	case 3:	// multi part
 		lua_pushboolean(L, 1);
-		lua_pushlstring(L, buf+5, sz-5);
+		push_body(L, (const uint8_t *)buf+5, sz-5, compressed);
 		lua_pushboolean(L, 1);
 		return 4;
 	default:
@@ -442,6 +513,54 @@ lunpackresponse(lua_State *L) {
 	}
 }
 
+/*
+	integer node
+	uint32_t/string addr
+	lightuserdata msg
+	uint32_t sz
+
+	return lightuserdata, integer : the call to cluster service (service-src/service_cluster.c), msg is freed
+		DWORD node
+		BYTE namelen (0 : addr is a number)
+		DWORD addr / name
+		PADDING msg
+ */
+static int
+lpackcall(lua_State *L) {
+	uint32_t node = (uint32_t)luaL_checkinteger(L,1);
+	void *msg = lua_touserdata(L,3);
+	if (msg == NULL) {
+		return luaL_error(L, "Invalid request message");
+	}
+	uint32_t sz = (uint32_t)luaL_checkinteger(L,4);
+	size_t namelen = 0;
+	const char *name = NULL;
+	uint32_t addr = 0;
+	if (lua_type(L,2) == LUA_TNUMBER) {
+		addr = (uint32_t)lua_tointeger(L,2);
+	} else {
+		name = lua_tolstring(L, 2, &namelen);
+		if (name == NULL || namelen < 1 || namelen > 255) {
+			skynet_free(msg);
+			return luaL_error(L, "name is too long %s", name);
+		}
+	}
+	size_t hsz = name ? 5 + namelen : 9;
+	uint8_t * buf = skynet_malloc(hsz + sz);
+	fill_uint32(buf, node);
+	buf[4] = (uint8_t)namelen;
+	if (name) {
+		memcpy(buf+5, name, namelen);
+	} else {
+		fill_uint32(buf+5, addr);
+	}
+	memcpy(buf+hsz, msg, sz);
+	skynet_free(msg);
+	lua_pushlightuserdata(L, buf);
+	lua_pushinteger(L, hsz + sz);
+	return 2;
+}
+
 static int
 lconcat(lua_State *L) {
 	if (!lua_istable(L,1))
@@ -483,6 +602,7 @@ luaopen_cluster_core(lua_State *L) {
 		{ "packresponse", lpackresponse },
 		{ "unpackresponse", lunpackresponse },
 		{ "concat", lconcat },
+		{ "packcall", lpackcall },
 		{ NULL, NULL },
 	};
 	luaL_checkversion(L);
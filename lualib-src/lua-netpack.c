@@ -1,6 +1,8 @@
 #include "skynet_malloc.h"
 
 #include "skynet_socket.h"
+#include "framing.h"
+#include "fdtable.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -11,7 +13,6 @@
 #include <string.h>
 
 #define QUEUESIZE 1024
-#define HASHSIZE 4096
 #define SMALLSTRING 2048
 
 #define TYPE_DATA 1
@@ -20,9 +21,14 @@
 #define TYPE_OPEN 4
 #define TYPE_CLOSE 5
 #define TYPE_WARNING 6
+#define TYPE_BATCH 7
 
 /*
 	Each package is uint16 + data , uint16 (serialized in big-endian) is the number of bytes comprising the data .
+	Other framings (read service-src/framing.h) can be selected by netpack.framing(name) .
+
+	In batch mode, the complete packages of one socket read are packed into one message (same as service_gate.c) :
+	package data ... , n * { uint32 offset, uint32 size } , uint32 n  (little-endian)
  */
 
 struct netpack {
@@ -31,31 +37,22 @@ struct netpack {
 	void * buffer;
 };
 
+// pack.id is the first field, as the entry of fdtable
 struct uncomplete {
 	struct netpack pack;
-	struct uncomplete * next;
-	int read;
-	int header;
+	int read;	// -1 : reading header
+	int header_size;
+	uint8_t header[FRAMING_MAXHEADER];
 };
 
 struct queue {
 	int cap;
 	int head;
 	int tail;
-	struct uncomplete * hash[HASHSIZE];
+	struct fdtable uncomplete;	// fd -> struct uncomplete
 	struct netpack queue[QUEUESIZE];
 };
 
-static void
-clear_list(struct uncomplete * uc) {
-	while (uc) {
-		skynet_free(uc->pack.buffer);
-		void * tmp = uc;
-		uc = uc->next;
-		skynet_free(tmp);
-	}
-}
-
 static int
 lclear(lua_State *L) {
 	struct queue * q = lua_touserdata(L, 1);
@@ -63,10 +60,11 @@ lclear(lua_State *L) {
 		return 0;
 	}
 	int i;
-	for (i=0;i<HASHSIZE;i++) {
-		clear_list(q->hash[i]);
-		q->hash[i] = NULL;
+	for (i=0;i<q->uncomplete.count;i++) {
+		struct uncomplete * uc = FDTABLE_ENTRY(&q->uncomplete, i);
+		skynet_free(uc->pack.buffer);
 	}
+	fdtable_release(&q->uncomplete);
 	if (q->head > q->tail) {
 		q->tail += q->cap;
 	}
@@ -79,36 +77,11 @@ lclear(lua_State *L) {
 	return 0;
 }
 
-static inline int
-hash_fd(int fd) {
-	int a = fd >> 24;
-	int b = fd >> 12;
-	int c = fd;
-	return (int)(((uint32_t)(a + b + c)) % HASHSIZE);
-}
-
-static struct uncomplete *
+static inline struct uncomplete *
 find_uncomplete(struct queue *q, int fd) {
 	if (q == NULL)
 		return NULL;
-	int h = hash_fd(fd);
-	struct uncomplete * uc = q->hash[h];
-	if (uc == NULL)
-		return NULL;
-	if (uc->pack.id == fd) {
-		q->hash[h] = uc->next;
-		return uc;
-	}
-	struct uncomplete * last = uc;
-	while (last->next) {
-		uc = last->next;
-		if (uc->pack.id == fd) {
-			last->next = uc->next;
-			return uc;
-		}
-		last = uc;
-	}
-	return NULL;
+	return fdtable_lookup(&q->uncomplete, fd);
 }
 
 static struct queue *
@@ -119,10 +92,7 @@ get_queue(lua_State *L) {
 		q->cap = QUEUESIZE;
 		q->head = 0;
 		q->tail = 0;
-		int i;
-		for (i=0;i<HASHSIZE;i++) {
-			q->hash[i] = NULL;
-		}
+		fdtable_init(&q->uncomplete, sizeof(struct uncomplete), 0);
 		lua_replace(L, 1);
 	}
 	return q;
@@ -134,8 +104,8 @@ expand_queue(lua_State *L, struct queue *q) {
 	nq->cap = q->cap + QUEUESIZE;
 	nq->head = 0;
 	nq->tail = q->cap;
-	memcpy(nq->hash, q->hash, sizeof(nq->hash));
-	memset(q->hash, 0, sizeof(q->hash));
+	nq->uncomplete = q->uncomplete;
+	fdtable_init(&q->uncomplete, sizeof(struct uncomplete), 0);
 	int i;
 	for (i=0;i<q->cap;i++) {
 		int idx = (q->head + i) % q->cap;
@@ -167,50 +137,118 @@ push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
 static struct uncomplete *
 save_uncomplete(lua_State *L, int fd) {
 	struct queue *q = get_queue(L);
-	int h = hash_fd(fd);
-	struct uncomplete * uc = skynet_malloc(sizeof(struct uncomplete));
-	memset(uc, 0, sizeof(*uc));
-	uc->next = q->hash[h];
-	uc->pack.id = fd;
-	q->hash[h] = uc;
-
-	return uc;
+	return fdtable_insert(&q->uncomplete, fd);
 }
 
-static inline int
-read_size(uint8_t * buffer) {
-	int r = (int)buffer[0] << 8 | (int)buffer[1];		// 由于skynet用的protobuf的前两个字节表示包长度(不包括前两个字节)，这里把包长度解析出来
-	// sproto没用过，应该前两个字节也是表示包长度吧
-	return r;
+static void
+save_header(lua_State *L, int fd, const uint8_t * buffer, int size) {
+	struct uncomplete * uc = save_uncomplete(L, fd);
+	uc->read = -1;
+	uc->header_size = size;
+	memcpy(uc->header, buffer, size);
 }
 
 static void
-push_more(lua_State *L, int fd, uint8_t *buffer, int size) {
-	if (size == 1) {
-		struct uncomplete * uc = save_uncomplete(L, fd);
-		uc->read = -1;
-		uc->header = *buffer;
-		return;
-	}
-	int pack_size = read_size(buffer);
-	buffer += 2;
-	size -= 2;
-
-	if (size < pack_size) {
-		struct uncomplete * uc = save_uncomplete(L, fd);
-		uc->read = size;
-		uc->pack.size = pack_size;
-		uc->pack.buffer = skynet_malloc(pack_size);
-		memcpy(uc->pack.buffer, buffer, size);
-		return;
+save_package(lua_State *L, int fd, const uint8_t * buffer, int size, int pack_size) {
+	struct uncomplete * uc = save_uncomplete(L, fd);
+	uc->read = size;
+	uc->pack.size = pack_size;
+	uc->pack.buffer = skynet_malloc(pack_size);
+	memcpy(uc->pack.buffer, buffer, size);
+}
+
+// push the packages in buffer into the queue, and save the rest as uncomplete. returns -1 if a header is invalid
+static int
+push_more(lua_State *L, int fd, uint8_t *buffer, int size, const struct framing *f) {
+	while (size > 0) {
+		int pack_size = 0;
+		int n = framing_header(f, buffer, size, &pack_size);
+		if (n == 0) {
+			save_header(L, fd, buffer, size);
+			return 0;
+		}
+		if (n < 0) {
+			return -1;
+		}
+		buffer += n;
+		size -= n;
+		if (size < pack_size) {
+			save_package(L, fd, buffer, size, pack_size);
+			return 0;
+		}
+		push_data(L, fd, buffer, pack_size, 1);
+		buffer += pack_size;
+		size -= pack_size;
 	}
-	push_data(L, fd, buffer, pack_size, 1);
+	return 0;
+}
 
-	buffer += pack_size;
-	size -= pack_size;
-	if (size > 0) {
-		push_more(L, fd, buffer, size);
+static int
+push_error(lua_State *L, int fd) {
+	lua_pushvalue(L, lua_upvalueindex(TYPE_ERROR));
+	lua_pushinteger(L, fd);
+	lua_pushliteral(L, "Invalid package size");
+	return 4;
+}
+
+// pack the first package and the complete packages in buffer into one batch, save the rest as uncomplete
+static int
+push_batch(lua_State *L, int fd, const void * first, int first_size, uint8_t *buffer, int size, const struct framing *f) {
+	int n = 1;
+	int total = first_size;
+	int offset = 0;
+	while (offset < size) {
+		int pack_size = 0;
+		int h = framing_header(f, buffer + offset, size - offset, &pack_size);
+		if (h == 0)
+			break;
+		if (h < 0)
+			return push_error(L, fd);
+		if (size - offset - h < pack_size)
+			break;
+		offset += h + pack_size;
+		total += pack_size;
+		++n;
+	}
+	if (n == 1) {
+		if (size > 0 && push_more(L, fd, buffer, size, f)) {
+			return push_error(L, fd);
+		}
+		lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
+		lua_pushinteger(L, fd);
+		void * result = skynet_malloc(first_size);
+		memcpy(result, first, first_size);
+		lua_pushlightuserdata(L, result);
+		lua_pushinteger(L, first_size);
+		return 5;
+	}
+	if (size > offset && push_more(L, fd, buffer + offset, size - offset, f)) {
+		return push_error(L, fd);
 	}
+	int sz = total + n * 8 + 4;
+	uint8_t * result = skynet_malloc(sz);
+	uint8_t * index = result + total;
+	memcpy(result, first, first_size);
+	write_uint32(index, 0);
+	write_uint32(index + 4, first_size);
+	int ptr = first_size;
+	int i;
+	for (i=1;i<n;i++) {
+		int pack_size = 0;
+		int h = framing_header(f, buffer, size, &pack_size);
+		memcpy(result + ptr, buffer + h, pack_size);
+		write_uint32(index + i * 8, ptr);
+		write_uint32(index + i * 8 + 4, pack_size);
+		ptr += pack_size;
+		buffer += h + pack_size;
+		size -= h + pack_size;
+	}
+	write_uint32(index + n * 8, n);
+	lua_pushvalue(L, lua_upvalueindex(TYPE_BATCH));
+	lua_pushinteger(L, fd);
+	lua_pushlightuserdata(L, result);
+	lua_pushinteger(L, sz);
+	return 5;
 }
 
 static void
@@ -219,24 +257,42 @@ close_uncomplete(lua_State *L, int fd) {
 	struct uncomplete * uc = find_uncomplete(q, fd);
 	if (uc) {
 		skynet_free(uc->pack.buffer);
-		skynet_free(uc);
+		fdtable_remove(&q->uncomplete, fd);
 	}
 }
 
 // filter_data_就是解protobuf/sproto包的过程
+// *keep is set when the socket buffer is reused as the package (parsed in place)
 static int
-filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
+filter_data_(lua_State *L, int fd, uint8_t * buffer, int size, int batch, const struct framing *f, int *keep) {
 	struct queue *q = lua_touserdata(L,1);
 	struct uncomplete * uc = find_uncomplete(q, fd);
 	if (uc) {
 		// fill uncomplete
 		if (uc->read < 0) {
-			// read size
-			assert(uc->read == -1);
-			int pack_size = *buffer;
-			pack_size |= uc->header << 8 ;
-			++buffer;
-			--size;
+			// read header
+			uint8_t header[FRAMING_MAXHEADER];
+			int hsz = uc->header_size;
+			int n = FRAMING_MAXHEADER - hsz;
+			if (n > size) {
+				n = size;
+			}
+			memcpy(header, uc->header, hsz);
+			memcpy(header + hsz, buffer, n);
+			int pack_size = 0;
+			int r = framing_header(f, header, hsz + n, &pack_size);
+			if (r < 0) {
+				fdtable_remove(&q->uncomplete, fd);
+				return push_error(L, fd);
+			}
+			if (r == 0) {
+				// all the buffer is a part of header
+				memcpy(uc->header + hsz, buffer, n);
+				uc->header_size += n;
+				return 1;
+			}
+			buffer += r - hsz;
+			size -= r - hsz;
 			uc->pack.size = pack_size;
 			uc->pack.buffer = skynet_malloc(pack_size);
 			uc->read = 0;
@@ -245,75 +301,87 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		if (size < need) {
 			memcpy(uc->pack.buffer + uc->read, buffer, size);
 			uc->read += size;
-			int h = hash_fd(fd);
-			uc->next = q->hash[h];
-			q->hash[h] = uc;
 			return 1;
 		}
 		memcpy(uc->pack.buffer + uc->read, buffer, need);
 		buffer += need;
 		size -= need;
+		// the package is complete, remove it before saving the rest (uc is invalid after remove)
+		struct netpack pack = uc->pack;
+		fdtable_remove(&q->uncomplete, fd);
 		if (size == 0) {
 			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
 			lua_pushinteger(L, fd);
-			lua_pushlightuserdata(L, uc->pack.buffer);
-			lua_pushinteger(L, uc->pack.size);
-			skynet_free(uc);
+			lua_pushlightuserdata(L, pack.buffer);
+			lua_pushinteger(L, pack.size);
 			return 5;
 		}
 		// more data
-		push_data(L, fd, uc->pack.buffer, uc->pack.size, 0);
-		skynet_free(uc);
-		push_more(L, fd, buffer, size);
+		if (batch) {
+			int ret = push_batch(L, fd, pack.buffer, pack.size, buffer, size, f);
+			skynet_free(pack.buffer);
+			return ret;
+		}
+		push_data(L, fd, pack.buffer, pack.size, 0);
+		if (push_more(L, fd, buffer, size, f)) {
+			return push_error(L, fd);
+		}
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
 	} else {
-		if (size == 1) {
-			struct uncomplete * uc = save_uncomplete(L, fd);
-			uc->read = -1;
-			uc->header = *buffer;
+		uint8_t * origin = buffer;
+		int pack_size = 0;
+		int n = framing_header(f, buffer, size, &pack_size);
+		// buffer就是从网络中真实收到的字节码，在堆中的大小为 MIN_READ_BUFFER
+		// 这里pack_size 是收到的网络包真实大小除去包头的字节数
+		if (n == 0) {
+			save_header(L, fd, buffer, size);
 			return 1;
 		}
-		int pack_size = read_size(buffer);	
-		// buffer就是从网络中真实收到的字节码，在堆中的大小为 MIN_READ_BUFFER
-		// 这里pack_size 是收到的网络包真实大小除去protobuf/sproto前两个字节的字节数
-		buffer+=2;		// 处理protobuf的前两个字节
-		size-=2;		// size是read函数收到的真实的数据字节数
+		if (n < 0) {
+			return push_error(L, fd);
+		}
+		buffer += n;		// 处理包头
+		size -= n;		// size是read函数收到的真实的数据字节数
 
 		if (size < pack_size) {
-			struct uncomplete * uc = save_uncomplete(L, fd);
-			uc->read = size;
-			uc->pack.size = pack_size;
-			uc->pack.buffer = skynet_malloc(pack_size);
-			memcpy(uc->pack.buffer, buffer, size);
+			save_package(L, fd, buffer, size, pack_size);
 			return 1;
 		}
 		if (size == pack_size) {
-			// just one package
+			// just one package, move it to the head of socket buffer and use it in place
 			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
 			lua_pushinteger(L, fd);
-			void * result = skynet_malloc(pack_size);
-			memcpy(result, buffer, size);
-			lua_pushlightuserdata(L, result);
+			memmove(origin, buffer, size);
+			*keep = 1;
+			lua_pushlightuserdata(L, origin);
 			lua_pushinteger(L, size);
 			return 5;	// queue 'data' 'fd' 'msg' 'sz'
 		}
 		// more data
+		if (batch) {
+			return push_batch(L, fd, buffer, pack_size, buffer + pack_size, size - pack_size, f);
+		}
 		push_data(L, fd, buffer, pack_size, 1);
 		buffer += pack_size;
 		size -= pack_size;
-		push_more(L, fd, buffer, size);
+		if (push_more(L, fd, buffer, size, f)) {
+			return push_error(L, fd);
+		}
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
 	}
 }
 
 static inline int
-filter_data(lua_State *L, int fd, uint8_t * buffer, int size) {
-	int ret = filter_data_(L, fd, buffer, size);
+filter_data(lua_State *L, int fd, uint8_t * buffer, int size, int batch, const struct framing *f) {
+	int keep = 0;
+	int ret = filter_data_(L, fd, buffer, size, batch, f, &keep);
 	// buffer is the data of socket message, it malloc at socket_server.c : function forward_message .
-	// it should be free before return,
-	skynet_free(buffer);
+	// it should be free before return, unless it's the package
+	if (!keep) {
+		skynet_free(buffer);
+	}
 	return ret;
 }
 
@@ -330,6 +398,8 @@ pushstring(lua_State *L, const char * msg, int size) {
 	userdata queue
 	lightuserdata msg
 	integer size
+	boolean batch (optional, the packages of one read returns as one 'batch')
+	userdata framing (optional, created by netpack.framing, default is uint16 big-endian)
 	return
 		userdata queue
 		integer type
@@ -340,6 +410,12 @@ static int
 lfilter(lua_State *L) {
 	struct skynet_socket_message *message = lua_touserdata(L,2);
 	int size = luaL_checkinteger(L,3);
+	int batch = lua_toboolean(L,4);
+	struct framing f = { FRAMING_BE16, 0xffff };
+	if (!lua_isnoneornil(L,5)) {
+		luaL_checktype(L,5,LUA_TUSERDATA);
+		f = *(struct framing *)lua_touserdata(L,5);
+	}
 	char * buffer = message->buffer;
 	if (buffer == NULL) {
 		buffer = (char *)(message+1);
@@ -354,7 +430,7 @@ lfilter(lua_State *L) {
 	case SKYNET_SOCKET_TYPE_DATA:
 		// ignore listen id (message->id)
 		assert(size == -1);	// never padding string
-		return filter_data(L, message->id, (uint8_t *)buffer, message->ud);
+		return filter_data(L, message->id, (uint8_t *)buffer, message->ud, batch, &f);
 	case SKYNET_SOCKET_TYPE_CONNECT:	// 'L'->'S'后
 		// ignore listen fd connect
 		return 1;		// 这里其实返回的是上层传过来的 queue
@@ -466,6 +542,77 @@ ltostring(lua_State *L) {
 	return 1;
 }
 
+/*
+	string name (read service-src/framing.h)
+	return
+		userdata framing
+ */
+static int
+lframing(lua_State *L) {
+	const char * name = luaL_checkstring(L, 1);
+	struct framing f;
+	if (framing_init(&f, name)) {
+		return luaL_error(L, "Invalid framing %s", name);
+	}
+	struct framing * ud = lua_newuserdata(L, sizeof(f));
+	*ud = f;
+	return 1;
+}
+
+/*
+	userdata framing
+	integer size
+	return
+		string header
+ */
+static int
+lheader(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TUSERDATA);
+	struct framing * f = lua_touserdata(L, 1);
+	int size = luaL_checkinteger(L, 2);
+	uint8_t header[FRAMING_MAXHEADER];
+	int n = framing_write(f, header, size);
+	if (n < 0) {
+		return luaL_error(L, "Invalid size of package : %d", size);
+	}
+	lua_pushlstring(L, (const char *)header, n);
+	return 1;
+}
+
+/*
+	lightuserdata batch
+	integer size
+	return
+		table { string msg ... }
+	The batch is not freed (the same as the other unpack functions).
+ */
+static int
+lunbatch(lua_State *L) {
+	const uint8_t * ptr = lua_touserdata(L, 1);
+	int size = luaL_checkinteger(L, 2);
+	if (ptr == NULL || size < 4) {
+		return luaL_error(L, "Invalid batch");
+	}
+	uint32_t n = read_uint32(ptr + size - 4);
+	if (n > (uint32_t)(size - 4) / 8) {
+		return luaL_error(L, "Invalid batch size %d", size);
+	}
+	const uint8_t * index = ptr + size - 4 - n * 8;
+	uint32_t data_size = index - ptr;
+	lua_createtable(L, n, 0);
+	uint32_t i;
+	for (i=0;i<n;i++) {
+		uint32_t offset = read_uint32(index + i * 8);
+		uint32_t sz = read_uint32(index + i * 8 + 4);
+		if (offset > data_size || sz > data_size - offset) {
+			return luaL_error(L, "Invalid batch package %d", (int)i+1);
+		}
+		lua_pushlstring(L, (const char *)ptr + offset, sz);
+		lua_rawseti(L, -2, i+1);
+	}
+	return 1;
+}
+
 int
 luaopen_netpack(lua_State *L) {
 	luaL_checkversion(L);
@@ -474,6 +621,9 @@ luaopen_netpack(lua_State *L) {
 		{ "pack", lpack },
 		{ "clear", lclear },
 		{ "tostring", ltostring },
+		{ "unbatch", lunbatch },
+		{ "framing", lframing },
+		{ "header", lheader },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);	// 创建一张新的表，并把l注册进去
@@ -485,8 +635,9 @@ luaopen_netpack(lua_State *L) {
 	lua_pushliteral(L, "open");
 	lua_pushliteral(L, "close");
 	lua_pushliteral(L, "warning");
+	lua_pushliteral(L, "batch");
 
-	lua_pushcclosure(L, lfilter, 6);
+	lua_pushcclosure(L, lfilter, 7);
 	lua_setfield(L, -2, "filter");
 
 	return 1;
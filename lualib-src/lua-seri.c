@@ -27,82 +27,119 @@
 #define TYPE_SHORT_STRING 4
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
+// hibits 1 : uint8 index of dictionary , 3 : uint16 index of dictionary
 #define TYPE_TABLE 6
+#define TYPE_ARRAY 7
+// hibits : the type of elements. A table its array part is homogeneous (MIN_ARRAY elements at least) :
+// TYPE_ARRAY , integer n , n packed elements , then the hash part like TYPE_TABLE (key value ... nil)
+#define ARRAY_BYTE 1	// int8
+#define ARRAY_WORD 2	// int16
+#define ARRAY_DWORD 4	// int32
+#define ARRAY_QWORD 6	// int64
+#define ARRAY_REAL 8	// double
+#define ARRAY_STRING8 9	// n * uint8 length , then the strings
+#define ARRAY_STRING16 10	// n * uint16 length
+#define ARRAY_STRING32 11	// n * uint32 length
+
+#define MIN_ARRAY 8
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
+#define INIT_BUFFER 1024
 #define MAX_DEPTH 32
 
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
+/*
+	Dictionary (opt-in) : a list of strings (table keys usually) known by both sides,
+	such a string is packed as its index : TYPE_LONG_STRING with cookie STRING_REF8 or STRING_REF16.
+	Only short strings (interned by lua) can be in dictionary, so they are found by the address.
+ */
+#define STRING_REF8 1
+#define STRING_REF16 3
+#define DICT_MAXLEN 40	// LUAI_MAXSHORTLEN
+#define DICT_MAXSIZE 0x10000
+
+struct dictionary_slot {
+	const char * str;
+	int index;
+};
+
+struct dictionary {
+	int cap;	// power of 2
+	struct dictionary_slot slot[1];
 };
 
+/*
+	Pack into one contiguous buffer : it starts on the C stack (INIT_BUFFER),
+	and moves to the heap (doubling) when it's full. The heap buffer is the result of pack, no more copy
+	(so a large message may hold up to twice of its size until the receiver frees it).
+ */
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;
 	int len;
-	int ptr;
+	int cap;
+	char * init;	// the buffer on stack
+	const struct dictionary * dict;
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	int dict;	// the index of dictionary strings table, 0 if none
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_expand(struct write_block *b, int sz) {
+	int cap = b->cap * 2;
+	while (cap < b->len + sz) {
+		cap *= 2;
+	}
+	if (b->buffer == b->init) {
+		char * buffer = skynet_malloc(cap);
+		memcpy(buffer, b->buffer, b->len);
+		b->buffer = buffer;
+	} else {
+		b->buffer = skynet_realloc(b->buffer, cap);
+	}
+	b->cap = cap;
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+	if (b->len + sz > b->cap) {
+		wb_expand(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
+}
+
+// reserve sz bytes at the end, returns the pointer to them
+static inline char *
+wb_alloc(struct write_block *b, int sz) {
+	if (b->len + sz > b->cap) {
+		wb_expand(b, sz);
+	}
+	char * p = b->buffer + b->len;
+	b->len += sz;
+	return p;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb , char * buffer, int sz) {
+	wb->buffer = buffer;
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	wb->cap = sz;
+	wb->init = buffer;
+	wb->dict = NULL;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	if (wb->buffer != wb->init) {
+		skynet_free(wb->buffer);
+	}
+	wb->buffer = wb->init;
 	wb->len = 0;
 }
 
@@ -111,6 +148,7 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->dict = 0;
 }
 
 static void *
@@ -210,6 +248,37 @@ wb_string(struct write_block *wb, const char *str, int len) {
 	}
 }
 
+static inline int
+dict_hash(const struct dictionary *d, const char *str) {
+	return (int)(((uint64_t)(uintptr_t)str * 0x9E3779B97F4A7C15ull) >> 32) & (d->cap - 1);
+}
+
+// returns 0 if str is not in dictionary
+static inline int
+wb_stringref(struct write_block *wb, const char *str) {
+	const struct dictionary *d = wb->dict;
+	int i = dict_hash(d, str);
+	for (;;) {
+		const struct dictionary_slot *s = &d->slot[i];
+		if (s->str == str)
+			break;
+		if (s->str == NULL)
+			return 0;
+		i = (i + 1) & (d->cap - 1);
+	}
+	int index = d->slot[i].index;
+	if (index < 0x100) {
+		uint8_t buf[2] = { COMBINE_TYPE(TYPE_LONG_STRING, STRING_REF8), (uint8_t)index };
+		wb_push(wb, buf, 2);
+	} else {
+		uint8_t n = COMBINE_TYPE(TYPE_LONG_STRING, STRING_REF16);
+		uint16_t x = (uint16_t)index;
+		wb_push(wb, &n, 1);
+		wb_push(wb, &x, 2);
+	}
+	return 1;
+}
+
 static void pack_one(lua_State *L, struct write_block *b, int index, int depth);
 
 static int
@@ -234,6 +303,162 @@ wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
 	return array_size;
 }
 
+/*
+	The array part is written in one pass, as int64 / double / uint32 length table at first,
+	then narrowed in place. Returns 0 (and rewinds) if the elements are not the same type.
+ */
+static int
+wb_array_integer(lua_State *L, struct write_block *wb, int index, int n) {
+	char * p = wb_alloc(wb, n * 8);
+	int offset = p - wb->buffer;
+	lua_Integer min = 0, max = 0;
+	int i;
+	for (i=0;i<n;i++) {
+		lua_rawgeti(L, index, i+1);
+		if (!lua_isinteger(L, -1)) {
+			lua_pop(L, 1);
+			return 0;
+		}
+		int64_t v = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		if (i == 0) {
+			min = max = v;
+		} else if (v < min) {
+			min = v;
+		} else if (v > max) {
+			max = v;
+		}
+		memcpy(p + i * 8, &v, 8);
+	}
+	int type;
+	if (min >= INT8_MIN && max <= INT8_MAX) {
+		type = ARRAY_BYTE;
+		for (i=0;i<n;i++) {
+			int64_t v;
+			memcpy(&v, p + i * 8, 8);
+			p[i] = (int8_t)v;
+		}
+	} else if (min >= INT16_MIN && max <= INT16_MAX) {
+		type = ARRAY_WORD;
+		for (i=0;i<n;i++) {
+			int64_t v;
+			memcpy(&v, p + i * 8, 8);
+			int16_t x = (int16_t)v;
+			memcpy(p + i * 2, &x, 2);
+		}
+	} else if (min >= INT32_MIN && max <= INT32_MAX) {
+		type = ARRAY_DWORD;
+		for (i=0;i<n;i++) {
+			int64_t v;
+			memcpy(&v, p + i * 8, 8);
+			int32_t x = (int32_t)v;
+			memcpy(p + i * 4, &x, 4);
+		}
+	} else {
+		return ARRAY_QWORD;
+	}
+	wb->len = offset + n * type;
+	return type;
+}
+
+static int
+wb_array_real(lua_State *L, struct write_block *wb, int index, int n) {
+	char * p = wb_alloc(wb, n * (int)sizeof(double));
+	int i;
+	for (i=1;i<=n;i++) {
+		lua_rawgeti(L, index, i);
+		if (lua_type(L, -1) != LUA_TNUMBER || lua_isinteger(L, -1)) {
+			lua_pop(L, 1);
+			return 0;
+		}
+		double v = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+		memcpy(p, &v, sizeof(v));
+		p += sizeof(v);
+	}
+	return ARRAY_REAL;
+}
+
+static int
+wb_array_string(lua_State *L, struct write_block *wb, int index, int n) {
+	// the length table, filled with the strings (the buffer may move)
+	char * p = wb_alloc(wb, n * 4);
+	int offset = p - wb->buffer;
+	size_t maxlen = 0;
+	int i;
+	for (i=0;i<n;i++) {
+		if (lua_rawgeti(L, index, i+1) != LUA_TSTRING) {
+			lua_pop(L, 1);
+			return 0;
+		}
+		size_t len = 0;
+		const char * str = lua_tolstring(L, -1, &len);
+		if (len > UINT32_MAX) {
+			lua_pop(L, 1);
+			return 0;
+		}
+		wb_push(wb, str, (int)len);
+		lua_pop(L, 1);
+		uint32_t x = (uint32_t)len;
+		memcpy(wb->buffer + offset + i * 4, &x, 4);
+		if (len > maxlen)
+			maxlen = len;
+	}
+	int type, width;
+	if (maxlen <= UINT8_MAX) {
+		type = ARRAY_STRING8;
+		width = 1;
+	} else if (maxlen <= UINT16_MAX) {
+		type = ARRAY_STRING16;
+		width = 2;
+	} else {
+		return ARRAY_STRING32;
+	}
+	p = wb->buffer + offset;	// wb_push may move the buffer
+	for (i=0;i<n;i++) {
+		uint32_t len;
+		memcpy(&len, p + i * 4, 4);
+		if (width == 1) {
+			p[i] = (uint8_t)len;
+		} else {
+			uint16_t x = (uint16_t)len;
+			memcpy(p + i * 2, &x, 2);
+		}
+	}
+	int strings = offset + n * 4;
+	memmove(p + n * width, wb->buffer + strings, wb->len - strings);
+	wb->len -= n * (4 - width);
+	return type;
+}
+
+// pack the array part as TYPE_ARRAY if it's homogeneous, returns 0 if not
+static int
+wb_table_typed(lua_State *L, struct write_block *wb, int index, int array_size) {
+	int start = wb->len;
+	int t = lua_rawgeti(L, index, 1);
+	int integer = lua_isinteger(L, -1);
+	lua_pop(L, 1);
+	if (t != LUA_TNUMBER && t != LUA_TSTRING)
+		return 0;
+	uint8_t n = TYPE_ARRAY;
+	wb_push(wb, &n, 1);
+	wb_integer(wb, array_size);
+	int type;
+	if (t == LUA_TSTRING) {
+		type = wb_array_string(L, wb, index, array_size);
+	} else if (integer) {
+		type = wb_array_integer(L, wb, index, array_size);
+	} else {
+		type = wb_array_real(L, wb, index, array_size);
+	}
+	if (type == 0) {
+		wb->len = start;
+		return 0;
+	}
+	wb->buffer[start] = COMBINE_TYPE(TYPE_ARRAY, type);
+	return 1;
+}
+
 static void
 wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int array_size) {
 	lua_pushnil(L);
@@ -286,7 +511,10 @@ wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	if (luaL_getmetafield(L, index, "__pairs") != LUA_TNIL) {
 		wb_table_metapairs(L, wb, index, depth);
 	} else {
-		int array_size = wb_table_array(L, wb, index, depth);
+		int array_size = lua_rawlen(L, index);
+		if (array_size < MIN_ARRAY || !wb_table_typed(L, wb, index, array_size)) {
+			array_size = wb_table_array(L, wb, index, depth);
+		}
 		wb_table_hash(L, wb, index, depth, array_size);
 	}
 }
@@ -318,7 +546,9 @@ pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 	case LUA_TSTRING: {
 		size_t sz = 0;
 		const char *str = lua_tolstring(L,index,&sz);
-		wb_string(b, str, (int)sz);
+		if (b->dict == NULL || sz > DICT_MAXLEN || !wb_stringref(b, str)) {
+			wb_string(b, str, (int)sz);
+		}
 		break;
 	}
 	case LUA_TLIGHTUSERDATA:
@@ -428,6 +658,7 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 }
 
 static void unpack_one(lua_State *L, struct read_block *rb);
+static void unpack_hash(lua_State *L, struct read_block *rb);
 
 static void
 unpack_table(lua_State *L, struct read_block *rb, int array_size) {
@@ -451,6 +682,11 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 		unpack_one(L,rb);
 		lua_rawseti(L,-2,i);
 	}
+	unpack_hash(L, rb);
+}
+
+static void
+unpack_hash(lua_State *L, struct read_block *rb) {
 	for (;;) {
 		unpack_one(L,rb);
 		if (lua_isnil(L,-1)) {
@@ -462,6 +698,99 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 	}
 }
 
+static void
+unpack_array(lua_State *L, struct read_block *rb, int type) {
+	uint8_t *t = rb_read(rb, 1);
+	if (t==NULL || (*t & 7) != TYPE_NUMBER || (*t >> 3) == TYPE_NUMBER_REAL) {
+		invalid_stream(L,rb);
+	}
+	lua_Integer n = get_integer(L, rb, *t >> 3);
+	int width;
+	switch (type) {
+	case ARRAY_BYTE:
+	case ARRAY_STRING8:
+		width = 1;
+		break;
+	case ARRAY_WORD:
+	case ARRAY_STRING16:
+		width = 2;
+		break;
+	case ARRAY_DWORD:
+	case ARRAY_STRING32:
+		width = 4;
+		break;
+	case ARRAY_QWORD:
+	case ARRAY_REAL:
+		width = 8;
+		break;
+	default:
+		invalid_stream(L,rb);
+		return;
+	}
+	if (n < 0 || n > rb->len / width) {
+		invalid_stream(L,rb);
+	}
+	const char * p = rb_read(rb, (int)n * width);
+	luaL_checkstack(L,LUA_MINSTACK,NULL);
+	lua_createtable(L,(int)n,0);
+	int i;
+	if (type >= ARRAY_STRING8) {
+		for (i=0;i<n;i++) {
+			uint32_t len;
+			if (type == ARRAY_STRING8) {
+				len = (uint8_t)p[i];
+			} else if (type == ARRAY_STRING16) {
+				uint16_t x;
+				memcpy(&x, p + i * 2, 2);
+				len = x;
+			} else {
+				memcpy(&len, p + i * 4, 4);
+			}
+			const char * str = len > INT32_MAX ? NULL : rb_read(rb, (int)len);
+			if (str == NULL) {
+				invalid_stream(L,rb);
+			}
+			lua_pushlstring(L, str, len);
+			lua_rawseti(L, -2, i+1);
+		}
+	} else {
+		for (i=0;i<n;i++) {
+			const char * v = p + i * width;
+			switch (type) {
+			case ARRAY_BYTE:
+				lua_pushinteger(L, (int8_t)*v);
+				break;
+			case ARRAY_WORD: {
+				int16_t x;
+				memcpy(&x, v, sizeof(x));
+				lua_pushinteger(L, x);
+				break;
+			}
+			case ARRAY_DWORD: {
+				int32_t x;
+				memcpy(&x, v, sizeof(x));
+				lua_pushinteger(L, x);
+				break;
+			}
+			case ARRAY_QWORD: {
+				int64_t x;
+				memcpy(&x, v, sizeof(x));
+				lua_pushinteger(L, x);
+				break;
+			}
+			default: {
+				double x;
+				memcpy(&x, v, sizeof(x));
+				lua_pushnumber(L, x);
+				break;
+			}
+			}
+			lua_rawseti(L, -2, i+1);
+		}
+	}
+	unpack_hash(L, rb);
+}
+
 static void
 push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 	switch(type) {
@@ -485,7 +814,27 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		get_buffer(L,rb,cookie);
 		break;
 	case TYPE_LONG_STRING: {
-		if (cookie == 2) {
+		if (cookie == STRING_REF8 || cookie == STRING_REF16) {
+			int index;
+			if (cookie == STRING_REF8) {
+				uint8_t *p = rb_read(rb, 1);
+				if (p == NULL) {
+					invalid_stream(L,rb);
+				}
+				index = *p;
+			} else {
+				uint16_t *p = rb_read(rb, 2);
+				if (p == NULL) {
+					invalid_stream(L,rb);
+				}
+				uint16_t n;
+				memcpy(&n, p, sizeof(n));
+				index = n;
+			}
+			if (rb->dict == 0 || lua_rawgeti(L, rb->dict, index + 1) != LUA_TSTRING) {
+				invalid_stream(L,rb);
+			}
+		} else if (cookie == 2) {
 			uint16_t *plen = rb_read(rb, 2);
 			if (plen == NULL) {
 				invalid_stream(L,rb);
@@ -511,6 +860,10 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		unpack_table(L,rb,cookie);
 		break;
 	}
+	case TYPE_ARRAY: {
+		unpack_array(L,rb,cookie);
+		break;
+	}
 	default: {
 		invalid_stream(L,rb);
 		break;
@@ -529,29 +882,22 @@ unpack_one(lua_State *L, struct read_block *rb) {
 	push_value(L, rb, type & 0x7, type>>3);
 }
 
+// push the result as lightuserdata and size, the buffer is moved to the caller
 static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
-			break;
-		}
+seri(lua_State *L, struct write_block *wb) {
+	void * buffer = wb->buffer;
+	if (buffer == wb->init) {
+		buffer = skynet_malloc(wb->len);
+		memcpy(buffer, wb->init, wb->len);
 	}
-	
 	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
+	lua_pushinteger(L, wb->len);
+	wb->buffer = wb->init;
 }
 
-int
-luaseri_unpack(lua_State *L) {
+// dict : the index of dictionary strings table, 0 if none
+static int
+unpack_buffer(lua_State *L, int dict) {
 	if (lua_isnoneornil(L,1)) {
 		return 0;
 	}
@@ -575,6 +921,7 @@ luaseri_unpack(lua_State *L) {
 	lua_settop(L,1);
 	struct read_block rb;
 	rball_init(&rb, buffer, len);
+	rb.dict = dict;
 
 	int i;
 	for (i=0;;i++) {
@@ -594,17 +941,111 @@ luaseri_unpack(lua_State *L) {
 	return lua_gettop(L) - 1;
 }
 
+int
+luaseri_unpack(lua_State *L) {
+	return unpack_buffer(L, 0);
+}
+
 int
 luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
+	char temp[INIT_BUFFER];
 	struct write_block wb;
-	wb_init(&wb, &temp);
+	wb_init(&wb, temp, sizeof(temp));
 	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
+	seri(L, &wb);
+
+	return 2;
+}
 
+int
+luaseri_packstring(lua_State *L) {
+	char temp[INIT_BUFFER];
+	struct write_block wb;
+	wb_init(&wb, temp, sizeof(temp));
+	pack_from(L,&wb,0);
+	lua_pushlstring(L, wb.buffer, wb.len);
 	wb_free(&wb);
 
+	return 1;
+}
+
+// upvalue 1 : struct dictionary , upvalue 2 : the strings
+static int
+ldict_pack(lua_State *L) {
+	char temp[INIT_BUFFER];
+	struct write_block wb;
+	wb_init(&wb, temp, sizeof(temp));
+	wb.dict = lua_touserdata(L, lua_upvalueindex(1));
+	pack_from(L,&wb,0);
+	seri(L, &wb);
+
 	return 2;
 }
+
+static int
+ldict_packstring(lua_State *L) {
+	char temp[INIT_BUFFER];
+	struct write_block wb;
+	wb_init(&wb, temp, sizeof(temp));
+	wb.dict = lua_touserdata(L, lua_upvalueindex(1));
+	pack_from(L,&wb,0);
+	lua_pushlstring(L, wb.buffer, wb.len);
+	wb_free(&wb);
+
+	return 1;
+}
+
+static int
+ldict_unpack(lua_State *L) {
+	return unpack_buffer(L, lua_upvalueindex(2));
+}
+
+int
+luaseri_dictionary(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int n = (int)lua_rawlen(L, 1);
+	if (n > DICT_MAXSIZE) {
+		return luaL_error(L, "Too many strings in dictionary (%d)", n);
+	}
+	int cap = 16;
+	while (cap < n * 2) {
+		cap *= 2;
+	}
+	struct dictionary * d = lua_newuserdata(L, sizeof(*d) + (cap - 1) * sizeof(struct dictionary_slot));
+	d->cap = cap;
+	memset(d->slot, 0, cap * sizeof(struct dictionary_slot));
+	lua_createtable(L, n, 0);
+	int i;
+	for (i=1;i<=n;i++) {
+		if (lua_rawgeti(L, 1, i) != LUA_TSTRING) {
+			return luaL_error(L, "Dictionary [%d] is not a string", i);
+		}
+		size_t sz;
+		const char * str = lua_tolstring(L, -1, &sz);
+		if (sz > DICT_MAXLEN) {
+			return luaL_error(L, "Dictionary [%d] is too long (%d)", i, (int)sz);
+		}
+		int h = dict_hash(d, str);
+		while (d->slot[h].str) {
+			if (d->slot[h].str == str) {
+				return luaL_error(L, "Dictionary [%d] %s is duplicate", i, str);
+			}
+			h = (h + 1) & (cap - 1);
+		}
+		d->slot[h].str = str;
+		d->slot[h].index = i - 1;
+		// the strings table keeps the strings alive (and the address)
+		lua_rawseti(L, -2, i);
+	}
+	luaL_Reg l[] = {
+		{ "pack", ldict_pack },
+		{ "packstring", ldict_packstring },
+		{ "unpack", ldict_unpack },
+		{ NULL, NULL },
+	};
+	lua_createtable(L, 0, 3);
+	lua_insert(L, -3);
+	luaL_setfuncs(L, l, 2);
+
+	return 1;
+}
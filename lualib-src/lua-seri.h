@@ -5,5 +5,9 @@
 
 int luaseri_pack(lua_State *L);
 int luaseri_unpack(lua_State *L);
+// pack into a string
+int luaseri_packstring(lua_State *L);
+// dictionary(strings) returns { pack, packstring, unpack } , the strings in dictionary are packed as indexes
+int luaseri_dictionary(lua_State *L);
 
 #endif
@@ -323,16 +323,6 @@ lharbor(lua_State *L) {
 	return 2;
 }
 
-static int
-lpackstring(lua_State *L) {
-	luaseri_pack(L);
-	char * str = (char *)lua_touserdata(L, -2);
-	int sz = lua_tointeger(L, -1);
-	lua_pushlstring(L, str, sz);
-	skynet_free(str);
-	return 1;
-}
-
 static int
 ltrash(lua_State *L) {
 	int t = lua_type(L,1);
@@ -375,7 +365,8 @@ luaopen_skynet_core(lua_State *L) {
 		{ "harbor", lharbor },
 		{ "pack", luaseri_pack },
 		{ "unpack", luaseri_unpack },
-		{ "packstring", lpackstring },
+		{ "packstring", luaseri_packstring },
+		{ "dictionary", luaseri_dictionary },
 		{ "trash" , ltrash },
 		{ "callback", lcallback },
 		{ "now", lnow },
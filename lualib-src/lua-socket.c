@@ -1,7 +1,9 @@
 #include "skynet_malloc.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <assert.h>
@@ -11,10 +13,14 @@
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "skynet_socket.h"
 
 #define BACKLOG 32
+// default threshold of MSG_ZEROCOPY, smaller buffers are cheaper to copy
+#define ZEROCOPY_SIZE (64 * 1024)
 // 2 ** 12 == 4096
 #define LARGE_PAGE_NODE 12
 #define BUFFER_LIMIT (256 * 1024)
@@ -401,6 +407,11 @@ lunpack(lua_State *L) {
 static const char *
 address_port(lua_State *L, char *tmp, const char * addr, int port_index, int *port) {
 	const char * host;
+	if (strncmp(addr, "unix:", 5) == 0) {
+		// unix domain socket, no port
+		*port = 0;
+		return addr;
+	}
 	if (lua_isnoneornil(L,port_index)) {
 		host = strchr(addr, '[');
 		if (host) {
@@ -443,7 +454,7 @@ lconnect(lua_State *L) {
 	char tmp[sz];
 	int port = 0;
 	const char * host = address_port(L, tmp, addr, 2, &port);
-	if (port == 0) {
+	if (port == 0 && strncmp(host, "unix:", 5) != 0) {
 		return luaL_error(L, "Invalid port");
 	}
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -472,10 +483,13 @@ lshutdown(lua_State *L) {
 static int
 llisten(lua_State *L) {
 	const char * host = luaL_checkstring(L,1);
-	int port = luaL_checkinteger(L,2);
+	int port = luaL_optinteger(L,2,0);	// no port for "unix:/path"
 	int backlog = luaL_optinteger(L,3,BACKLOG);
+	int reuseport = lua_toboolean(L,4);
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
-	int id = skynet_socket_listen(ctx, host,port,backlog);
+	int id = reuseport ?
+		skynet_socket_listen_reuseport(ctx, host,port,backlog) :
+		skynet_socket_listen(ctx, host,port,backlog);
 	// 注意这里返回的是skynet框架分配的一个id 为s->slot的一个下标，一个数组索引而已
 	if (id < 0) {
 		return luaL_error(L, "Listen error");
@@ -570,6 +584,39 @@ lsendlow(lua_State *L) {
 	return 0;
 }
 
+/*
+	sendfile(id, file, offset, size)
+	file is a file name or a lua file handle (io.open), offset default 0, size default to the end of file.
+	The file is sent by the socket thread without copying to lua string.
+ */
+static int
+lsendfile(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	lua_Integer sz = luaL_optinteger(L, 4, -1);
+	int fd;
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		fd = open(lua_tostring(L, 2), O_RDONLY);
+	} else {
+		luaL_Stream *p = (luaL_Stream *)luaL_checkudata(L, 2, LUA_FILEHANDLE);
+		if (p->closef == NULL) {
+			return luaL_error(L, "attempt to use a closed file");
+		}
+		fflush(p->f);
+		// socket server closes the fd after sending, so the file handle can be closed by lua anytime
+		fd = dup(fileno(p->f));
+	}
+	if (fd < 0) {
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, strerror(errno));
+		return 2;
+	}
+	int err = skynet_socket_sendfile(ctx, id, fd, offset, sz);
+	lua_pushboolean(L, !err);
+	return 1;
+}
+
 static int
 lbind(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -587,6 +634,15 @@ lstart(lua_State *L) {
 	return 0;
 }
 
+// stop reading, socketdriver.start resumes it
+static int
+lpause(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	skynet_socket_pause(ctx,id);
+	return 0;
+}
+
 static int
 lnodelay(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -595,6 +651,30 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+// id, size (default ZEROCOPY_SIZE, 0 to disable)
+static int
+lzerocopy(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int size = luaL_optinteger(L, 2, ZEROCOPY_SIZE);
+	skynet_socket_zerocopy(ctx, id, size);
+	return 0;
+}
+
+// id, low, high, limit, "drop"/"close"
+static int
+lwatermark(lua_State *L) {
+	static const char * const overflow[] = { "drop", "close", NULL };
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	lua_Integer low = luaL_checkinteger(L, 2);
+	lua_Integer high = luaL_checkinteger(L, 3);
+	lua_Integer limit = luaL_optinteger(L, 4, 0);
+	int op = luaL_checkoption(L, 5, "drop", overflow);
+	skynet_socket_watermark(ctx, id, low, high, limit, op);
+	return 0;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -649,6 +729,32 @@ ludp_send(lua_State *L) {
 	return 1;
 }
 
+// unpack SKYNET_SOCKET_TYPE_UDP_BATCH message (lightuserdata, size), return data1, address1, data2, address2, ...
+static int
+ludp_unpack(lua_State *L) {
+	const uint8_t * ptr = lua_touserdata(L, 1);
+	int sz = luaL_checkinteger(L, 2);
+	int n = 0;
+	while (sz > 0) {
+		uint32_t size;
+		if (sz < 5) {
+			return luaL_error(L, "Invalid udp batch");
+		}
+		memcpy(&size, ptr, sizeof(size));
+		int addrsz = ptr[4];
+		if (5 + addrsz + (int64_t)size > sz) {
+			return luaL_error(L, "Invalid udp batch");
+		}
+		luaL_checkstack(L, 2, NULL);
+		lua_pushlstring(L, (const char *)ptr + 5 + addrsz, size);
+		lua_pushlstring(L, (const char *)ptr + 5, addrsz);
+		ptr += 5 + addrsz + size;
+		sz -= 5 + addrsz + size;
+		n += 2;
+	}
+	return n;
+}
+
 static int
 ludp_address(lua_State *L) {
 	size_t sz = 0;
@@ -700,13 +806,18 @@ luaopen_socketdriver(lua_State *L) {
 		{ "listen", llisten },
 		{ "send", lsend },
 		{ "lsend", lsendlow },
+		{ "sendfile", lsendfile },
 		{ "bind", lbind },
 		{ "start", lstart },
+		{ "pause", lpause },
 		{ "nodelay", lnodelay },
+		{ "watermark", lwatermark },
+		{ "zerocopy", lzerocopy },
 		{ "udp", ludp },
 		{ "udp_connect", ludp_connect },
 		{ "udp_send", ludp_send },
 		{ "udp_address", ludp_address },
+		{ "udp_unpack", ludp_unpack },
 		{ NULL, NULL },
 	};
 	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context");
@@ -1,11 +1,63 @@
 local skynet = require "skynet"
+local core = require "cluster.core"
 
 local clusterd
+local transport	-- the C services send the requests, see service-src/service_cluster.c
 local cluster = {}
 
+local node_id = setmetatable({}, { __index = function(t, node)
+	local id
+	id, transport = skynet.call(clusterd, "lua", "node", node)
+	t[node] = id
+	return id
+end })
+
+--[[
+	cluster_balance chooses a transport (a connection to the node) if cluster_pool > 1 :
+	"address" (default) : by the address of caller, so the calls of a service keep in order
+	"session" : by the calls of this service, one by one
+	"least" : the one with the least calls of this service in flight
+]]
+local balance = skynet.getenv "cluster_balance" or "address"
+local ncall = 0
+local inflight = {}
+
+local function call_least(id, address, msg, sz)
+	local index = 1
+	for i = 2, #transport do
+		if (inflight[i] or 0) < (inflight[index] or 0) then
+			index = i
+		end
+	end
+	inflight[index] = (inflight[index] or 0) + 1
+	local ok, msg, sz = pcall(skynet.rawcall, transport[index], "lua", core.packcall(id, address, msg, sz))
+	inflight[index] = inflight[index] - 1
+	if not ok then
+		error(msg)
+	end
+	return msg, sz
+end
+
+local function call(node, address, msg, sz)
+	local id = node_id[node]	-- query transport at first
+	local n = #transport
+	local t
+	if n == 1 then
+		t = transport[1]
+	elseif balance == "least" then
+		return call_least(id, address, msg, sz)
+	elseif balance == "session" then
+		ncall = ncall + 1
+		t = transport[ncall % n + 1]
+	else
+		t = transport[skynet.self() % n + 1]
+	end
+	-- msg will free by cluster.core.packcall
+	return skynet.rawcall(t, "lua", core.packcall(id, address, msg, sz))
+end
+
 function cluster.call(node, address, ...)
-	-- skynet.pack(...) will free by cluster.core.packrequest
-	return skynet.call(clusterd, "lua", "req", node, address, skynet.pack(...))
+	return skynet.unpack(call(node, address, skynet.pack(...)))
 end
 
 function cluster.open(port)
@@ -40,10 +92,13 @@ function cluster.register(name, addr)
 end
 
 function cluster.query(node, name)
-	-- 注意第5个参数为0
-	return skynet.call(clusterd, "lua", "req", node, 0, skynet.pack(name))
+	-- 地址为 0 代表查询名字
+	return skynet.unpack(call(node, 0, skynet.pack(name)))
 end
 
+-- for clusterproxy
+cluster.rawcall = call
+
 skynet.init(function()
 	clusterd = skynet.uniqueservice("clusterd")
 end)
@@ -1,4 +1,5 @@
 local internal = require "http.internal"
+local sockethelper = require "http.sockethelper"
 
 local table = table
 local string = string
@@ -127,6 +128,21 @@ local function writeall(writefunc, statuscode, bodyfunc, header)
 	if t == "string" then
 		writefunc(string.format("content-length: %d\r\n\r\n", #bodyfunc))
 		writefunc(bodyfunc)
+	elseif io.type(bodyfunc) == "file" then
+		-- send the rest of file by sendfile if writefunc supports (see sockethelper.writefunc)
+		local offset = bodyfunc:seek()
+		local size = bodyfunc:seek("end") - offset
+		bodyfunc:seek("set", offset)
+		writefunc(string.format("content-length: %d\r\n\r\n", size))
+		if sockethelper.sendfile_support(writefunc) then
+			writefunc(bodyfunc, offset, size)
+		else
+			while size > 0 do
+				local s = assert(bodyfunc:read(math.min(size, 0x10000)), "file truncated")
+				writefunc(s)
+				size = size - #s
+			end
+		end
 	elseif t == "function" then
 		writefunc("transfer-encoding: chunked\r\n")
 		while true do
@@ -2,6 +2,7 @@ local socket = require "socket"
 
 local readbytes = socket.read
 local writebytes = socket.write
+local sendfile = socket.sendfile
 
 local sockethelper = {}
 local socket_error = setmetatable({} , { __tostring = function() return "[Socket Error]" end })
@@ -57,13 +58,27 @@ end
 
 sockethelper.readall = socket.readall
 
+local sendfile_writer = setmetatable({}, { __mode = "k" })
+
 function sockethelper.writefunc(fd)
-	return function(content)
-		local ok = writebytes(fd, content)
+	local f = function(content, offset, size)
+		local ok
+		if io.type(content) == "file" then
+			ok = sendfile(fd, content, offset, size)
+		else
+			ok = writebytes(fd, content)
+		end
 		if not ok then
 			error(socket_error)
 		end
 	end
+	sendfile_writer[f] = true
+	return f
+end
+
+-- true if writefunc is created by sockethelper.writefunc, it accepts (file, offset, size)
+function sockethelper.sendfile_support(writefunc)
+	return sendfile_writer[writefunc] == true
 end
 
 function sockethelper.connect(host, port)
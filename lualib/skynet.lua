@@ -29,6 +29,7 @@ local skynet = {
 	PTYPE_DEBUG = 9,
 	PTYPE_LUA = 10,
 	PTYPE_SNAX = 11,
+	PTYPE_CLIENT_BATCH = 12,	-- client packages from one socket read, unpack by netpack.unbatch
 }
 
 -- code cache
@@ -73,6 +74,45 @@ local function string_to_handle(str)
 	return tonumber("0x" .. string.sub(str , 2))
 end
 
+----- callmulti
+
+-- skynet.callmulti 的请求共用一个协程, session_id_coroutine 中这些请求(和超时定时器)的 session 对应的是请求集合 m (table)
+-- 记录结果, 全部完成 (有 callback 时每个结果) 才返回需要唤醒的协程 m.co
+local function multi_response(m, session, succ, msg, sz)
+	session_id_coroutine[session] = nil
+	if session == m.timer then
+		m.timer = nil
+		for s, i in pairs(m.session) do
+			session_id_coroutine[s] = "BREAK"	-- 超时后到达的回应直接丢弃
+			watching_session[s] = nil
+			m.result[i] = { false, "timeout", n = 2 }
+			if m.callback then
+				table.insert(m.ready, i)
+			end
+		end
+		m.session = {}
+		m.pending = 0
+	else
+		local i = m.session[session]
+		m.session[session] = nil
+		watching_session[session] = nil
+		if succ then
+			m.result[i] = table.pack(pcall(m.unpack[i], msg, sz))
+		else
+			m.result[i] = { false, "call failed", n = 2 }
+		end
+		m.pending = m.pending - 1
+		if m.callback then
+			table.insert(m.ready, i)
+		end
+	end
+	local co = m.co
+	if co and (m.callback or m.pending == 0) then
+		m.co = nil
+		return co
+	end
+end
+
 ----- monitor exit
 
 -- 每执行完一个suspend函数执行一次，从error_queue中取出一个协程并唤醒
@@ -80,6 +120,20 @@ local function dispatch_error_queue()
 	local session = table.remove(error_queue,1)
 	if session then
 		local co = session_id_coroutine[session]
+		if type(co) == "table" then
+			co = multi_response(co, session, false)
+			if co == nil then
+				-- 请求集合还没有完成, 没有协程被唤醒, 继续处理队列中其它的 session
+				return dispatch_error_queue()
+			end
+			return suspend(co, coroutine_resume(co))
+			-- 唤醒 skynet.callmulti 中的 coroutine_yield("MULTI", m)
+		end
+		if co == "BREAK" then
+			-- skynet.callmulti 超时后丢弃的请求
+			session_id_coroutine[session] = nil
+			return dispatch_error_queue()
+		end
 		session_id_coroutine[session] = nil
 		return suspend(co, coroutine_resume(co, false))
 		-- 一般会唤醒skynet.call 中的 yield_call 中的 coroutine_yield("CALL", session) 的执行
@@ -158,6 +212,8 @@ function suspend(co, result, command, param, size)
 	elseif command == "SLEEP" then				-- 调用skynet.sleep后会触发此处执行
 		session_id_coroutine[param] = co		-- 这里的param是session
 		sleep_session[co] = param				
+	elseif command == "MULTI" then				-- 调用skynet.callmulti后会触发此处执行, 请求的session在发送时已经记录
+		param.co = co
 	elseif command == "RETURN" then				-- 调用skynet.ret后会触发此处执行
 		local co_session = session_coroutine_id[co]
 		local co_address = session_coroutine_address[co]
@@ -279,6 +335,12 @@ local function raw_dispatch_message(prototype, msg, sz, session, source)
 			session_id_coroutine[session] = nil
 		elseif co == nil then
 			unknown_response(session, source, msg, sz)
+		elseif type(co) == "table" then
+			co = multi_response(co, session, true, msg, sz)
+			if co then
+				suspend(co, coroutine_resume(co))
+				-- 唤醒 skynet.callmulti 中的 coroutine_yield("MULTI", m)
+			end
 		else
 			session_id_coroutine[session] = nil
 			suspend(co, coroutine_resume(co, true, msg, sz))
@@ -434,6 +496,8 @@ end
 skynet.pack = assert(c.pack)
 skynet.packstring = assert(c.packstring)
 skynet.unpack = assert(c.unpack)
+-- 双方用同一个字符串列表(如 table 的 key)创建字典, 返回 { pack, packstring, unpack }, 字典里的字符串只打包为序号
+skynet.dictionary = assert(c.dictionary)
 skynet.tostring = assert(c.tostring)
 skynet.trash = assert(c.trash)
 
@@ -465,6 +529,53 @@ function skynet.rawcall(addr, typename, msg, sz)
 	return yield_call(addr, session)
 end
 
+-- 同时发出一组请求, 由当前协程等待它们的回应 (不为每个请求创建协程)
+-- reqs 为 { { addr, typename, ... }, ... }, 返回 ret, ret[i] = table.pack(ok, ...) 为 reqs[i] 的结果, 失败时 ok 为 false
+-- timeout (单位 1/100 秒) 到期时还没有回应的请求都以 false, "timeout" 结束
+-- 有 callback 时按回应到达的顺序调用 callback(i, ok, ...), 否则全部完成后才返回
+function skynet.callmulti(reqs, timeout, callback)
+	local m = { session = {}, unpack = {}, result = {}, ready = {}, pending = 0, callback = callback }
+	for i, req in ipairs(reqs) do
+		local addr = req[1]
+		local p = proto[req[2]]
+		local session = c.send(addr, p.id , nil , p.pack(table.unpack(req, 3)))
+		if session == nil then
+			m.result[i] = { false, "call to invalid address " .. skynet.address(addr), n = 2 }
+			if callback then
+				table.insert(m.ready, i)
+			end
+		else
+			session_id_coroutine[session] = m
+			watching_session[session] = addr
+			m.session[session] = i
+			m.unpack[i] = p.unpack
+			m.pending = m.pending + 1
+		end
+	end
+	if timeout and m.pending > 0 then
+		m.timer = c.intcommand("TIMEOUT", timeout)
+		session_id_coroutine[m.timer] = m
+	end
+	while true do
+		if callback and #m.ready > 0 then
+			local ready = m.ready
+			m.ready = {}	-- callback 中可能挂起, 这期间到达的回应记在新的队列里
+			for _, i in ipairs(ready) do
+				local r = m.result[i]
+				callback(i, table.unpack(r, 1, r.n))
+			end
+		elseif m.pending == 0 then
+			break
+		else
+			coroutine_yield("MULTI", m)
+		end
+	end
+	if m.timer then
+		session_id_coroutine[m.timer] = "BREAK"
+	end
+	return m.result
+end
+
 -- 一般用来返回消息给主动调用skynet.call的服务
 function skynet.ret(msg, sz)
 	msg = msg or ""
@@ -690,6 +801,9 @@ function skynet.task(ret)
 	local t = 0
 	for session,co in pairs(session_id_coroutine) do
 		if ret then
+			if type(co) == "table" then	-- skynet.callmulti
+				co = co.co or "callmulti"
+			end
 			ret[session] = debug.traceback(co)
 		end
 		t = t + 1
@@ -1,4 +1,5 @@
 local skynet = require "skynet"
+local c = require "skynet.core"
 
 local harbor = {}
 
@@ -28,4 +29,20 @@ function harbor.linkmaster()
 	skynet.call(".cslave", "lua", "LINKMASTER")
 end
 
+local stat_field = { "rtt", "srtt", "send", "recv", "queue", "drop", "pending" }
+
+-- 到某个 harbor 的连接状态 : status ("none", "connecting", "up", "down") , rtt 和 srtt (微秒),
+-- send/recv (字节), queue (等待连接的字节数), drop (丢弃的消息数), pending (发送缓冲超过警戒线时的 K 字节数)
+function harbor.stat(id)
+	local status = c.command("HARBOR", id .. " status")
+	if status == nil then
+		return
+	end
+	local stat = { status = status }
+	for _, field in ipairs(stat_field) do
+		stat[field] = tonumber(c.command("HARBOR", id .. " " .. field))
+	end
+	return stat
+end
+
 return harbor
@@ -10,6 +10,8 @@ local maxclient	-- max client
 local client_number = 0
 local CMD = setmetatable({}, { __gc = function() netpack.clear(queue) end })
 local nodelay = false
+local batch = false
+local framing	-- nil : uint16 big-endian
 
 local connection = {}
 
@@ -37,8 +39,15 @@ function gateserver.start(handler)
 		local port = assert(conf.port)
 		maxclient = conf.maxclient or 1024
 		nodelay = conf.nodelay
-		skynet.error(string.format("Listen on %s:%d", address, port))
-		socket = socketdriver.listen(address, port)
+		-- conf.batch : the packages of one socket read are passed to handler.batch(fd, msg, sz) in one message (read netpack.unbatch)
+		batch = conf.batch and true or false
+		assert(not batch or handler.batch, "Need handler.batch")
+		-- conf.framing : "be16" (default), "be32", "le16", "le32", "varint", "type16", with optional ":max" (read service-src/framing.h)
+		framing = conf.framing and netpack.framing(conf.framing)
+		local listen_address = address:find("^unix:") and address or string.format("%s:%d", address, port)
+		skynet.error("Listen on " .. listen_address .. (conf.reuseport and " (reuseport)" or ""))
+		-- conf.reuseport : several gates open the same port, the kernel balances the new connections among them
+		socket = socketdriver.listen(address, port, nil, conf.reuseport)
 		socketdriver.start(socket)
 		if handler.open then
 			return handler.open(source, conf)
@@ -62,6 +71,15 @@ function gateserver.start(handler)
 
 	MSG.data = dispatch_msg
 
+	function MSG.batch(fd, msg, sz)
+		if connection[fd] then
+			handler.batch(fd, msg, sz)
+		else
+			skynet.error(string.format("Drop batch from fd (%d)", fd))
+			skynet.trash(msg, sz)
+		end
+	end
+
 	local function dispatch_queue()
 		local fd, msg, sz = netpack.pop(queue)
 		if fd then
@@ -115,9 +133,15 @@ function gateserver.start(handler)
 			socketdriver.close(fd)
 			skynet.error(msg)
 		else
+			-- the packages before the error (an invalid header) in queue
+			dispatch_queue()
 			if handler.error then
 				handler.error(fd, msg)
 			end
+			if connection[fd] ~= nil then
+				-- the socket may be still open if the error comes from netpack
+				socketdriver.close(fd)
+			end
 			close_fd(fd)
 		end
 	end
@@ -132,7 +156,7 @@ function gateserver.start(handler)
 		name = "socket",
 		id = skynet.PTYPE_SOCKET,	-- PTYPE_SOCKET = 6
 		unpack = function ( msg, sz )
-			return netpack.filter( queue, msg, sz)
+			return netpack.filter( queue, msg, sz, batch, framing)
 		end,
 		dispatch = function (_, _, q, type, ...)
 			queue = q
@@ -137,6 +137,22 @@ socket_message[6] = function(id, size, data, address)
 	s.callback(str, address)
 end
 
+-- SKYNET_SOCKET_TYPE_UDP_BATCH = 8 , datagrams received by one recvmmsg
+socket_message[8] = function(id, size, data)
+	local s = socket_pool[id]
+	if s == nil or s.callback == nil then
+		skynet.error("socket: drop udp package from " .. id)
+		driver.drop(data, size)
+		return
+	end
+	local r = table.pack(driver.udp_unpack(data, size))
+	skynet_core.trash(data, size)
+	local callback = s.callback
+	for i=1,r.n,2 do
+		callback(r[i], r[i+1])
+	end
+end
+
 local function default_warning(id, size)
 	local s = socket_pool[id]
 		local last = s.warningsize or 0
@@ -148,6 +164,7 @@ local function default_warning(id, size)
 end
 
 -- SKYNET_SOCKET_TYPE_WARNING
+-- size > 0 : send buffer is above the high watermark (pause), size == 0 : drained to the low watermark (resume)
 socket_message[7] = function(id, size)
 	local s = socket_pool[id]
 	if s then
@@ -363,6 +380,8 @@ end
 
 socket.write = assert(driver.send)
 socket.lwrite = assert(driver.lsend)
+-- socket.sendfile(id, file, offset, size) : file 为文件名或 io.open 打开的文件, 由 socket 线程用 sendfile 发送, 不经过 lua 字符串
+socket.sendfile = assert(driver.sendfile)
 socket.header = assert(driver.header)
 
 function socket.invalid(id)
@@ -371,12 +390,13 @@ end
 
 -- 监听一个地址与端口，等待远端连接过来，此函数一般与 socket.start(id, func) 配合使用
 -- 其中 socket.start 第一个参数为监听描述符，第二个参数为一个函数，函数的参数为:(已连接描述符 "远端地址:端口")
-function socket.listen(host, port, backlog)
-	if port == nil then
+-- reuseport 为 true 时设置 SO_REUSEPORT，多个服务可以各自监听同一端口，由内核把新连接分摊给它们
+function socket.listen(host, port, backlog, reuseport)
+	if port == nil and not host:find("^unix:") then
 		host, port = string.match(host, "([^:]+):(.+)$")
 		port = tonumber(port)
 	end
-	return driver.listen(host, port, backlog)
+	return driver.listen(host, port, backlog, reuseport)
 	-- 此函数底层的动作为:给管道发送一个 'L' 命令，调用 bing listen 函数
 end
 
@@ -465,4 +485,15 @@ function socket.warning(id, callback)
 	obj.warning = callback
 end
 
+-- 设置发送缓冲的水位 (bytes) : 超过 high 时 warning 回调收到 size (K bytes), 降到 low 以下时收到 0
+-- limit 为硬上限 (nil 或 0 为不限制), 达到后 overflow 为 "drop" 丢弃 lsend 的低优先级包, "close" 关闭连接
+function socket.watermark(id, low, high, limit, overflow)
+	driver.watermark(id, low, high, limit, overflow)
+end
+
+-- 不小于 size (默认 64K, 0 关闭) 的包用 MSG_ZEROCOPY 发送, 内核不再拷贝, 仅 linux 有效
+function socket.zerocopy(id, size)
+	driver.zerocopy(id, size)
+end
+
 return socket
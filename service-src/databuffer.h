@@ -5,6 +5,8 @@
 #include <string.h>
 #include <assert.h>
 
+#include "framing.h"
+
 #define MESSAGEPOOL 1023
 
 struct message {
@@ -88,6 +90,24 @@ databuffer_read(struct databuffer *db, struct messagepool *mp, void * buffer, in
 	}
 }
 
+// discard sz bytes
+static void
+databuffer_skip(struct databuffer *db, struct messagepool *mp, int sz) {
+	assert(db->size >= sz);
+	db->size -= sz;
+	while (sz > 0) {
+		struct message *current = db->head;
+		int bsz = current->size - db->offset;
+		if (bsz > sz) {
+			db->offset += sz;
+			return;
+		}
+		_return_message(db, mp);
+		db->offset = 0;
+		sz -= bsz;
+	}
+}
+
 static void
 databuffer_push(struct databuffer *db, struct messagepool *mp, void *data, int sz) {
 	struct message * m;
@@ -122,21 +142,43 @@ databuffer_push(struct databuffer *db, struct messagepool *mp, void *data, int s
 	}
 }
 
+// copy sz bytes without reading
+static void
+databuffer_peek(struct databuffer *db, void * buffer, int sz) {
+	assert(db->size >= sz);
+	char * ptr = (char *)buffer;
+	struct message *current = db->head;
+	int offset = db->offset;
+	while (sz > 0) {
+		int bsz = current->size - offset;
+		if (bsz > sz) {
+			bsz = sz;
+		}
+		memcpy(ptr, current->buffer + offset, bsz);
+		ptr += bsz;
+		sz -= bsz;
+		current = current->next;
+		offset = 0;
+	}
+}
+
+// returns the size of package, -1 if need more data, -2 if the header is invalid
 static int
-databuffer_readheader(struct databuffer *db, struct messagepool *mp, int header_size) {
+databuffer_readheader(struct databuffer *db, struct messagepool *mp, const struct framing *f) {
 	if (db->header == 0) {
-		// parser header (2 or 4)
-		if (db->size < header_size) {
+		// parser header (see framing.h)
+		uint8_t plen[FRAMING_MAXHEADER];
+		int sz = db->size < FRAMING_MAXHEADER ? db->size : FRAMING_MAXHEADER;
+		int size = 0;
+		databuffer_peek(db, plen, sz);
+		int n = framing_header(f, plen, sz, &size);
+		if (n == 0) {
 			return -1;
+		} else if (n < 0) {
+			return -2;
 		}
-		uint8_t plen[4];
-		databuffer_read(db,mp,(char *)plen,header_size);
-		// big-endian
-		if (header_size == 2) {
-			db->header = plen[0] << 8 | plen[1];
-		} else {
-			db->header = plen[0] << 24 | plen[1] << 16 | plen[2] << 8 | plen[3];
-		}
+		databuffer_read(db,mp,(char *)plen,n);
+		db->header = size;
 	}
 	if (db->size < db->header)
 		return -1;
@@ -0,0 +1,179 @@
+#ifndef skynet_fdtable_h
+#define skynet_fdtable_h
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+	Socket id -> connection state table, used by service_gate.c and lua-netpack.c .
+	The index is open-addressing (linear probing, backward shift deletion) of compact { id, index } nodes,
+	the entries are stored densely in one array, each entry begins with an int id.
+	Remove moves the last entry into the hole, so the pointer of an entry is valid until the next insert or remove.
+ */
+
+#define FDTABLE_EMPTY -1
+
+struct fdtable_node {
+	int id;
+	int index;
+};
+
+struct fdtable {
+	int cap;	// nodes, power of 2 (or 0)
+	int shift;	// 32 - log2(cap)
+	int count;
+	int max;	// entries allocated
+	int size;	// size of entry
+	struct fdtable_node * node;
+	char * entry;
+};
+
+#define FDTABLE_ENTRY(t, i) ((void *)((t)->entry + (size_t)(i) * (t)->size))
+
+// fibonacci hashing, use the high bits
+static inline int
+fdtable_hash(struct fdtable *t, int id) {
+	return (int)(((uint32_t)id * 2654435769u) >> t->shift);
+}
+
+static void
+fdtable_rehash(struct fdtable *t, int cap) {
+	skynet_free(t->node);
+	t->node = skynet_malloc(cap * sizeof(struct fdtable_node));
+	t->cap = cap;
+	t->shift = 32;
+	while (cap > 1) {
+		--t->shift;
+		cap >>= 1;
+	}
+	int mask = t->cap - 1;
+	int i;
+	for (i=0;i<t->cap;i++) {
+		t->node[i].id = FDTABLE_EMPTY;
+	}
+	for (i=0;i<t->count;i++) {
+		int id = *(int *)FDTABLE_ENTRY(t, i);
+		int h = fdtable_hash(t, id);
+		while (t->node[h].id != FDTABLE_EMPTY) {
+			h = (h + 1) & mask;
+		}
+		t->node[h].id = id;
+		t->node[h].index = i;
+	}
+}
+
+static void
+fdtable_reserve(struct fdtable *t, int max) {
+	if (max <= t->max)
+		return;
+	t->entry = skynet_realloc(t->entry, (size_t)max * t->size);
+	t->max = max;
+	if (max * 2 > t->cap) {
+		int cap = 16;
+		while (cap < max * 2) {
+			cap *= 2;
+		}
+		fdtable_rehash(t, cap);
+	}
+}
+
+// max : the number of entries without expanding
+static void
+fdtable_init(struct fdtable *t, int size, int max) {
+	assert(size >= (int)sizeof(int));
+	memset(t, 0, sizeof(*t));
+	t->size = size;
+	t->shift = 32;
+	if (max > 0) {
+		fdtable_reserve(t, max);
+	}
+}
+
+static void
+fdtable_release(struct fdtable *t) {
+	skynet_free(t->node);
+	skynet_free(t->entry);
+	fdtable_init(t, t->size, 0);
+}
+
+static inline int
+fdtable_find(struct fdtable *t, int id) {
+	if (t->cap == 0)
+		return -1;
+	int mask = t->cap - 1;
+	int i = fdtable_hash(t, id);
+	for (;;) {
+		int key = t->node[i].id;
+		if (key == id)
+			return i;
+		if (key == FDTABLE_EMPTY)
+			return -1;
+		i = (i + 1) & mask;
+	}
+}
+
+static inline void *
+fdtable_lookup(struct fdtable *t, int id) {
+	int i = fdtable_find(t, id);
+	if (i < 0)
+		return NULL;
+	return FDTABLE_ENTRY(t, t->node[i].index);
+}
+
+// returns a new entry (zeroed except the id), the id should not be in the table
+static void *
+fdtable_insert(struct fdtable *t, int id) {
+	assert(id != FDTABLE_EMPTY);
+	if (t->count >= t->max) {
+		fdtable_reserve(t, t->max ? t->max * 2 : 8);
+	}
+	int mask = t->cap - 1;
+	int i = fdtable_hash(t, id);
+	while (t->node[i].id != FDTABLE_EMPTY) {
+		assert(t->node[i].id != id);
+		i = (i + 1) & mask;
+	}
+	int index = t->count++;
+	t->node[i].id = id;
+	t->node[i].index = index;
+	void * entry = FDTABLE_ENTRY(t, index);
+	memset(entry, 0, t->size);
+	*(int *)entry = id;
+	return entry;
+}
+
+// returns 0 if id is not in the table
+static int
+fdtable_remove(struct fdtable *t, int id) {
+	int i = fdtable_find(t, id);
+	if (i < 0)
+		return 0;
+	int index = t->node[i].index;
+	// backward shift deletion, no tombstone
+	int mask = t->cap - 1;
+	int j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		int key = t->node[j].id;
+		if (key == FDTABLE_EMPTY)
+			break;
+		int h = fdtable_hash(t, key);
+		// move the node at j to the hole i, if its home h is not in (i, j]
+		if ((j > i && (h <= i || h > j)) || (j < i && (h <= i && h > j))) {
+			t->node[i] = t->node[j];
+			i = j;
+		}
+	}
+	t->node[i].id = FDTABLE_EMPTY;
+	// move the last entry into the hole
+	int last = --t->count;
+	if (index != last) {
+		memcpy(FDTABLE_ENTRY(t, index), FDTABLE_ENTRY(t, last), t->size);
+		t->node[fdtable_find(t, *(int *)FDTABLE_ENTRY(t, index))].index = index;
+	}
+	return 1;
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef skynet_framing_h
+#define skynet_framing_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+	The wire framing of client packages, shared by service_gate.c and lua-netpack.c .
+
+	be16 (or S) : uint16 big-endian size + data (default)
+	be32 (or L) : uint32 big-endian size + data
+	le16 / le32 : the same in little-endian
+	varint : LEB128 size (1-5 bytes) + data
+	type16 : uint16 big-endian size of body + uint8 type + body, the package is type + body
+
+	A name can be followed by ":max" to set the max size of a package, such as "varint:1048576".
+ */
+
+#define FRAMING_BE16 0
+#define FRAMING_BE32 1
+#define FRAMING_LE16 2
+#define FRAMING_LE32 3
+#define FRAMING_VARINT 4
+#define FRAMING_TYPE16 5
+
+#define FRAMING_MAXHEADER 5
+#define FRAMING_MAXSIZE 0xffffff
+
+struct framing {
+	int type;
+	int max;
+};
+
+static inline int
+framing_limit(int type) {
+	switch (type) {
+	case FRAMING_BE16:
+	case FRAMING_LE16:
+		return 0xffff;
+	case FRAMING_TYPE16:
+		return 0x10000;
+	default:
+		return 0x7fffffff;
+	}
+}
+
+// returns 0 if succ
+static int
+framing_init(struct framing *f, const char * name) {
+	static const char * names[] = { "be16", "be32", "le16", "le32", "varint", "type16", NULL };
+	const char * sep = strchr(name, ':');
+	size_t len = sep ? (size_t)(sep - name) : strlen(name);
+	int type = -1;
+	if (len == 1 && (name[0] == 'S' || name[0] == 'L')) {
+		type = name[0] == 'S' ? FRAMING_BE16 : FRAMING_BE32;
+	} else {
+		int i;
+		for (i=0;names[i];i++) {
+			if (strlen(names[i]) == len && memcmp(names[i], name, len) == 0) {
+				type = i;
+				break;
+			}
+		}
+	}
+	if (type < 0)
+		return 1;
+	int limit = framing_limit(type);
+	int max = limit < FRAMING_MAXSIZE ? limit : FRAMING_MAXSIZE;
+	if (sep) {
+		char * endptr;
+		long v = strtol(sep + 1, &endptr, 10);
+		if (*endptr != '\0' || v <= 0 || v > limit)
+			return 1;
+		max = (int)v;
+	}
+	f->type = type;
+	f->max = max;
+	return 0;
+}
+
+/*
+	Parse the header at buffer (sz bytes).
+	return the size of header and set *size (the package size) ,
+	0 if the header is not complete, -1 if the header is invalid (or the package is larger than max).
+ */
+static inline int
+framing_header(const struct framing *f, const uint8_t * buffer, int sz, int *size) {
+	uint32_t v;
+	int n;
+	switch (f->type) {
+	case FRAMING_BE16:
+	case FRAMING_TYPE16:
+		if (sz < 2)
+			return 0;
+		v = buffer[0] << 8 | buffer[1];
+		n = 2;
+		if (f->type == FRAMING_TYPE16)
+			++v;
+		break;
+	case FRAMING_LE16:
+		if (sz < 2)
+			return 0;
+		v = buffer[0] | buffer[1] << 8;
+		n = 2;
+		break;
+	case FRAMING_BE32:
+		if (sz < 4)
+			return 0;
+		v = (uint32_t)buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
+		n = 4;
+		break;
+	case FRAMING_LE32:
+		if (sz < 4)
+			return 0;
+		v = buffer[0] | buffer[1] << 8 | buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+		n = 4;
+		break;
+	case FRAMING_VARINT:
+		v = 0;
+		for (n=0;;) {
+			if (n >= sz)
+				return 0;
+			uint8_t b = buffer[n];
+			if (n == 4 && b > 0x0f)
+				return -1;	// more than 32 bits
+			v |= (uint32_t)(b & 0x7f) << (7 * n);
+			++n;
+			if (!(b & 0x80))
+				break;
+		}
+		break;
+	default:
+		return -1;
+	}
+	if (v > (uint32_t)f->max)
+		return -1;
+	*size = (int)v;
+	return n;
+}
+
+// write the header of a package (size bytes) to buffer (FRAMING_MAXHEADER bytes at least), returns the size of header or -1
+static inline int
+framing_write(const struct framing *f, uint8_t * buffer, int size) {
+	if (size < 0 || size > f->max)
+		return -1;
+	uint32_t v = (uint32_t)size;
+	switch (f->type) {
+	case FRAMING_TYPE16:
+		if (v == 0)
+			return -1;
+		--v;
+		// fall through
+	case FRAMING_BE16:
+		buffer[0] = (v >> 8) & 0xff;
+		buffer[1] = v & 0xff;
+		return 2;
+	case FRAMING_LE16:
+		buffer[0] = v & 0xff;
+		buffer[1] = (v >> 8) & 0xff;
+		return 2;
+	case FRAMING_BE32:
+		buffer[0] = (v >> 24) & 0xff;
+		buffer[1] = (v >> 16) & 0xff;
+		buffer[2] = (v >> 8) & 0xff;
+		buffer[3] = v & 0xff;
+		return 4;
+	case FRAMING_LE32:
+		buffer[0] = v & 0xff;
+		buffer[1] = (v >> 8) & 0xff;
+		buffer[2] = (v >> 16) & 0xff;
+		buffer[3] = (v >> 24) & 0xff;
+		return 4;
+	case FRAMING_VARINT: {
+		int n = 0;
+		while (v >= 0x80) {
+			buffer[n++] = (v & 0x7f) | 0x80;
+			v >>= 7;
+		}
+		buffer[n++] = v;
+		return n;
+	}
+	default:
+		return -1;
+	}
+}
+
+// the integers in the batch of packages (service_gate.c / netpack.unbatch) are uint32 little-endian
+
+static inline void
+write_uint32(uint8_t * buffer, uint32_t v) {
+	buffer[0] = v & 0xff;
+	buffer[1] = (v >> 8) & 0xff;
+	buffer[2] = (v >> 16) & 0xff;
+	buffer[3] = (v >> 24) & 0xff;
+}
+
+static inline uint32_t
+read_uint32(const uint8_t * buffer) {
+	return buffer[0] | buffer[1] << 8 | buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+}
+
+#endif
@@ -0,0 +1,1422 @@
+#include "skynet.h"
+#include "skynet_socket.h"
+#include "fdtable.h"
+#include "shmlink.h"
+#include "lz4.h"
+
+/*
+	The transport of cluster, read service/clusterd.lua and lualib/cluster.lua .
+	The protocol on wire is the same as lualib-src/lua-cluster.c , so it can talk to the nodes use the lua version.
+
+	clusterd controls it in PTYPE_TEXT :
+	N id fd : the connection to node id (asked by C id) is ready
+	M id path : connect to node id by shared memory, path is the unix domain socket of it
+	D id : can't connect to node id
+	K id : close the connection to node id (the address is changed)
+	A fd : accept a connection from other node
+	S fd : accept a shared memory link (read shmlink.h) from other node, fd is not started.
+		The fds of the link are received without waiting, it retries by a timer if they are not arrived.
+	R name handle : register the name for the queries (address 0), handle 0 : remove it
+
+	When a node is not connected, it asks clusterd to connect it in PTYPE_TEXT : C id
+
+	A local service calls the remote service in PTYPE_LUA (cluster.core.packcall) :
+		DWORD node id
+		BYTE namelen (0 : the address is a number)
+		DWORD address / name
+		PADDING msg
+	the session on wire is allocated here, and the response (or PTYPE_ERROR) is sent back to the caller directly.
+
+	The requests from the remote nodes are sent to the local services in PTYPE_LUA, and the responses are sent back.
+	The frames to a connection are copied into a batch, and the batch is sent when the messages already
+	in the queue of this service are dispatched (a TIMEOUT 0 timer), or it's larger than BATCH_SIZE.
+	The message larger than part (cluster_part, MULTI_PART by default) is split into multi parts.
+	The size of a multi part message from other node is limited by max_frame (cluster_max_frame, MAX_FRAME by default),
+	the connection is closed if it's larger.
+
+	If compress (the threshold, cluster_compress) is set, ask the node by the name query COMPRESS_QUERY
+	after connected, and compress the messages to it if it answers.
+
+	clusterd may launch several cluster services (cluster_pool), each one has its own connection to a node.
+	If inflight (cluster_inflight) is set, the calls more than it on a connection wait for the responses.
+
+	The frames of a shared memory link are the same, they are written into the ring directly (or the batch if
+	the ring is full), and published when the batch is flushed. The eventfd of doorbell is bound to a socket id.
+	The peer can write the ring at any time, so each frame is copied out before it's parsed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+
+#define MULTI_PART 0x8000
+#define MAX_PART 0xfe00
+#define COMPRESSED 0x40
+#define COMPRESSED_MAXSIZE 0x10000
+#define MAX_FRAME 0x1000000
+#define NAME_MAXLEN 255
+
+#define BATCH_INIT 4096
+#define BATCH_SIZE 0x10000
+
+#define COMPRESS_QUERY "@compress"
+
+#define HANDSHAKE_RETRY 100	// wait the fds of a shared memory link for 1s at most (a tick each retry)
+
+struct buffer {
+	uint8_t * ptr;
+	int sz;
+	int cap;
+};
+
+// multi part request
+struct large_request {
+	int session;	// the session on wire
+	uint32_t address;
+	int namelen;
+	char name[NAME_MAXLEN+1];
+	uint8_t * buffer;
+	uint32_t size;
+	uint32_t offset;
+};
+
+// the call waits for the in flight calls
+struct waiting {
+	struct waiting * next;
+	uint32_t source;
+	int session;
+	int sz;
+	uint8_t msg[];	// the message of cluster.core.packcall
+};
+
+struct conn {
+	int fd;	// -1 : connecting
+	int doorbell;	// the socket id of shm->rx_efd, -1 if it's not a shared memory link
+	struct shmlink * shm;
+	bool shm_last;	// the last batch_alloc is in the ring
+	int node;	// the node id, 0 : accepted from other node
+	bool compress;	// the other side accepts compressed messages
+	bool pending;	// in the flush list
+	int inflight;	// the calls waiting for responses
+	struct waiting * wait_head;
+	struct waiting * wait_tail;
+	struct buffer recv;
+	struct buffer batch;
+	struct fdtable large;	// session -> struct large_request
+};
+
+struct conn_fd {
+	int fd;
+	struct conn * c;	// NULL : wait for SOCKET_CLOSE to close rawfd
+	int rawfd;	// the fd bound by skynet_socket_bind, closed after SOCKET_CLOSE. -1 if none
+	bool doorbell;
+};
+
+// the call to remote node
+struct call {
+	int session;	// the session on wire
+	uint32_t source;	// 0 : COMPRESS_QUERY
+	int local;	// the session of source
+	int node;
+	uint8_t * buffer;	// multi part response
+	uint32_t size;
+	uint32_t offset;
+};
+
+// the accepted shared memory link waits for the fds
+struct handshake {
+	int session;	// the timer
+	int fd;
+	int retry;
+};
+
+// the request from remote node, dispatched to local service
+struct request {
+	int session;	// the session of local service
+	int fd;
+	uint32_t remote;	// the session on wire
+};
+
+struct name {
+	char * name;
+	uint32_t handle;
+};
+
+struct cluster {
+	struct skynet_context * ctx;
+	uint32_t clusterd;
+	int part;
+	int compress;	// the threshold of compression, 0 : disable
+	int inflight;	// the max calls in flight per connection, 0 : unlimited
+	uint32_t shm_size;	// the ring size of shared memory links
+	uint32_t max_frame;	// the max size of a multi part message from other node
+	int session;	// the last session on wire
+	struct fdtable fd;	// socket id -> struct conn_fd
+	struct fdtable call;	// session on wire -> struct call
+	struct fdtable request;	// local session -> struct request
+	struct fdtable handshake;	// timer session -> struct handshake
+	struct conn ** node;
+	int node_cap;
+	struct name * names;
+	int name_n;
+	int name_cap;
+	int flush_session;	// the timer to flush the batches, 0 if none
+	struct conn ** pending;
+	int pending_n;
+	int pending_cap;
+};
+
+static inline void
+fill_uint32(uint8_t * buf, uint32_t n) {
+	buf[0] = n & 0xff;
+	buf[1] = (n >> 8) & 0xff;
+	buf[2] = (n >> 16) & 0xff;
+	buf[3] = (n >> 24) & 0xff;
+}
+
+static inline uint32_t
+unpack_uint32(const uint8_t * buf) {
+	return buf[0] | buf[1]<<8 | buf[2]<<16 | buf[3]<<24;
+}
+
+static void
+buffer_reserve(struct buffer *b, int sz) {
+	if (b->sz + sz <= b->cap)
+		return;
+	int cap = b->cap ? b->cap * 2 : BATCH_INIT;
+	while (cap < b->sz + sz) {
+		cap *= 2;
+	}
+	b->ptr = skynet_realloc(b->ptr, cap);
+	b->cap = cap;
+}
+
+static void
+buffer_free(struct buffer *b) {
+	skynet_free(b->ptr);
+	b->ptr = NULL;
+	b->sz = 0;
+	b->cap = 0;
+}
+
+struct cluster *
+cluster_create(void) {
+	struct cluster * h = skynet_malloc(sizeof(*h));
+	memset(h,0,sizeof(*h));
+	fdtable_init(&h->fd, sizeof(struct conn_fd), 0);
+	fdtable_init(&h->call, sizeof(struct call), 0);
+	fdtable_init(&h->request, sizeof(struct request), 0);
+	fdtable_init(&h->handshake, sizeof(struct handshake), 0);
+	return h;
+}
+
+static void
+free_conn(struct conn *c) {
+	int i;
+	for (i=0;i<c->large.count;i++) {
+		struct large_request * req = FDTABLE_ENTRY(&c->large, i);
+		skynet_free(req->buffer);
+	}
+	fdtable_release(&c->large);
+	while (c->wait_head) {
+		struct waiting * w = c->wait_head;
+		c->wait_head = w->next;
+		skynet_free(w);
+	}
+	buffer_free(&c->recv);
+	buffer_free(&c->batch);
+	if (c->shm) {
+		shmlink_release(c->shm);
+		skynet_free(c->shm);
+	}
+	skynet_free(c);
+}
+
+void
+cluster_release(struct cluster *h) {
+	int i;
+	// never call skynet_send during module exit
+	for (i=0;i<h->fd.count;i++) {
+		struct conn_fd * cfd = FDTABLE_ENTRY(&h->fd, i);
+		skynet_socket_close(h->ctx, cfd->fd);
+		if (cfd->rawfd >= 0) {
+			close(cfd->rawfd);
+		}
+		if (cfd->c && !cfd->doorbell && cfd->c->node == 0) {
+			free_conn(cfd->c);
+		}
+	}
+	for (i=0;i<h->node_cap;i++) {
+		if (h->node[i]) {
+			free_conn(h->node[i]);
+		}
+	}
+	for (i=0;i<h->call.count;i++) {
+		struct call * c = FDTABLE_ENTRY(&h->call, i);
+		skynet_free(c->buffer);
+	}
+	for (i=0;i<h->handshake.count;i++) {
+		struct handshake * hs = FDTABLE_ENTRY(&h->handshake, i);
+		skynet_socket_close(h->ctx, hs->fd);
+	}
+	for (i=0;i<h->name_n;i++) {
+		skynet_free(h->names[i].name);
+	}
+	fdtable_release(&h->fd);
+	fdtable_release(&h->call);
+	fdtable_release(&h->request);
+	fdtable_release(&h->handshake);
+	skynet_free(h->node);
+	skynet_free(h->names);
+	skynet_free(h->pending);
+	skynet_free(h);
+}
+
+// copy the batch into the ring, and publish the frames
+static void
+flush_shm(struct cluster *h, struct conn *c) {
+	struct shmlink * l = c->shm;
+	struct buffer * b = &c->batch;
+	for (;;) {
+		uint32_t space = shmlink_space(l);
+		int n = (uint32_t)b->sz < space ? b->sz : (int)space;
+		if (n > 0) {
+			memcpy(shmlink_reserve(l, n), b->ptr, n);
+			memmove(b->ptr, b->ptr + n, b->sz - n);
+			b->sz -= n;
+		}
+		shmlink_publish(l);
+		// flush again when the doorbell rings, if the ring is full
+		if (b->sz == 0 || !shmlink_wait_space(l, 1))
+			break;
+	}
+}
+
+static void
+flush_batch(struct cluster *h, struct conn *c) {
+	if (c->shm) {
+		flush_shm(h, c);
+		return;
+	}
+	if (c->batch.sz == 0)
+		return;
+	// ignore send error, because if the connection is broken, the mainloop will recv a message.
+	skynet_socket_send(h->ctx, c->fd, c->batch.ptr, c->batch.sz);
+	c->batch.ptr = NULL;
+	c->batch.sz = 0;
+	c->batch.cap = 0;
+}
+
+static void
+flush_all(struct cluster *h) {
+	int i;
+	for (i=0;i<h->pending_n;i++) {
+		struct conn *c = h->pending[i];
+		c->pending = false;
+		flush_batch(h, c);
+	}
+	h->pending_n = 0;
+	h->flush_session = 0;
+}
+
+static void
+add_pending(struct cluster *h, struct conn *c) {
+	if (c->pending)
+		return;
+	if (h->pending_n >= h->pending_cap) {
+		h->pending_cap = h->pending_cap ? h->pending_cap * 2 : 16;
+		h->pending = skynet_realloc(h->pending, h->pending_cap * sizeof(struct conn *));
+	}
+	c->pending = true;
+	h->pending[h->pending_n++] = c;
+	if (h->flush_session == 0) {
+		// flush after the messages in queue
+		const char * session = skynet_command(h->ctx, "TIMEOUT", "0");
+		h->flush_session = strtol(session, NULL, 10);
+	}
+}
+
+// reserve sz bytes in the batch, the batch of a connecting node is sent after connected
+static uint8_t *
+batch_alloc(struct cluster *h, struct conn *c, int sz) {
+	struct buffer *b = &c->batch;
+	if (c->shm && b->sz == 0) {
+		uint8_t * ptr = shmlink_reserve(c->shm, sz);
+		if (ptr) {
+			c->shm_last = true;
+			add_pending(h, c);
+			return ptr;
+		}
+	}
+	c->shm_last = false;
+	if (c->fd >= 0) {
+		if (b->sz + sz > BATCH_SIZE) {
+			flush_batch(h, c);
+		}
+		add_pending(h, c);
+	}
+	buffer_reserve(b, sz);
+	uint8_t * ptr = b->ptr + b->sz;
+	b->sz += sz;
+	return ptr;
+}
+
+/*
+	Append a frame : WORD size (big-endian) + header + body.
+	The body is compressed if it's not smaller than compress (0 : never) and the result is smaller,
+	and then the type (header[type]) is marked COMPRESSED.
+ */
+static void
+send_frame(struct cluster *h, struct conn *c, const uint8_t * header, int hsz, int type, const void * body, int sz, int compress) {
+	uint8_t * frame = batch_alloc(h, c, 2 + hsz + sz);
+	memcpy(frame+2, header, hsz);
+	uint8_t * ptr = frame + 2 + hsz;
+	int n = sz;
+	if (compress > 0 && sz >= compress && sz > 5) {
+		int csz = LZ4_compress_default(body, (char *)ptr + 4, sz, sz - 5);
+		if (csz > 0) {
+			fill_uint32(ptr, (uint32_t)sz);
+			n = csz + 4;
+			frame[2+type] |= COMPRESSED;
+			if (c->shm_last) {
+				shmlink_shrink(c->shm, sz - n);
+			} else {
+				c->batch.sz -= sz - n;
+			}
+		} else {
+			memcpy(ptr, body, sz);
+		}
+	} else if (sz > 0) {
+		memcpy(ptr, body, sz);
+	}
+	int len = hsz + n;
+	frame[0] = (len >> 8) & 0xff;
+	frame[1] = len & 0xff;
+}
+
+static inline int
+conn_compress(struct cluster *h, struct conn *c) {
+	return c->compress ? h->compress : 0;
+}
+
+static void
+send_request(struct cluster *h, struct conn *c, int session, uint32_t address, const char * name, int namelen, const uint8_t * msg, int sz) {
+	uint8_t header[2 + NAME_MAXLEN + 8];
+	int compress = conn_compress(h, c);
+	int hsz;
+	if (sz < h->part) {
+		if (namelen == 0) {
+			header[0] = 0;
+			fill_uint32(header+1, address);
+			fill_uint32(header+5, (uint32_t)session);
+			hsz = 9;
+		} else {
+			header[0] = 0x80;
+			header[1] = (uint8_t)namelen;
+			memcpy(header+2, name, namelen);
+			fill_uint32(header+2+namelen, (uint32_t)session);
+			hsz = 6 + namelen;
+		}
+		send_frame(h, c, header, hsz, 0, msg, sz, compress);
+		return;
+	}
+	if (namelen == 0) {
+		header[0] = 1;
+		fill_uint32(header+1, address);
+		fill_uint32(header+5, (uint32_t)session);
+		fill_uint32(header+9, (uint32_t)sz);
+		hsz = 13;
+	} else {
+		header[0] = 0x81;
+		header[1] = (uint8_t)namelen;
+		memcpy(header+2, name, namelen);
+		fill_uint32(header+2+namelen, (uint32_t)session);
+		fill_uint32(header+6+namelen, (uint32_t)sz);
+		hsz = 10 + namelen;
+	}
+	send_frame(h, c, header, hsz, 0, NULL, 0, 0);
+	fill_uint32(header+1, (uint32_t)session);
+	while (sz > 0) {
+		int s = sz > h->part ? h->part : sz;
+		header[0] = sz > h->part ? 2 : 3;	// 3 : the last multi part
+		send_frame(h, c, header, 5, 0, msg, s, compress);
+		msg += s;
+		sz -= s;
+	}
+}
+
+static void
+send_response(struct cluster *h, struct conn *c, uint32_t session, int ok, const uint8_t * msg, int sz) {
+	uint8_t header[9];
+	fill_uint32(header, session);
+	if (!ok) {
+		if (sz > h->part) {
+			// truncate the error msg if too long
+			sz = h->part;
+		}
+		header[4] = 0;
+		send_frame(h, c, header, 5, 4, msg, sz, 0);
+		return;
+	}
+	int compress = conn_compress(h, c);
+	if (sz <= h->part) {
+		header[4] = 1;
+		send_frame(h, c, header, 5, 4, msg, sz, compress);
+		return;
+	}
+	// multi part begin
+	header[4] = 2;
+	fill_uint32(header+5, (uint32_t)sz);
+	send_frame(h, c, header, 9, 4, NULL, 0, 0);
+	while (sz > 0) {
+		int s = sz > h->part ? h->part : sz;
+		header[4] = sz > h->part ? 3 : 4;	// 4 : multi end
+		send_frame(h, c, header, 5, 4, msg, s, compress);
+		msg += s;
+		sz -= s;
+	}
+}
+
+// skynet.pack(n) , see lualib-src/lua-seri.c
+static void
+pack_integer(uint8_t buf[9], int64_t n) {
+	buf[0] = 2 | 6 << 3;	// TYPE_NUMBER , TYPE_NUMBER_QWORD
+	int i;
+	for (i=0;i<8;i++) {
+		buf[i+1] = (uint8_t)((uint64_t)n >> (i*8));
+	}
+}
+
+// skynet.pack(str) for short string
+static int
+pack_string(uint8_t * buf, const char * str) {
+	int len = strlen(str);
+	assert(len < 32);
+	buf[0] = 4 | len << 3;	// TYPE_SHORT_STRING
+	memcpy(buf+1, str, len);
+	return len + 1;
+}
+
+// the string packed by skynet.pack , returns the length (or -1)
+static int
+unpack_string(const uint8_t * msg, int sz, const uint8_t ** str) {
+	if (sz < 1)
+		return -1;
+	int type = msg[0] & 7;
+	int cookie = msg[0] >> 3;
+	int len;
+	if (type == 4) {	// TYPE_SHORT_STRING
+		len = cookie;
+		*str = msg + 1;
+		return sz == 1 + len ? len : -1;
+	}
+	if (type == 5 && cookie == 2 && sz >= 3) {	// TYPE_LONG_STRING , WORD
+		len = msg[1] | msg[2] << 8;
+		*str = msg + 3;
+		return sz == 3 + len ? len : -1;
+	}
+	return -1;
+}
+
+static struct conn *
+new_conn(int fd, int node) {
+	struct conn * c = skynet_malloc(sizeof(*c));
+	memset(c, 0, sizeof(*c));
+	c->fd = fd;
+	c->doorbell = -1;
+	c->node = node;
+	fdtable_init(&c->large, sizeof(struct large_request), 0);
+	return c;
+}
+
+static struct conn_fd *
+insert_fd(struct cluster *h, int fd, struct conn *c, int rawfd, bool doorbell) {
+	struct conn_fd * cfd = fdtable_lookup(&h->fd, fd);
+	if (cfd == NULL) {
+		cfd = fdtable_insert(&h->fd, fd);
+	}
+	cfd->c = c;
+	cfd->rawfd = rawfd;
+	cfd->doorbell = doorbell;
+	return cfd;
+}
+
+// the connection is closed, the bound fd is closed after SOCKET_CLOSE
+static void
+release_fd(struct cluster *h, int fd) {
+	struct conn_fd * cfd = fdtable_lookup(&h->fd, fd);
+	if (cfd == NULL)
+		return;
+	if (cfd->rawfd >= 0) {
+		cfd->c = NULL;
+	} else {
+		fdtable_remove(&h->fd, fd);
+	}
+}
+
+static void
+start_conn(struct cluster *h, struct conn *c, int fd) {
+	c->fd = fd;
+	insert_fd(h, fd, c, -1, false);
+	skynet_socket_start(h->ctx, fd);
+	skynet_socket_nodelay(h->ctx, fd);
+}
+
+static void shm_recv(struct cluster *h, struct conn *c);
+
+// fd is the socket id of the unix domain socket, rawfd is bound (connecting side) or -1 (accepted)
+static void
+start_shm(struct cluster *h, struct conn *c, int fd, int rawfd, struct shmlink *l) {
+	c->fd = fd;
+	c->shm = l;
+	insert_fd(h, fd, c, rawfd, false);
+	c->doorbell = skynet_socket_bind(h->ctx, l->rx_efd);
+	insert_fd(h, c->doorbell, c, l->rx_efd, true);
+	l->rx_efd = -1;	// closed by release_fd
+	if (rawfd < 0) {
+		skynet_socket_start(h->ctx, fd);
+	}
+	// read the frames sent before, and sleep
+	shm_recv(h, c);
+}
+
+static struct conn *
+lookup_conn(struct cluster *h, int fd) {
+	struct conn_fd * cfd = fdtable_lookup(&h->fd, fd);
+	return cfd ? cfd->c : NULL;
+}
+
+static void send_waiting(struct cluster *h, struct conn *c);
+
+static void
+free_call(struct cluster *h, struct call *c) {
+	int node = c->node;
+	skynet_free(c->buffer);
+	fdtable_remove(&h->call, c->session);
+	struct conn * conn = h->node[node];
+	if (conn) {
+		--conn->inflight;
+		send_waiting(h, conn);
+	}
+}
+
+// report the error to the caller, and remove the call
+static void
+call_error(struct cluster *h, struct call *c) {
+	if (c->source && c->local) {
+		skynet_send(h->ctx, 0, c->source, PTYPE_ERROR, c->local, NULL, 0);
+	}
+	free_call(h, c);
+}
+
+static void
+close_conn(struct cluster *h, struct conn *c) {
+	int i;
+	if (c->node) {
+		h->node[c->node] = NULL;
+		while (c->wait_head) {
+			struct waiting * w = c->wait_head;
+			c->wait_head = w->next;
+			if (w->session) {
+				skynet_send(h->ctx, 0, w->source, PTYPE_ERROR, w->session, NULL, 0);
+			}
+			skynet_free(w);
+		}
+		// remove backward, fdtable_remove moves the last entry into the hole
+		for (i=h->call.count-1;i>=0;i--) {
+			struct call * call = FDTABLE_ENTRY(&h->call, i);
+			if (call->node == c->node) {
+				call_error(h, call);
+			}
+		}
+	} else {
+		for (i=h->request.count-1;i>=0;i--) {
+			struct request * req = FDTABLE_ENTRY(&h->request, i);
+			if (req->fd == c->fd) {
+				fdtable_remove(&h->request, req->session);
+			}
+		}
+	}
+	if (c->fd >= 0) {
+		release_fd(h, c->fd);
+	}
+	if (c->doorbell >= 0) {
+		skynet_socket_close(h->ctx, c->doorbell);
+		release_fd(h, c->doorbell);
+	}
+	if (c->pending) {
+		for (i=0;i<h->pending_n;i++) {
+			if (h->pending[i] == c) {
+				h->pending[i] = h->pending[--h->pending_n];
+				break;
+			}
+		}
+	}
+	free_conn(c);
+}
+
+static void
+report(struct cluster *h, const char * cmd, int id) {
+	char tmp[32];
+	int n = sprintf(tmp, "%s %d", cmd, id);
+	skynet_send(h->ctx, 0, h->clusterd, PTYPE_TEXT, 0, tmp, n);
+}
+
+// the connection to node id, ask clusterd to connect if it's not connected
+static struct conn *
+node_conn(struct cluster *h, int id) {
+	if (id >= h->node_cap) {
+		int cap = h->node_cap ? h->node_cap : 16;
+		while (cap <= id) {
+			cap *= 2;
+		}
+		h->node = skynet_realloc(h->node, cap * sizeof(struct conn *));
+		memset(h->node + h->node_cap, 0, (cap - h->node_cap) * sizeof(struct conn *));
+		h->node_cap = cap;
+	}
+	struct conn * c = h->node[id];
+	if (c == NULL) {
+		c = new_conn(-1, id);
+		h->node[id] = c;
+		report(h, "C", id);
+	}
+	return c;
+}
+
+static struct call *
+new_call(struct cluster *h, uint32_t source, int local, int node) {
+	do {
+		if (++h->session <= 0) {
+			h->session = 1;
+		}
+	} while (fdtable_lookup(&h->call, h->session));
+	struct call * c = fdtable_insert(&h->call, h->session);
+	c->source = source;
+	c->local = local;
+	c->node = node;
+	++h->node[node]->inflight;
+	return c;
+}
+
+// msg is the message of cluster.core.packcall, the node id is checked
+static void
+send_call(struct cluster *h, struct conn *c, uint32_t source, int session, const uint8_t * msg, int sz) {
+	int namelen = msg[4];
+	uint32_t address = 0;
+	const char * name = NULL;
+	int hsz;
+	if (namelen == 0) {
+		hsz = 9;
+		if (sz >= hsz) {
+			address = unpack_uint32(msg+5);
+		}
+	} else {
+		hsz = 5 + namelen;
+		name = (const char *)msg + 5;
+	}
+	if (sz < hsz) {
+		skynet_error(h->ctx, "Invalid cluster call from :%08x", source);
+		skynet_send(h->ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
+		return;
+	}
+	struct call * call = new_call(h, source, session, c->node);
+	send_request(h, c, call->session, address, name, namelen, msg + hsz, sz - hsz);
+}
+
+// send the waiting calls if the in flight calls are less than the limit
+static void
+send_waiting(struct cluster *h, struct conn *c) {
+	while (c->wait_head && c->inflight < h->inflight) {
+		struct waiting * w = c->wait_head;
+		c->wait_head = w->next;
+		if (c->wait_head == NULL) {
+			c->wait_tail = NULL;
+		}
+		send_call(h, c, w->source, w->session, w->msg, w->sz);
+		skynet_free(w);
+	}
+}
+
+static void
+remote_call(struct cluster *h, uint32_t source, int session, const uint8_t * msg, int sz) {
+	int id = sz >= 5 ? (int)unpack_uint32(msg) : 0;
+	if (id <= 0 || id > 0xffff) {
+		skynet_error(h->ctx, "Invalid cluster call from :%08x", source);
+		skynet_send(h->ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
+		return;
+	}
+	struct conn * c = node_conn(h, id);
+	if (h->inflight > 0 && (c->inflight >= h->inflight || c->wait_head)) {
+		struct waiting * w = skynet_malloc(sizeof(*w) + sz);
+		w->next = NULL;
+		w->source = source;
+		w->session = session;
+		w->sz = sz;
+		memcpy(w->msg, msg, sz);
+		if (c->wait_tail) {
+			c->wait_tail->next = w;
+		} else {
+			c->wait_head = w;
+		}
+		c->wait_tail = w;
+		return;
+	}
+	send_call(h, c, source, session, msg, sz);
+}
+
+// the node id is connected, ask if it accepts compressed messages, and send the queued requests
+static void
+node_connected(struct cluster *h, int id, int fd) {
+	struct conn * c = id > 0 && id < h->node_cap ? h->node[id] : NULL;
+	if (c == NULL || c->fd >= 0) {
+		skynet_error(h->ctx, "Invalid connection %d to node %d", fd, id);
+		skynet_socket_close(h->ctx, fd);
+		return;
+	}
+	start_conn(h, c, fd);
+	if (h->compress) {
+		uint8_t query[32];
+		int sz = pack_string(query, COMPRESS_QUERY);
+		struct call * call = new_call(h, 0, 0, id);
+		send_request(h, c, call->session, 0, NULL, 0, query, sz);
+	}
+	if (c->batch.sz > 0) {
+		add_pending(h, c);
+	}
+}
+
+// connect to node id by shared memory (the compression is not used)
+static void
+node_shm(struct cluster *h, int id, const char * path) {
+	struct conn * c = id > 0 && id < h->node_cap ? h->node[id] : NULL;
+	if (c == NULL || c->fd >= 0) {
+		skynet_error(h->ctx, "Invalid shared memory link %s to node %d", path, id);
+		return;
+	}
+	struct shmlink * l = skynet_malloc(sizeof(*l));
+	int rawfd = shmlink_connect(l, path, h->shm_size);
+	if (rawfd < 0) {
+		skynet_error(h->ctx, "Can't connect to node %d by shared memory (%s)", id, path);
+		skynet_free(l);
+		close_conn(h, c);
+		return;
+	}
+	int fd = skynet_socket_bind(h->ctx, rawfd);
+	start_shm(h, c, fd, rawfd, l);
+	if (c->batch.sz > 0) {
+		add_pending(h, c);
+	}
+}
+
+// accept a shared memory link from the socket id fd, retry by a timer if the fds are not arrived yet
+static void
+accept_shm(struct cluster *h, int fd, int retry) {
+	struct shmlink tmp;
+	int rawfd = skynet_socket_acceptfd(fd);
+	int r = rawfd < 0 ? -1 : shmlink_accept(&tmp, rawfd);
+	if (r == 0) {
+		struct shmlink * l = skynet_malloc(sizeof(*l));
+		*l = tmp;
+		struct conn * c = new_conn(-1, 0);
+		start_shm(h, c, fd, -1, l);
+		return;
+	}
+	if (r > 0 && retry < HANDSHAKE_RETRY) {
+		const char * session = skynet_command(h->ctx, "TIMEOUT", "1");
+		struct handshake * hs = fdtable_insert(&h->handshake, strtol(session, NULL, 10));
+		hs->fd = fd;
+		hs->retry = retry + 1;
+		return;
+	}
+	skynet_error(h->ctx, "Accept shared memory link (%d) failed", fd);
+	skynet_socket_close(h->ctx, fd);
+}
+
+// the size of body after decompression, -1 if invalid
+static int
+body_size(const uint8_t * buf, int sz, int compressed) {
+	if (!compressed)
+		return sz;
+	if (sz < 4)
+		return -1;
+	uint32_t size = unpack_uint32(buf);
+	if (size > COMPRESSED_MAXSIZE)
+		return -1;
+	return (int)size;
+}
+
+// copy (or decompress) the body (size is from body_size), returns 0 if invalid
+static int
+body_copy(void * dst, const uint8_t * buf, int sz, int compressed, int size) {
+	if (!compressed) {
+		memcpy(dst, buf, sz);
+		return 1;
+	}
+	return LZ4_decompress_safe((const char *)buf+4, dst, sz-4, size) == size;
+}
+
+static void *
+body_dup(const uint8_t * buf, int sz, int compressed, int * size) {
+	int n = body_size(buf, sz, compressed);
+	if (n < 0)
+		return NULL;
+	void * data = skynet_malloc(n > 0 ? n : 1);
+	if (!body_copy(data, buf, sz, compressed, n)) {
+		skynet_free(data);
+		return NULL;
+	}
+	*size = n;
+	return data;
+}
+
+// append the body of a multi part message, returns 0 if invalid
+static int
+body_append(uint8_t * buffer, uint32_t size, uint32_t * offset, const uint8_t * buf, int sz, int compressed) {
+	int n = body_size(buf, sz, compressed);
+	if (n < 0 || *offset + n > size)
+		return 0;
+	if (!body_copy(buffer + *offset, buf, sz, compressed, n))
+		return 0;
+	*offset += n;
+	return 1;
+}
+
+static void
+query_name(struct cluster *h, struct conn *c, uint32_t session, const uint8_t * msg, int sz) {
+	const uint8_t * str = NULL;
+	int len = unpack_string(msg, sz, &str);
+	uint8_t ret[9];
+	if (len == sizeof(COMPRESS_QUERY) - 1 && memcmp(str, COMPRESS_QUERY, len) == 0 && h->compress) {
+		c->compress = true;
+		pack_integer(ret, h->compress);
+		send_response(h, c, session, 1, ret, sizeof(ret));
+		return;
+	}
+	int i;
+	for (i=0;i<h->name_n;i++) {
+		struct name * n = &h->names[i];
+		if ((int)strlen(n->name) == len && memcmp(n->name, str, len) == 0) {
+			pack_integer(ret, n->handle);
+			send_response(h, c, session, 1, ret, sizeof(ret));
+			return;
+		}
+	}
+	const char * err = "name not found";
+	send_response(h, c, session, 0, (const uint8_t *)err, strlen(err));
+}
+
+// dispatch the request to local service, msg is moved
+static void
+dispatch_request(struct cluster *h, struct conn *c, uint32_t session, uint32_t address, const char * name, int namelen, void * msg, int sz) {
+	if (namelen == 0 && address == 0) {
+		query_name(h, c, session, msg, sz);
+		skynet_free(msg);
+		return;
+	}
+	int type = PTYPE_RESERVED_LUA | PTYPE_TAG_DONTCOPY | PTYPE_TAG_ALLOCSESSION;
+	int local;
+	if (namelen == 0) {
+		local = skynet_send(h->ctx, 0, address, type, 0, msg, sz);
+	} else {
+		char tmp[NAME_MAXLEN+1];
+		memcpy(tmp, name, namelen);
+		tmp[namelen] = '\0';
+		local = skynet_sendname(h->ctx, 0, tmp, type, 0, msg, sz);
+	}
+	if (local < 0) {
+		const char * err = "call to invalid address";
+		send_response(h, c, session, 0, (const uint8_t *)err, strlen(err));
+		return;
+	}
+	struct request * req = fdtable_insert(&h->request, local);
+	req->fd = c->fd;
+	req->remote = session;
+}
+
+// the request frame from other node, returns 0 if invalid
+static int
+recv_request(struct cluster *h, struct conn *c, const uint8_t * buf, int sz) {
+	if (sz < 1)
+		return 0;
+	int type = buf[0];
+	int compressed = type & COMPRESSED;
+	uint32_t address = 0;
+	const char * name = NULL;
+	int namelen = 0;
+	int hsz;
+	switch (type & ~COMPRESSED) {
+	case 0:
+	case 1:
+		hsz = 9;
+		if (sz < hsz)
+			return 0;
+		address = unpack_uint32(buf+1);
+		break;
+	case 0x80:
+	case 0x81:
+		if (sz < 2)
+			return 0;
+		namelen = buf[1];
+		name = (const char *)buf + 2;
+		hsz = 6 + namelen;
+		if (namelen == 0 || sz < hsz)
+			return 0;
+		break;
+	case 2:
+	case 3: {
+		// multi part
+		if (sz < 5)
+			return 0;
+		int session = (int)unpack_uint32(buf+1);
+		struct large_request * req = fdtable_lookup(&c->large, session);
+		if (req == NULL) {
+			skynet_error(h->ctx, "Unknown large request %d", session);
+			return 1;
+		}
+		if (req->buffer && !body_append(req->buffer, req->size, &req->offset, buf+5, sz-5, compressed)) {
+			skynet_free(req->buffer);
+			req->buffer = NULL;
+		}
+		if ((type & ~COMPRESSED) == 3) {
+			uint8_t * msg = req->buffer;
+			if (msg && req->offset == req->size) {
+				dispatch_request(h, c, (uint32_t)session, req->address, req->name, req->namelen, msg, req->size);
+			} else {
+				skynet_free(msg);
+				const char * err = "Invalid large req";
+				send_response(h, c, (uint32_t)session, 0, (const uint8_t *)err, strlen(err));
+			}
+			fdtable_remove(&c->large, session);
+		}
+		return 1;
+	}
+	default:
+		return 0;
+	}
+	uint32_t session = unpack_uint32(buf + hsz - 4);
+	if (type & 1) {
+		// multi req header
+		if (sz != hsz + 4 || compressed)
+			return 0;
+		uint32_t size = unpack_uint32(buf + hsz);
+		if (size > h->max_frame) {
+			skynet_error(h->ctx, "Large request %u is too large (%u > %u)", session, size, h->max_frame);
+			return 0;
+		}
+		struct large_request * req = fdtable_lookup(&c->large, (int)session);
+		if (req) {
+			skynet_free(req->buffer);
+		} else {
+			req = fdtable_insert(&c->large, (int)session);
+		}
+		req->address = address;
+		req->namelen = namelen;
+		memcpy(req->name, name, namelen);
+		req->buffer = skynet_malloc(size > 0 ? size : 1);
+		req->size = size;
+		req->offset = 0;
+		return 1;
+	}
+	int size = 0;
+	void * msg = body_dup(buf + hsz, sz - hsz, compressed, &size);
+	if (msg == NULL)
+		return 0;
+	dispatch_request(h, c, session, address, name, namelen, msg, size);
+	return 1;
+}
+
+// the response frame of a remote call, returns 0 if invalid
+static int
+recv_response(struct cluster *h, struct conn *c, const uint8_t * buf, int sz) {
+	if (sz < 5)
+		return 0;
+	int session = (int)unpack_uint32(buf);
+	int type = buf[4];
+	int compressed = type & COMPRESSED;
+	buf += 5;
+	sz -= 5;
+	struct call * call = fdtable_lookup(&h->call, session);
+	if (call == NULL || call->node != c->node) {
+		skynet_error(h->ctx, "Unknown response session %d from node %d", session, c->node);
+		return 1;
+	}
+	switch (type & ~COMPRESSED) {
+	case 0:	// error
+		skynet_error(h->ctx, "%.*s", sz, (const char *)buf);
+		call_error(h, call);
+		return 1;
+	case 1: {	// ok
+		if (call->source == 0) {
+			// answer of COMPRESS_QUERY
+			c->compress = true;
+			free_call(h, call);
+			return 1;
+		}
+		int size = 0;
+		void * msg = body_dup(buf, sz, compressed, &size);
+		if (msg == NULL)
+			return 0;
+		if (call->local) {
+			skynet_send(h->ctx, 0, call->source, PTYPE_RESPONSE | PTYPE_TAG_DONTCOPY, call->local, msg, size);
+		} else {
+			skynet_free(msg);
+		}
+		free_call(h, call);
+		return 1;
+	}
+	case 2:	// multi begin
+		if (sz != 4 || call->size)
+			return 0;
+		call->size = unpack_uint32(buf);
+		if (call->size > h->max_frame) {
+			skynet_error(h->ctx, "Large response %d is too large (%u > %u)", session, call->size, h->max_frame);
+			call->size = 0;
+			return 0;
+		}
+		call->buffer = skynet_malloc(call->size > 0 ? call->size : 1);
+		call->offset = 0;
+		return 1;
+	case 3:	// multi part
+	case 4:	// multi end
+		if (call->buffer == NULL || !body_append(call->buffer, call->size, &call->offset, buf, sz, compressed))
+			return 0;
+		if ((type & ~COMPRESSED) == 4) {
+			if (call->offset != call->size)
+				return 0;
+			if (call->local && call->source) {
+				skynet_send(h->ctx, 0, call->source, PTYPE_RESPONSE | PTYPE_TAG_DONTCOPY, call->local, call->buffer, call->size);
+				call->buffer = NULL;
+			}
+			free_call(h, call);
+		}
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// returns 0 if the frame is invalid
+static inline int
+recv_frame(struct cluster *h, struct conn *c, const uint8_t * buf, int sz) {
+	if (c->node) {
+		return recv_response(h, c, buf, sz);
+	} else {
+		return recv_request(h, c, buf, sz);
+	}
+}
+
+// returns the bytes of the completed frames, -1 if there is an invalid frame
+static int
+recv_frames(struct cluster *h, struct conn *c, const uint8_t * buf, int sz) {
+	int offset = 0;
+	while (sz - offset >= 2) {
+		int len = buf[offset] << 8 | buf[offset+1];
+		if (sz - offset - 2 < len)
+			break;
+		if (!recv_frame(h, c, buf + offset + 2, len))
+			return -1;
+		offset += 2 + len;
+	}
+	return offset;
+}
+
+// the frames in the ring of a shared memory link, returns the bytes of the completed frames, -1 if there is an invalid frame
+static int
+shm_frames(struct cluster *h, struct conn *c, const uint8_t * buf, int sz) {
+	struct buffer * b = &c->recv;	// not used by the socket data of shared memory link
+	int offset = 0;
+	while (sz - offset >= 2) {
+		// the peer can write the ring, so read the length once and copy the frame out before validating it
+		const volatile uint8_t * ptr = buf + offset;
+		int len = ptr[0] << 8 | ptr[1];
+		if (sz - offset - 2 < len)
+			break;
+		buffer_reserve(b, len);
+		memcpy(b->ptr, buf + offset + 2, len);
+		if (!recv_frame(h, c, b->ptr, len))
+			return -1;
+		offset += 2 + len;
+	}
+	return offset;
+}
+
+// the doorbell rings, read the frames in the ring, and flush the batch if the ring was full
+static void
+shm_recv(struct cluster *h, struct conn *c) {
+	struct shmlink * l = c->shm;
+	for (;;) {
+		uint32_t sz;
+		const uint8_t * buf = shmlink_peek(l, &sz);
+		int n = sz > 0 ? shm_frames(h, c, buf, (int)sz) : 0;
+		if (n < 0) {
+			skynet_error(h->ctx, "Invalid cluster frame from shared memory link (%d) node %d", c->fd, c->node);
+			skynet_socket_close(h->ctx, c->fd);
+			close_conn(h, c);
+			return;
+		}
+		if (n > 0) {
+			shmlink_consume(l, n);
+		} else if (!shmlink_sleep(l, sz)) {
+			// nothing (or an incomplete frame) to read
+			break;
+		}
+	}
+	if (c->batch.sz > 0) {
+		flush_batch(h, c);
+	}
+}
+
+static void
+push_socket_data(struct cluster *h, const struct skynet_socket_message * message) {
+	struct conn * c = lookup_conn(h, message->id);
+	if (c == NULL) {
+		skynet_error(h->ctx, "Invalid socket fd (%d) data", message->id);
+		return;
+	}
+	struct buffer * b = &c->recv;
+	const uint8_t * buf = (const uint8_t *)message->buffer;
+	int sz = message->ud;
+	if (b->sz > 0) {
+		buffer_reserve(b, sz);
+		memcpy(b->ptr + b->sz, buf, sz);
+		b->sz += sz;
+		buf = b->ptr;
+		sz = b->sz;
+	}
+	int n = recv_frames(h, c, buf, sz);
+	if (n < 0) {
+		skynet_error(h->ctx, "Invalid cluster frame from fd (%d) node %d", c->fd, c->node);
+		skynet_socket_close(h->ctx, c->fd);
+		close_conn(h, c);
+		return;
+	}
+	if (b->sz > 0) {
+		memmove(b->ptr, b->ptr + n, b->sz - n);
+		b->sz -= n;
+	} else if (n < sz) {
+		// keep the incomplete frame
+		buffer_reserve(b, sz - n);
+		memcpy(b->ptr, buf + n, sz - n);
+		b->sz = sz - n;
+	}
+}
+
+// the response of the request dispatched to local service
+static void
+local_response(struct cluster *h, int type, int session, const uint8_t * msg, int sz) {
+	struct request * req = fdtable_lookup(&h->request, session);
+	if (req == NULL) {
+		// the connection is closed
+		return;
+	}
+	struct conn * c = lookup_conn(h, req->fd);
+	if (c) {
+		if (type == PTYPE_ERROR) {
+			const char * err = "call failed";
+			send_response(h, c, req->remote, 0, (const uint8_t *)err, strlen(err));
+		} else {
+			send_response(h, c, req->remote, 1, msg, sz);
+		}
+	}
+	fdtable_remove(&h->request, session);
+}
+
+static void
+register_name(struct cluster *h, const char * name, uint32_t handle) {
+	int i;
+	for (i=0;i<h->name_n;i++) {
+		struct name * n = &h->names[i];
+		if (strcmp(n->name, name) == 0) {
+			if (handle) {
+				n->handle = handle;
+			} else {
+				skynet_free(n->name);
+				h->names[i] = h->names[--h->name_n];
+			}
+			return;
+		}
+	}
+	if (handle == 0)
+		return;
+	if (h->name_n >= h->name_cap) {
+		h->name_cap = h->name_cap ? h->name_cap * 2 : 16;
+		h->names = skynet_realloc(h->names, h->name_cap * sizeof(struct name));
+	}
+	struct name * n = &h->names[h->name_n++];
+	n->name = skynet_strdup(name);
+	n->handle = handle;
+}
+
+static void
+cluster_command(struct cluster *h, const char * msg, size_t sz) {
+	char tmp[sz+1];
+	memcpy(tmp, msg, sz);
+	tmp[sz] = '\0';
+	const char * args = tmp + 1;
+	int id = 0, fd = 0;
+	switch (tmp[0]) {
+	case 'N':
+		if (sscanf(args, "%d %d", &id, &fd) != 2)
+			break;
+		node_connected(h, id, fd);
+		return;
+	case 'M': {
+		char path[sz+1];
+		if (sscanf(args, "%d %s", &id, path) != 2)
+			break;
+		node_shm(h, id, path);
+		return;
+	}
+	case 'D':
+	case 'K': {
+		if (sscanf(args, "%d", &id) != 1)
+			break;
+		struct conn * c = id > 0 && id < h->node_cap ? h->node[id] : NULL;
+		if (c) {
+			if (c->fd >= 0) {
+				skynet_socket_close(h->ctx, c->fd);
+			}
+			close_conn(h, c);
+		}
+		return;
+	}
+	case 'A': {
+		if (sscanf(args, "%d", &fd) != 1)
+			break;
+		struct conn * c = new_conn(-1, 0);
+		start_conn(h, c, fd);
+		return;
+	}
+	case 'S':
+		if (sscanf(args, "%d", &fd) != 1)
+			break;
+		accept_shm(h, fd, 0);
+		return;
+	case 'R': {
+		char name[sz+1];
+		uint32_t handle = 0;
+		if (sscanf(args, "%s %u", name, &handle) != 2)
+			break;
+		register_name(h, name, handle);
+		return;
+	}
+	}
+	skynet_error(h->ctx, "Invalid cluster command %s", tmp);
+}
+
+static int
+mainloop(struct skynet_context * context, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
+	struct cluster * h = ud;
+	switch (type) {
+	case PTYPE_RESPONSE:
+		if (source == 0 && msg == NULL) {
+			if (session == h->flush_session) {
+				// the timer of batches
+				flush_all(h);
+				return 0;
+			}
+			struct handshake * hs = fdtable_lookup(&h->handshake, session);
+			if (hs) {
+				int fd = hs->fd;
+				int retry = hs->retry;
+				fdtable_remove(&h->handshake, session);
+				accept_shm(h, fd, retry);
+				return 0;
+			}
+		}
+		// fall through
+	case PTYPE_ERROR:
+		local_response(h, type, session, msg, (int)sz);
+		return 0;
+	case PTYPE_SOCKET: {
+		const struct skynet_socket_message * message = msg;
+		switch(message->type) {
+		case SKYNET_SOCKET_TYPE_DATA: {
+			struct conn_fd * cfd = fdtable_lookup(&h->fd, message->id);
+			if (cfd && cfd->doorbell) {
+				if (cfd->c) {
+					shm_recv(h, cfd->c);
+				}
+			} else if (cfd == NULL || cfd->c == NULL || cfd->c->shm == NULL) {
+				push_socket_data(h, message);
+			}
+			skynet_free(message->buffer);
+			break;
+		}
+		case SKYNET_SOCKET_TYPE_ERROR:
+		case SKYNET_SOCKET_TYPE_CLOSE: {
+			struct conn_fd * cfd = fdtable_lookup(&h->fd, message->id);
+			if (cfd == NULL)
+				break;
+			if (cfd->rawfd >= 0) {
+				close(cfd->rawfd);
+				cfd->rawfd = -1;
+			}
+			struct conn * c = cfd->c;
+			if (c) {
+				skynet_error(context, "Cluster connection fd (%d) node %d closed", message->id, c->node);
+				close_conn(h, c);
+			} else {
+				fdtable_remove(&h->fd, message->id);
+			}
+			break;
+		}
+		case SKYNET_SOCKET_TYPE_WARNING: {
+			struct conn * c = lookup_conn(h, message->id);
+			if (c && message->ud > 0) {
+				skynet_error(context, "message havn't send to cluster fd (%d) node %d reach %d K", message->id, c->node, message->ud);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		return 0;
+	}
+	case PTYPE_TEXT:
+		if (source == h->clusterd) {
+			cluster_command(h, msg, sz);
+		}
+		return 0;
+	case PTYPE_RESERVED_LUA:
+		remote_call(h, source, session, msg, (int)sz);
+		return 0;
+	default:
+		skynet_error(context, "Unknown message type %d from :%08x", type, source);
+		return 0;
+	}
+}
+
+// args : clusterd part compress inflight shm_size max_frame
+int
+cluster_init(struct cluster *h, struct skynet_context *ctx, const char * args) {
+	uint32_t clusterd = 0;
+	int part = 0;
+	int compress = 0;
+	int inflight = 0;
+	uint32_t shm_size = 0;
+	uint32_t max_frame = 0;
+	sscanf(args, "%u %d %d %d %u %u", &clusterd, &part, &compress, &inflight, &shm_size, &max_frame);
+	if (clusterd == 0) {
+		skynet_error(ctx, "Invalid cluster args %s", args);
+		return 1;
+	}
+	if (part <= 0) {
+		part = MULTI_PART;
+	} else if (part > MAX_PART) {
+		part = MAX_PART;
+	}
+	h->ctx = ctx;
+	h->clusterd = clusterd;
+	h->part = part;
+	h->compress = compress > 0 ? compress : 0;
+	h->inflight = inflight > 0 ? inflight : 0;
+	h->shm_size = shm_size > 0 ? shm_size : SHMLINK_DEFAULT_SIZE;
+	h->max_frame = max_frame > 0 ? max_frame : MAX_FRAME;
+	skynet_callback(ctx, h, mainloop);
+	return 0;
+}
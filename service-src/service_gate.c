@@ -1,7 +1,8 @@
 #include "skynet.h"
 #include "skynet_socket.h"
 #include "databuffer.h"
-#include "hashid.h"
+#include "framing.h"
+#include "fdtable.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,47 @@
 #include <stdarg.h>
 
 #define BACKLOG 32
+#define BATCH_SIZE 1024
+
+/*
+	PTYPE_CLIENT_BATCH message : the packages from one socket read for the same agent (or broker)
+	package data ... , n * { uint32 offset, uint32 size } , uint32 n
+	integers are little-endian, unpack it by netpack.unbatch (lualib-src/lua-netpack.c)
+ */
+struct batch {
+	char * buffer;
+	int size;
+	int cap;
+	int n;
+	int index_cap;
+	uint32_t * index;	// offset, size pairs
+};
+
+/*
+	Rate limit (set by the text command "limit") : token buckets of bytes and packages per second,
+	for each connection and for the whole listener. Tokens are counted in 1/100 (the tick of skynet_now),
+	the capacity of a bucket is one second.
+	The action when a bucket is empty :
+		drop : discard the package before copying or sending it
+		pause : stop reading the socket (tcp flow control pushes back the client) until the buckets are refilled
+		close : close the connection
+	The watchdog gets "id limit drop|pause|close" when a connection is limited, and "id stat ..." by the command "stat".
+ */
+#define LIMIT_NONE 0
+#define LIMIT_DROP 1
+#define LIMIT_PAUSE 2
+#define LIMIT_CLOSE 3
+
+struct limit {
+	int bytes;	// per second, 0 : unlimited
+	int packets;
+};
+
+struct bucket {
+	int64_t bytes;
+	int64_t packets;
+	uint64_t time;
+};
 
 struct connection {
 	int id;	// skynet_socket id
@@ -18,6 +60,8 @@ struct connection {
 	uint32_t client;
 	char remote_name[32];
 	struct databuffer buffer;
+	struct bucket bucket;
+	int limited;	// LIMIT_* , the last action reported to watchdog (drop is reported once)
 };
 
 struct gate {
@@ -26,10 +70,20 @@ struct gate {
 	uint32_t watchdog;
 	uint32_t broker;
 	int client_tag;
-	int header_size;
+	struct framing framing;
 	int max_connection;
-	struct hashid hash;
-	struct connection *conn;
+	struct fdtable conn;	// socket id -> struct connection
+	int batch;
+	struct batch pending;
+	int limit;	// action (LIMIT_*), LIMIT_NONE : no limit
+	struct limit conn_limit;
+	struct limit listen_limit;
+	struct bucket listen_bucket;
+	int resume_session;	// the timer to resume paused connections
+	uint64_t drop_packets;
+	uint64_t drop_bytes;
+	uint64_t paused;
+	uint64_t closed;
 	// todo: save message pool ptr for release
 	struct messagepool mp;
 };
@@ -46,18 +100,18 @@ void
 gate_release(struct gate *g) {
 	int i;
 	struct skynet_context *ctx = g->ctx;
-	for (i=0;i<g->max_connection;i++) {
-		struct connection *c = &g->conn[i];
-		if (c->id >=0) {
-			skynet_socket_close(ctx, c->id);
-		}
+	for (i=0;i<g->conn.count;i++) {
+		struct connection *c = FDTABLE_ENTRY(&g->conn, i);
+		skynet_socket_close(ctx, c->id);
+		databuffer_clear(&c->buffer,&g->mp);
 	}
 	if (g->listen_id >= 0) {
 		skynet_socket_close(ctx, g->listen_id);
 	}
 	messagepool_free(&g->mp);
-	hashid_clear(&g->hash);
-	skynet_free(g->conn);
+	skynet_free(g->pending.buffer);
+	skynet_free(g->pending.index);
+	fdtable_release(&g->conn);
 	skynet_free(g);
 }
 
@@ -77,14 +131,28 @@ _parm(char *msg, int sz, int command_sz) {
 
 static void
 _forward_agent(struct gate * g, int fd, uint32_t agentaddr, uint32_t clientaddr) {
-	int id = hashid_lookup(&g->hash, fd);
-	if (id >=0) {
-		struct connection * agent = &g->conn[id];
+	struct connection * agent = fdtable_lookup(&g->conn, fd);
+	if (agent) {
 		agent->agent = agentaddr;
 		agent->client = clientaddr;
 	}
 }
 
+static void
+_report(struct gate * g, const char * data, ...) {
+	if (g->watchdog == 0) {
+		return;
+	}
+	struct skynet_context * ctx = g->ctx;
+	va_list ap;
+	va_start(ap, data);
+	char tmp[1024];
+	int n = vsnprintf(tmp, sizeof(tmp), data, ap);
+	va_end(ap);
+
+	skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT,  0, tmp, n);
+}
+
 static void
 _ctrl(struct gate * g, const void * msg, int sz) {
 	struct skynet_context * ctx = g->ctx;
@@ -103,8 +171,7 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 	if (memcmp(command,"kick",i)==0) {
 		_parm(tmp, sz, i);
 		int uid = strtol(command , NULL, 10);
-		int id = hashid_lookup(&g->hash, uid);
-		if (id>=0) {
+		if (fdtable_lookup(&g->conn, uid)) {
 			skynet_socket_close(ctx, uid);
 		}
 		return;
@@ -134,12 +201,54 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 	if (memcmp(command,"start",i) == 0) {
 		_parm(tmp, sz, i);
 		int uid = strtol(command , NULL, 10);
-		int id = hashid_lookup(&g->hash, uid);
-		if (id>=0) {
+		if (fdtable_lookup(&g->conn, uid)) {
 			skynet_socket_start(ctx, uid);
 		}
 		return;
 	}
+	if (memcmp(command,"limit",i) == 0) {
+		// limit bytes packets listen_bytes listen_packets [drop|pause|close]
+		_parm(tmp, sz, i);
+		struct limit conn, listen;
+		char action[sz+1];
+		strcpy(action, "drop");
+		int n = sscanf(command, "%d %d %d %d %s", &conn.bytes, &conn.packets, &listen.bytes, &listen.packets, action);
+		if (n < 4) {
+			skynet_error(ctx, "[gate] Invalid limit : %s", command);
+			return;
+		}
+		int limit;
+		if (strcmp(action, "drop") == 0) {
+			limit = LIMIT_DROP;
+		} else if (strcmp(action, "pause") == 0) {
+			limit = LIMIT_PAUSE;
+		} else if (strcmp(action, "close") == 0) {
+			limit = LIMIT_CLOSE;
+		} else {
+			skynet_error(ctx, "[gate] Invalid limit action : %s", action);
+			return;
+		}
+		if (conn.bytes <= 0 && conn.packets <= 0 && listen.bytes <= 0 && listen.packets <= 0) {
+			limit = LIMIT_NONE;
+		}
+		g->conn_limit = conn;
+		g->listen_limit = listen;
+		g->limit = limit;
+		// refill all the buckets
+		memset(&g->listen_bucket, 0, sizeof(g->listen_bucket));
+		int j;
+		for (j=0;j<g->conn.count;j++) {
+			struct connection *c = FDTABLE_ENTRY(&g->conn, j);
+			memset(&c->bucket, 0, sizeof(c->bucket));
+		}
+		return;
+	}
+	if (memcmp(command,"stat",i) == 0) {
+		_report(g, "%d stat %d %llu %llu %llu %llu", g->listen_id, g->conn.count,
+			(unsigned long long)g->drop_packets, (unsigned long long)g->drop_bytes,
+			(unsigned long long)g->paused, (unsigned long long)g->closed);
+		return;
+	}
 	if (memcmp(command, "close", i) == 0) {
 		if (g->listen_id >= 0) {
 			skynet_socket_close(ctx, g->listen_id);
@@ -150,24 +259,66 @@ _ctrl(struct gate * g, const void * msg, int sz) {
 	skynet_error(ctx, "[gate] Unkown command : %s", command);
 }
 
-static void
-_report(struct gate * g, const char * data, ...) {
-	if (g->watchdog == 0) {
-		return;
+static char *
+batch_alloc(struct batch *b, int size) {
+	if (b->n >= b->index_cap) {
+		b->index_cap = b->index_cap ? b->index_cap * 2 : 64;
+		b->index = skynet_realloc(b->index, b->index_cap * 2 * sizeof(uint32_t));
 	}
-	struct skynet_context * ctx = g->ctx;
-	va_list ap;
-	va_start(ap, data);
-	char tmp[1024];
-	int n = vsnprintf(tmp, sizeof(tmp), data, ap);
-	va_end(ap);
+	int need = b->size + size;
+	if (need > b->cap) {
+		int cap = b->cap ? b->cap : BATCH_SIZE;
+		while (cap < need) {
+			cap *= 2;
+		}
+		b->buffer = skynet_realloc(b->buffer, cap);
+		b->cap = cap;
+	}
+	char * ptr = b->buffer + b->size;
+	b->index[b->n * 2] = b->size;
+	b->index[b->n * 2 + 1] = size;
+	b->size = need;
+	++b->n;
+	return ptr;
+}
 
-	skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT,  0, tmp, n);
+static void
+batch_flush(struct gate *g, struct connection * c) {
+	struct batch *b = &g->pending;
+	int sz = b->size;
+	char * msg = b->buffer;
+	int type = g->client_tag;
+	if (b->n > 1) {
+		sz += b->n * 8 + 4;
+		msg = skynet_realloc(msg, sz);
+		uint8_t * index = (uint8_t *)msg + b->size;
+		int i;
+		for (i=0;i<b->n * 2;i++) {
+			write_uint32(index + i * 4, b->index[i]);
+		}
+		write_uint32(index + i * 4, b->n);
+		type = PTYPE_CLIENT_BATCH;
+	}
+	b->buffer = NULL;
+	b->size = 0;
+	b->cap = 0;
+	b->n = 0;
+	if (g->broker) {
+		skynet_send(g->ctx, 0, g->broker, type | PTYPE_TAG_DONTCOPY, 0, msg, sz);
+	} else if (c->agent) {
+		skynet_send(g->ctx, c->client, c->agent, type | PTYPE_TAG_DONTCOPY, 0, msg, sz);
+	} else {
+		skynet_free(msg);
+	}
 }
 
 static void
 _forward(struct gate *g, struct connection * c, int size) {
 	struct skynet_context * ctx = g->ctx;
+	if (g->batch && (g->broker || c->agent)) {
+		databuffer_read(&c->buffer,&g->mp,batch_alloc(&g->pending, size), size);
+		return;
+	}
 	if (g->broker) {
 		void * temp = skynet_malloc(size);
 		databuffer_read(&c->buffer,&g->mp,temp, size);
@@ -186,24 +337,283 @@ _forward(struct gate *g, struct connection * c, int size) {
 	}
 }
 
+// forward the package at buffer+offset which is inside one socket buffer, no databuffer needed.
+// the socket buffer is reused for the last package in it (last != 0), otherwise the package is copied.
+// In batch mode, the packages are copied into the pending batch unless it's the only one.
 static void
-dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
-	databuffer_push(&c->buffer,&g->mp, data, sz);
+_forward_buffer(struct gate *g, struct connection * c, char * buffer, int offset, int size, int last) {
+	struct skynet_context * ctx = g->ctx;
+	if (g->batch && (g->broker || c->agent) && !(last && g->pending.n == 0)) {
+		memcpy(batch_alloc(&g->pending, size), buffer+offset, size);
+		if (last) {
+			skynet_free(buffer);
+		}
+		return;
+	}
+	uint32_t source = 0;
+	uint32_t dest;
+	if (g->broker) {
+		dest = g->broker;
+	} else if (c->agent) {
+		source = c->client;
+		dest = c->agent;
+	} else {
+		if (g->watchdog) {
+			char * tmp = skynet_malloc(size + 32);
+			int n = snprintf(tmp,32,"%d data ",c->id);
+			memcpy(tmp+n, buffer+offset, size);
+			skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT | PTYPE_TAG_DONTCOPY, 0, tmp, size + n);
+		}
+		if (last) {
+			skynet_free(buffer);
+		}
+		return;
+	}
+	void * temp;
+	if (last) {
+		memmove(buffer, buffer+offset, size);
+		temp = buffer;
+	} else {
+		temp = skynet_malloc(size);
+		memcpy(temp, buffer+offset, size);
+	}
+	skynet_send(ctx, source, dest, g->client_tag | PTYPE_TAG_DONTCOPY, 0, temp, size);
+}
+
+static void
+bucket_refill(struct bucket *b, const struct limit *l, uint64_t now) {
+	if (b->time == now)
+		return;
+	// a new bucket (time 0) is full
+	int full = b->time == 0 || now - b->time >= 100;
+	int64_t elapsed = (int64_t)(now - b->time);
+	b->time = now;
+	if (l->bytes > 0) {
+		int64_t cap = (int64_t)l->bytes * 100;
+		b->bytes = full ? cap : b->bytes + l->bytes * elapsed;
+		if (b->bytes > cap)
+			b->bytes = cap;
+	}
+	if (l->packets > 0) {
+		int64_t cap = (int64_t)l->packets * 100;
+		b->packets = full ? cap : b->packets + l->packets * elapsed;
+		if (b->packets > cap)
+			b->packets = cap;
+	}
+}
+
+// ticks (1/100 s) to wait until the bucket has enough tokens for a package (size bytes), 0 : now.
+// a package larger than the capacity can be taken when the bucket is full.
+static int
+bucket_wait(const struct bucket *b, const struct limit *l, int size) {
+	int64_t t = 0;
+	if (l->bytes > 0) {
+		int64_t need = (int64_t)size * 100;
+		if (need > (int64_t)l->bytes * 100)
+			need = (int64_t)l->bytes * 100;
+		if (b->bytes < need)
+			t = (need - b->bytes + l->bytes - 1) / l->bytes;
+	}
+	if (l->packets > 0 && b->packets < 100) {
+		int64_t tp = (100 - b->packets + l->packets - 1) / l->packets;
+		if (tp > t)
+			t = tp;
+	}
+	return (int)t;
+}
+
+static inline void
+bucket_take(struct bucket *b, const struct limit *l, int size) {
+	if (l->bytes > 0)
+		b->bytes -= (int64_t)size * 100;
+	if (l->packets > 0)
+		b->packets -= 100;
+}
+
+static void
+_limit_report(struct gate *g, struct connection *c, int action) {
+	if (c->limited != action) {
+		c->limited = action;
+		static const char * name[] = { "none", "drop", "pause", "close" };
+		_report(g, "%d limit %s", c->id, name[action]);
+	}
+}
+
+static void
+_limit_timeout(struct gate *g, int ticks) {
+	if (g->resume_session)
+		return;
+	char tmp[16];
+	sprintf(tmp, "%d", ticks);
+	const char * session = skynet_command(g->ctx, "TIMEOUT", tmp);
+	g->resume_session = strtol(session, NULL, 10);
+}
+
+/*
+	returns 1 if the package (size bytes) can be forwarded, 0 to discard it,
+	-1 to keep it (and the rest) in the connection buffer until _limit_resume (pause).
+ */
+static int
+_limit(struct gate *g, struct connection *c, int size) {
+	if (g->limit == LIMIT_NONE)
+		return 1;
+	if (c->limited == LIMIT_CLOSE)
+		return 0;
+	uint64_t now = skynet_now();
+	bucket_refill(&c->bucket, &g->conn_limit, now);
+	bucket_refill(&g->listen_bucket, &g->listen_limit, now);
+	int t = bucket_wait(&c->bucket, &g->conn_limit, size);
+	int lt = bucket_wait(&g->listen_bucket, &g->listen_limit, size);
+	if (lt > t)
+		t = lt;
+	if (t > 0) {
+		switch (g->limit) {
+		case LIMIT_DROP:
+			++g->drop_packets;
+			g->drop_bytes += size;
+			_limit_report(g, c, LIMIT_DROP);
+			return 0;
+		case LIMIT_PAUSE:
+			if (c->limited != LIMIT_PAUSE) {
+				++g->paused;
+				skynet_socket_pause(g->ctx, c->id);
+				_limit_report(g, c, LIMIT_PAUSE);
+			}
+			_limit_timeout(g, t);
+			return -1;
+		default:
+			++g->closed;
+			skynet_socket_close(g->ctx, c->id);
+			_limit_report(g, c, LIMIT_CLOSE);
+			return 0;
+		}
+	}
+	bucket_take(&c->bucket, &g->conn_limit, size);
+	bucket_take(&g->listen_bucket, &g->listen_limit, size);
+	return 1;
+}
+
+// Frame the packages in a socket buffer directly when no partial package is pending (the common case).
+// Returns the offset of the bytes left (a partial package or the packages paused by limit), or -1 if the buffer is consumed or freed.
+static int
+dispatch_buffer(struct gate *g, struct connection *c, int id, char * data, int sz) {
+	int offset = 0;
+	while (offset < sz) {
+		int size = 0;
+		int n = framing_header(&g->framing, (const uint8_t *)data + offset, sz - offset, &size);
+		if (n == 0) {
+			break;
+		}
+		if (n < 0) {
+			struct skynet_context * ctx = g->ctx;
+			skynet_free(data);
+			skynet_socket_close(ctx, id);
+			skynet_error(ctx, "Recv socket message > %d", g->framing.max);
+			return -1;
+		}
+		int pos = offset + n;
+		if (sz - pos < size) {
+			break;
+		}
+		int forward = 0;
+		if (size > 0) {
+			forward = _limit(g, c, size);
+			if (forward < 0) {
+				break;
+			}
+		}
+		offset = pos + size;
+		if (offset == sz) {
+			if (forward) {
+				_forward_buffer(g, c, data, pos, size, 1);
+			} else {
+				skynet_free(data);
+			}
+			return -1;
+		}
+		if (forward) {
+			_forward_buffer(g, c, data, pos, size, 0);
+		}
+	}
+	return offset;
+}
+
+// Frame the packages in connection buffer, returns 0 if it stops by limit (pause)
+static int
+frame_buffer(struct gate *g, struct connection *c, int id) {
 	for (;;) {
-		int size = databuffer_readheader(&c->buffer, &g->mp, g->header_size);
-		if (size < 0) {
-			return;
+		int size = databuffer_readheader(&c->buffer, &g->mp, &g->framing);
+		if (size == -1) {
+			return 1;
+		} else if (size < 0) {
+			struct skynet_context * ctx = g->ctx;
+			databuffer_clear(&c->buffer,&g->mp);
+			skynet_socket_close(ctx, id);
+			skynet_error(ctx, "Recv socket message > %d", g->framing.max);
+			return 1;
 		} else if (size > 0) {
-			if (size >= 0x1000000) {
-				struct skynet_context * ctx = g->ctx;
-				databuffer_clear(&c->buffer,&g->mp);
-				skynet_socket_close(ctx, id);
-				skynet_error(ctx, "Recv socket message > 16M");
-				return;
-			} else {
+			int forward = _limit(g, c, size);
+			if (forward < 0) {
+				// keep the header, read it again after resume
+				return 0;
+			}
+			if (forward) {
 				_forward(g, c, size);
-				databuffer_reset(&c->buffer);
+			} else {
+				databuffer_skip(&c->buffer, &g->mp, size);
 			}
+			databuffer_reset(&c->buffer);
+		}
+	}
+}
+
+static void
+frame_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
+	if (c->buffer.size == 0 && c->buffer.header == 0) {
+		int offset = dispatch_buffer(g, c, id, data, sz);
+		if (offset < 0) {
+			return;
+		}
+		if (offset > 0) {
+			sz -= offset;
+			memmove(data, (char *)data + offset, sz);
+		}
+	}
+	databuffer_push(&c->buffer,&g->mp, data, sz);
+	if (c->limited != LIMIT_PAUSE) {
+		frame_buffer(g, c, id);
+	}
+}
+
+static void
+dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
+	if (c->limited == LIMIT_CLOSE) {
+		// closing by limit
+		skynet_free(data);
+		return;
+	}
+	frame_message(g, c, id, data, sz);
+	if (g->pending.n > 0) {
+		batch_flush(g, c);
+	}
+}
+
+// forward the packages kept by limit, and resume reading the connections
+static void
+_limit_resume(struct gate *g) {
+	g->resume_session = 0;
+	int i;
+	for (i=0;i<g->conn.count;i++) {
+		struct connection *c = FDTABLE_ENTRY(&g->conn, i);
+		if (c->limited != LIMIT_PAUSE)
+			continue;
+		int done = frame_buffer(g, c, c->id);
+		if (g->pending.n > 0) {
+			batch_flush(g, c);
+		}
+		if (done) {
+			c->limited = LIMIT_NONE;
+			skynet_socket_start(g->ctx, c->id);
 		}
 	}
 }
@@ -213,9 +623,8 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 	struct skynet_context * ctx = g->ctx;
 	switch(message->type) {
 	case SKYNET_SOCKET_TYPE_DATA: {
-		int id = hashid_lookup(&g->hash, message->id);
-		if (id>=0) {
-			struct connection *c = &g->conn[id];
+		struct connection *c = fdtable_lookup(&g->conn, message->id);
+		if (c) {
 			dispatch_message(g, c, message->id, message->buffer, message->ud);
 		} else {
 			skynet_error(ctx, "Drop unknown connection %d message", message->id);
@@ -229,8 +638,7 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 			// start listening
 			break;
 		}
-		int id = hashid_lookup(&g->hash, message->id);
-		if (id<0) {
+		if (fdtable_lookup(&g->conn, message->id) == NULL) {
 			skynet_error(ctx, "Close unknown connection %d", message->id);
 			skynet_socket_close(ctx, message->id);
 		}
@@ -238,12 +646,10 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 	}
 	case SKYNET_SOCKET_TYPE_CLOSE:
 	case SKYNET_SOCKET_TYPE_ERROR: {
-		int id = hashid_remove(&g->hash, message->id);
-		if (id>=0) {
-			struct connection *c = &g->conn[id];
+		struct connection *c = fdtable_lookup(&g->conn, message->id);
+		if (c) {
 			databuffer_clear(&c->buffer,&g->mp);
-			memset(c, 0, sizeof(*c));
-			c->id = -1;
+			fdtable_remove(&g->conn, message->id);
 			_report(g, "%d close", message->id);
 		}
 		break;
@@ -251,14 +657,13 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 	case SKYNET_SOCKET_TYPE_ACCEPT:
 		// report accept, then it will be get a SKYNET_SOCKET_TYPE_CONNECT message
 		assert(g->listen_id == message->id);
-		if (hashid_full(&g->hash)) {
+		if (g->conn.count >= g->max_connection) {
 			skynet_socket_close(ctx, message->ud);
 		} else {
-			struct connection *c = &g->conn[hashid_insert(&g->hash, message->ud)];
+			struct connection *c = fdtable_insert(&g->conn, message->ud);
 			if (sz >= sizeof(c->remote_name)) {
 				sz = sizeof(c->remote_name) - 1;
 			}
-			c->id = message->ud;
 			memcpy(c->remote_name, message+1, sz);
 			c->remote_name[sz] = '\0';
 			_report(g, "%d open %d %s:0",c->id, c->id, c->remote_name);
@@ -266,7 +671,9 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		}
 		break;
 	case SKYNET_SOCKET_TYPE_WARNING:
-		skynet_error(ctx, "fd (%d) send buffer (%d)K", message->id, message->ud);
+		if (message->ud > 0) {
+			skynet_error(ctx, "fd (%d) send buffer (%d)K", message->id, message->ud);
+		}
 		break;
 	}
 }
@@ -286,8 +693,7 @@ _cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t sour
 		// The last 4 bytes in msg are the id of socket, write following bytes to it
 		const uint8_t * idbuf = msg + sz - 4;
 		uint32_t uid = idbuf[0] | idbuf[1] << 8 | idbuf[2] << 16 | idbuf[3] << 24;
-		int id = hashid_lookup(&g->hash, uid);
-		if (id>=0) {
+		if (fdtable_lookup(&g->conn, uid)) {
 			// don't send id (last 4 bytes)
 			skynet_socket_send(ctx, uid, (void*)msg, sz-4);
 			// return 1 means don't free msg
@@ -297,6 +703,11 @@ _cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t sour
 			break;
 		}
 	}
+	case PTYPE_RESPONSE:
+		if (session == g->resume_session) {
+			_limit_resume(g);
+		}
+		break;
 	case PTYPE_SOCKET:
 		// recv socket message from skynet_socket
 		dispatch_socket_message(g, msg, (int)(sz-sizeof(struct skynet_socket_message)));
@@ -306,7 +717,7 @@ _cb(struct skynet_context * ctx, void * ud, int type, int session, uint32_t sour
 }
 
 static int
-start_listen(struct gate *g, char * listen_addr) {
+start_listen(struct gate *g, char * listen_addr, int reuseport) {
 	struct skynet_context * ctx = g->ctx;
 	char * portstr = strchr(listen_addr,':');
 	const char * host = "";
@@ -326,7 +737,11 @@ start_listen(struct gate *g, char * listen_addr) {
 		portstr[0] = '\0';
 		host = listen_addr;
 	}
-	g->listen_id = skynet_socket_listen(ctx, host, port, BACKLOG);
+	if (reuseport) {
+		g->listen_id = skynet_socket_listen_reuseport(ctx, host, port, BACKLOG);
+	} else {
+		g->listen_id = skynet_socket_listen(ctx, host, port, BACKLOG);
+	}
 	if (g->listen_id < 0) {
 		return 1;
 	}
@@ -343,8 +758,10 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	char watchdog[sz];
 	char binding[sz];
 	int client_tag = 0;
-	char header;
-	int n = sscanf(parm, "%c %s %s %d %d", &header, watchdog, binding, &client_tag, &max);
+	char header[sz];	// S, L or the framing name (read framing.h)
+	int reuseport = 0;	// optional, start several gates on the same port
+	int batch = 0;	// optional, send the packages of one read to the agent in one PTYPE_CLIENT_BATCH message
+	int n = sscanf(parm, "%s %s %s %d %d %d %d", header, watchdog, binding, &client_tag, &max, &reuseport, &batch);
 	if (n<4) {
 		skynet_error(ctx, "Invalid gate parm %s",parm);
 		return 1;
@@ -353,8 +770,8 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 		skynet_error(ctx, "Need max connection");
 		return 1;
 	}
-	if (header != 'S' && header !='L') {
-		skynet_error(ctx, "Invalid data header style");
+	if (framing_init(&g->framing, header)) {
+		skynet_error(ctx, "Invalid data header style %s", header);
 		return 1;
 	}
 
@@ -373,19 +790,13 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 
 	g->ctx = ctx;
 
-	hashid_init(&g->hash, max);
-	g->conn = skynet_malloc(max * sizeof(struct connection));
-	memset(g->conn, 0, max *sizeof(struct connection));
+	fdtable_init(&g->conn, sizeof(struct connection), max);
 	g->max_connection = max;
-	int i;
-	for (i=0;i<max;i++) {
-		g->conn[i].id = -1;
-	}
 	
 	g->client_tag = client_tag;
-	g->header_size = header=='S' ? 2 : 4;
+	g->batch = batch;
 
 	skynet_callback(ctx,g,_cb);
 
-	return start_listen(g,binding);
+	return start_listen(g,binding,reuseport);
 }
@@ -2,15 +2,46 @@
 #include "skynet_harbor.h"
 #include "skynet_socket.h"
 #include "skynet_handle.h"
+#include "fdtable.h"
+#include "lz4.h"
+#include "shmlink.h"
 
 /*
 	harbor listen the PTYPE_HARBOR (in text)
 	N name : update the global name
 	S fd id: connect to new harbor , we should send self_id to fd first , and then recv a id (check it), and at last send queue.
-	A fd id: accept new harbor , we should send self_id to fd , and then send queue.
+	A fd id flags: accept new harbor (flags is sent by it), we should send self_id to fd , and then send queue.
+	M id path: connect to harbor id by a shared memory link (read shmlink.h), path is the unix domain socket to setup it.
+		It's a call from slave, the response is the socket id of the unix domain socket, or an error.
+	L fd: accept a shared memory link from fd (not started), it's a call from slave before reading the handshake from fd,
+		and then the slave sends A fd id flags. K fd : the slave closes fd before A.
+
+	The handshake is self_id (1 byte), and flags (1 byte) if harbor_flags is set. HANDSHAKE_COMPRESS : compress
+	the messages to me, the link is compressed if both sides set it. The old versions send self_id only, so
+	harbor_flags should be the same on all the harbors, and the links without flags are not compressed and
+	don't send the control frames.
 
 	If the fd is disconnected, send message to slave in PTYPE_TEXT.  D id
 	If we don't known a globalname, send message to slave in PTYPE_TEXT. Q name
+
+	The messages to a remote harbor are copied into a batch (per harbor), and the batch is sent
+	when the messages already in the queue of harbor service are dispatched (a TIMEOUT 0 timer),
+	or it's larger than BATCH_SIZE. A message larger than BATCH_LARGE is sent without copy (except a shared memory link).
+
+	If the link is compressed, a message (with cookie) not smaller than the threshold is compressed by lz4,
+	the high bit of the size is set, and the content is the original size (4 bytes big-endian) + lz4 block.
+
+	HANDSHAKE_CONTROL : the harbor knows the control frames, the size is SIZE_CONTROL | 9 , and the content is
+	the type (PING/PONG) and a timestamp (8 bytes big-endian, in microseconds). The timestamp of the PING is sent back
+	by the PONG, so the sender gets the rtt. A link is closed if nothing is received in the timeout.
+
+	The messages to a harbor are queued until connected, and the queue (or the send buffer after connected) is limited.
+	When it's full, the new messages are dropped (OVERFLOW_DROP, the callers get an error),
+	or the harbor is down (OVERFLOW_DOWN).
+
+	The handshake of a shared memory link is sent by the unix domain socket, and then the frames are sent by the rings.
+	The socket is kept to know the remote harbor is down. The batch is copied into the ring, and the rest of it waits
+	for the doorbell if the ring is full, the queue limit applies to the rest.
  */
 
 #include <stdio.h>
@@ -20,6 +51,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <time.h>
 
 #define HASH_SIZE 4096
 #define DEFAULT_QUEUE_SIZE 1024
@@ -27,6 +59,22 @@
 // 12 is sizeof(struct remote_message_header)
 #define HEADER_COOKIE_LENGTH 12
 
+#define BATCH_INIT 4096
+#define BATCH_SIZE 0x10000
+#define BATCH_LARGE 4096
+
+#define HANDSHAKE_COMPRESS 1
+#define HANDSHAKE_CONTROL 2
+#define SIZE_COMPRESSED 0x80
+#define SIZE_CONTROL 0x40
+#define CONTROL_PING 1
+#define CONTROL_PONG 2
+#define CONTROL_SIZE 9
+#define OVERFLOW_DROP 0
+#define OVERFLOW_DOWN 1
+#define MESSAGE_MAXSIZE 0xffffff
+#define HANDSHAKE_RETRY 100	// wait the fds of a shared memory link for 1s at most (a tick each retry)
+
 /*
 	message type (8bits) is in destination high 8bits
 	harbor id (8bits) is also in that place , but remote message doesn't need harbor id.
@@ -75,7 +123,38 @@ struct slave {
 	int length;
 	int read;
 	uint8_t size[4];
+	bool compress;	// the link is compressed
+	bool compressed;	// the content is compressed
+	bool control;	// the remote harbor knows the control frames
+	bool control_frame;	// the content is a control frame
+	bool paused;	// the send buffer is above the watermark
+	bool overflow;	// dropping messages, for log
+	uint64_t last_recv;	// in microseconds
+	struct harbor_stat * stat;
 	char * recv_buffer;
+	uint8_t * batch;	// the messages to send : size (4 bytes big-endian) + message + cookie
+	int batch_sz;
+	int batch_cap;
+	bool pending;	// in the flush list
+	struct shmlink * shm;	// the shared memory link, NULL if the frames are sent by the socket
+	int doorbell;	// the socket id of shm->rx_efd
+};
+
+struct harbor_fd {
+	int fd;
+	int id;
+	int rawfd;	// the fd bound by skynet_socket_bind, closed after SOCKET_CLOSE. -1 if none
+	bool doorbell;	// the doorbell of the shared memory link of harbor id
+	struct shmlink * shm;	// accepted by L, and waiting for A (id is 0)
+};
+
+// L fd retries by a timer until the fds of the shared memory link arrive
+struct shm_accept {
+	int session;	// the timer
+	int fd;
+	int retry;
+	int call;	// the session of L
+	uint32_t source;
 };
 
 struct harbor {
@@ -83,6 +162,19 @@ struct harbor {
 	int id;
 	uint32_t slave;
 	struct hashmap * map;
+	int compress;	// the threshold of compression, 0 : disable
+	bool flags;	// the handshake has the flags byte
+	int heartbeat;	// the interval of PING (in 1/100 second), 0 : disable
+	int timeout;	// close the link if nothing is received in the time (1/100 second), 0 : never
+	int64_t queue_limit;	// the bytes waiting for a harbor, 0 : unlimited
+	int overflow;	// OVERFLOW_DROP or OVERFLOW_DOWN
+	int heartbeat_session;
+	struct fdtable fd;	// socket id -> struct harbor_fd
+	struct fdtable accept;	// timer session -> struct shm_accept
+	uint32_t shm_size;	// the ring size of shared memory links
+	int flush_session;	// the timer to flush the batches, 0 if none
+	int npending;
+	uint8_t pending[REMOTE_MAX];
 	struct slave s[REMOTE_MAX];
 };
 
@@ -227,17 +319,62 @@ hash_delete(struct hashmap *hash) {
 
 ///////////////
 
+static inline uint64_t
+monotonic_us(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * 1000000 + ti.tv_nsec / 1000;
+}
+
+// send an error to the caller of the message (to harbor id), the buffer is not freed
 static void
-close_harbor(struct harbor *h, int id) {
+reject_message(struct harbor *h, int id, const struct remote_message_header *header) {
+	int type = header->destination >> HANDLE_REMOTE_SHIFT;
+	if (header->session != 0 && type != PTYPE_RESPONSE && type != PTYPE_ERROR) {
+		uint32_t destination = (header->destination & HANDLE_MASK) | ((uint32_t)id << HANDLE_REMOTE_SHIFT);
+		skynet_send(h->ctx, destination, header->source, PTYPE_ERROR, (int)header->session, NULL, 0);
+	}
+	++h->s[id].stat->drop;
+}
+
+static void
+reject_queue(struct harbor *h, int id) {
+	struct slave *s = &h->s[id];
+	struct harbor_msg_queue *queue = s->queue;
+	if (queue == NULL)
+		return;
+	struct harbor_msg * m;
+	while ((m = pop_queue(queue)) != NULL) {
+		reject_message(h, id, &m->header);
+		skynet_free(m->buffer);
+	}
+	release_queue(queue);
+	s->queue = NULL;
+	s->stat->queue = 0;
+}
+
+// the messages to it will be dropped, but the socket is not closed
+static void
+link_down(struct harbor *h, int id) {
 	struct slave *s = &h->s[id];
 	s->status = STATUS_DOWN;
+	reject_queue(h, id);
+	skynet_free(s->batch);
+	s->batch = NULL;
+	s->batch_sz = 0;
+	s->batch_cap = 0;
+	s->paused = false;
+	s->stat->status = HARBOR_LINK_DOWN;
+	s->stat->pending = 0;
+}
+
+static void
+close_harbor(struct harbor *h, int id) {
+	struct slave *s = &h->s[id];
+	link_down(h, id);
 	if (s->fd) {
 		skynet_socket_close(h->ctx, s->fd);
 	}
-	if (s->queue) {
-		release_queue(s->queue);
-		s->queue = NULL;
-	}
 }
 
 static void
@@ -253,6 +390,12 @@ harbor_create(void) {
 	struct harbor * h = skynet_malloc(sizeof(*h));
 	memset(h,0,sizeof(*h));
 	h->map = hash_new();
+	fdtable_init(&h->fd, sizeof(struct harbor_fd), 0);
+	fdtable_init(&h->accept, sizeof(struct shm_accept), 0);
+	int i;
+	for (i=1;i<REMOTE_MAX;i++) {
+		h->s[i].stat = skynet_harbor_stat(i);
+	}
 	return h;
 }
 
@@ -261,12 +404,32 @@ harbor_release(struct harbor *h) {
 	int i;
 	for (i=1;i<REMOTE_MAX;i++) {
 		struct slave *s = &h->s[i];
+		release_queue(s->queue);
+		s->queue = NULL;
 		if (s->fd && s->status != STATUS_DOWN) {
 			close_harbor(h,i);
 			// don't call report_harbor_down.
 			// never call skynet_send during module exit, because of dead lock
 		}
+		if (s->shm) {
+			skynet_socket_close(h->ctx, s->doorbell);
+			shmlink_release(s->shm);
+			skynet_free(s->shm);
+		}
+		skynet_free(s->batch);
 	}
+	for (i=0;i<h->fd.count;i++) {
+		struct harbor_fd * hfd = FDTABLE_ENTRY(&h->fd, i);
+		if (hfd->rawfd >= 0) {
+			close(hfd->rawfd);
+		}
+		if (hfd->shm) {
+			shmlink_release(hfd->shm);
+			skynet_free(hfd->shm);
+		}
+	}
+	fdtable_release(&h->fd);
+	fdtable_release(&h->accept);
 	hash_delete(h->map);
 	skynet_free(h);
 }
@@ -286,6 +449,11 @@ header_to_message(const struct remote_message_header * header, uint8_t * message
 	to_bigendian(message+8 , header->session);
 }
 
+static inline uint32_t
+read_bigendian(const uint8_t *buffer) {
+	return (uint32_t)buffer[0] << 24 | buffer[1] << 16 | buffer[2] << 8 | buffer[3];
+}
+
 static inline uint32_t
 from_bigendian(uint32_t n) {
 	union {
@@ -325,20 +493,148 @@ forward_local_messsage(struct harbor *h, void *msg, int sz) {
 	}
 }
 
+// copy the batch into the ring, and publish the frames
+static void
+flush_shm(struct harbor *h, struct slave *s) {
+	struct shmlink * l = s->shm;
+	for (;;) {
+		uint32_t space = shmlink_space(l);
+		int n = (uint32_t)s->batch_sz < space ? s->batch_sz : (int)space;
+		if (n > 0) {
+			memcpy(shmlink_reserve(l, n), s->batch, n);
+			memmove(s->batch, s->batch + n, s->batch_sz - n);
+			s->batch_sz -= n;
+			s->stat->send += n;
+		}
+		shmlink_publish(l);
+		// flush again when the doorbell rings, if the ring is full
+		if (s->batch_sz == 0 || !shmlink_wait_space(l, 1))
+			break;
+	}
+	s->stat->pending = s->batch_sz / 1024;
+	if (s->batch_sz == 0) {
+		s->overflow = false;
+	}
+}
+
+static void
+flush_batch(struct harbor *h, struct slave *s) {
+	if (s->shm) {
+		flush_shm(h, s);
+		return;
+	}
+	if (s->batch_sz == 0)
+		return;
+	// ignore send error, because if the connection is broken, the mainloop will recv a message.
+	s->stat->send += s->batch_sz;
+	skynet_socket_send(h->ctx, s->fd, s->batch, s->batch_sz);
+	s->batch = NULL;
+	s->batch_sz = 0;
+	s->batch_cap = 0;
+}
+
+static void
+flush_all(struct harbor *h) {
+	int i;
+	for (i=0;i<h->npending;i++) {
+		struct slave *s = &h->s[h->pending[i]];
+		s->pending = false;
+		flush_batch(h, s);
+	}
+	h->npending = 0;
+	h->flush_session = 0;
+}
+
+// reserve sz bytes in the batch of harbor id
+static uint8_t *
+batch_alloc(struct harbor *h, int id, int sz) {
+	struct slave *s = &h->s[id];
+	if (s->batch_sz + sz > BATCH_SIZE) {
+		flush_batch(h, s);
+	}
+	if (s->batch_sz + sz > s->batch_cap) {
+		int cap = s->batch_cap ? s->batch_cap * 2 : BATCH_INIT;
+		while (cap < s->batch_sz + sz) {
+			cap *= 2;
+		}
+		s->batch = skynet_realloc(s->batch, cap);
+		s->batch_cap = cap;
+	}
+	if (!s->pending) {
+		s->pending = true;
+		h->pending[h->npending++] = id;
+	}
+	if (h->flush_session == 0) {
+		// flush after the messages in queue
+		const char * session = skynet_command(h->ctx, "TIMEOUT", "0");
+		h->flush_session = strtol(session, NULL, 10);
+	}
+	uint8_t * ptr = s->batch + s->batch_sz;
+	s->batch_sz += sz;
+	return ptr;
+}
+
+static void
+send_control(struct harbor *h, int id, int type, uint64_t ti) {
+	uint8_t * frame = batch_alloc(h, id, 4 + CONTROL_SIZE);
+	to_bigendian(frame, CONTROL_SIZE);
+	frame[0] = SIZE_CONTROL;
+	frame[4] = (uint8_t)type;
+	to_bigendian(frame+5, (uint32_t)(ti >> 32));
+	to_bigendian(frame+9, (uint32_t)ti);
+}
+
+// compress the message (sz bytes, with cookie) into the batch, returns 0 if the result is not smaller
+static int
+send_compressed(struct harbor *h, int id, const uint8_t * message, int sz) {
+	struct slave *s = &h->s[id];
+	// the compressed frame should be smaller than the raw one : 4 + sz
+	int cap = sz - 5;
+	uint8_t * frame = batch_alloc(h, id, 8 + cap);
+	int csz = LZ4_compress_default((const char *)message, (char *)frame + 8, sz, cap);
+	if (csz <= 0) {
+		s->batch_sz -= 8 + cap;
+		return 0;
+	}
+	s->batch_sz -= cap - csz;
+	to_bigendian(frame, (uint32_t)(4 + csz));
+	frame[0] |= SIZE_COMPRESSED;
+	to_bigendian(frame+4, (uint32_t)sz);
+	return 1;
+}
+
+// the buffer is moved to send_remote
 static void
-send_remote(struct skynet_context * ctx, int fd, const char * buffer, size_t sz, struct remote_message_header * cookie) {
+send_remote(struct harbor *h, int id, void * buffer, size_t sz, struct remote_message_header * cookie) {
 	size_t sz_header = sz+sizeof(*cookie);
 	if (sz_header > UINT32_MAX) {
-		skynet_error(ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
+		skynet_error(h->ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
+		skynet_free(buffer);
 		return;
 	}
-	uint8_t * sendbuf = skynet_malloc(sz_header+4);
+	if (h->s[id].compress && sz_header >= (size_t)h->compress && sz_header <= MESSAGE_MAXSIZE) {
+		buffer = skynet_realloc(buffer, sz_header);
+		header_to_message(cookie, (uint8_t *)buffer+sz);
+		if (send_compressed(h, id, buffer, (int)sz_header)) {
+			skynet_free(buffer);
+			return;
+		}
+	}
+	if (sz >= BATCH_LARGE && h->s[id].shm == NULL) {
+		struct slave *s = &h->s[id];
+		to_bigendian(batch_alloc(h, id, 4), (uint32_t)sz_header);
+		flush_batch(h, s);
+		uint8_t * sendbuf = skynet_realloc(buffer, sz_header);
+		header_to_message(cookie, sendbuf+sz);
+		s->stat->send += sz_header;
+		skynet_socket_send(h->ctx, s->fd, sendbuf, sz_header);
+		return;
+	}
+	uint8_t * sendbuf = batch_alloc(h, id, (int)sz_header+4);	// 消息先放入该 harbor 的批量缓冲, 队列中的消息处理完后一起发出去
 	to_bigendian(sendbuf, (uint32_t)sz_header);
 	memcpy(sendbuf+4, buffer, sz);
 	header_to_message(cookie, sendbuf+4+sz);
-
-	// ignore send error, because if the connection is broken, the mainloop will recv a message.
-	skynet_socket_send(ctx, fd, sendbuf, sz_header+4);	// 在这里发送一个 "D" 给本地管道，本地管道收到后 封装成网络包发出去
+	skynet_free(buffer);
 }
 
 static void
@@ -349,40 +645,42 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 	struct skynet_context * context = h->ctx;
 	struct slave *s = &h->s[harbor_id];
 	int fd = s->fd;
+	struct harbor_msg * m;
+	if (s->status == STATUS_DOWN) {
+		char tmp [GLOBALNAME_LENGTH+1];
+		memcpy(tmp, node->key, GLOBALNAME_LENGTH);
+		tmp[GLOBALNAME_LENGTH] = '\0';
+		skynet_error(context, "Drop message to %s (in harbor %d)",tmp,harbor_id);
+		while ((m = pop_queue(queue)) != NULL) {
+			m->header.destination |= (handle & HANDLE_MASK);
+			reject_message(h, harbor_id, &m->header);
+			skynet_free(m->buffer);
+		}
+		return;
+	}
+	if (harbor_id == (h->slave >> HANDLE_REMOTE_SHIFT)) {
+		// the harbor_id is local
+		while ((m = pop_queue(queue)) != NULL) {
+			int type = m->header.destination >> HANDLE_REMOTE_SHIFT;
+			skynet_send(context, m->header.source, handle , type | PTYPE_TAG_DONTCOPY, m->header.session, m->buffer, m->size);
+		}
+		return;
+	}
 	if (fd == 0) {
-		if (s->status == STATUS_DOWN) {
-			char tmp [GLOBALNAME_LENGTH+1];
-			memcpy(tmp, node->key, GLOBALNAME_LENGTH);
-			tmp[GLOBALNAME_LENGTH] = '\0';
-			skynet_error(context, "Drop message to %s (in harbor %d)",tmp,harbor_id);
-		} else {
-			if (s->queue == NULL) {
-				s->queue = node->queue;
-				node->queue = NULL;
-			} else {
-				struct harbor_msg * m;
-				while ((m = pop_queue(queue))!=NULL) {
-					push_queue_msg(s->queue, m);
-				}
-			}
-			if (harbor_id == (h->slave >> HANDLE_REMOTE_SHIFT)) {
-				// the harbor_id is local
-				struct harbor_msg * m;
-				while ((m = pop_queue(s->queue)) != NULL) {
-					int type = m->header.destination >> HANDLE_REMOTE_SHIFT;
-					skynet_send(context, m->header.source, handle , type | PTYPE_TAG_DONTCOPY, m->header.session, m->buffer, m->size);
-				}
-				release_queue(s->queue);
-				s->queue = NULL;
-			}
+		// wait for the connection
+		if (s->queue == NULL) {
+			s->queue = new_queue();
+		}
+		while ((m = pop_queue(queue))!=NULL) {
+			m->header.destination |= (handle & HANDLE_MASK);
+			s->stat->queue += m->size;
+			push_queue_msg(s->queue, m);
 		}
 		return;
 	}
-	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
 		m->header.destination |= (handle & HANDLE_MASK);
-		send_remote(context, fd, m->buffer, m->size, &m->header);
-		skynet_free(m->buffer);
+		send_remote(h, harbor_id, m->buffer, m->size, &m->header);
 	}
 }
 
@@ -398,50 +696,105 @@ dispatch_queue(struct harbor *h, int id) {
 
 	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
-		send_remote(h->ctx, fd, m->buffer, m->size, &m->header);
-		skynet_free(m->buffer);
+		send_remote(h, id, m->buffer, m->size, &m->header);
 	}
 	release_queue(queue);
 	s->queue = NULL;
+	s->stat->queue = 0;
+}
+
+static int
+harbor_id(struct harbor *h, int fd) {
+	struct harbor_fd * hfd = fdtable_lookup(&h->fd, fd);
+	return hfd ? hfd->id : 0;
+}
+
+// replace the recv_buffer by the decompressed one
+static int
+decompress_message(struct slave *s) {
+	const uint8_t * content = (const uint8_t *)s->recv_buffer;
+	if (s->length < 4)
+		return 1;
+	uint32_t sz = read_bigendian(content);
+	if (sz < HEADER_COOKIE_LENGTH || sz > MESSAGE_MAXSIZE)
+		return 1;
+	char * buffer = skynet_malloc(sz);
+	if (LZ4_decompress_safe((const char *)content + 4, buffer, s->length - 4, (int)sz) != (int)sz) {
+		skynet_free(buffer);
+		return 1;
+	}
+	skynet_free(s->recv_buffer);
+	s->recv_buffer = buffer;
+	s->length = (int)sz;
+	s->compressed = false;
+	return 0;
 }
 
 static void
-push_socket_data(struct harbor *h, const struct skynet_socket_message * message) {
-	assert(message->type == SKYNET_SOCKET_TYPE_DATA);
-	int fd = message->id;
-	int i;
-	int id = 0;
-	struct slave * s = NULL;
-	for (i=1;i<REMOTE_MAX;i++) {
-		if (h->s[i].fd == fd) {
-			s = &h->s[i];
-			id = i;
-			break;
-		}
+control_message(struct harbor *h, int id, const uint8_t * frame) {
+	struct slave *s = &h->s[id];
+	uint64_t ti = (uint64_t)read_bigendian(frame+1) << 32 | read_bigendian(frame+5);
+	switch (frame[0]) {
+	case CONTROL_PING:
+		send_control(h, id, CONTROL_PONG, ti);
+		break;
+	case CONTROL_PONG: {
+		uint64_t now = monotonic_us();
+		uint32_t rtt = now > ti ? (uint32_t)(now - ti) : 0;
+		s->stat->rtt = rtt;
+		s->stat->srtt = s->stat->srtt ? s->stat->srtt - s->stat->srtt / 8 + rtt / 8 : rtt;
+		break;
 	}
-	if (s == NULL) {
-		skynet_free(message->buffer);
-		skynet_error(h->ctx, "Invalid socket fd (%d) data", fd);
-		return;
+	default:
+		skynet_error(h->ctx, "Unknown control frame %d from harbor %d", frame[0], id);
+		break;
 	}
-	uint8_t * buffer = (uint8_t *)message->buffer;
-	int size = message->ud;
+}
 
+// the handshake (id and flags) is received, or the flags is sent by cslave
+static void
+link_up(struct harbor *h, int id, int flags) {
+	struct slave *s = &h->s[id];
+	s->compress = h->compress && (flags & HANDSHAKE_COMPRESS);
+	s->control = (flags & HANDSHAKE_CONTROL) != 0;
+	s->status = STATUS_HEADER;
+	s->stat->status = HARBOR_LINK_UP;
+	dispatch_queue(h, id);
+}
+
+static void shm_recv(struct harbor *h, int id);
+
+// the bytes from harbor id (the socket, or the ring of a shared memory link), they are copied out before parsing
+static void
+push_data(struct harbor *h, int id, const uint8_t * buffer, int size) {
+	struct slave * s = &h->s[id];
 	for (;;) {
 		switch(s->status) {
 		case STATUS_HANDSHAKE: {
+			// id (and flags)
+			int need = (h->flags ? 2 : 1) - s->read;
+			if (size < need) {
+				memcpy(s->size + s->read, buffer, size);
+				s->read += size;
+				return;
+			}
+			memcpy(s->size + s->read, buffer, need);
+			buffer += need;
+			size -= need;
+			s->read = 0;
 			// check id
-			uint8_t remote_id = buffer[0];
+			uint8_t remote_id = s->size[0];
 			if (remote_id != id) {
-				skynet_error(h->ctx, "Invalid shakehand id (%d) from fd = %d , harbor = %d", id, fd, remote_id);
+				skynet_error(h->ctx, "Invalid shakehand id (%d) from fd = %d , harbor = %d", id, s->fd, remote_id);
 				close_harbor(h,id);
 				return;
 			}
-			++buffer;
-			--size;
-			s->status = STATUS_HEADER;
-
-			dispatch_queue(h, id);
+			link_up(h, id, h->flags ? s->size[1] : 0);
+			if (s->shm) {
+				// the socket of a shared memory link sends the handshake only
+				shm_recv(h, id);
+				return;
+			}
 
 			if (size == 0) {
 				break;
@@ -460,12 +813,19 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 				buffer += need;
 				size -= need;
 
-				if (s->size[0] != 0) {
+				s->compressed = s->size[0] == SIZE_COMPRESSED;
+				s->control_frame = s->size[0] == SIZE_CONTROL && s->control;
+				if (s->size[0] != 0 && !s->compressed && !s->control_frame) {
 					skynet_error(h->ctx, "Message is too long from harbor %d", id);
 					close_harbor(h,id);
 					return;
 				}
 				s->length = s->size[1] << 16 | s->size[2] << 8 | s->size[3];
+				if (s->control_frame && s->length != CONTROL_SIZE) {
+					skynet_error(h->ctx, "Invalid control frame from harbor %d", id);
+					close_harbor(h,id);
+					return;
+				}
 				s->read = 0;
 				s->recv_buffer = skynet_malloc(s->length);
 				s->status = STATUS_CONTENT;
@@ -483,8 +843,20 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 				return;
 			}
 			memcpy(s->recv_buffer + s->read, buffer, need);
-			// 分发到对应的服务上去
-			forward_local_messsage(h, s->recv_buffer, s->length);
+			if (s->compressed && decompress_message(s) != 0) {
+				skynet_error(h->ctx, "Invalid compressed message from harbor %d", id);
+				skynet_free(s->recv_buffer);
+				s->recv_buffer = NULL;
+				close_harbor(h,id);
+				return;
+			}
+			if (s->control_frame) {
+				control_message(h, id, (const uint8_t *)s->recv_buffer);
+				skynet_free(s->recv_buffer);
+			} else {
+				// 分发到对应的服务上去
+				forward_local_messsage(h, s->recv_buffer, s->length);
+			}
 			s->length = 0;
 			s->read = 0;
 			s->recv_buffer = NULL;
@@ -501,6 +873,47 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 	}
 }
 
+static void
+push_socket_data(struct harbor *h, const struct skynet_socket_message * message) {
+	assert(message->type == SKYNET_SOCKET_TYPE_DATA);
+	int fd = message->id;
+	int id = harbor_id(h, fd);
+	if (id == 0) {
+		skynet_error(h->ctx, "Invalid socket fd (%d) data", fd);
+		return;
+	}
+	struct slave * s = &h->s[id];
+	s->last_recv = monotonic_us();
+	s->stat->recv += message->ud;
+	push_data(h, id, (const uint8_t *)message->buffer, message->ud);
+}
+
+// the doorbell rings, read the frames in the ring, and flush the batch if the ring was full
+static void
+shm_recv(struct harbor *h, int id) {
+	struct slave * s = &h->s[id];
+	struct shmlink * l = s->shm;
+	if (s->status != STATUS_HEADER && s->status != STATUS_CONTENT)
+		return;
+	for (;;) {
+		uint32_t sz;
+		const uint8_t * buf = shmlink_peek(l, &sz);
+		if (sz > 0) {
+			s->last_recv = monotonic_us();
+			s->stat->recv += sz;
+			push_data(h, id, buf, (int)sz);
+			if (s->status == STATUS_DOWN)
+				return;
+			shmlink_consume(l, sz);
+		} else if (!shmlink_sleep(l, 0)) {
+			break;
+		}
+	}
+	if (s->batch_sz > 0) {
+		flush_batch(h, s);
+	}
+}
+
 static void
 update_name(struct harbor *h, const char name[GLOBALNAME_LENGTH], uint32_t handle) {
 	struct keyvalue * node = hash_search(h->map, name);
@@ -526,32 +939,60 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 	}
 
 	struct slave * s = &h->s[harbor_id];
-	if (s->fd == 0 || s->status == STATUS_HANDSHAKE) {
-		if (s->status == STATUS_DOWN) {
-			// throw an error return to source
-			// report the destination is dead
+	if (s->status == STATUS_DOWN) {
+		// throw an error return to source
+		// report the destination is dead
+		skynet_send(context, destination, source, PTYPE_ERROR, 0 , NULL, 0);
+		skynet_error(context, "Drop message to harbor %d from %x to %x (session = %d, msgsz = %d)",harbor_id, source, destination,session,(int)sz);
+		++s->stat->drop;
+		return 0;
+	}
+	struct remote_message_header header;
+	header.source = source;
+	header.destination = (type << HANDLE_REMOTE_SHIFT) | (destination & HANDLE_MASK);
+	header.session = (uint32_t)session;
+	bool connected = s->fd != 0 && s->status != STATUS_HANDSHAKE;
+	bool overflow;
+	if (!connected) {
+		overflow = (int64_t)(s->stat->queue + sz) > h->queue_limit;
+	} else if (s->shm) {
+		// the batch waiting for the ring
+		overflow = s->batch_sz > h->queue_limit;
+	} else {
+		// the socket of OVERFLOW_DOWN is closed by socket server when the send buffer reach the limit
+		overflow = s->paused && h->overflow == OVERFLOW_DROP;
+	}
+	if (h->queue_limit > 0 && overflow) {
+		if (h->overflow == OVERFLOW_DOWN) {
+			skynet_error(context, "The queue to harbor %d is full, it's down", harbor_id);
 			skynet_send(context, destination, source, PTYPE_ERROR, 0 , NULL, 0);
-			skynet_error(context, "Drop message to harbor %d from %x to %x (session = %d, msgsz = %d)",harbor_id, source, destination,session,(int)sz);
+			if (s->fd) {
+				// report_harbor_down when the socket is closed
+				link_down(h, harbor_id);
+				skynet_socket_shutdown(context, s->fd);
+			} else {
+				link_down(h, harbor_id);
+				report_harbor_down(h, harbor_id);
+			}
 		} else {
-			if (s->queue == NULL) {
-				s->queue = new_queue();
+			if (!s->overflow) {
+				s->overflow = true;
+				skynet_error(context, "The queue to harbor %d is full, drop messages", harbor_id);
 			}
-			struct remote_message_header header;
-			header.source = source;
-			header.destination = (type << HANDLE_REMOTE_SHIFT) | (destination & HANDLE_MASK);
-			header.session = (uint32_t)session;
-			push_queue(s->queue, (void *)msg, sz, &header);
-			return 1;
+			reject_message(h, harbor_id, &header);
 		}
+		return 0;
+	}
+	if (!connected) {
+		if (s->queue == NULL) {
+			s->queue = new_queue();
+		}
+		push_queue(s->queue, (void *)msg, sz, &header);
+		s->stat->queue += sz;
 	} else {
-		struct remote_message_header cookie;
-		cookie.source = source;
-		cookie.destination = (destination & HANDLE_MASK) | ((uint32_t)type << HANDLE_REMOTE_SHIFT);
-		cookie.session = (uint32_t)session;
-		send_remote(context, s->fd, msg,sz,&cookie);
+		send_remote(h, harbor_id, (void *)msg, sz, &header);
 	}
-
-	return 0;
+	return 1;
 }
 
 static int
@@ -579,12 +1020,128 @@ remote_send_name(struct harbor *h, uint32_t source, const char name[GLOBALNAME_L
 	}
 }
 
-static void
-handshake(struct harbor *h, int id) {
+// rawfd is the bound socket (M), returns 0 if succ
+static int
+handshake(struct harbor *h, int id, int rawfd) {
 	struct slave *s = &h->s[id];
-	uint8_t * handshake = skynet_malloc(1);
+	uint8_t * handshake = skynet_malloc(2);
 	handshake[0] = (uint8_t)h->id;
-	skynet_socket_send(h->ctx, s->fd, handshake, 1);
+	int n = 1;
+	if (h->flags) {
+		handshake[1] = (h->compress ? HANDSHAKE_COMPRESS : 0) | HANDSHAKE_CONTROL;
+		n = 2;
+	}
+	if (rawfd >= 0) {
+		// the socket server doesn't send by a bound socket, and the new unix domain socket has space for it
+		int r = (int)write(rawfd, handshake, n);
+		skynet_free(handshake);
+		return r == n ? 0 : 1;
+	}
+	skynet_socket_send(h->ctx, s->fd, handshake, n);
+	return 0;
+}
+
+static struct harbor_fd *
+insert_fd(struct harbor *h, int fd, int id, int rawfd, bool doorbell) {
+	struct harbor_fd * hfd = fdtable_lookup(&h->fd, fd);
+	if (hfd == NULL) {
+		hfd = fdtable_insert(&h->fd, fd);
+	}
+	hfd->id = id;
+	hfd->rawfd = rawfd;
+	hfd->doorbell = doorbell;
+	return hfd;
+}
+
+// the frames to harbor id are sent by the shared memory link l, and its doorbell is bound
+static void
+start_shm(struct harbor *h, int id, struct shmlink *l) {
+	struct slave *s = &h->s[id];
+	s->shm = l;
+	s->doorbell = skynet_socket_bind(h->ctx, l->rx_efd);
+	insert_fd(h, s->doorbell, id, l->rx_efd, true);
+	l->rx_efd = -1;	// closed after the SOCKET_CLOSE of doorbell
+}
+
+// the socket of the shared memory link of harbor id is closed
+static void
+close_shm(struct harbor *h, int id) {
+	struct slave *s = &h->s[id];
+	if (s->shm == NULL)
+		return;
+	skynet_socket_close(h->ctx, s->doorbell);
+	shmlink_release(s->shm);
+	skynet_free(s->shm);
+	s->shm = NULL;
+}
+
+// fd is connected to harbor id (S, M) or accepted from it (A), rawfd is bound by M (or -1), l is the shared memory link (or NULL)
+static void
+start_link(struct harbor *h, int fd, int id, int flags, bool connecting, int rawfd, struct shmlink *l) {
+	struct slave * slave = &h->s[id];
+	slave->fd = fd;	// 将远端的套接字id记录起来
+	insert_fd(h, fd, id, rawfd, false);
+
+	slave->last_recv = monotonic_us();
+	if (l) {
+		// the queue limit applies to the batch waiting for the ring
+		start_shm(h, id, l);
+	} else if (h->queue_limit > 0) {
+		if (h->overflow == OVERFLOW_DOWN) {
+			// close the socket when the send buffer reach the limit
+			skynet_socket_watermark(h->ctx, fd, h->queue_limit / 4, h->queue_limit / 2, h->queue_limit, 1);
+		} else {
+			// pause (drop the messages) above the limit, and resume below the half
+			skynet_socket_watermark(h->ctx, fd, h->queue_limit / 2, h->queue_limit, 0, 0);
+		}
+	}
+
+	if (rawfd < 0) {
+		skynet_socket_start(h->ctx, fd);
+	}
+	if (handshake(h, id, rawfd)) {
+		skynet_error(h->ctx, "Can't send the handshake to harbor %d", id);
+		close_harbor(h, id);
+		return;
+	}
+	if (connecting) {
+		slave->status = STATUS_HANDSHAKE;
+		slave->stat->status = HARBOR_LINK_CONNECTING;
+	} else {
+		link_up(h, id, flags);
+		if (l) {
+			// read the frames in the ring, and sleep
+			shm_recv(h, id);
+		}
+	}
+}
+
+// accept a shared memory link from the socket id fd (not started), retry by a timer if the fds are not arrived yet.
+// the response to the call L (session, source) is sent after it's accepted
+static void
+accept_shm(struct harbor *h, int fd, int retry, int session, uint32_t source) {
+	struct shmlink tmp;
+	int rawfd = skynet_socket_acceptfd(fd);
+	int r = rawfd < 0 ? -1 : shmlink_accept(&tmp, rawfd);
+	if (r == 0) {
+		struct shmlink * l = skynet_malloc(sizeof(*l));
+		*l = tmp;
+		struct harbor_fd * hfd = insert_fd(h, fd, 0, -1, false);
+		hfd->shm = l;
+		skynet_send(h->ctx, 0, source, PTYPE_RESPONSE, session, NULL, 0);
+		return;
+	}
+	if (r > 0 && retry < HANDSHAKE_RETRY) {
+		const char * timer = skynet_command(h->ctx, "TIMEOUT", "1");
+		struct shm_accept * a = fdtable_insert(&h->accept, strtol(timer, NULL, 10));
+		a->fd = fd;
+		a->retry = retry + 1;
+		a->call = session;
+		a->source = source;
+		return;
+	}
+	skynet_error(h->ctx, "Accept shared memory link (%d) failed", fd);
+	skynet_send(h->ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
 }
 
 static void
@@ -610,26 +1167,78 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 		char buffer[s+1];
 		memcpy(buffer, name, s);
 		buffer[s] = 0;
-		int fd=0, id=0;
-		sscanf(buffer, "%d %d",&fd,&id);
+		int fd=0, id=0, flags=0;
+		sscanf(buffer, "%d %d %d",&fd,&id,&flags);
+		// the shared memory link accepted by L
+		struct harbor_fd * hfd = fdtable_lookup(&h->fd, fd);
+		struct shmlink * l = hfd ? hfd->shm : NULL;
+		if (l) {
+			hfd->shm = NULL;
+		}
 		if (fd == 0 || id <= 0 || id>=REMOTE_MAX) {
 			skynet_error(h->ctx, "Invalid command %c %s", msg[0], buffer);
+		} else if (h->s[id].fd != 0) {
+			skynet_error(h->ctx, "Harbor %d alreay exist", id);
+		} else {
+			start_link(h, fd, id, flags, msg[0] == 'S', -1, l);
+			break;
+		}
+		if (l) {
+			shmlink_release(l);
+			skynet_free(l);
+			fdtable_remove(&h->fd, fd);
+		}
+		return;
+	}
+	case 'M' : {	// 通过共享内存连接另外一个slave, 回应 unix domain socket 的 id
+		char buffer[s+1];
+		memcpy(buffer, name, s);
+		buffer[s] = 0;
+		char path[s+1];
+		int id=0;
+		if (sscanf(buffer, "%d %s", &id, path) != 2 || id <= 0 || id>=REMOTE_MAX || h->s[id].fd != 0) {
+			skynet_error(h->ctx, "Invalid command %c %s", msg[0], buffer);
+			skynet_send(h->ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
 			return;
 		}
-		struct slave * slave = &h->s[id];
-		if (slave->fd != 0) {
-			skynet_error(h->ctx, "Harbor %d alreay exist", id);
+		struct shmlink * l = skynet_malloc(sizeof(*l));
+		int rawfd = shmlink_connect(l, path, h->shm_size);
+		if (rawfd < 0) {
+			skynet_error(h->ctx, "Can't connect to harbor %d by shared memory (%s)", id, path);
+			skynet_free(l);
+			skynet_send(h->ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
 			return;
 		}
-		slave->fd = fd;	// 将远端的套接字id记录起来
-
-		skynet_socket_start(h->ctx, fd);
-		handshake(h, id);
-		if (msg[0] == 'S') {
-			slave->status = STATUS_HANDSHAKE;
-		} else {
-			slave->status = STATUS_HEADER;
-			dispatch_queue(h,id);
+		int fd = skynet_socket_bind(h->ctx, rawfd);
+		start_link(h, fd, id, 0, true, rawfd, l);
+		char ret[16];
+		int n = sprintf(ret, "%d", fd);
+		skynet_send(h->ctx, 0, source, PTYPE_RESPONSE, session, ret, n);
+		break;
+	}
+	case 'L' :		// 接受共享内存连接, 收到 fds 后回应, 然后 slave 读握手并发送 A
+	case 'K' : {	// slave 在 A 之前关闭了 L 接受的连接
+		char buffer[s+1];
+		memcpy(buffer, name, s);
+		buffer[s] = 0;
+		int fd = 0;
+		sscanf(buffer, "%d", &fd);
+		if (fd == 0) {
+			skynet_error(h->ctx, "Invalid command %c %s", msg[0], buffer);
+			if (msg[0] == 'L') {
+				skynet_send(h->ctx, 0, source, PTYPE_ERROR, session, NULL, 0);
+			}
+			return;
+		}
+		if (msg[0] == 'L') {
+			accept_shm(h, fd, 0, session, source);
+			break;
+		}
+		struct harbor_fd * hfd = fdtable_lookup(&h->fd, fd);
+		if (hfd && hfd->shm) {
+			shmlink_release(hfd->shm);
+			skynet_free(hfd->shm);
+			fdtable_remove(&h->fd, fd);
 		}
 		break;
 	}
@@ -639,33 +1248,92 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 	}
 }
 
-static int
-harbor_id(struct harbor *h, int fd) {
+static void
+heartbeat_timer(struct harbor *h) {
+	char ti[16];
+	sprintf(ti, "%d", h->heartbeat);
+	const char * session = skynet_command(h->ctx, "TIMEOUT", ti);
+	h->heartbeat_session = strtol(session, NULL, 10);
+}
+
+static void
+heartbeat(struct harbor *h) {
+	uint64_t now = monotonic_us();
+	uint64_t timeout = (uint64_t)h->timeout * 10000;
 	int i;
 	for (i=1;i<REMOTE_MAX;i++) {
 		struct slave *s = &h->s[i];
-		if (s->fd == fd) {
-			return i;
+		if (s->fd == 0 || s->status == STATUS_DOWN)
+			continue;
+		bool connected = s->status != STATUS_HANDSHAKE;
+		// the remote harbor without control frames may be idle
+		if (timeout > 0 && (s->control || !connected) && now - s->last_recv > timeout) {
+			skynet_error(h->ctx, "Nothing received from harbor %d in %d ms, close it", i, (int)((now - s->last_recv) / 1000));
+			// report_harbor_down when the socket is closed
+			link_down(h, i);
+			skynet_socket_shutdown(h->ctx, s->fd);
+			continue;
+		}
+		if (connected && s->control) {
+			send_control(h, i, CONTROL_PING, now);
 		}
 	}
-	return 0;
+	heartbeat_timer(h);
 }
 
 static int
 mainloop(struct skynet_context * context, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
 	struct harbor * h = ud;
+	if (type == PTYPE_RESPONSE && source == 0 && msg == NULL) {
+		// the timers, a remote response has a source
+		if (session == h->flush_session) {
+			flush_all(h);
+			return 0;
+		}
+		if (session == h->heartbeat_session) {
+			heartbeat(h);
+			return 0;
+		}
+		struct shm_accept * a = fdtable_lookup(&h->accept, session);
+		if (a) {
+			struct shm_accept tmp = *a;
+			fdtable_remove(&h->accept, session);
+			accept_shm(h, tmp.fd, tmp.retry, tmp.call, tmp.source);
+			return 0;
+		}
+	}
 	switch (type) {
 	case PTYPE_SOCKET: {		// 收到远端 harbor 的消息
 		const struct skynet_socket_message * message = msg;
 		switch(message->type) {
-		case SKYNET_SOCKET_TYPE_DATA:
-			push_socket_data(h, message);
+		case SKYNET_SOCKET_TYPE_DATA: {
+			struct harbor_fd * hfd = fdtable_lookup(&h->fd, message->id);
+			if (hfd && hfd->doorbell) {
+				if (h->s[hfd->id].shm) {
+					shm_recv(h, hfd->id);
+				}
+			} else {
+				push_socket_data(h, message);
+			}
 			skynet_free(message->buffer);
 			break;
+		}
 		case SKYNET_SOCKET_TYPE_ERROR:
 		case SKYNET_SOCKET_TYPE_CLOSE: {
-			int id = harbor_id(h, message->id);
-			if (id) {
+			struct harbor_fd * hfd = fdtable_lookup(&h->fd, message->id);
+			int id = hfd ? hfd->id : 0;
+			bool doorbell = hfd && hfd->doorbell;
+			if (hfd && hfd->rawfd >= 0) {
+				close(hfd->rawfd);
+			}
+			if (doorbell) {
+				fdtable_remove(&h->fd, message->id);
+			} else if (id) {
+				fdtable_remove(&h->fd, message->id);
+				if (h->s[id].status != STATUS_DOWN) {
+					link_down(h, id);
+				}
+				close_shm(h, id);
 				report_harbor_down(h,id);
 			} else {
 				skynet_error(context, "Unkown fd (%d) closed", message->id);
@@ -678,7 +1346,14 @@ mainloop(struct skynet_context * context, void * ud, int type, int session, uint
 		case SKYNET_SOCKET_TYPE_WARNING: {
 			int id = harbor_id(h, message->id);
 			if (id) {
-				skynet_error(context, "message havn't send to Harbor (%d) reach %d K", id, message->ud);
+				struct slave *s = &h->s[id];
+				if (message->ud > 0) {
+					skynet_error(context, "message havn't send to Harbor (%d) reach %d K", id, message->ud);
+				} else {
+					s->overflow = false;
+				}
+				s->paused = message->ud > 0;
+				s->stat->pending = message->ud;
 			}
 			break;
 		}
@@ -715,14 +1390,41 @@ harbor_init(struct harbor *h, struct skynet_context *ctx, const char * args) {
 	h->ctx = ctx;
 	int harbor_id = 0;
 	uint32_t slave = 0;
-	sscanf(args,"%d %u", &harbor_id, &slave);
+	int compress = 0;
+	int heartbeat = 0;
+	int timeout = 0;
+	long long queue = 0;
+	char overflow[8] = "drop";
+	int flags = 0;
+	uint32_t shm_size = 0;
+	sscanf(args,"%d %u %d %d %d %lld %7s %d %u", &harbor_id, &slave, &compress, &heartbeat, &timeout, &queue, overflow, &flags, &shm_size);
 	if (slave == 0) {
 		return 1;
 	}
 	h->id = harbor_id;
 	h->slave = slave;
+	h->compress = compress > 0 ? compress : 0;
+	h->flags = flags != 0;
+	if (h->compress && !h->flags) {
+		skynet_error(ctx, "harbor_compress is ignored without harbor_flags");
+	}
+	h->heartbeat = heartbeat > 0 ? heartbeat : 0;
+	h->timeout = timeout > 0 ? timeout : 0;
+	h->queue_limit = queue > 0 ? queue : 0;
+	h->shm_size = shm_size > 0 ? shm_size : SHMLINK_DEFAULT_SIZE;
+	if (strcmp(overflow, "down") == 0) {
+		h->overflow = OVERFLOW_DOWN;
+	} else if (strcmp(overflow, "drop") == 0) {
+		h->overflow = OVERFLOW_DROP;
+	} else {
+		skynet_error(ctx, "Invalid harbor overflow policy %s", overflow);
+		return 1;
+	}
 	skynet_callback(ctx, h, mainloop);
 	skynet_harbor_start(ctx);
+	if (h->heartbeat > 0) {
+		heartbeat_timer(h);
+	}
 
 	return 0;
 }
@@ -0,0 +1,381 @@
+#ifndef skynet_shmlink_h
+#define skynet_shmlink_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+	A shared memory link between two processes on the same host (linux only), used by service_cluster.c and service_harbor.c .
+
+	The connecting side creates a memfd (the header page and two rings) and two eventfds (the doorbells),
+	and sends them by SCM_RIGHTS through an unix domain socket. The socket is kept to know the peer is down.
+	Ring 0 is from the connecting side to the accepting side, ring 1 is the other direction.
+
+	Each ring is a single producer single consumer byte stream, it's mapped twice side by side,
+	so the bytes to read (or the space to write) are always continuous. head and tail are the total bytes
+	written and read. The consumer sets sleep before waiting for its doorbell, and the producer rings it
+	after publishing if it's set. The producer sets full when there is no space, and the consumer rings
+	the doorbell of producer after consuming if it's set.
+ */
+
+#define SHMLINK_MAGIC 0x6b6e6c73	// "slnk"
+#define SHMLINK_PAGE 4096
+#define SHMLINK_MINSIZE 0x40000
+#define SHMLINK_DEFAULT_SIZE 0x100000
+
+struct shmlink_ring {
+	volatile uint64_t head;
+	char pad0[56];
+	volatile uint64_t tail;
+	char pad1[56];
+	volatile int sleep;
+	volatile int full;
+	char pad2[56];
+};
+
+struct shmlink_header {
+	uint32_t magic;
+	uint32_t size;	// the size of each ring
+	char pad[56];
+	struct shmlink_ring ring[2];
+};
+
+struct shmlink {
+	int memfd;
+	int rx_efd;	// my doorbell
+	int tx_efd;	// the doorbell of peer
+	uint32_t size;
+	uint64_t whead;	// the bytes written, published by shmlink_publish
+	void * base;
+	size_t map_size;
+	struct shmlink_ring * rx;
+	struct shmlink_ring * tx;
+	uint8_t * rx_data;
+	uint8_t * tx_data;
+};
+
+static inline void
+shmlink_init(struct shmlink *l) {
+	memset(l, 0, sizeof(*l));
+	l->memfd = -1;
+	l->rx_efd = -1;
+	l->tx_efd = -1;
+}
+
+#if defined(__linux__)
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1
+#endif
+
+static void
+shmlink_release(struct shmlink *l) {
+	if (l->base) {
+		munmap(l->base, l->map_size);
+	}
+	if (l->memfd >= 0)
+		close(l->memfd);
+	if (l->rx_efd >= 0)
+		close(l->rx_efd);
+	if (l->tx_efd >= 0)
+		close(l->tx_efd);
+	shmlink_init(l);
+}
+
+// map the header and the rings (twice each), side 0 : the connecting side
+static int
+shmlink_map(struct shmlink *l, int side) {
+	size_t size = l->size;	// power of 2, not less than a page
+	l->map_size = SHMLINK_PAGE + size * 4;
+	uint8_t * base = mmap(NULL, l->map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		l->base = NULL;
+		return 1;
+	}
+	l->base = base;
+	if (mmap(base, SHMLINK_PAGE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, l->memfd, 0) == MAP_FAILED)
+		return 1;
+	int i;
+	for (i=0;i<2;i++) {
+		uint8_t * ring = base + SHMLINK_PAGE + size * 2 * i;
+		off_t offset = SHMLINK_PAGE + (off_t)size * i;
+		if (mmap(ring, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, l->memfd, offset) == MAP_FAILED)
+			return 1;
+		if (mmap(ring + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, l->memfd, offset) == MAP_FAILED)
+			return 1;
+	}
+	struct shmlink_header * h = (struct shmlink_header *)base;
+	uint8_t * ring0 = base + SHMLINK_PAGE;
+	uint8_t * ring1 = ring0 + size * 2;
+	if (side == 0) {
+		l->tx = &h->ring[0];
+		l->tx_data = ring0;
+		l->rx = &h->ring[1];
+		l->rx_data = ring1;
+	} else {
+		l->rx = &h->ring[0];
+		l->rx_data = ring0;
+		l->tx = &h->ring[1];
+		l->tx_data = ring1;
+	}
+	l->whead = l->tx->head;
+	return 0;
+}
+
+// size is rounded up to power of 2, returns 0 if succ
+static int
+shmlink_create(struct shmlink *l, uint32_t size) {
+	shmlink_init(l);
+	uint32_t sz = SHMLINK_MINSIZE;
+	while (sz < size && sz < 0x40000000) {
+		sz *= 2;
+	}
+	l->size = sz;
+	l->memfd = (int)syscall(SYS_memfd_create, "skynet-shmlink", MFD_CLOEXEC);
+	l->rx_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	l->tx_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (l->memfd < 0 || l->rx_efd < 0 || l->tx_efd < 0
+		|| ftruncate(l->memfd, SHMLINK_PAGE + (off_t)l->size * 2) != 0
+		|| shmlink_map(l, 0) != 0) {
+		shmlink_release(l);
+		return 1;
+	}
+	struct shmlink_header * h = l->base;
+	h->magic = SHMLINK_MAGIC;
+	h->size = l->size;
+	return 0;
+}
+
+// the fds are from the connecting side, returns 0 if succ
+static int
+shmlink_attach(struct shmlink *l, int memfd, int rx_efd, int tx_efd) {
+	shmlink_init(l);
+	l->memfd = memfd;
+	l->rx_efd = rx_efd;
+	l->tx_efd = tx_efd;
+	struct shmlink_header * h = mmap(NULL, SHMLINK_PAGE, PROT_READ, MAP_SHARED, memfd, 0);
+	if (h == MAP_FAILED) {
+		shmlink_release(l);
+		return 1;
+	}
+	uint32_t magic = h->magic;
+	uint32_t size = h->size;
+	munmap(h, SHMLINK_PAGE);
+	struct stat st;
+	if (magic != SHMLINK_MAGIC || size < SHMLINK_MINSIZE || (size & (size - 1))
+		|| fstat(memfd, &st) != 0 || st.st_size < SHMLINK_PAGE + (off_t)size * 2) {
+		shmlink_release(l);
+		return 1;
+	}
+	l->size = size;
+	if (shmlink_map(l, 1) != 0) {
+		shmlink_release(l);
+		return 1;
+	}
+	return 0;
+}
+
+// connect to the unix domain socket path, and send the link. returns the socket fd, or -1
+// The socket is non-blocking, connect fails if the backlog of the listening socket is full, and sendmsg
+// doesn't wait on a new connection.
+static int
+shmlink_connect(struct shmlink *l, const char * path, uint32_t size) {
+	struct sockaddr_un sa;
+	size_t len = strlen(path);
+	if (len == 0 || len >= sizeof(sa.sun_path))
+		return -1;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	memcpy(sa.sun_path, path, len);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || shmlink_create(l, size) != 0) {
+		close(fd);
+		return -1;
+	}
+	// the doorbell of the accepting side is my tx_efd
+	int fds[3] = { l->memfd, l->tx_efd, l->rx_efd };
+	uint32_t magic = SHMLINK_MAGIC;
+	struct iovec iov = { &magic, sizeof(magic) };
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(fds))];
+	} ctrl;
+	memset(&ctrl, 0, sizeof(ctrl));
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(magic)) {
+		shmlink_release(l);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// receive the link from the accepted socket fd without waiting, returns 0 if succ, 1 if it's not arrived yet, -1 if failed
+static int
+shmlink_accept(struct shmlink *l, int fd) {
+	int fds[3];
+	uint32_t magic = 0;
+	struct iovec iov = { &magic, sizeof(magic) };
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(fds))];
+	} ctrl;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+	ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return 1;
+	// the magic and the fds are sent by one sendmsg, so they arrive together
+	if (n != sizeof(magic))
+		return -1;
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+		return -1;
+	int nfd = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+	memcpy(fds, CMSG_DATA(cmsg), (nfd < 3 ? nfd : 3) * sizeof(int));
+	if (nfd != 3 || magic != SHMLINK_MAGIC) {
+		int i;
+		for (i=0;i<nfd && i<3;i++) {
+			close(fds[i]);
+		}
+		return -1;
+	}
+	return shmlink_attach(l, fds[0], fds[1], fds[2]) == 0 ? 0 : -1;
+}
+
+static inline void
+shmlink_ring(int efd) {
+	uint64_t one = 1;
+	// EAGAIN means the counter is not read yet, the peer will wake up anyway
+	if (write(efd, &one, sizeof(one))) {}
+}
+
+// reserve sz bytes to write, returns NULL if there is no space
+static inline uint8_t *
+shmlink_reserve(struct shmlink *l, uint32_t sz) {
+	uint64_t tail = l->tx->tail;
+	__sync_synchronize();
+	if (l->whead + sz - tail > l->size)
+		return NULL;
+	uint8_t * ptr = l->tx_data + (l->whead & (l->size - 1));
+	l->whead += sz;
+	return ptr;
+}
+
+// give back n bytes of the last reserve
+static inline void
+shmlink_shrink(struct shmlink *l, uint32_t n) {
+	l->whead -= n;
+}
+
+static inline uint32_t
+shmlink_space(struct shmlink *l) {
+	uint64_t tail = l->tx->tail;
+	__sync_synchronize();
+	return l->size - (uint32_t)(l->whead - tail);
+}
+
+static inline void
+shmlink_publish(struct shmlink *l) {
+	if (l->tx->head == l->whead)
+		return;
+	__sync_synchronize();
+	l->tx->head = l->whead;
+	__sync_synchronize();
+	if (l->tx->sleep) {
+		l->tx->sleep = 0;
+		shmlink_ring(l->tx_efd);
+	}
+}
+
+// wait for the doorbell when the consumer makes space, returns true if there is space now
+static inline bool
+shmlink_wait_space(struct shmlink *l, uint32_t sz) {
+	l->tx->full = 1;
+	__sync_synchronize();
+	if (shmlink_space(l) >= sz) {
+		l->tx->full = 0;
+		return true;
+	}
+	return false;
+}
+
+// the bytes to read
+static inline const uint8_t *
+shmlink_peek(struct shmlink *l, uint32_t *sz) {
+	uint64_t head = l->rx->head;
+	__sync_synchronize();
+	uint64_t n = head - l->rx->tail;
+	*sz = n > l->size ? l->size : (uint32_t)n;
+	return l->rx_data + (l->rx->tail & (l->size - 1));
+}
+
+static inline void
+shmlink_consume(struct shmlink *l, uint32_t n) {
+	__sync_synchronize();
+	l->rx->tail += n;
+	__sync_synchronize();
+	if (l->rx->full) {
+		l->rx->full = 0;
+		shmlink_ring(l->tx_efd);
+	}
+}
+
+// wait for the doorbell when more than sz bytes are published, returns true if they are published already
+static inline bool
+shmlink_sleep(struct shmlink *l, uint32_t sz) {
+	l->rx->sleep = 1;
+	__sync_synchronize();
+	uint32_t n;
+	shmlink_peek(l, &n);
+	if (n > sz) {
+		l->rx->sleep = 0;
+		return true;
+	}
+	return false;
+}
+
+#else
+
+static inline void shmlink_release(struct shmlink *l) {}
+static inline int shmlink_connect(struct shmlink *l, const char * path, uint32_t size) { return -1; }
+static inline int shmlink_accept(struct shmlink *l, int fd) { return -1; }
+static inline uint8_t * shmlink_reserve(struct shmlink *l, uint32_t sz) { return NULL; }
+static inline void shmlink_shrink(struct shmlink *l, uint32_t n) {}
+static inline uint32_t shmlink_space(struct shmlink *l) { return 0; }
+static inline void shmlink_publish(struct shmlink *l) {}
+static inline bool shmlink_wait_space(struct shmlink *l, uint32_t sz) { return false; }
+static inline const uint8_t * shmlink_peek(struct shmlink *l, uint32_t *sz) { *sz = 0; return NULL; }
+static inline void shmlink_consume(struct shmlink *l, uint32_t n) {}
+static inline bool shmlink_sleep(struct shmlink *l, uint32_t sz) { return false; }
+
+#endif
+
+#endif
@@ -1,34 +1,38 @@
 local skynet = require "skynet"
-local sc = require "socketchannel"
 local socket = require "socket"
-local cluster = require "cluster.core"
+local core = require "cluster.core"
+require "skynet.manager"	-- import skynet.launch
+
+-- clusterd 只负责配置, 连接和名字. 请求和回应由 C 服务 cluster (service-src/service_cluster.c) 收发, 不经过这里
 
 local config_name = skynet.getenv "cluster"
 local node_address = {}
-local node_session = {}
+local node_id = {}	-- node name -> id
+local node_name = {}	-- id -> node name
 local command = {}
+local transport = {}	-- the C services, each one has its own connection to a node
+local accept_index = 0
 
-local function read_response(sock)
-	local sz = socket.header(sock:read(2))	-- sock:read(2)为读取前两个字节 socket.header(sock:read(2))为得到前两个字节表示的 number 类型的值
-	local msg = sock:read(sz)
-	return cluster.unpackresponse(msg)	-- session, ok, data, padding
+local function broadcast(text)
+	for _, t in ipairs(transport) do
+		skynet.send(t, "text", text)
+	end
 end
 
-local function open_channel(t, key)
-	local host, port = string.match(node_address[key], "([^:]+):(.*)$")
-	local c = sc.channel {
-		host = host,
-		port = tonumber(port),
-		response = read_response,
-		nodelay = true,
-	}
-	assert(c:connect(true))
-	t[key] = c
-	return c
+-- "host:port" or "unix:/path" for the nodes on the same host,
+-- "shm:/path" is a shared memory link (service-src/shmlink.h), the path is the unix domain socket to setup it
+local function parse_address(address)
+	if address:find("^unix:") then
+		return address, 0
+	end
+	local path = address:match("^shm:(.+)$")
+	if path then
+		return "unix:" .. path, 0, true
+	end
+	local host, port = string.match(address, "([^:]+):(.*)$")
+	return host, tonumber(port)
 end
 
-local node_channel = setmetatable({}, { __index = open_channel })
-
 local function loadconfig()
 	local f = assert(io.open(config_name))
 	local source = f:read "*a"
@@ -39,52 +43,98 @@ local function loadconfig()
 		assert(type(address) == "string")
 		if node_address[name] ~= address then
 			-- address changed
-			if rawget(node_channel, name) then
-				node_channel[name] = nil	-- reset connection
+			if node_address[name] and node_id[name] then
+				broadcast("K " .. node_id[name])	-- reset connections
 			end
 			node_address[name] = address
 		end
 	end
 end
 
+-- the transport asks to connect the node (C id)
+local function connect(t, id)
+	local node = node_name[id]
+	local address = node_address[node]
+	local shm = address:match("^shm:(.+)$")
+	if shm then
+		-- the transport connects it
+		skynet.send(t, "text", string.format("M %d %s", id, shm))
+		return
+	end
+	local fd, err = socket.open(parse_address(address))
+	if fd then
+		socket.abandon(fd)
+		skynet.send(t, "text", string.format("N %d %d", id, fd))
+	else
+		skynet.error(string.format("cluster: connect to %s (%s) failed : %s", node, address, err))
+		skynet.send(t, "text", "D " .. id)
+	end
+end
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(text) return text end,
+	unpack = skynet.tostring,
+	dispatch = function(_, source, msg)
+		local cmd, id = msg:match "(%a) (%d+)"
+		if cmd == "C" then
+			connect(source, tonumber(id))
+		else
+			skynet.error("Invalid cluster transport command " .. msg)
+		end
+	end
+}
+
 function command.reload()
 	loadconfig()
 	skynet.ret(skynet.pack(nil))
 end
 
-function command.listen(source, addr, port)
-	local gate = skynet.newservice("gate")
-	if port == nil then
-		addr, port = string.match(node_address[addr], "([^:]+):(.*)$")
+local function query_node(node)
+	local id = node_id[node]
+	if not id then
+		assert(node_address[node], "Unknown cluster node " .. tostring(node))
+		id = #node_name + 1
+		node_name[id] = node
+		node_id[node] = id
 	end
-	skynet.call(gate, "lua", "open", { address = addr, port = port })
-	skynet.ret(skynet.pack(nil))
+	return id
 end
 
-local function send_request(source, node, addr, msg, sz)
-	local session = node_session[node] or 1
-	-- msg is a local pointer, cluster.packrequest will free it
-	-- request 为前面10个字节[(sz+9)、0(0x80, 0x81)、addr(int32)、session(int32)]加上msg组成的字符串
-	-- session 会自增1
-	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz)
-	node_session[node] = new_session
-
-	-- node_channel[node] may yield or throw error
-	local c = node_channel[node]
+-- returns the node id and the transport services
+function command.node(source, node)
+	skynet.ret(skynet.pack(query_node(node), transport))
+end
 
-	return c:request(request, session, padding)
+function command.listen(source, addr, port)
+	local shm
+	if port == nil then
+		addr, port, shm = parse_address(node_address[addr] or addr)
+	end
+	local id = assert(socket.listen(addr, port))
+	local cmd = shm and "S " or "A "
+	socket.start(id, function(fd, from)
+		skynet.error(string.format("socket accept from %s", from))
+		-- the connections from a node are shared by the transports
+		accept_index = accept_index % #transport + 1
+		skynet.send(transport[accept_index], "text", cmd .. fd)
+	end)
+	skynet.ret(skynet.pack(nil))
 end
 
-function command.req(...)
-	local ok, msg, sz = pcall(send_request, ...)
-	if ok then
-		if type(msg) == "table" then
-			skynet.ret(cluster.concat(msg))
-		else
-			skynet.ret(msg)
-		end
-	else
-		skynet.error(msg)
+-- compatible with the old cluster.call : skynet.call(clusterd, "lua", "req", node, address, skynet.pack(...))
+function command.req(source, node, addr, msg, sz)
+	local ok, err = pcall(function()
+		local id = query_node(node)
+		local t = transport[source % #transport + 1]
+		-- msg will free by cluster.core.packcall
+		local rmsg, rsz = skynet.rawcall(t, "lua", core.packcall(id, addr, msg, sz))
+		-- the response message is freed after dispatch, so copy it
+		skynet.ret(skynet.tostring(rmsg, rsz))
+	end)
+	if not ok then
+		skynet.error(err)
 		skynet.response()(false)
 	end
 end
@@ -107,76 +157,31 @@ function command.register(source, name, addr)
 	local old_name = register_name[addr]
 	if old_name then
 		register_name[old_name] = nil
+		broadcast(string.format("R %s 0", old_name))
 	end
 	register_name[addr] = name
 	register_name[name] = addr
+	broadcast(string.format("R %s %d", name, addr))
 	skynet.ret(nil)
 	skynet.error(string.format("Register [%s] :%08x", name, addr))
 end
 
-local large_request = {}
-
--- 供主动监听的一方接收 gate 服务发过来的消息使用
-function command.socket(source, subcmd, fd, msg)
-	if subcmd == "data" then
-		local sz
-		local addr, session, msg, padding = cluster.unpackrequest(msg)
-		if padding then
-			local req = large_request[session] or { addr = addr }
-			large_request[session] = req
-			table.insert(req, msg)
-			return
-		else
-			local req = large_request[session]
-			if req then
-				large_request[session] = nil
-				table.insert(req, msg)
-				msg,sz = cluster.concat(req)
-				addr = req.addr
-			end
-			if not msg then
-				local response = cluster.packresponse(session, false, "Invalid large req")
-				socket.write(fd, response)
-				return
-			end
-		end
-		local ok, response
-		if addr == 0 then		-- 如果为 0 代表是查询地址
-			local name = skynet.unpack(msg, sz)
-			local addr = register_name[name]
-			if addr then
-				ok = true
-				msg, sz = skynet.pack(addr)
-			else
-				ok = false
-				msg = "name not found"
-			end
-		else
-			ok , msg, sz = pcall(skynet.rawcall, addr, "lua", msg, sz)
-		end
-		if ok then
-			response = cluster.packresponse(session, true, msg, sz)
-			if type(response) == "table" then
-				for _, v in ipairs(response) do
-					socket.lwrite(fd, v)
-				end
-			else
-				socket.write(fd, response)
-			end
-		else
-			response = cluster.packresponse(session, false, msg)
-			socket.write(fd, response)
-		end
-	elseif subcmd == "open" then
-		skynet.error(string.format("socket accept from %s", msg))
-		skynet.call(source, "lua", "accept", fd)
-	else
-		large_request = {}
-		skynet.error(string.format("socket %s %d : %s", subcmd, fd, msg))
-	end
-end
-
 skynet.start(function()
+	-- cluster_part : 大于这个字节数的消息分包发送, 默认 0x8000
+	-- cluster_compress : 大于等于这个字节数的消息用 lz4 压缩, 0 (默认) 不压缩. 两端都打开时才会压缩
+	-- cluster_pool : 到每个节点的连接数 (每个连接由一个 C 服务负责), 默认 1
+	-- cluster_inflight : 每个连接上等待回应的请求数上限, 超过的请求排队, 0 (默认) 不限
+	-- cluster_shm : 共享内存连接 (地址 "shm:/path") 每个方向的环形缓冲字节数, 默认 1M
+	-- cluster_max_frame : 接收的分包消息的字节数上限, 超过时断开连接, 默认 16M
+	local pool = tonumber(skynet.getenv "cluster_pool") or 1
+	for i = 1, math.max(pool, 1) do
+		transport[i] = assert(skynet.launch("cluster", skynet.self(),
+			tonumber(skynet.getenv "cluster_part") or 0,
+			tonumber(skynet.getenv "cluster_compress") or 0,
+			tonumber(skynet.getenv "cluster_inflight") or 0,
+			tonumber(skynet.getenv "cluster_shm") or 0,
+			tonumber(skynet.getenv "cluster_max_frame") or 0))
+	end
 	loadconfig()
 	skynet.dispatch("lua", function(session , source, cmd, ...)
 		local f = assert(command[cmd])
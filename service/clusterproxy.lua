@@ -17,12 +17,11 @@ local forward_map = {
 }
 
 skynet.forward_type( forward_map ,function()
-	local clusterd = skynet.uniqueservice("clusterd")
 	local n = tonumber(address)
 	if n then
 		address = n
 	end
 	skynet.dispatch("system", function (session, source, msg, sz)
-		skynet.ret(skynet.rawcall(clusterd, "lua", skynet.pack("req", node, address, msg, sz)))
+		skynet.ret(cluster.rawcall(node, address, msg, sz))
 	end)
 end)
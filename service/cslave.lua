@@ -9,6 +9,8 @@ local globalname = {}
 local queryname = {}
 local harbor = {}
 local harbor_service
+local handshake_flags	-- harbor_flags : the handshake has the flags byte
+local shm_listen	-- the address is "shm:/path", accept the shared memory links
 local monitor = {}
 local monitor_master_set = {}
 
@@ -27,6 +29,11 @@ local function pack_package(...)
 	return string.char(size) .. message
 end
 
+-- "shm:/path" is a shared memory link (service-src/shmlink.h) on the same host, the path is the unix domain socket to setup it
+local function shm_path(address)
+	return address:match "^shm:(.+)$"
+end
+
 -- 通知监控的相应的节点(新上线的/下线的)
 local function monitor_clear(id)
 	local v = monitor[id]
@@ -41,12 +48,22 @@ end
 local function connect_slave(slave_id, address)
 	local ok, err = pcall(function()
 		if slaves[slave_id] == nil then
-			local fd = assert(socket.open(address), "Can't connect to "..address)
+			local path = shm_path(address)
+			local fd
+			if path then
+				-- harbor connects it, and the response is the socket id
+				local ok, ret = pcall(skynet.call, harbor_service, "harbor", string.format("M %d %s", slave_id, path))
+				fd = assert(ok and tonumber(ret), "Can't connect to "..address)
+			else
+				fd = assert(socket.open(address), "Can't connect to "..address)
+			end
 			skynet.error(string.format("Connect to harbor %d (fd=%d), %s", slave_id, fd, address))
 			slaves[slave_id] = fd
 			monitor_clear(slave_id)
-			socket.abandon(fd)
-			skynet.send(harbor_service, "harbor", string.format("S %d %d",fd,slave_id))
+			if not path then
+				socket.abandon(fd)
+				skynet.send(harbor_service, "harbor", string.format("S %d %d",fd,slave_id))
+			end
 		end
 	end)
 	if not ok then
@@ -115,24 +132,39 @@ local function monitor_master(master_fd)
 end
 
 local function accept_slave(fd)
+	if shm_listen then
+		-- harbor takes the shared memory link before reading the handshake
+		if not pcall(skynet.call, harbor_service, "harbor", "L " .. fd) then
+			socket.close_fd(fd)
+			return
+		end
+	end
+	local function close()
+		socket.close(fd)
+		if shm_listen then
+			skynet.send(harbor_service, "harbor", "K " .. fd)
+		end
+	end
 	socket.start(fd)
-	local id = socket.read(fd, 1)
-	if not id then
+	-- handshake : id, and flags if harbor_flags is set (see service_harbor.c)
+	local hs = socket.read(fd, handshake_flags and 2 or 1)
+	if not hs then
 		skynet.error(string.format("Connection (fd =%d) closed", fd))
-		socket.close(fd)
+		close()
 		return
 	end
-	id = string.byte(id)
+	local id, flags = string.byte(hs, 1, 2)
+	flags = flags or 0
 	if slaves[id] ~= nil then
 		skynet.error(string.format("Slave %d exist (fd =%d)", id, fd))
-		socket.close(fd)
+		close()
 		return
 	end
 	slaves[id] = fd
 	monitor_clear(id)
 	socket.abandon(fd)
 	skynet.error(string.format("Harbor %d connected (fd = %d)", id, fd))
-	skynet.send(harbor_service, "harbor", string.format("A %d %d", fd, id))
+	skynet.send(harbor_service, "harbor", string.format("A %d %d %d", fd, id, flags))
 end
 
 skynet.register_protocol {
@@ -242,8 +274,10 @@ skynet.start(function()
 	-- 得到本节点的地址
 	local slave_address = assert(skynet.getenv "address")
 
-	-- 监听本节点
-	local slave_fd = socket.listen(slave_address)
+	-- 监听本节点, "shm:/path" 监听这个 unix domain socket, 接受共享内存连接
+	local path = shm_path(slave_address)
+	shm_listen = path ~= nil
+	local slave_fd = socket.listen(path and "unix:" .. path or slave_address)
 	skynet.error("slave connect to master " .. tostring(master_addr))
 
 	-- 连接 master 节点
@@ -258,7 +292,22 @@ skynet.start(function()
 	skynet.dispatch("text", monitor_harbor(master_fd))
 
 	-- 启动 harbor 服务
-	harbor_service = assert(skynet.launch("harbor", harbor_id, skynet.self()))
+	-- harbor_compress : 压缩不小于这个字节数的消息(对方也要开启), 不配置则不压缩
+	-- harbor_heartbeat : 心跳间隔 (1/100 秒), 默认 100, 0 关闭
+	-- harbor_timeout : 这么长时间 (1/100 秒) 没有收到对方的数据就断开, 默认 0 不检查. 需要打开心跳和 harbor_flags
+	-- harbor_queue : 等待发往每个 harbor 的字节数上限, 默认 0 不限制
+	-- harbor_overflow : 超过上限时, "drop" (默认) 丢弃新的消息, "down" 断开这个 harbor
+	-- harbor_flags : 1 握手时交换特性 (压缩, 心跳的控制帧), 所有的 harbor 都要一样配置.
+	--	默认 0 和旧版本兼容, 不压缩, 不发心跳的控制帧
+	-- harbor_shm : 共享内存连接 (address 为 "shm:/path") 每个方向的环形缓冲区的字节数, 默认 1M
+	local compress = tonumber(skynet.getenv "harbor_compress") or 0
+	local heartbeat = tonumber(skynet.getenv "harbor_heartbeat") or 100
+	local timeout = tonumber(skynet.getenv "harbor_timeout") or 0
+	local queue = tonumber(skynet.getenv "harbor_queue") or 0
+	local overflow = skynet.getenv "harbor_overflow" or "drop"
+	handshake_flags = (tonumber(skynet.getenv "harbor_flags") or 0) ~= 0
+	local shm_size = tonumber(skynet.getenv "harbor_shm") or 0
+	harbor_service = assert(skynet.launch("harbor", harbor_id, skynet.self(), compress, heartbeat, timeout, queue, overflow, handshake_flags and 1 or 0, shm_size))
 
 	-- 发送一个 "H" 消息，告诉master:hi, gay!我连接上来了，并且告诉 master:harbor id 和 节点地址
 	local hs_message = pack_package("H", harbor_id, slave_address)
@@ -11,6 +11,11 @@ skynet.register_protocol {
 	id = skynet.PTYPE_CLIENT,
 }
 
+skynet.register_protocol {
+	name = "client_batch",
+	id = skynet.PTYPE_CLIENT_BATCH,
+}
+
 local handler = {}
 
 function handler.open(source, conf)
@@ -28,6 +33,20 @@ function handler.message(fd, msg, sz)
 	end
 end
 
+-- conf.batch = true , the agent should register "client_batch" protocol and unpack it by netpack.unbatch
+function handler.batch(fd, msg, sz)
+	local c = connection[fd]
+	local agent = c.agent
+	if agent then
+		skynet.redirect(agent, c.client, "client_batch", 0, msg, sz)
+	else
+		for _, pack in ipairs(netpack.unbatch(msg, sz)) do
+			skynet.send(watchdog, "lua", "socket", "data", fd, pack)
+		end
+		skynet.trash(msg, sz)
+	end
+end
+
 function handler.connect(fd, addr)
 	local c = {
 		fd = fd,
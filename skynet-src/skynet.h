@@ -20,6 +20,8 @@
 #define PTYPE_RESERVED_DEBUG 9
 #define PTYPE_RESERVED_LUA 10
 #define PTYPE_RESERVED_SNAX 11
+// several client packages in one message, read service-src/service_gate.c lualib-src/lua-netpack.c
+#define PTYPE_CLIENT_BATCH 12
 
 #define PTYPE_TAG_DONTCOPY 0x10000
 #define PTYPE_TAG_ALLOCSESSION 0x20000
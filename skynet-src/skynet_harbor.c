@@ -10,6 +10,7 @@
 
 static struct skynet_context * REMOTE = 0;
 static unsigned int HARBOR = ~0;
+static struct harbor_stat STAT[REMOTE_MAX];
 
 void 
 skynet_harbor_send(struct remote_message *rmsg, uint32_t source, int session) {
@@ -47,3 +48,10 @@ skynet_harbor_exit() {
 		skynet_context_release(ctx);
 	}
 }
+
+struct harbor_stat *
+skynet_harbor_stat(int harbor) {
+	if (harbor <= 0 || harbor >= REMOTE_MAX)
+		return NULL;
+	return &STAT[harbor];
+}
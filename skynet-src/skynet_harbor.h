@@ -18,10 +18,28 @@ struct remote_message {
 	size_t sz;
 };
 
+#define HARBOR_LINK_NONE 0
+#define HARBOR_LINK_CONNECTING 1
+#define HARBOR_LINK_UP 2
+#define HARBOR_LINK_DOWN 3
+
+// the statistics of the link to a remote harbor, written by the harbor service only
+struct harbor_stat {
+	int status;	// HARBOR_LINK_*
+	uint32_t rtt;	// the last round trip time of heartbeat, in microseconds
+	uint32_t srtt;	// smoothed rtt (srtt = 7/8 srtt + 1/8 rtt)
+	uint64_t send;	// bytes
+	uint64_t recv;
+	uint64_t queue;	// the bytes waiting for the connection
+	uint64_t drop;	// the messages dropped for overflow or down
+	uint64_t pending;	// K bytes in the send buffer when it's above the watermark, or 0
+};
+
 void skynet_harbor_send(struct remote_message *rmsg, uint32_t source, int session);
 int skynet_harbor_message_isremote(uint32_t handle);
 void skynet_harbor_init(int harbor);
 void skynet_harbor_start(void * ctx);
 void skynet_harbor_exit();
+struct harbor_stat * skynet_harbor_stat(int harbor);
 
 #endif
@@ -573,6 +573,42 @@ cmd_mqlen(struct skynet_context * context, const char * param) {
 	return context->result;
 }
 
+// param : "harbor_id field" , see struct harbor_stat
+static const char *
+cmd_harbor(struct skynet_context * context, const char * param) {
+	static const char * status[] = { "none", "connecting", "up", "down" };
+	int id = 0;
+	char field[16] = "";
+	if (param == NULL)
+		return NULL;
+	sscanf(param, "%d %15s", &id, field);
+	const struct harbor_stat * st = skynet_harbor_stat(id);
+	if (st == NULL)
+		return NULL;
+	uint64_t v;
+	if (strcmp(field, "status") == 0) {
+		return status[st->status & 3];
+	} else if (strcmp(field, "rtt") == 0) {
+		v = st->rtt;
+	} else if (strcmp(field, "srtt") == 0) {
+		v = st->srtt;
+	} else if (strcmp(field, "send") == 0) {
+		v = st->send;
+	} else if (strcmp(field, "recv") == 0) {
+		v = st->recv;
+	} else if (strcmp(field, "queue") == 0) {
+		v = st->queue;
+	} else if (strcmp(field, "drop") == 0) {
+		v = st->drop;
+	} else if (strcmp(field, "pending") == 0) {
+		v = st->pending;
+	} else {
+		return NULL;
+	}
+	sprintf(context->result, "%llu", (unsigned long long)v);
+	return context->result;
+}
+
 static const char *
 cmd_logon(struct skynet_context * context, const char * param) {
 	uint32_t handle = tohandle(context, param);
@@ -650,6 +686,7 @@ static struct command_func cmd_funcs[] = {
 	{ "ABORT", cmd_abort },
 	{ "MONITOR", cmd_monitor },
 	{ "MQLEN", cmd_mqlen },
+	{ "HARBOR", cmd_harbor },
 	{ "LOGON", cmd_logon },
 	{ "LOGOFF", cmd_logoff },
 	{ "SIGNAL", cmd_signal },
@@ -11,6 +11,8 @@
 #include <string.h>
 #include <stdbool.h>
 
+#define MAX_POLL_BATCH 16
+
 static struct socket_server * SOCKET_SERVER = NULL;
 
 void 
@@ -72,56 +74,60 @@ forward_message(int type, bool padding, struct socket_message * result) {
 	}
 }
 
+// return 0 when exit, -1 when nothing happened, 1 when some messages are forwarded
 int 
 skynet_socket_poll() {
 	struct socket_server *ss = SOCKET_SERVER;
 	assert(ss);
-	struct socket_message result;
-	int more = 1;
-	int type = socket_server_poll(ss, &result, &more);
-	switch (type) {
-	case SOCKET_EXIT:
-		return 0;
-	case SOCKET_DATA:	//远端有数据发送过来
-		forward_message(SKYNET_SOCKET_TYPE_DATA, false, &result);
-		break;
-	case SOCKET_CLOSE:
-		forward_message(SKYNET_SOCKET_TYPE_CLOSE, false, &result);
-		break;
-	case SOCKET_OPEN:	//本地打开socket连接进行监听 or 连接建立成功 or 转换网络包目的地址
-		forward_message(SKYNET_SOCKET_TYPE_CONNECT, true, &result);
-		break;
-	case SOCKET_ERROR:
-		forward_message(SKYNET_SOCKET_TYPE_ERROR, true, &result);
-		break;
-	case SOCKET_ACCEPT:	//说明acccpt成功了
-		forward_message(SKYNET_SOCKET_TYPE_ACCEPT, true, &result);
-		break;
-	case SOCKET_UDP:
-		forward_message(SKYNET_SOCKET_TYPE_UDP, false, &result);
-		break;
-	default:
-		skynet_error(NULL, "Unknown socket message type %d.",type);
-		return -1;
+	struct socket_message result[MAX_POLL_BATCH];
+	int type[MAX_POLL_BATCH];
+	// forward a batch of messages, and then wakeup the workers once.
+	int n = socket_server_poll_batch(ss, result, type, MAX_POLL_BATCH);
+	int i;
+	for (i=0;i<n;i++) {
+		switch (type[i]) {
+		case SOCKET_EXIT:
+			return 0;
+		case SOCKET_DATA:	//远端有数据发送过来
+			forward_message(SKYNET_SOCKET_TYPE_DATA, false, &result[i]);
+			break;
+		case SOCKET_CLOSE:
+			forward_message(SKYNET_SOCKET_TYPE_CLOSE, false, &result[i]);
+			break;
+		case SOCKET_OPEN:	//本地打开socket连接进行监听 or 连接建立成功 or 转换网络包目的地址
+			forward_message(SKYNET_SOCKET_TYPE_CONNECT, true, &result[i]);
+			break;
+		case SOCKET_ERROR:
+			forward_message(SKYNET_SOCKET_TYPE_ERROR, true, &result[i]);
+			break;
+		case SOCKET_ACCEPT:	//说明acccpt成功了
+			forward_message(SKYNET_SOCKET_TYPE_ACCEPT, true, &result[i]);
+			break;
+		case SOCKET_UDP:
+			forward_message(SKYNET_SOCKET_TYPE_UDP, false, &result[i]);
+			break;
+		case SOCKET_UDP_BATCH:
+			forward_message(SKYNET_SOCKET_TYPE_UDP_BATCH, false, &result[i]);
+			break;
+		case SOCKET_WARNING:	// 发送缓冲超过高水位 (ud 为 K bytes) 或者降到低水位 (ud 为 0)
+			forward_message(SKYNET_SOCKET_TYPE_WARNING, false, &result[i]);
+			break;
+		default:
+			skynet_error(NULL, "Unknown socket message type %d.",type[i]);
+			break;
+		}
 	}
-	if (more) {
+	if (n == 0) {
 		return -1;
 	}
 	return 1;
 }
 
+// SKYNET_SOCKET_TYPE_WARNING is sent by socket thread when send buffer crosses the watermark (see skynet_socket_watermark)
 static int
 check_wsz(struct skynet_context *ctx, int id, void *buffer, int64_t wsz) {
 	if (wsz < 0) {
 		return -1;
-	} else if (wsz > 1024 * 1024) {
-		struct skynet_socket_message tmp;
-		tmp.type = SKYNET_SOCKET_TYPE_WARNING;
-		tmp.id = id;
-		tmp.ud = (int)(wsz / 1024);
-		tmp.buffer = NULL;
-		skynet_send(ctx, 0, skynet_context_handle(ctx), PTYPE_SOCKET, 0 , &tmp, sizeof(tmp));
-//		skynet_error(ctx, "%d Mb bytes on socket %d need to send out", (int)(wsz / (1024 * 1024)), id);
 	}
 	return 0;
 }
@@ -137,13 +143,24 @@ skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer,
 	socket_server_send_lowpriority(SOCKET_SERVER, id, buffer, sz);
 }
 
+int
+skynet_socket_sendfile(struct skynet_context *ctx, int id, int fd, int64_t offset, int64_t sz) {
+	return socket_server_sendfile(SOCKET_SERVER, id, fd, offset, sz);
+}
+
 int 
 skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog) {
 	uint32_t source = skynet_context_handle(ctx);		// 哪个服务调用就取得那个服务的地址
-	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog);
+	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog, 0);
 	// 注意这里返回的是skynet框架分配的一个id 为s->slot的一个下标，一个数组索引而已
 }
 
+int 
+skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog, 1);
+}
+
 int 
 skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -156,6 +173,11 @@ skynet_socket_bind(struct skynet_context *ctx, int fd) {
 	return socket_server_bind(SOCKET_SERVER, source, fd);
 }
 
+int
+skynet_socket_acceptfd(int id) {
+	return socket_server_acceptfd(SOCKET_SERVER, id);
+}
+
 void 
 skynet_socket_close(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -174,11 +196,27 @@ skynet_socket_start(struct skynet_context *ctx, int id) {
 	socket_server_start(SOCKET_SERVER, source, id);
 }
 
+void
+skynet_socket_pause(struct skynet_context *ctx, int id) {
+	uint32_t source = skynet_context_handle(ctx);
+	socket_server_pause(SOCKET_SERVER, source, id);
+}
+
 void
 skynet_socket_nodelay(struct skynet_context *ctx, int id) {
 	socket_server_nodelay(SOCKET_SERVER, id);
 }
 
+void
+skynet_socket_zerocopy(struct skynet_context *ctx, int id, int size) {
+	socket_server_zerocopy(SOCKET_SERVER, id, size);
+}
+
+void
+skynet_socket_watermark(struct skynet_context *ctx, int id, int64_t low, int64_t high, int64_t limit, int overflow) {
+	socket_server_watermark(SOCKET_SERVER, id, low, high, limit, overflow);
+}
+
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -1,6 +1,8 @@
 #ifndef skynet_socket_h
 #define skynet_socket_h
 
+#include <stdint.h>
+
 struct skynet_context;
 
 #define SKYNET_SOCKET_TYPE_DATA 1
@@ -10,6 +12,8 @@ struct skynet_context;
 #define SKYNET_SOCKET_TYPE_ERROR 5
 #define SKYNET_SOCKET_TYPE_UDP 6
 #define SKYNET_SOCKET_TYPE_WARNING 7
+// buffer is a list of datagrams : [uint32 size][uint8 addrsz][address][data], ud is the total size
+#define SKYNET_SOCKET_TYPE_UDP_BATCH 8
 
 struct skynet_socket_message {
 	int type;
@@ -25,13 +29,24 @@ int skynet_socket_poll();
 
 int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);
 void skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz);
+// fd is closed by socket server after sending, sz < 0 means to the end of file
+int skynet_socket_sendfile(struct skynet_context *ctx, int id, int fd, int64_t offset, int64_t sz);
 int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog);
+// each service listens the same port with its own id, the kernel shards the accepts among them
+int skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog);
 int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);
 int skynet_socket_bind(struct skynet_context *ctx, int fd);
+// the fd of an accepted socket before skynet_socket_start, -1 if it's not
+int skynet_socket_acceptfd(int id);
 void skynet_socket_close(struct skynet_context *ctx, int id);
 void skynet_socket_shutdown(struct skynet_context *ctx, int id);
 void skynet_socket_start(struct skynet_context *ctx, int id);
+// stop reading until skynet_socket_start
+void skynet_socket_pause(struct skynet_context *ctx, int id);
 void skynet_socket_nodelay(struct skynet_context *ctx, int id);
+void skynet_socket_zerocopy(struct skynet_context *ctx, int id, int size);
+// overflow : 0 drop low priority packages , 1 close socket , when send buffer reach the limit
+void skynet_socket_watermark(struct skynet_context *ctx, int id, int64_t low, int64_t high, int64_t limit, int overflow);
 
 int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
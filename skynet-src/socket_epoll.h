@@ -10,6 +10,14 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 
+// build with -DEPOLL_EDGE_TRIGGER to register fd with EPOLLET
+#ifdef EPOLL_EDGE_TRIGGER
+#define SP_EDGE_TRIGGER 1
+#define EPOLL_MODE EPOLLET
+#else
+#define EPOLL_MODE 0
+#endif
+
 static bool 
 sp_invalid(int efd) {
 	return efd == -1;
@@ -28,7 +36,7 @@ sp_release(int efd) {
 static int 
 sp_add(int efd, int sock, void *ud) {
 	struct epoll_event ev;
-	ev.events = EPOLLIN;
+	ev.events = EPOLLIN | EPOLL_MODE;
 	ev.data.ptr = ud;
 	if (epoll_ctl(efd, EPOLL_CTL_ADD, sock, &ev) == -1) {
 		return 1;
@@ -41,24 +49,28 @@ sp_del(int efd, int sock) {
 	epoll_ctl(efd, EPOLL_CTL_DEL, sock , NULL);
 }
 
-static void 
-sp_write(int efd, int sock, void *ud, bool enable) {
+static int 
+sp_enable(int efd, int sock, void *ud, bool read_enable, bool write_enable) {
 	struct epoll_event ev;
-	ev.events = EPOLLIN | (enable ? EPOLLOUT : 0);
+	ev.events = (read_enable ? EPOLLIN : 0) | (write_enable ? EPOLLOUT : 0) | EPOLL_MODE;
 	ev.data.ptr = ud;
-	epoll_ctl(efd, EPOLL_CTL_MOD, sock, &ev);
+	if (epoll_ctl(efd, EPOLL_CTL_MOD, sock, &ev) == -1) {
+		return 1;
+	}
+	return 0;
 }
 
 static int 
-sp_wait(int efd, struct event *e, int max) {
+sp_wait(int efd, struct event *e, int max, int timeout) {
 	struct epoll_event ev[max];
-	int n = epoll_wait(efd , ev, max, -1);		// 返回的是需要处理的事件个数
+	int n = epoll_wait(efd , ev, max, timeout);		// 返回的是需要处理的事件个数
 	int i;
 	for (i=0;i<n;i++) {
 		e[i].s = ev[i].data.ptr;
 		unsigned flag = ev[i].events;
 		e[i].write = (flag & EPOLLOUT) != 0;
 		e[i].read = (flag & EPOLLIN) != 0;
+		e[i].error = (flag & (EPOLLERR | EPOLLHUP)) != 0;
 	}
 
 	return n;
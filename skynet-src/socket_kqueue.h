@@ -55,19 +55,25 @@ sp_add(int kfd, int sock, void *ud) {
 	return 0;
 }
 
-static void 
-sp_write(int kfd, int sock, void *ud, bool enable) {
+static int 
+sp_enable(int kfd, int sock, void *ud, bool read_enable, bool write_enable) {
 	struct kevent ke;
-	EV_SET(&ke, sock, EVFILT_WRITE, enable ? EV_ENABLE : EV_DISABLE, 0, 0, ud);
+	EV_SET(&ke, sock, EVFILT_READ, read_enable ? EV_ENABLE : EV_DISABLE, 0, 0, ud);
 	if (kevent(kfd, &ke, 1, NULL, 0, NULL) == -1) {
-		// todo: check error
+		return 1;
 	}
+	EV_SET(&ke, sock, EVFILT_WRITE, write_enable ? EV_ENABLE : EV_DISABLE, 0, 0, ud);
+	if (kevent(kfd, &ke, 1, NULL, 0, NULL) == -1) {
+		return 1;
+	}
+	return 0;
 }
 
 static int 
-sp_wait(int kfd, struct event *e, int max) {
+sp_wait(int kfd, struct event *e, int max, int timeout) {
 	struct kevent ev[max];
-	int n = kevent(kfd, NULL, 0, ev, max, NULL);
+	struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000 };
+	int n = kevent(kfd, NULL, 0, ev, max, timeout < 0 ? NULL : &ts);
 
 	int i;
 	for (i=0;i<n;i++) {
@@ -75,6 +81,7 @@ sp_wait(int kfd, struct event *e, int max) {
 		unsigned filter = ev[i].filter;
 		e[i].write = (filter == EVFILT_WRITE);
 		e[i].read = (filter == EVFILT_READ);
+		e[i].error = (ev[i].flags & EV_ERROR) != 0;
 	}
 
 	return n;
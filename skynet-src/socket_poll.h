@@ -9,6 +9,7 @@ struct event {
 	void * s;      //指向struct socket
 	bool read;     //此标志为true时，表示有数据可读  在sp_wait中置位
 	bool write;    //此标志为false时，表示有数据可读 在sp_wait中置位
+	bool error;    // error queue is readable (MSG_ZEROCOPY notification) or socket error
 };
 
 static bool sp_invalid(poll_fd fd);
@@ -16,8 +17,8 @@ static poll_fd sp_create();
 static void sp_release(poll_fd fd);
 static int sp_add(poll_fd fd, int sock, void *ud);
 static void sp_del(poll_fd fd, int sock);
-static void sp_write(poll_fd, int sock, void *ud, bool enable);
-static int sp_wait(poll_fd, struct event *e, int max);
+static int sp_enable(poll_fd, int sock, void *ud, bool read_enable, bool write_enable);	// returns 0 if succ
+static int sp_wait(poll_fd, struct event *e, int max, int timeout);	// timeout : -1 block, 0 return immediately
 static void sp_nonblocking(int sock);
 
 #ifdef __linux__
@@ -28,4 +29,10 @@ static void sp_nonblocking(int sock);
 #include "socket_kqueue.h"
 #endif
 
+// The backend defines SP_EDGE_TRIGGER 1 when an event is reported only once,
+// so socket server should read until EAGAIN (see ready list in socket_server.c)
+#ifndef SP_EDGE_TRIGGER
+#define SP_EDGE_TRIGGER 0
+#endif
+
 #endif
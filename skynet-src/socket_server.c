@@ -1,12 +1,22 @@
+#ifdef __linux__
+// for recvmmsg/sendmmsg
+#define _GNU_SOURCE
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
 #include "socket_poll.h"
 #include "atomic.h"
+#include "spinlock.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/tcp.h>
+#include <netdb.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -15,12 +25,34 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
+#include <stddef.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#define HAVE_ZEROCOPY 1
+#else
+#define HAVE_ZEROCOPY 0
+#endif
 
 #define MAX_INFO 128
 // MAX_SOCKET will be 2^MAX_SOCKET_P
-#define MAX_SOCKET_P 16
+#define MAX_SOCKET_P 20
+// slots are allocated by page (2^SOCKET_PAGE_P sockets) when needed
+#define SOCKET_PAGE_P 12
 #define MAX_EVENT 64
 #define MIN_READ_BUFFER 64
+// max reads of one socket in one event, then give other sockets a chance
+#define READ_BUDGET 8
+// threads for getaddrinfo, started when the first host name (not ip) is connected
+#define RESOLVER_THREAD 2
+// default high watermark of send buffer, see socket_server_watermark
+#define WARNING_SIZE (1024*1024)
 #define SOCKET_TYPE_INVALID 0 		//初始时的状态
 #define SOCKET_TYPE_RESERVE 1
 #define SOCKET_TYPE_PLISTEN 2 		//监听准备工作完成
@@ -32,10 +64,13 @@
 #define SOCKET_TYPE_BIND 8 			//上层已经调用了socketdriver.bind，绑定端口还未发生，绑定端口要上层调用socketdriver.listen后才发生
 
 #define MAX_SOCKET (1<<MAX_SOCKET_P)
+#define SOCKET_PAGE_SIZE (1<<SOCKET_PAGE_P)
+#define MAX_SOCKET_PAGE (MAX_SOCKET/SOCKET_PAGE_SIZE)
 
 #define PRIORITY_HIGH 0
 #define PRIORITY_LOW 1
 
+// index of id in ss->id_map, see reserve_id
 #define HASH_ID(id) (((unsigned)id) % MAX_SOCKET)
 
 #define PROTOCOL_TCP 0
@@ -46,6 +81,13 @@
 
 #define MAX_UDP_PACKAGE 65535
 
+#ifdef __linux__
+// recvmmsg/sendmmsg at most UDP_BATCH datagrams in one syscall
+#define UDP_BATCH 16
+#else
+#define UDP_BATCH 1
+#endif
+
 // EAGAIN and EWOULDBLOCK may be not the same value.
 #if (EAGAIN != EWOULDBLOCK)
 #define AGAIN_WOULDBLOCK EAGAIN : case EWOULDBLOCK
@@ -59,6 +101,10 @@ struct write_buffer {
 	char *ptr;
 	int sz;
 	bool userobject;
+	int fd;			// >= 0 : send sz bytes of file fd from offset (socket_server_sendfile), buffer and ptr are unused
+	off_t offset;
+	bool zerocopy;		// sent by MSG_ZEROCOPY, keep the buffer until the kernel notify zc_seq is finished
+	uint32_t zc_seq;
 	uint8_t udp_address[UDP_ADDRESS_SIZE];
 };
 
@@ -75,29 +121,78 @@ struct socket {
 	struct wb_list high;
 	struct wb_list low;
 	int64_t wb_size;
+	int64_t wb_low;		// 发送缓冲降到 wb_low 以下时通知 resume (SOCKET_WARNING ud = 0)
+	int64_t wb_high;	// 发送缓冲超过 wb_high 时通知 pause (SOCKET_WARNING ud = K bytes)
+	int64_t wb_limit;	// 硬上限, 0 表示不限制
+	uint8_t wb_overflow;	// SOCKET_OVERFLOW_DROP or SOCKET_OVERFLOW_CLOSE
+	bool wb_paused;
+	int zc_size;		// send the buffers not smaller than zc_size by MSG_ZEROCOPY, 0 : disable
+	uint32_t zc_seq;	// sequence of the next MSG_ZEROCOPY send
+	struct wb_list zc;	// sent by MSG_ZEROCOPY, waiting for the notification from error queue
 	int fd;
 	int id;
 	uint16_t protocol;
 	uint16_t type;
+	bool ready;		// in ready list (edge trigger)
+	bool reading;	// read is enabled, socket_server_pause disables it until socket_server_start
+	bool writing;	// write is enabled, the send buffer is not empty (or connecting)
+	struct socket *free_next;	// next slot in free list
+	char * path;	// the path of unix domain listen socket, unlinked when it closes
 	union {
 		int size;
 		uint8_t udp_address[UDP_ADDRESS_SIZE];
 	} p;
 };
 
+struct resolve_job {
+	struct resolve_job * next;
+	int id;
+	int port;
+	int status;
+	uintptr_t opaque;
+	struct addrinfo * ai_list;
+	char host[1];
+};
+
+struct resolver {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct resolve_job * head;	// the jobs waiting for resolver thread
+	struct resolve_job * tail;
+	struct resolve_job * done;	// the results waiting for socket thread
+	struct resolve_job * done_tail;
+	int thread_n;
+	int ref;	// socket server and the (detached) resolver threads, the last one frees it
+	bool quit;
+	int notify[2];	// non-blocking pipe to wake up socket thread, the read end is in event poll
+};
+
 struct socket_server {
 	int recvctrl_fd;						//管道的接收端，用作本地的网络命令请求(监听、绑定、发送消息等)
 	int sendctrl_fd;						//管道的发送端，用作本地的网络命令请求(监听、绑定、发送消息等)
 	int checkctrl;							//控制是否检测本地的网络请求命令
 	poll_fd event_fd;						//epoll专用描述符
-	int alloc_id;
+	struct spinlock lock;					//保护 free list, id_map 和 page 的分配, reserve_id 会在 worker 线程中调用
+	int alloc_id;							//上一个分配的 id, 单调递增 (31 位回绕)
+	struct socket *free_head;				//空闲 slot (先进先出)
+	struct socket *free_tail;
+	int page_n;
 	int event_n;							//表示有多少个描述符已经可读或者可写			
 	int event_index;						//表示处理到第几个描述符了
+	int budget_index;						//read_budget 属于哪个 event
+	int read_budget;
+	int ready_head;							//ready list : 边缘触发时还有数据未读完的 socket id (环形队列)
+	int ready_n;
+	int ready_cap;
+	int *ready;
 	struct socket_object_interface soi;
+	struct resolver *resolver;				//域名解析线程, 避免 getaddrinfo 阻塞 socket 线程, 第一次解析时创建
+	int resolving;							//已交给 resolver 还没有处理结果的数量 (仅 socket 线程访问)
 	struct event ev[MAX_EVENT];				//与描述符对应的事件(包括socket、read、write)
-	struct socket slot[MAX_SOCKET];			//与描述符对应的数据，用于标识自定义的数据
+	struct socket * slot[MAX_SOCKET_PAGE];	//与描述符对应的数据，用于标识自定义的数据, 按页分配
+	struct socket ** id_map[MAX_SOCKET_PAGE];	//HASH_ID(id) -> slot, 没有使用的为 NULL, 按页分配
 	char buffer[MAX_INFO];
-	uint8_t udpbuffer[MAX_UDP_PACKAGE];
+	uint8_t *udpbuffer;						//UDP_BATCH 个 MAX_UDP_PACKAGE 的接收缓冲, 第一次收 udp 时分配
 	fd_set rfds;							//给select使用,主要用来检查是否有本地cmd从管道过来
 };
 
@@ -154,6 +249,14 @@ struct request_setopt {
 	int value;
 };
 
+struct request_watermark {
+	int id;
+	int overflow;
+	int64_t low;
+	int64_t high;
+	int64_t limit;
+};
+
 struct request_udp {
 	int id;
 	int fd;
@@ -161,6 +264,18 @@ struct request_udp {
 	uintptr_t opaque;
 };
 
+struct request_sendfile {
+	int id;
+	int fd;
+	int64_t offset;
+	int sz;
+};
+
+struct request_zerocopy {
+	int id;
+	int size;
+};
+
 /*
 	The first byte is TYPE
 
@@ -174,8 +289,11 @@ struct request_udp {
 	P Send package (low)
 	A Send UDP package
 	T Set opt
+	W Set watermark of send buffer
 	U Create UDP socket
 	C set udp address
+	F Send file (high)
+	Z Set MSG_ZEROCOPY threshold
  */
 
 struct request_package {
@@ -190,8 +308,11 @@ struct request_package {
 		struct request_bind bind;
 		struct request_start start;
 		struct request_setopt setopt;
+		struct request_watermark watermark;
 		struct request_udp udp;
 		struct request_setudp set_udp;
+		struct request_sendfile sendfile;
+		struct request_zerocopy zerocopy;
 	} u;
 	uint8_t dummy[256];
 };
@@ -200,6 +321,7 @@ union sockaddr_all {
 	struct sockaddr s;
 	struct sockaddr_in v4;
 	struct sockaddr_in6 v6;
+	struct sockaddr_un un;
 };
 
 struct send_object {
@@ -228,7 +350,9 @@ send_object_init(struct socket_server *ss, struct send_object *so, void *object,
 
 static inline void
 write_buffer_free(struct socket_server *ss, struct write_buffer *wb) {
-	if (wb->userobject) {
+	if (wb->fd >= 0) {
+		close(wb->fd);
+	} else if (wb->userobject) {
 		ss->soi.free(wb->buffer);
 	} else {
 		FREE(wb->buffer);
@@ -242,30 +366,118 @@ socket_keepalive(int fd) {
 	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void *)&keepalive , sizeof(keepalive));  
 }
 
+static inline struct socket *
+slot_index(struct socket_server *ss, int index) {
+	return &ss->slot[index >> SOCKET_PAGE_P][index & (SOCKET_PAGE_SIZE-1)];
+}
+
+/*
+	Return the slot which id maps to, or NULL if the id isn't used.
+	The slot may be freed and reused by another id at any time (slots are never released),
+	so the caller should check s->id and s->type.
+ */
+static inline struct socket *
+get_socket(struct socket_server *ss, int id) {
+	int index = HASH_ID(id);
+	// the page and the entry are published (ATOM_STORE) by reserve_id in another thread
+	struct socket **page = ATOM_LOAD(&ss->id_map[index >> SOCKET_PAGE_P]);
+	if (page == NULL)
+		return NULL;
+	return ATOM_LOAD(&page[index & (SOCKET_PAGE_SIZE-1)]);
+}
+
+static void clear_wb_list(struct wb_list *list);
+
+// alloc a new page into free list, return false if reach MAX_SOCKET
+static bool
+new_page(struct socket_server *ss) {
+	if (ss->page_n >= MAX_SOCKET_PAGE)
+		return false;
+	struct socket *page = MALLOC(SOCKET_PAGE_SIZE * sizeof(struct socket));
+	int i;
+	for (i=0;i<SOCKET_PAGE_SIZE;i++) {
+		struct socket *s = &page[i];
+		s->type = SOCKET_TYPE_INVALID;
+		s->ready = false;
+		s->id = -1;
+		s->path = NULL;
+		s->free_next = &page[i+1];
+		clear_wb_list(&s->high);
+		clear_wb_list(&s->low);
+		clear_wb_list(&s->zc);
+	}
+	page[SOCKET_PAGE_SIZE-1].free_next = NULL;
+	ss->free_head = &page[0];
+	ss->free_tail = &page[SOCKET_PAGE_SIZE-1];
+	ATOM_STORE(&ss->slot[ss->page_n], page);
+	++ss->page_n;
+	return true;
+}
+
+// the entry of id in id_map, alloc the page of id_map if needed
+static struct socket **
+id_entry(struct socket_server *ss, int id) {
+	int index = HASH_ID(id);
+	struct socket **page = ss->id_map[index >> SOCKET_PAGE_P];
+	if (page == NULL) {
+		page = MALLOC(SOCKET_PAGE_SIZE * sizeof(struct socket *));
+		memset(page, 0, SOCKET_PAGE_SIZE * sizeof(struct socket *));
+		ATOM_STORE(&ss->id_map[index >> SOCKET_PAGE_P], page);
+	}
+	return &page[index & (SOCKET_PAGE_SIZE-1)];
+}
+
+/*
+	The ids are allocated in sequence from alloc_id like before (an id is reused after 2^31 allocations),
+	the used ones (HASH_ID collisions with living sockets) are skipped.
+	The slot of the socket is taken from the free list (memory follows the number of living sockets),
+	and id_map maps HASH_ID(id) to the slot.
+ */
 static int
 reserve_id(struct socket_server *ss) {
-	int i;
-	for (i=0;i<MAX_SOCKET;i++) {
-		int id = ATOM_INC(&(ss->alloc_id));
-		if (id < 0) {
-			id = ATOM_AND(&(ss->alloc_id), 0x7fffffff);
-		}
-		struct socket *s = &ss->slot[HASH_ID(id)];
-		if (s->type == SOCKET_TYPE_INVALID) {
-			if (ATOM_CAS(&s->type, SOCKET_TYPE_INVALID, SOCKET_TYPE_RESERVE)) {
-				s->id = id;
-				s->fd = -1;
-				return id;
-			} else {
-				// retry
-				--i;
-			}
-		}
+	SPIN_LOCK(ss)
+	if (ss->free_head == NULL && !new_page(ss)) {
+		SPIN_UNLOCK(ss)
+		return -1;
 	}
-	return -1;
+	// there is a free slot, so there is a free entry in id_map (both have MAX_SOCKET)
+	struct socket **entry;
+	int id;
+	do {
+		id = (ss->alloc_id + 1) & 0x7fffffff;
+		ss->alloc_id = id;
+		entry = id_entry(ss, id);
+	} while (*entry != NULL);
+	struct socket *s = ss->free_head;
+	ss->free_head = s->free_next;
+	if (ss->free_head == NULL) {
+		ss->free_tail = NULL;
+	}
+	s->id = id;
+	s->fd = -1;
+	s->type = SOCKET_TYPE_RESERVE;
+	ATOM_STORE(entry, s);
+	SPIN_UNLOCK(ss)
+	return id;
 }
 
-static inline void
+// set the slot invalid, remove it from id_map and put it back to free list
+static void
+free_slot(struct socket_server *ss, struct socket *s) {
+	SPIN_LOCK(ss)
+	s->type = SOCKET_TYPE_INVALID;
+	ATOM_STORE(id_entry(ss, s->id), NULL);
+	s->free_next = NULL;
+	if (ss->free_tail) {
+		ss->free_tail->free_next = s;
+	} else {
+		ss->free_head = s;
+	}
+	ss->free_tail = s;
+	SPIN_UNLOCK(ss)
+}
+
+static void
 clear_wb_list(struct wb_list *list) {
 	list->head = NULL;
 	list->tail = NULL;
@@ -300,16 +512,27 @@ socket_server_create() {
 	ss->sendctrl_fd = fd[1];	//管道的写入端
 	ss->checkctrl = 1;			//控制是否去检查本地从管道写过来的请求
 
-	for (i=0;i<MAX_SOCKET;i++) {			// MAX_SOCKET为65536
-		struct socket *s = &ss->slot[i];	//ss->slot[i]为一个struct socket
-		s->type = SOCKET_TYPE_INVALID;
-		clear_wb_list(&s->high);
-		clear_wb_list(&s->low);
+	SPIN_INIT(ss)
+	for (i=0;i<MAX_SOCKET_PAGE;i++) {
+		ss->slot[i] = NULL;		// 按页分配, 见 new_page
+		ss->id_map[i] = NULL;	// 见 id_entry
 	}
 	ss->alloc_id = 0;
+	ss->free_head = NULL;
+	ss->free_tail = NULL;
+	ss->page_n = 0;
 	ss->event_n = 0;
 	ss->event_index = 0;
+	ss->budget_index = -1;
+	ss->read_budget = 0;
+	ss->ready_head = 0;
+	ss->ready_n = 0;
+	ss->ready_cap = 0;
+	ss->ready = NULL;
+	ss->udpbuffer = NULL;
 	memset(&ss->soi, 0, sizeof(ss->soi));
+	ss->resolver = NULL;
+	ss->resolving = 0;
 	FD_ZERO(&ss->rfds);
 	assert(ss->recvctrl_fd < FD_SETSIZE);
 
@@ -340,6 +563,7 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_message *r
 	assert(s->type != SOCKET_TYPE_RESERVE);
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
+	free_wb_list(ss,&s->zc);
 	if (s->type != SOCKET_TYPE_PACCEPT && s->type != SOCKET_TYPE_PLISTEN) {
 		sp_del(ss->event_fd, s->fd);
 	}
@@ -348,22 +572,84 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_message *r
 			perror("close socket:");
 		}
 	}
-	s->type = SOCKET_TYPE_INVALID;
+	if (s->path) {
+		unlink(s->path);
+		FREE(s->path);
+		s->path = NULL;
+	}
+	s->ready = false;
+	free_slot(ss, s);
+}
+
+static void
+free_resolve_jobs(struct resolve_job *job) {
+	while (job) {
+		struct resolve_job *next = job->next;
+		if (job->ai_list) {
+			freeaddrinfo(job->ai_list);
+		}
+		FREE(job);
+		job = next;
+	}
+}
+
+static void
+resolver_free(struct resolver *r) {
+	free_resolve_jobs(r->head);
+	free_resolve_jobs(r->done);
+	close(r->notify[0]);
+	close(r->notify[1]);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	FREE(r);
+}
+
+/*
+	Don't wait for the resolver threads, getaddrinfo may block for a long time.
+	Drop the jobs and the results not reported, the threads drop what they are resolving
+	and exit, the last one frees the resolver.
+ */
+static void
+resolver_release(struct resolver *r) {
+	if (r == NULL)
+		return;
+	pthread_mutex_lock(&r->lock);
+	r->quit = true;
+	pthread_cond_broadcast(&r->cond);
+	free_resolve_jobs(r->head);
+	free_resolve_jobs(r->done);
+	r->head = r->tail = NULL;
+	r->done = r->done_tail = NULL;
+	bool last = --r->ref == 0;
+	pthread_mutex_unlock(&r->lock);
+	if (last) {
+		resolver_free(r);
+	}
 }
 
 void 
 socket_server_release(struct socket_server *ss) {
 	int i;
 	struct socket_message dummy;
-	for (i=0;i<MAX_SOCKET;i++) {
-		struct socket *s = &ss->slot[i];
+	resolver_release(ss->resolver);
+	for (i=0;i<ss->page_n * SOCKET_PAGE_SIZE;i++) {
+		struct socket *s = slot_index(ss, i);
 		if (s->type != SOCKET_TYPE_RESERVE) {
 			force_close(ss, s , &dummy);
 		}
 	}
+	for (i=0;i<ss->page_n;i++) {
+		FREE(ss->slot[i]);
+	}
+	for (i=0;i<MAX_SOCKET_PAGE;i++) {
+		FREE(ss->id_map[i]);
+	}
+	SPIN_DESTROY(ss)
 	close(ss->sendctrl_fd);
 	close(ss->recvctrl_fd);
 	sp_release(ss->event_fd);
+	FREE(ss->ready);
+	FREE(ss->udpbuffer);
 	FREE(ss);
 }
 
@@ -375,12 +661,12 @@ check_wb_list(struct wb_list *s) {
 
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool add) {	//当有新的描述符需要加入时调用此函数
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	assert(s->type == SOCKET_TYPE_RESERVE);
 
 	if (add) {
 		if (sp_add(ss->event_fd, fd, s)) {
-			s->type = SOCKET_TYPE_INVALID;
+			free_slot(ss, s);
 			return NULL;
 		}
 	}
@@ -391,32 +677,313 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	s->p.size = MIN_READ_BUFFER;
 	s->opaque = opaque;		// 调用监听动作的服务的地址
 	s->wb_size = 0;
+	s->wb_low = 0;
+	s->wb_high = WARNING_SIZE;
+	s->wb_limit = 0;
+	s->wb_overflow = SOCKET_OVERFLOW_DROP;
+	s->wb_paused = false;
+	s->zc_size = 0;
+	s->zc_seq = 0;
+	s->ready = false;
+	s->reading = true;
+	s->writing = false;
 	check_wb_list(&s->high);
 	check_wb_list(&s->low);
+	check_wb_list(&s->zc);
 	return s;
 }
 
+/*
+	In edge trigger mode, a socket is reported only once when it becomes readable.
+	If it still has data after READ_BUDGET reads (or a listen socket accepted one),
+	push it into the ready list, socket_server_poll will read it again later
+	without waiting for a new event.
+ */
+static void
+ready_push(struct socket_server *ss, struct socket *s) {
+	if (s->ready)
+		return;
+	if (ss->ready_n == ss->ready_cap) {
+		int cap = ss->ready_cap == 0 ? 64 : ss->ready_cap * 2;
+		int *ready = MALLOC(cap * sizeof(int));
+		int i;
+		for (i=0;i<ss->ready_n;i++) {
+			ready[i] = ss->ready[(ss->ready_head + i) % ss->ready_cap];
+		}
+		FREE(ss->ready);
+		ss->ready = ready;
+		ss->ready_head = 0;
+		ss->ready_cap = cap;
+	}
+	ss->ready[(ss->ready_head + ss->ready_n) % ss->ready_cap] = s->id;
+	++ss->ready_n;
+	s->ready = true;
+}
+
+// fill events from ready list, return the number of events
+static int
+ready_event(struct socket_server *ss, struct event *e, int max) {
+	int n = 0;
+	while (ss->ready_n > 0 && n < max) {
+		int id = ss->ready[ss->ready_head];
+		ss->ready_head = (ss->ready_head + 1) % ss->ready_cap;
+		--ss->ready_n;
+		struct socket *s = get_socket(ss, id);
+		if (s == NULL || s->id != id || !s->ready) {
+			// closed
+			continue;
+		}
+		if (!s->reading) {
+			// paused, enable_read will push it again
+			s->ready = false;
+			continue;
+		}
+		s->ready = false;
+		e[n].s = s;
+		e[n].read = true;
+		e[n].write = false;
+		e[n].error = false;
+		++n;
+	}
+	return n;
+}
+
+static void send_request(struct socket_server *ss, struct request_package *request, char type, int len);
+
+// keep the state if sp_enable fails (the fd is broken), it will be retried
+static inline void
+enable_write(struct socket_server *ss, struct socket *s, bool enable) {
+	if (s->writing != enable && sp_enable(ss->event_fd, s->fd, s, s->reading, enable) == 0) {
+		s->writing = enable;
+	}
+}
+
+static inline void
+enable_read(struct socket_server *ss, struct socket *s, bool enable) {
+	if (s->reading != enable && sp_enable(ss->event_fd, s->fd, s, enable, s->writing) == 0) {
+		s->reading = enable;
+		if (enable && SP_EDGE_TRIGGER) {
+			// the data arrived when paused will not trigger an event again
+			ready_push(ss, s);
+		}
+	}
+}
+
+// "unix:/path" is an AF_UNIX stream socket for the nodes on the same host, the port is ignored
+#define UNIX_PREFIX "unix:"
+#define UNIX_PREFIX_LEN (sizeof(UNIX_PREFIX)-1)
+
+static inline const char *
+unix_path(const char *host) {
+	if (strncmp(host, UNIX_PREFIX, UNIX_PREFIX_LEN) == 0) {
+		return host + UNIX_PREFIX_LEN;
+	}
+	return NULL;
+}
+
+// return 0 if the path is invalid
+static socklen_t
+unix_address(const char *path, struct sockaddr_un *sa) {
+	size_t len = strlen(path);
+	if (len == 0 || len >= sizeof(sa->sun_path)) {
+		return 0;
+	}
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	memcpy(sa->sun_path, path, len);
+	return offsetof(struct sockaddr_un, sun_path) + len + 1;
+}
+
+// format "unix:/path" into buffer, the path of a connecting peer is usually empty
+static void
+unix_name(union sockaddr_all *u, socklen_t len, char *buffer, size_t sz) {
+	int n = (int)len - (int)offsetof(struct sockaddr_un, sun_path);
+	if (n < 0) {
+		n = 0;
+	}
+	snprintf(buffer, sz, UNIX_PREFIX "%.*s", n, u->un.sun_path);
+}
+
+// host[1] is the head of a variable length string, don't let the compiler assume its size is 1
+static inline const char *
+request_host(struct request_open *request) {
+	return (const char *)request + offsetof(struct request_open, host);
+}
+
+static int
+getaddr(const char *host, int port, int flags, struct addrinfo **ai_list) {
+	struct addrinfo ai_hints;
+	char portstr[16];
+	sprintf(portstr, "%d", port);
+	memset(&ai_hints, 0, sizeof( ai_hints ) );
+	ai_hints.ai_family = AF_UNSPEC;
+	ai_hints.ai_socktype = SOCK_STREAM;
+	ai_hints.ai_protocol = IPPROTO_TCP;
+	ai_hints.ai_flags = flags;
+
+	return getaddrinfo( host, portstr, &ai_hints, ai_list );
+}
+
+/*
+	getaddrinfo may block for seconds when the dns server is slow,
+	so the host names are resolved in resolver threads. The result is
+	queued in r->done, and the socket thread is woken up by r->notify
+	(see resolver_pop). The threads never block on the control pipe,
+	so socket server can be released at any time.
+ */
+static void *
+resolver_thread(void *ud) {
+	struct resolver *r = ud;
+	pthread_mutex_lock(&r->lock);
+	for (;;) {
+		while (r->head == NULL && !r->quit) {
+			pthread_cond_wait(&r->cond, &r->lock);
+		}
+		if (r->quit) {
+			break;
+		}
+		struct resolve_job *job = r->head;
+		r->head = job->next;
+		if (r->head == NULL) {
+			r->tail = NULL;
+		}
+		pthread_mutex_unlock(&r->lock);
+
+		job->next = NULL;
+		job->status = getaddr(job->host, job->port, 0, &job->ai_list);
+
+		pthread_mutex_lock(&r->lock);
+		if (r->quit) {
+			free_resolve_jobs(job);
+			break;
+		}
+		if (r->done_tail) {
+			r->done_tail->next = job;
+		} else {
+			r->done = job;
+		}
+		r->done_tail = job;
+		char c = 0;
+		if (write(r->notify[1], &c, 1) < 0) {
+			// EAGAIN : the pipe is full, socket thread will be woken up anyway
+		}
+	}
+	bool last = --r->ref == 0;
+	pthread_mutex_unlock(&r->lock);
+	if (last) {
+		resolver_free(r);
+	}
+	return NULL;
+}
+
+static struct resolver *
+resolver_create(struct socket_server *ss) {
+	struct resolver *r = MALLOC(sizeof(*r));
+	if (pipe(r->notify)) {
+		FREE(r);
+		return NULL;
+	}
+	sp_nonblocking(r->notify[0]);
+	sp_nonblocking(r->notify[1]);
+	// ud NULL (the same as control pipe), socket_server_poll checks the results after sp_wait
+	if (sp_add(ss->event_fd, r->notify[0], NULL)) {
+		close(r->notify[0]);
+		close(r->notify[1]);
+		FREE(r);
+		return NULL;
+	}
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	r->head = r->tail = NULL;
+	r->done = r->done_tail = NULL;
+	r->thread_n = 0;
+	r->ref = 1;
+	r->quit = false;
+	return r;
+}
+
+// return 0 when the job is queued
+static int
+resolver_push(struct socket_server *ss, struct request_open *request) {
+	struct resolver *r = ss->resolver;
+	if (r == NULL) {
+		r = resolver_create(ss);
+		if (r == NULL)
+			return 1;
+		ss->resolver = r;
+	}
+	const char * host = request_host(request);
+	size_t len = strlen(host);
+	struct resolve_job *job = MALLOC(sizeof(*job) + len);
+	job->next = NULL;
+	job->id = request->id;
+	job->port = request->port;
+	job->status = 0;
+	job->opaque = request->opaque;
+	job->ai_list = NULL;
+	memcpy(job->host, host, len + 1);
+
+	pthread_mutex_lock(&r->lock);
+	// only socket thread starts resolver threads, so thread_n is safe here.
+	if (r->thread_n < RESOLVER_THREAD && (r->head != NULL || r->thread_n == 0)) {
+		pthread_t pid;
+		if (pthread_create(&pid, NULL, resolver_thread, r) == 0) {
+			pthread_detach(pid);
+			++r->thread_n;
+			++r->ref;
+		}
+	}
+	if (r->thread_n == 0) {
+		pthread_mutex_unlock(&r->lock);
+		FREE(job);
+		return 1;
+	}
+	if (r->tail) {
+		r->tail->next = job;
+	} else {
+		r->head = job;
+	}
+	r->tail = job;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+	++ss->resolving;
+	return 0;
+}
+
+// take a result of resolver, NULL if none
+static struct resolve_job *
+resolver_pop(struct socket_server *ss) {
+	if (ss->resolving == 0)
+		return NULL;
+	struct resolver *r = ss->resolver;
+	pthread_mutex_lock(&r->lock);
+	struct resolve_job *job = r->done;
+	if (job) {
+		r->done = job->next;
+		if (r->done == NULL) {
+			r->done_tail = NULL;
+		}
+		--ss->resolving;
+	}
+	if (r->done == NULL) {
+		char tmp[64];
+		while (read(r->notify[0], tmp, sizeof(tmp)) > 0) {
+		}
+	}
+	pthread_mutex_unlock(&r->lock);
+	return job;
+}
+
 // return -1 when connecting
 static int
-open_socket(struct socket_server *ss, struct request_open * request, struct socket_message *result) {
-	int id = request->id;
-	result->opaque = request->opaque;
+connect_addr(struct socket_server *ss, int id, uintptr_t opaque, int status, struct addrinfo *ai_list, struct socket_message *result) {
+	result->opaque = opaque;
 	result->id = id;
 	result->ud = 0;
 	result->data = NULL;
 	struct socket *ns;
-	int status;
-	struct addrinfo ai_hints;
-	struct addrinfo *ai_list = NULL;
 	struct addrinfo *ai_ptr = NULL;
-	char port[16];
-	sprintf(port, "%d", request->port);
-	memset(&ai_hints, 0, sizeof( ai_hints ) );
-	ai_hints.ai_family = AF_UNSPEC;
-	ai_hints.ai_socktype = SOCK_STREAM;
-	ai_hints.ai_protocol = IPPROTO_TCP;
 
-	status = getaddrinfo( request->host, port, &ai_hints, &ai_list );
 	if ( status != 0 ) {
 		result->data = (void *)gai_strerror(status);
 		goto _failed;
@@ -443,11 +1010,13 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 		goto _failed;
 	}
 
-	ns = new_fd(ss, id, sock, PROTOCOL_TCP, request->opaque, true);
+	ns = new_fd(ss, id, sock, PROTOCOL_TCP, opaque, true);
 	if (ns == NULL) {
+		// slot is freed by new_fd
 		close(sock);
+		freeaddrinfo( ai_list );
 		result->data = "reach skynet socket number limit";
-		goto _failed;
+		return SOCKET_ERROR;
 	}
 
 	if(status == 0) {
@@ -461,23 +1030,185 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 		return SOCKET_OPEN;
 	} else {
 		ns->type = SOCKET_TYPE_CONNECTING;
-		sp_write(ss->event_fd, ns->fd, ns, true);
+		enable_write(ss, ns, true);
 	}
 
 	freeaddrinfo( ai_list );
 	return -1;
 _failed:
-	freeaddrinfo( ai_list );
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	if (ai_list) {
+		freeaddrinfo( ai_list );
+	}
+	free_slot(ss, get_socket(ss, id));
+	return SOCKET_ERROR;
+}
+
+static int
+connect_unix(struct socket_server *ss, struct request_open * request, const char *path, struct socket_message *result) {
+	int id = request->id;
+	result->opaque = request->opaque;
+	result->id = id;
+	result->ud = 0;
+	result->data = NULL;
+	struct sockaddr_un sa;
+	socklen_t len = unix_address(path, &sa);
+	if (len == 0) {
+		result->data = "invalid unix socket path";
+		goto _failed;
+	}
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		result->data = strerror(errno);
+		goto _failed;
+	}
+	sp_nonblocking(sock);
+	// connect to unix socket doesn't block, EAGAIN means the backlog is full
+	int status = connect(sock, (struct sockaddr *)&sa, len);
+	if (status != 0 && errno != EINPROGRESS) {
+		result->data = strerror(errno);
+		close(sock);
+		goto _failed;
+	}
+	struct socket *ns = new_fd(ss, id, sock, PROTOCOL_TCP, request->opaque, true);
+	if (ns == NULL) {
+		close(sock);
+		result->data = "reach skynet socket number limit";
+		return SOCKET_ERROR;
+	}
+	if (status == 0) {
+		ns->type = SOCKET_TYPE_CONNECTED;
+		snprintf(ss->buffer, sizeof(ss->buffer), "%s", request_host(request));
+		result->data = ss->buffer;
+		return SOCKET_OPEN;
+	}
+	ns->type = SOCKET_TYPE_CONNECTING;
+	enable_write(ss, ns, true);
+	return -1;
+_failed:
+	free_slot(ss, get_socket(ss, id));
 	return SOCKET_ERROR;
 }
 
+// return -1 when connecting or resolving
+static int
+open_socket(struct socket_server *ss, struct request_open * request, struct socket_message *result) {
+	const char *path = unix_path(request_host(request));
+	if (path) {
+		return connect_unix(ss, request, path, result);
+	}
+	struct addrinfo *ai_list = NULL;
+	// literal ip address doesn't need dns query
+	int status = getaddr(request_host(request), request->port, AI_NUMERICHOST, &ai_list);
+	if (status == EAI_NONAME) {
+		if (resolver_push(ss, request) == 0) {
+			return -1;
+		}
+		// can't start resolver thread, resolve it here
+		status = getaddr(request_host(request), request->port, 0, &ai_list);
+	}
+	return connect_addr(ss, request->id, request->opaque, status, ai_list, result);
+}
+
+static int
+resolve_socket(struct socket_server *ss, struct resolve_job *job, struct socket_message *result) {
+	int id = job->id;
+	uintptr_t opaque = job->opaque;
+	int status = job->status;
+	struct addrinfo *ai_list = job->ai_list;
+	FREE(job);
+	struct socket *s = get_socket(ss, id);
+	if (s == NULL || s->id != id || s->type != SOCKET_TYPE_RESERVE) {
+		// closed during resolving
+		if (ai_list) {
+			freeaddrinfo(ai_list);
+		}
+		return -1;
+	}
+	return connect_addr(ss, id, opaque, status, ai_list, result);
+}
+
+#ifdef __linux__
+
+static int
+sendfile_fd(int sock, int fd, off_t offset, int sz) {
+	return sendfile(sock, fd, &offset, sz);
+}
+
+#else
+
+// no portable sendfile, copy by a small buffer
+static int
+sendfile_fd(int sock, int fd, off_t offset, int sz) {
+	char tmp[0x10000];
+	if (sz > (int)sizeof(tmp))
+		sz = (int)sizeof(tmp);
+	int n = pread(fd, tmp, sz, offset);
+	if (n <= 0)
+		return n;
+	return write(sock, tmp, n);
+}
+
+#endif
+
+// return bytes sent, 0 means the file is shorter than expected
+static inline int
+write_buffer_send(struct socket *s, struct write_buffer *wb) {
+	if (wb->fd >= 0) {
+		return sendfile_fd(s->fd, wb->fd, wb->offset, wb->sz);
+	}
+#if HAVE_ZEROCOPY
+	if (s->zc_size > 0 && (wb->zerocopy || wb->sz >= s->zc_size)) {
+		int n = send(s->fd, wb->ptr, wb->sz, MSG_ZEROCOPY);
+		if (n >= 0) {
+			wb->zerocopy = true;
+			wb->zc_seq = s->zc_seq++;	// each successful send has a sequence
+			return n;
+		}
+		if (errno != ENOBUFS)
+			return n;
+		// out of optmem, copy it
+	}
+#endif
+	return write(s->fd, wb->ptr, wb->sz);
+}
+
+// the kernel may still read the buffer sent by MSG_ZEROCOPY, free it in zerocopy_complete
+static inline void
+write_buffer_done(struct socket_server *ss, struct socket *s, struct write_buffer *wb) {
+	if (wb->zerocopy) {
+		wb->next = NULL;
+		if (s->zc.head == NULL) {
+			s->zc.head = s->zc.tail = wb;
+		} else {
+			s->zc.tail->next = wb;
+			s->zc.tail = wb;
+		}
+	} else {
+		write_buffer_free(ss, wb);
+	}
+}
+
+static inline void
+write_buffer_skip(struct write_buffer *wb, int sz) {
+	if (wb->fd >= 0) {
+		wb->offset += sz;
+	} else {
+		wb->ptr += sz;
+	}
+	wb->sz -= sz;
+}
+
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
 	while (list->head) {
 		struct write_buffer * tmp = list->head;
 		for (;;) {
-			int sz = write(s->fd, tmp->ptr, tmp->sz);
+			int sz = write_buffer_send(s, tmp);
+			if (sz == 0 && tmp->fd >= 0) {
+				fprintf(stderr, "socket-server: sendfile to %d reach the end of file.\n", s->id);
+				force_close(ss,s, result);
+				return SOCKET_CLOSE;
+			}
 			if (sz < 0) {
 				switch(errno) {
 				case EINTR:
@@ -490,14 +1221,13 @@ send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 			}
 			s->wb_size -= sz;
 			if (sz != tmp->sz) {
-				tmp->ptr += sz;
-				tmp->sz -= sz;
+				write_buffer_skip(tmp, sz);
 				return -1;
 			}
 			break;
 		}
 		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
+		write_buffer_done(ss,s,tmp);
 	}
 	list->tail = NULL;
 
@@ -528,14 +1258,45 @@ udp_socket_address(struct socket *s, const uint8_t udp_address[UDP_ADDRESS_SIZE]
 	return 0;
 }
 
+#ifdef __linux__
+
+// send at most UDP_BATCH buffers by one sendmmsg, return the number of buffers sent
+static int
+sendmmsg_udp(struct socket *s, struct write_buffer *wb) {
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all sa[UDP_BATCH];
+	int n = 0;
+	for (; wb && n < UDP_BATCH; wb = wb->next) {
+		memset(&msg[n].msg_hdr, 0, sizeof(msg[n].msg_hdr));
+		iov[n].iov_base = wb->ptr;
+		iov[n].iov_len = wb->sz;
+		msg[n].msg_hdr.msg_name = &sa[n];
+		msg[n].msg_hdr.msg_namelen = udp_socket_address(s, wb->udp_address, &sa[n]);
+		msg[n].msg_hdr.msg_iov = &iov[n];
+		msg[n].msg_hdr.msg_iovlen = 1;
+		++n;
+	}
+	return sendmmsg(s->fd, msg, n, 0);
+}
+
+#else
+
+static int
+sendmmsg_udp(struct socket *s, struct write_buffer *wb) {
+	union sockaddr_all sa;
+	socklen_t sasz = udp_socket_address(s, wb->udp_address, &sa);
+	int err = sendto(s->fd, wb->ptr, wb->sz, 0, &sa.s, sasz);
+	return err < 0 ? err : 1;
+}
+
+#endif
+
 static int
 send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
 	while (list->head) {
-		struct write_buffer * tmp = list->head;
-		union sockaddr_all sa;
-		socklen_t sasz = udp_socket_address(s, tmp->udp_address, &sa);
-		int err = sendto(s->fd, tmp->ptr, tmp->sz, 0, &sa.s, sasz);
-		if (err < 0) {
+		int n = sendmmsg_udp(s, list->head);
+		if (n < 0) {
 			switch(errno) {
 			case EINTR:
 			case AGAIN_WOULDBLOCK:
@@ -554,9 +1315,12 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 */
 		}
 
-		s->wb_size -= tmp->sz;
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
+		while (n-- > 0) {
+			struct write_buffer * tmp = list->head;
+			s->wb_size -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
+		}
 	}
 	list->tail = NULL;
 
@@ -572,6 +1336,7 @@ send_list(struct socket_server *ss, struct socket *s, struct wb_list *list, stru
 	}
 }
 
+// only for low list, file buffers (always high) never be here
 static inline int
 list_uncomplete(struct wb_list *s) {
 	struct write_buffer *wb = s->head;
@@ -625,26 +1390,30 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_message *r
 			}
 		} else {
 			// step 4
-			sp_write(ss->event_fd, s->fd, s, false);
+			enable_write(ss, s, false);
 
-			if (s->type == SOCKET_TYPE_HALFCLOSE) {
+			if (s->type == SOCKET_TYPE_HALFCLOSE && s->zc.head == NULL) {
 				force_close(ss, s, result);
 				return SOCKET_CLOSE;
 			}
 		}
 	}
+	if (s->wb_paused && s->wb_size <= s->wb_low) {
+		// drained, the owner can send again
+		s->wb_paused = false;
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = 0;
+		result->data = NULL;
+		return SOCKET_WARNING;
+	}
 
 	return -1;
 }
 
 static struct write_buffer *
-append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_send * request, int size, int n) {
+new_write_buffer(struct wb_list *s, int size) {
 	struct write_buffer * buf = MALLOC(size);
-	struct send_object so;
-	buf->userobject = send_object_init(ss, &so, request->buffer, request->sz);
-	buf->ptr = (char*)so.buffer+n;
-	buf->sz = so.sz - n;
-	buf->buffer = request->buffer;
 	buf->next = NULL;
 	if (s->head == NULL) {
 		s->head = s->tail = buf;
@@ -657,6 +1426,20 @@ append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_s
 	return buf;
 }
 
+static struct write_buffer *
+append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_send * request, int size, int n) {
+	struct write_buffer * buf = new_write_buffer(s, size);
+	struct send_object so;
+	buf->userobject = send_object_init(ss, &so, request->buffer, request->sz);
+	buf->ptr = (char*)so.buffer+n;
+	buf->sz = so.sz - n;
+	buf->buffer = request->buffer;
+	buf->fd = -1;
+	buf->offset = 0;
+	buf->zerocopy = false;
+	return buf;
+}
+
 static inline void
 append_sendbuffer_udp(struct socket_server *ss, struct socket *s, int priority, struct request_send * request, const uint8_t udp_address[UDP_ADDRESS_SIZE]) {
 	struct wb_list *wl = (priority == PRIORITY_HIGH) ? &s->high : &s->low;
@@ -682,6 +1465,72 @@ send_buffer_empty(struct socket *s) {
 	return (s->high.head == NULL && s->low.head == NULL);
 }
 
+// return SOCKET_WARNING (ud = K bytes) when the send buffer grows above the high watermark
+static int
+check_high(struct socket *s, struct socket_message *result) {
+	if (!s->wb_paused && s->wb_high > 0 && s->wb_size > s->wb_high) {
+		s->wb_paused = true;
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = (int)((s->wb_size + 1023) / 1024);
+		result->data = NULL;
+		return SOCKET_WARNING;
+	}
+	return -1;
+}
+
+#if HAVE_ZEROCOPY
+
+/*
+	The kernel notifies the finished MSG_ZEROCOPY sends by error queue, a range of sequence [ee_info, ee_data].
+	For tcp they are in order, so free the buffers in s->zc until ee_data.
+ */
+static int
+zerocopy_complete(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	for (;;) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(s->fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EINTR)
+				continue;
+			// EAGAIN, error queue is empty
+			break;
+		}
+		struct cmsghdr *cm;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR) ||
+				(cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+			struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				continue;
+			}
+			uint32_t hi = serr->ee_data;
+			struct write_buffer *wb = s->zc.head;
+			while (wb && (int32_t)(wb->zc_seq - hi) <= 0) {
+				s->zc.head = wb->next;
+				write_buffer_free(ss, wb);
+				wb = s->zc.head;
+			}
+			if (wb == NULL) {
+				s->zc.tail = NULL;
+			}
+		}
+	}
+	if (s->type == SOCKET_TYPE_HALFCLOSE && s->zc.head == NULL && send_buffer_empty(s)) {
+		// close_socket is waiting for the kernel
+		force_close(ss, s, result);
+		return SOCKET_CLOSE;
+	}
+	return -1;
+}
+
+#endif
+
 /*
 	When send a package , we can assign the priority : PRIORITY_HIGH or PRIORITY_LOW
 
@@ -692,10 +1541,10 @@ send_buffer_empty(struct socket *s) {
 static int
 send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = get_socket(ss, id);
 	struct send_object so;
 	send_object_init(ss, &so, request->buffer, request->sz);
-	if (s->type == SOCKET_TYPE_INVALID || s->id != id 
+	if (s == NULL || s->type == SOCKET_TYPE_INVALID || s->id != id 
 		|| s->type == SOCKET_TYPE_HALFCLOSE
 		|| s->type == SOCKET_TYPE_PACCEPT) {
 		so.free_func(request->buffer);
@@ -708,6 +1557,12 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 	}
 	if (send_buffer_empty(s) && s->type == SOCKET_TYPE_CONNECTED) {
 		if (s->protocol == PROTOCOL_TCP) {
+			if (s->zc_size > 0 && so.sz >= s->zc_size) {
+				// MSG_ZEROCOPY buffer must be kept in list, send it in send_list_tcp
+				append_sendbuffer(ss, s, request, 0);
+				enable_write(ss, s, true);
+				return check_high(s, result);
+			}
 			int n = write(s->fd, so.buffer, so.sz);
 			if (n<0) {
 				switch(errno) {
@@ -742,8 +1597,19 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 				return -1;
 			}
 		}
-		sp_write(ss->event_fd, s->fd, s, true);
+		enable_write(ss, s, true);
 	} else {
+		if (s->wb_limit > 0 && s->wb_size + so.sz > s->wb_limit) {
+			if (s->wb_overflow == SOCKET_OVERFLOW_CLOSE) {
+				fprintf(stderr, "socket-server: send buffer of %d reach limit %d K, close it.\n", id, (int)(s->wb_limit / 1024));
+				force_close(ss,s,result);
+				so.free_func(request->buffer);
+				return SOCKET_CLOSE;
+			} else if (priority == PRIORITY_LOW) {
+				so.free_func(request->buffer);
+				return -1;
+			}
+		}
 		if (s->protocol == PROTOCOL_TCP) {
 			if (priority == PRIORITY_LOW) {
 				append_sendbuffer_low(ss, s, request);
@@ -757,7 +1623,80 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 			append_sendbuffer_udp(ss,s,priority,request,udp_address);
 		}
 	}
-	return -1;
+	return check_high(s, result);
+}
+
+static void
+append_sendfile(struct socket *s, int fd, off_t offset, int sz) {
+	struct write_buffer * buf = new_write_buffer(&s->high, SIZEOF_TCPBUFFER);
+	buf->buffer = NULL;
+	buf->ptr = NULL;
+	buf->sz = sz;
+	buf->userobject = false;
+	buf->fd = fd;
+	buf->offset = offset;
+	buf->zerocopy = false;
+	s->wb_size += sz;
+}
+
+/*
+	Send sz bytes of file fd from offset, the fd is closed after sending.
+	The file is sent in order with the packages in high list, like PRIORITY_HIGH send_socket.
+ */
+static int
+sendfile_socket(struct socket_server *ss, struct request_sendfile * request, struct socket_message *result) {
+	int id = request->id;
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->type == SOCKET_TYPE_INVALID || s->id != id 
+		|| s->type == SOCKET_TYPE_HALFCLOSE
+		|| s->type == SOCKET_TYPE_PACCEPT) {
+		close(request->fd);
+		return -1;
+	}
+	if (s->type == SOCKET_TYPE_PLISTEN || s->type == SOCKET_TYPE_LISTEN || s->protocol != PROTOCOL_TCP) {
+		fprintf(stderr, "socket-server: sendfile to non tcp stream %d.\n", id);
+		close(request->fd);
+		return -1;
+	}
+	off_t offset = request->offset;
+	int sz = request->sz;
+	if (send_buffer_empty(s) && s->type == SOCKET_TYPE_CONNECTED) {
+		int n = sendfile_fd(s->fd, request->fd, offset, sz);
+		if (n<=0) {
+			if (n == 0) {
+				fprintf(stderr, "socket-server: sendfile to %d reach the end of file.\n", id);
+				force_close(ss,s,result);
+				close(request->fd);
+				return SOCKET_CLOSE;
+			}
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				n = 0;
+				break;
+			default:
+				fprintf(stderr, "socket-server: sendfile to %d (fd=%d) error :%s.\n",id,s->fd,strerror(errno));
+				force_close(ss,s,result);
+				close(request->fd);
+				return SOCKET_CLOSE;
+			}
+		}
+		if (n == sz) {
+			close(request->fd);
+			return -1;
+		}
+		append_sendfile(s, request->fd, offset + n, sz - n);
+		enable_write(ss, s, true);
+	} else {
+		if (s->wb_limit > 0 && s->wb_size + sz > s->wb_limit && s->wb_overflow == SOCKET_OVERFLOW_CLOSE) {
+			fprintf(stderr, "socket-server: send buffer of %d reach limit %d K, close it.\n", id, (int)(s->wb_limit / 1024));
+			force_close(ss,s,result);
+			close(request->fd);
+			return SOCKET_CLOSE;
+		}
+		append_sendfile(s, request->fd, offset, sz);
+	}
+	return check_high(s, result);
 }
 
 static int
@@ -770,6 +1709,12 @@ listen_socket(struct socket_server *ss, struct request_listen * request, struct
 		goto _failed;
 	}
 	s->type = SOCKET_TYPE_PLISTEN;
+	const char * path = (const char *)request + offsetof(struct request_listen, host);
+	if (path[0]) {
+		size_t len = strlen(path);
+		s->path = MALLOC(len + 1);
+		memcpy(s->path, path, len + 1);
+	}
 	return -1;
 _failed:
 	close(listen_fd);
@@ -777,7 +1722,7 @@ _failed:
 	result->id = id;
 	result->ud = 0;
 	result->data = "reach skynet socket number limit";
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	free_slot(ss, get_socket(ss, id));
 
 	return SOCKET_ERROR;
 }
@@ -785,8 +1730,17 @@ _failed:
 static int
 close_socket(struct socket_server *ss, struct request_close *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
-	if (s->type == SOCKET_TYPE_INVALID || s->id != id) {
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->type == SOCKET_TYPE_INVALID || s->id != id) {
+		result->id = id;
+		result->opaque = request->opaque;
+		result->ud = 0;
+		result->data = NULL;
+		return SOCKET_CLOSE;
+	}
+	if (s->type == SOCKET_TYPE_RESERVE) {
+		// host name is resolving, drop the result later (see resolve_socket)
+		free_slot(ss, s);
 		result->id = id;
 		result->opaque = request->opaque;
 		result->ud = 0;
@@ -795,10 +1749,10 @@ close_socket(struct socket_server *ss, struct request_close *request, struct soc
 	}
 	if (!send_buffer_empty(s)) { 
 		int type = send_buffer(ss,s,result);
-		if (type != -1)
+		if (type != -1 && type != SOCKET_WARNING)
 			return type;
 	}
-	if (request->shutdown || send_buffer_empty(s)) {
+	if (request->shutdown || (send_buffer_empty(s) && s->zc.head == NULL)) {
 		force_close(ss,s,result);
 		result->id = id;
 		result->opaque = request->opaque;
@@ -833,8 +1787,8 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 	result->opaque = request->opaque;		// 服务的地址
 	result->ud = 0;
 	result->data = NULL;
-	struct socket *s = &ss->slot[HASH_ID(id)];
-	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		result->data = "invalid socket";
 		return SOCKET_ERROR;
 	}
@@ -850,6 +1804,8 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 		return SOCKET_OPEN;
 	} else if (s->type == SOCKET_TYPE_CONNECTED) {
 		// todo: maybe we should send a message SOCKET_TRANSFER to s->opaque
+		// resume reading if it's paused
+		enable_read(ss, s, true);
 		s->opaque = request->opaque;
 		result->data = "transfer";
 		return SOCKET_OPEN;
@@ -858,18 +1814,72 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 	return -1;
 }
 
+// stop reading until start it again, the data is kept in kernel buffer (so tcp flow control works)
+static void
+pause_socket(struct socket_server *ss, struct request_start *request) {
+	int id = request->id;
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->type != SOCKET_TYPE_CONNECTED || s->id != id || s->protocol != PROTOCOL_TCP) {
+		return;
+	}
+	enable_read(ss, s, false);
+}
+
 //状态没有变化，仅仅是设置nodelay
 static void
 setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
-	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return;
 	}
 	int v = request->value;
 	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
 }
 
+static void
+zerocopy_socket(struct socket_server *ss, struct request_zerocopy *request) {
+	int id = request->id;
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->type == SOCKET_TYPE_INVALID || s->id !=id || s->protocol != PROTOCOL_TCP) {
+		return;
+	}
+#if HAVE_ZEROCOPY
+	if (request->size > 0) {
+		int on = 1;
+		if (setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0) {
+			fprintf(stderr, "socket-server: enable zerocopy of %d failed : %s.\n", id, strerror(errno));
+			return;
+		}
+	}
+	// the buffers in s->zc are still freed by notification after disable
+	s->zc_size = request->size > 0 ? request->size : 0;
+#endif
+}
+
+// return SOCKET_WARNING if the send buffer crosses the new watermark
+static int
+watermark_socket(struct socket_server *ss, struct request_watermark *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->type == SOCKET_TYPE_INVALID || s->id !=id) {
+		return -1;
+	}
+	s->wb_low = request->low;
+	s->wb_high = request->high;
+	s->wb_limit = request->limit;
+	s->wb_overflow = request->overflow;
+	if (s->wb_paused && s->wb_size <= s->wb_low) {
+		s->wb_paused = false;
+		result->opaque = s->opaque;
+		result->id = id;
+		result->ud = 0;
+		result->data = NULL;
+		return SOCKET_WARNING;
+	}
+	return check_high(s, result);
+}
+
 static void
 block_readpipe(int pipefd, void *buffer, int sz) {
 	for (;;) {
@@ -913,7 +1923,6 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 	struct socket *ns = new_fd(ss, id, udp->fd, protocol, udp->opaque, true);
 	if (ns == NULL) {
 		close(udp->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
 		return;
 	}
 	ns->type = SOCKET_TYPE_CONNECTED;
@@ -923,8 +1932,8 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 static int
 set_udp_address(struct socket_server *ss, struct request_setudp *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
-	if (s->type == SOCKET_TYPE_INVALID || s->id !=id) {
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->type == SOCKET_TYPE_INVALID || s->id !=id) {
 		return -1;
 	}
 	int type = request->address[0];
@@ -971,7 +1980,7 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 		return listen_socket(ss,(struct request_listen *)buffer, result);
 	case 'K':	//返回:SOCKET_CLOSE、
 		return close_socket(ss,(struct request_close *)buffer, result);
-	case 'O':	//返回:SOCKET_OPEN、SOCKET_ERROR
+	case 'O':	//返回:SOCKET_OPEN、SOCKET_ERROR、-1
 		return open_socket(ss, (struct request_open *)buffer, result);
 	case 'X':	//返回:SOCKET_EXIT
 		result->opaque = 0;
@@ -989,9 +1998,19 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	}
 	case 'C':	//返回:SOCKET_CLOSE、-1
 		return set_udp_address(ss, (struct request_setudp *)buffer, result);
+	case 'Q':	//返回:-1
+		pause_socket(ss, (struct request_start *)buffer);
+		return -1;
 	case 'T':	//状态没有变化，仅仅是设置nodelay 返回:-1
 		setopt_socket(ss, (struct request_setopt *)buffer);
 		return -1;
+	case 'Z':	//返回:-1
+		zerocopy_socket(ss, (struct request_zerocopy *)buffer);
+		return -1;
+	case 'F':	//返回:SOCKET_CLOSE、SOCKET_WARNING、-1
+		return sendfile_socket(ss, (struct request_sendfile *)buffer, result);
+	case 'W':	//返回:SOCKET_WARNING、-1
+		return watermark_socket(ss, (struct request_watermark *)buffer, result);
 	case 'U':	//返回:-1
 		add_udp_socket(ss, (struct request_udp *)buffer);
 		return -1;
@@ -1013,9 +2032,15 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_me
 		FREE(buffer);
 		switch(errno) {
 		case EINTR:
+			if (SP_EDGE_TRIGGER) {
+				ready_push(ss, s);
+			}
 			break;
 		case AGAIN_WOULDBLOCK:
-			fprintf(stderr, "socket-server: EAGAIN capture.\n");
+			// In edge trigger mode, the socket in ready list may be drained already.
+			if (!SP_EDGE_TRIGGER) {
+				fprintf(stderr, "socket-server: EAGAIN capture.\n");
+			}
 			break;
 		default:
 			// close when error
@@ -1068,11 +2093,67 @@ gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	return addrsz;
 }
 
+static uint8_t *
+udp_buffer(struct socket_server *ss, int index) {
+	if (ss->udpbuffer == NULL) {
+		ss->udpbuffer = MALLOC(UDP_BATCH * MAX_UDP_PACKAGE);
+	}
+	return ss->udpbuffer + index * MAX_UDP_PACKAGE;
+}
+
+// recv at most UDP_BATCH datagrams into udp_buffer, return the number of datagrams or -1 when error
+static int
+recv_udp(struct socket_server *ss, struct socket *s, union sockaddr_all *sa, socklen_t *slen, int *sz) {
+#ifdef __linux__
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	int i;
+	for (i=0;i<UDP_BATCH;i++) {
+		memset(&msg[i].msg_hdr, 0, sizeof(msg[i].msg_hdr));
+		iov[i].iov_base = udp_buffer(ss, i);
+		iov[i].iov_len = MAX_UDP_PACKAGE;
+		msg[i].msg_hdr.msg_name = &sa[i];
+		msg[i].msg_hdr.msg_namelen = sizeof(sa[i]);
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+	int n = recvmmsg(s->fd, msg, UDP_BATCH, 0, NULL);
+	for (i=0;i<n;i++) {
+		slen[i] = msg[i].msg_hdr.msg_namelen;
+		sz[i] = msg[i].msg_len;
+	}
+	return n;
+#else
+	slen[0] = sizeof(sa[0]);
+	int n = recvfrom(s->fd, udp_buffer(ss, 0), MAX_UDP_PACKAGE, 0, &sa[0].s, &slen[0]);
+	if (n < 0)
+		return -1;
+	sz[0] = n;
+	return 1;
+#endif
+}
+
+// return the size of udp address, or 0 if the address doesn't match the protocol of socket
+static inline int
+udp_address_size(struct socket *s, socklen_t slen) {
+	if (slen == sizeof(struct sockaddr_in)) {
+		return s->protocol == PROTOCOL_UDP ? 1 + 2 + 4 : 0;
+	} else {
+		return s->protocol == PROTOCOL_UDPv6 ? 1 + 2 + 16 : 0;
+	}
+}
+
+/*
+	One datagram is forwarded as SOCKET_UDP : data + address.
+	More datagrams from one recvmmsg are forwarded in one SOCKET_UDP_BATCH message,
+	the data is a list of [uint32 size][uint8 addrsz][address][data], ud is the total size.
+ */
 static int
 forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_message * result) {
-	union sockaddr_all sa;
-	socklen_t slen = sizeof(sa);
-	int n = recvfrom(s->fd, ss->udpbuffer,MAX_UDP_PACKAGE,0,&sa.s,&slen);
+	union sockaddr_all sa[UDP_BATCH];
+	socklen_t slen[UDP_BATCH];
+	int sz[UDP_BATCH];
+	int n = recv_udp(ss, s, sa, slen, sz);
 	if (n<0) {
 		switch(errno) {
 		case EINTR:
@@ -1086,26 +2167,46 @@ forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_me
 		}
 		return -1;
 	}
-	uint8_t * data;
-	if (slen == sizeof(sa.v4)) {
-		if (s->protocol != PROTOCOL_UDP)
-			return -1;
-		data = MALLOC(n + 1 + 2 + 4);
-		gen_udp_address(PROTOCOL_UDP, &sa, data + n);
-	} else {
-		if (s->protocol != PROTOCOL_UDPv6)
-			return -1;
-		data = MALLOC(n + 1 + 2 + 16);
-		gen_udp_address(PROTOCOL_UDPv6, &sa, data + n);
-	}
-	memcpy(data, ss->udpbuffer, n);
-
 	result->opaque = s->opaque;
 	result->id = s->id;
-	result->ud = n;
+	if (n == 1) {
+		int addrsz = udp_address_size(s, slen[0]);
+		if (addrsz == 0)
+			return -1;
+		uint8_t * data = MALLOC(sz[0] + addrsz);
+		memcpy(data, udp_buffer(ss, 0), sz[0]);
+		gen_udp_address(s->protocol, &sa[0], data + sz[0]);
+		result->ud = sz[0];
+		result->data = (char *)data;
+		return SOCKET_UDP;
+	}
+	int i;
+	int total = 0;
+	for (i=0;i<n;i++) {
+		int addrsz = udp_address_size(s, slen[i]);
+		if (addrsz) {
+			total += 4 + 1 + addrsz + sz[i];
+		}
+	}
+	if (total == 0)
+		return -1;
+	uint8_t * data = MALLOC(total);
+	uint8_t * ptr = data;
+	for (i=0;i<n;i++) {
+		if (udp_address_size(s, slen[i]) == 0)
+			continue;
+		uint32_t size = sz[i];
+		memcpy(ptr, &size, 4);
+		uint8_t addrsz = gen_udp_address(s->protocol, &sa[i], ptr + 5);
+		ptr[4] = addrsz;
+		ptr += 5 + addrsz;
+		memcpy(ptr, udp_buffer(ss, i), size);
+		ptr += size;
+	}
+	result->ud = total;
 	result->data = (char *)data;
 
-	return SOCKET_UDP;
+	return SOCKET_UDP_BATCH;
 }
 
 static int
@@ -1126,11 +2227,16 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_message
 		result->id = s->id;
 		result->ud = 0;
 		if (send_buffer_empty(s)) {
-			sp_write(ss->event_fd, s->fd, s, false);
+			enable_write(ss, s, false);
 		}
 		union sockaddr_all u;
 		socklen_t slen = sizeof(u);
 		if (getpeername(s->fd, &u.s, &slen) == 0) {
+			if (u.s.sa_family == AF_UNIX) {
+				unix_name(&u, slen, ss->buffer, sizeof(ss->buffer));
+				result->data = ss->buffer;
+				return SOCKET_OPEN;
+			}
 			void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
 			if (inet_ntop(u.s.sa_family, sin_addr, ss->buffer, sizeof(ss->buffer))) {
 				result->data = ss->buffer;
@@ -1177,6 +2283,11 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	result->ud = id;					// 当是accept时ud为id
 	result->data = NULL;
 
+	if (u.s.sa_family == AF_UNIX) {
+		unix_name(&u, len, ss->buffer, sizeof(ss->buffer));
+		result->data = ss->buffer;
+		return 1;
+	}
 	void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;
 	int sin_port = ntohs((u.s.sa_family == AF_INET) ? u.v4.sin_port : u.v6.sin6_port);
 	char tmp[INET6_ADDRSTRLEN];
@@ -1188,6 +2299,19 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	return 1;
 }
 
+// read the same event again if there is budget, or push it into ready list (edge trigger)
+static inline bool
+read_again(struct socket_server *ss, struct socket *s) {
+	if (--ss->read_budget > 0) {
+		--ss->event_index;
+		return true;
+	}
+	if (SP_EDGE_TRIGGER) {
+		ready_push(ss, s);
+	}
+	return false;
+}
+
 //清除已经关闭或发生错误的连接
 static inline void 
 clear_closed_event(struct socket_server *ss, struct socket_message * result, int type) {
@@ -1207,9 +2331,9 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
 	}
 }
 
-// return type
-int 
-socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
+// return type, block in sp_wait when there is nothing to do if block is true
+static int
+poll_message(struct socket_server *ss, struct socket_message * result, int * more, bool block) {
 	for (;;) {
 		if (ss->checkctrl) {	//控制是否去检查本地从管道写过来的请求
 			if (has_cmd(ss)) {	//判断管道的接收描述符是不是有请求过来
@@ -1219,22 +2343,39 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 					return type;
 				} else
 					continue;
-			} else {			//如果没有本地的命令过来，就先暂时不检查本地的命令，等处理完远端的数据再打开本地管道的"监听"
-				ss->checkctrl = 0;
 			}
+			struct resolve_job *job = resolver_pop(ss);	// 域名解析的结果, 继续 connect
+			if (job) {
+				int type = resolve_socket(ss, job, result);
+				if (type != -1) {
+					clear_closed_event(ss, result, type);
+					return type;
+				} else
+					continue;
+			}
+			//如果没有本地的命令过来，就先暂时不检查本地的命令，等处理完远端的数据再打开本地管道的"监听"
+			ss->checkctrl = 0;
 		}
 		if (ss->event_index == ss->event_n) { //如果event_index等于event_n，说明已经处理完了
-			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);		//等待有事情发生， 返回的是需要处理的事件个数
+			// sockets in ready list are dispatched first, and don't block in sp_wait if there are any.
+			int n = ready_event(ss, ss->ev, MAX_EVENT/2);
+			int m = sp_wait(ss->event_fd, ss->ev + n, MAX_EVENT - n, (n > 0 || !block) ? 0 : -1);		//等待有事情发生， 返回的是需要处理的事件个数
 			ss->checkctrl = 1;	//检查本地的请求标志
 			if (more) {
 				*more = 0;
 			}
 			ss->event_index = 0;
+			ss->budget_index = -1;
+			ss->event_n = n + (m > 0 ? m : 0);
 			if (ss->event_n <= 0) {
 				ss->event_n = 0;
 				return -1;
 			}
 		}
+		if (ss->budget_index != ss->event_index) {
+			ss->budget_index = ss->event_index;
+			ss->read_budget = READ_BUDGET;
+		}
 		struct event *e = &ss->ev[ss->event_index++];
 		struct socket *s = e->s;	// 取出自定义数据
 		if (s == NULL) {
@@ -1247,6 +2388,10 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		case SOCKET_TYPE_LISTEN: {	// listen完以后管道再接收一个"S"命令状态就变为SOCKET_TYPE_LISTEN了
 			int ok = report_accept(ss, s, result);
 			if (ok > 0) {	//accept成功后会大于0
+				if (SP_EDGE_TRIGGER) {
+					// accept again later, until EAGAIN
+					ready_push(ss, s);
+				}
 				return SOCKET_ACCEPT;		
 				// 返回给 skynet_socket_poll 处理，这时socket已连接描述符类型为 SOCKET_TYPE_PACCEPT 并且此已连接描述符还未被epoll管理
 			} if (ok < 0 ) {
@@ -1259,16 +2404,36 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			fprintf(stderr, "socket-server: invalid socket\n");
 			break;
 		default:
+			if (!s->reading) {
+				// paused (the event may be polled before pause), read only to report the error or hangup
+				e->read = e->error;
+			}
+#if HAVE_ZEROCOPY
+			if (e->error && s->zc.head) {
+				e->error = false;
+				int type = zerocopy_complete(ss, s, result);
+				if (type != -1)
+					return type;
+			}
+#endif
 			if (e->read) {	//有数据可读,在sp_wait中进行设置
 				int type;
 				if (s->protocol == PROTOCOL_TCP) {
 					type = forward_message_tcp(ss, s, result);		// 正常的话返回 SOCKET_DATA
+					if (SP_EDGE_TRIGGER && type == SOCKET_DATA) {
+						// read until EAGAIN (or 0), a short read doesn't mean the socket is drained:
+						// the FIN may arrive with the data, and there is no new event for it.
+						if (read_again(ss, s)) {
+							return SOCKET_DATA;
+						}
+					}
 				} else {
 					type = forward_message_udp(ss, s, result);
-					if (type == SOCKET_UDP) {
+					if (type == SOCKET_UDP || type == SOCKET_UDP_BATCH) {
 						// try read again
-						--ss->event_index;
-						return SOCKET_UDP;
+						if (read_again(ss, s)) {
+							return type;
+						}
 					}
 				}
 				if (e->write && type != SOCKET_CLOSE && type != SOCKET_ERROR) {
@@ -1291,6 +2456,37 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 	}
 }
 
+// return type
+int 
+socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
+	return poll_message(ss, result, more, true);
+}
+
+/*
+	Poll at most max results, only the first one may block.
+	The batch stops at the result which is not SOCKET_DATA/SOCKET_UDP(_BATCH)/SOCKET_CLOSE/SOCKET_WARNING,
+	because the others may use ss->buffer for data.
+ */
+int
+socket_server_poll_batch(struct socket_server *ss, struct socket_message *result, int *type, int max) {
+	int n = 0;
+	while (n < max) {
+		if (n > 0 && ss->event_index == ss->event_n && ss->ready_n == 0) {
+			// no more events, don't call sp_wait again
+			break;
+		}
+		int t = poll_message(ss, &result[n], NULL, n == 0);
+		if (t == -1) {
+			break;
+		}
+		type[n++] = t;
+		if (t != SOCKET_DATA && t != SOCKET_UDP && t != SOCKET_UDP_BATCH && t != SOCKET_CLOSE && t != SOCKET_WARNING) {
+			break;
+		}
+	}
+	return n;
+}
+
 static void
 send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
 	request->header[6] = (uint8_t)type;
@@ -1347,8 +2543,8 @@ free_buffer(struct socket_server *ss, const void * buffer, int sz) {
 // return -1 when error
 int64_t 
 socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
-	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
 	}
@@ -1364,8 +2560,8 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 
 void 
 socket_server_send_lowpriority(struct socket_server *ss, int id, const void * buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
-	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return;
 	}
@@ -1378,6 +2574,50 @@ socket_server_send_lowpriority(struct socket_server *ss, int id, const void * bu
 	send_request(ss, &request, 'P', sizeof(request.u.send));
 }
 
+// the socket server owns fd after calling, it's closed after sending (or when error)
+int
+socket_server_sendfile(struct socket_server *ss, int id, int fd, int64_t offset, int64_t sz) {
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->id != id || s->type == SOCKET_TYPE_INVALID || offset < 0) {
+		close(fd);
+		return -1;
+	}
+	if (sz < 0) {
+		// to the end of file
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			return -1;
+		}
+		sz = st.st_size - offset;
+	}
+	if (sz <= 0) {
+		close(fd);
+		return sz < 0 ? -1 : 0;
+	}
+	struct request_package request;
+	request.u.sendfile.id = id;
+	// write_buffer size is int, split large file into parts, each part owns a dup fd
+	while (sz > INT_MAX) {
+		int part = dup(fd);
+		if (part < 0) {
+			close(fd);
+			return -1;
+		}
+		request.u.sendfile.fd = part;
+		request.u.sendfile.offset = offset;
+		request.u.sendfile.sz = 0x40000000;
+		send_request(ss, &request, 'F', sizeof(request.u.sendfile));
+		offset += 0x40000000;
+		sz -= 0x40000000;
+	}
+	request.u.sendfile.fd = fd;
+	request.u.sendfile.offset = offset;
+	request.u.sendfile.sz = (int)sz;
+	send_request(ss, &request, 'F', sizeof(request.u.sendfile));
+	return 0;
+}
+
 void
 socket_server_exit(struct socket_server *ss) {
 	struct request_package request;
@@ -1406,7 +2646,7 @@ socket_server_shutdown(struct socket_server *ss, uintptr_t opaque, int id) {
 // return -1 means failed
 // or return AF_INET or AF_INET6
 static int
-do_bind(const char *host, int port, int protocol, int *family) {
+do_bind(const char *host, int port, int protocol, int *family, bool reuseport) {
 	int fd;
 	int status;
 	int reuse = 1;
@@ -1439,6 +2679,16 @@ do_bind(const char *host, int port, int protocol, int *family) {
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse, sizeof(int))==-1) {
 		goto _failed;
 	}
+	if (reuseport) {
+		// several sockets bind the same port, the kernel balances the incoming connections among them
+#ifdef SO_REUSEPORT
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void *)&reuse, sizeof(int))==-1) {
+			goto _failed;
+		}
+#else
+		goto _failed;
+#endif
+	}
 	status = bind(fd, (struct sockaddr *)ai_list->ai_addr, ai_list->ai_addrlen);
 	if (status != 0)
 		goto _failed;
@@ -1453,9 +2703,41 @@ _failed_fd:
 }
 
 static int
-do_listen(const char * host, int port, int backlog) {
+do_bind_unix(const char *path) {
+	struct sockaddr_un sa;
+	socklen_t len = unix_address(path, &sa);
+	if (len == 0) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		// there is no SO_REUSEADDR for unix socket, unlink the path left by the last process,
+		// but not the one another process is listening on (bind fails then)
+		int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (probe >= 0) {
+			sp_nonblocking(probe);
+			if (connect(probe, (struct sockaddr *)&sa, len) != 0 && errno == ECONNREFUSED) {
+				unlink(path);
+			}
+			close(probe);
+		}
+	}
+	if (bind(fd, (struct sockaddr *)&sa, len) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int
+do_listen(const char * host, int port, int backlog, bool reuseport) {
 	int family = 0;
-	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family);
+	const char *path = unix_path(host);
+	int listen_fd = path ? do_bind_unix(path) : do_bind(host, port, IPPROTO_TCP, &family, reuseport);
 	if (listen_fd < 0) {
 		return -1;
 	}
@@ -1463,12 +2745,14 @@ do_listen(const char * host, int port, int backlog) {
 		close(listen_fd);
 		return -1;
 	}
+	// accept until EAGAIN in edge trigger mode
+	sp_nonblocking(listen_fd);
 	return listen_fd;
 }
 
 int 
-socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
-	int fd = do_listen(addr, port, backlog);
+socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog, int reuseport) {
+	int fd = do_listen(addr, port, backlog, reuseport != 0);
 	if (fd < 0) {
 		return -1;
 	}
@@ -1481,7 +2765,12 @@ socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * ad
 	request.u.listen.opaque = opaque;		//opaque就是调用listen的服务的地址
 	request.u.listen.id = id;
 	request.u.listen.fd = fd;
-	send_request(ss, &request, 'L', sizeof(request.u.listen));
+	// the path of unix domain socket is unlinked when the listen socket closes
+	const char * path = unix_path(addr);
+	size_t len = path ? strlen(path) : 0;
+	char * host = (char *)&request.u.listen + offsetof(struct request_listen, host);
+	memcpy(host, path ? path : "", len + 1);
+	send_request(ss, &request, 'L', sizeof(request.u.listen) + len);
 	return id;	// 注意这里返回的是skynet框架分配的一个id 为s->slot的一个下标，一个数组索引而已
 }
 
@@ -1498,6 +2787,14 @@ socket_server_bind(struct socket_server *ss, uintptr_t opaque, int fd) {
 	return id;
 }
 
+int
+socket_server_acceptfd(struct socket_server *ss, int id) {
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->id != id || s->type != SOCKET_TYPE_PACCEPT)
+		return -1;
+	return s->fd;
+}
+
 void 
 socket_server_start(struct socket_server *ss, uintptr_t opaque, int id) {
 	struct request_package request;
@@ -1506,6 +2803,14 @@ socket_server_start(struct socket_server *ss, uintptr_t opaque, int id) {
 	send_request(ss, &request, 'S', sizeof(request.u.start));
 }
 
+void
+socket_server_pause(struct socket_server *ss, uintptr_t opaque, int id) {
+	struct request_package request;
+	request.u.start.id = id;
+	request.u.start.opaque = opaque;
+	send_request(ss, &request, 'Q', sizeof(request.u.start));
+}
+
 void
 socket_server_nodelay(struct socket_server *ss, int id) {
 	struct request_package request;
@@ -1515,6 +2820,25 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	send_request(ss, &request, 'T', sizeof(request.u.setopt));
 }
 
+void
+socket_server_zerocopy(struct socket_server *ss, int id, int size) {
+	struct request_package request;
+	request.u.zerocopy.id = id;
+	request.u.zerocopy.size = size;
+	send_request(ss, &request, 'Z', sizeof(request.u.zerocopy));
+}
+
+void
+socket_server_watermark(struct socket_server *ss, int id, int64_t low, int64_t high, int64_t limit, int overflow) {
+	struct request_package request;
+	request.u.watermark.id = id;
+	request.u.watermark.overflow = overflow;
+	request.u.watermark.low = low;
+	request.u.watermark.high = high;
+	request.u.watermark.limit = limit;
+	send_request(ss, &request, 'W', sizeof(request.u.watermark));
+}
+
 void 
 socket_server_userobject(struct socket_server *ss, struct socket_object_interface *soi) {
 	ss->soi = *soi;
@@ -1528,7 +2852,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 	int family;
 	if (port != 0 || addr != NULL) {
 		// bind
-		fd = do_bind(addr, port, IPPROTO_UDP, &family);
+		fd = do_bind(addr, port, IPPROTO_UDP, &family, false);
 		if (fd < 0) {
 			return -1;
 		}
@@ -1558,8 +2882,8 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 
 int64_t 
 socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp_address *addr, const void *buffer, int sz) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
-	if (s->id != id || s->type == SOCKET_TYPE_INVALID) {
+	struct socket * s = get_socket(ss, id);
+	if (s == NULL || s->id != id || s->type == SOCKET_TYPE_INVALID) {
 		free_buffer(ss, buffer, sz);
 		return -1;
 	}
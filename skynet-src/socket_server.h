@@ -10,6 +10,8 @@
 #define SOCKET_ERROR 4
 #define SOCKET_EXIT 5
 #define SOCKET_UDP 6
+#define SOCKET_WARNING 7
+#define SOCKET_UDP_BATCH 8	// datagrams of one recvmmsg, data : [uint32 size][uint8 addrsz][address][data] ...
 
 struct socket_server;
 
@@ -23,23 +25,45 @@ struct socket_message {
 struct socket_server * socket_server_create();
 void socket_server_release(struct socket_server *);
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
+// poll results as many as possible (at most max) , return the number of results
+int socket_server_poll_batch(struct socket_server *, struct socket_message *result, int *type, int max);
 
 void socket_server_exit(struct socket_server *);
 void socket_server_close(struct socket_server *, uintptr_t opaque, int id);
 void socket_server_shutdown(struct socket_server *, uintptr_t opaque, int id);
 void socket_server_start(struct socket_server *, uintptr_t opaque, int id);
+// stop reading a tcp socket (the peer is blocked by tcp flow control), socket_server_start resumes it
+void socket_server_pause(struct socket_server *, uintptr_t opaque, int id);
 
 // return -1 when error
 int64_t socket_server_send(struct socket_server *, int id, const void * buffer, int sz);
 void socket_server_send_lowpriority(struct socket_server *, int id, const void * buffer, int sz);
+// send sz bytes (sz < 0 : to the end) of file fd from offset by sendfile, without copying to user space.
+// socket server owns the fd, it's closed after sending. return -1 when error
+int socket_server_sendfile(struct socket_server *, int id, int fd, int64_t offset, int64_t sz);
 
 // ctrl command below returns id
-int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
+// addr "unix:/path" is a unix domain stream socket (for the nodes on the same host), port is ignored
+// reuseport : set SO_REUSEPORT, so several listen sockets (in different services) can share one port
+int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog, int reuseport);
 int socket_server_connect(struct socket_server *, uintptr_t opaque, const char * addr, int port);
 int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
+// the fd of an accepted socket before socket_server_start (the socket thread doesn't touch it), -1 if it's not
+int socket_server_acceptfd(struct socket_server *, int id);
 
 // for tcp
 void socket_server_nodelay(struct socket_server *, int id);
+// send the buffers (size >= size) by MSG_ZEROCOPY, and free them after the kernel notifies. size <= 0 to disable.
+// linux only, ignored elsewhere.
+void socket_server_zerocopy(struct socket_server *, int id, int size);
+
+#define SOCKET_OVERFLOW_DROP 0	// drop PRIORITY_LOW packages when send buffer reach the limit
+#define SOCKET_OVERFLOW_CLOSE 1	// close the socket when send buffer reach the limit
+
+// The owner gets SOCKET_WARNING (ud = K bytes) when send buffer grows above high (pause),
+// and SOCKET_WARNING (ud = 0) when it's drained to low (resume). high = 0 means never warning.
+// limit is the hard limit of send buffer, 0 for unlimited. Default : low 0, high 1M, no limit.
+void socket_server_watermark(struct socket_server *, int id, int64_t low, int64_t high, int64_t limit, int overflow);
 
 struct socket_udp_address;
 
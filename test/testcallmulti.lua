@@ -0,0 +1,157 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.abort
+
+-- testcallmulti
+-- Run with start = "testcallmulti" (examples/config). It checks the results, errors and timeout of skynet.callmulti,
+-- and compares fanning out the requests to the shards with skynet.callmulti / skynet.fork + skynet.call.
+
+local SHARDS = 8
+local FANOUT = 200
+local ROUNDS = 500
+
+local mode = ...
+
+if mode == "shard" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, cmd, ...)
+		if cmd == "echo" then
+			skynet.ret(skynet.pack(...))
+		elseif cmd == "sleep" then
+			local ti = ...
+			skynet.sleep(ti)
+			skynet.ret(skynet.pack(ti))
+		elseif cmd == "error" then
+			error "shard error"
+		elseif cmd == "exit" then
+			skynet.exit()
+		end
+	end)
+end)
+
+else
+
+local function fork_call(reqs)
+	local ret = {}
+	local n = #reqs
+	local co = coroutine.running()
+	for i, req in ipairs(reqs) do
+		skynet.fork(function()
+			ret[i] = table.pack(pcall(skynet.call, table.unpack(req)))
+			n = n - 1
+			if n == 0 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait()
+	return ret
+end
+
+local function bench(name, f, reqs)
+	local ti = skynet.now()
+	for i = 1, ROUNDS do
+		local ret = f(reqs)
+		assert(#ret == #reqs and ret[FANOUT][2] == FANOUT)
+	end
+	ti = math.max(skynet.now() - ti, 1) / 100
+	print(string.format("%-10s %d x %d calls : %.2fs %d calls/s", name, ROUNDS, FANOUT, ti, math.floor(ROUNDS * FANOUT / ti)))
+end
+
+skynet.start(function()
+	local shard = {}
+	for i = 1, SHARDS do
+		shard[i] = skynet.newservice(SERVICE_NAME, "shard")
+	end
+
+	local ret = skynet.callmulti {
+		{ shard[1], "lua", "echo", 1, 2 },
+		{ shard[2], "lua", "sleep", 10 },
+		{ shard[3], "lua", "error" },
+		{ shard[4], "lua", "echo" },
+	}
+	assert(ret[1][1] and ret[1][2] == 1 and ret[1][3] == 2)
+	assert(ret[2][1] and ret[2][2] == 10)
+	assert(ret[3][1] == false)
+	assert(ret[4][1] and ret[4].n == 1)
+	ret = skynet.callmulti {
+		{ skynet.newservice(SERVICE_NAME, "shard"), "lua", "exit" },
+		{ shard[1], "lua", "echo", 1 },
+	}
+	assert(ret[1][1] == false and ret[2][2] == 1)
+	print("callmulti ok")
+
+	local ti = skynet.now()
+	ret = skynet.callmulti({
+		{ shard[1], "lua", "sleep", 500 },
+		{ shard[2], "lua", "echo", "fast" },
+	}, 50)
+	assert(ret[1][1] == false and ret[1][2] == "timeout")
+	assert(ret[2][1] and ret[2][2] == "fast")
+	print("callmulti timeout in", (skynet.now() - ti) * 10 .. "ms")
+
+	local order = {}
+	skynet.callmulti({
+		{ shard[1], "lua", "sleep", 20 },
+		{ shard[2], "lua", "sleep", 10 },
+		{ shard[3], "lua", "echo", 0 },
+	}, nil, function(i, ok, v)
+		assert(ok)
+		-- the callback can block
+		skynet.call(shard[4], "lua", "echo")
+		table.insert(order, v)
+	end)
+	assert(order[1] == 0 and order[2] == 10 and order[3] == 20)
+	print("callmulti callback ok")
+
+	-- the callee is killed with several callmulti and skynet.call in flight
+	local victim = skynet.newservice(SERVICE_NAME, "shard")
+	local n = 0
+	local co = coroutine.running()
+	local function done()
+		n = n - 1
+		if n == 0 then
+			skynet.wakeup(co)
+		end
+	end
+	for i = 1, 3 do
+		n = n + 2
+		skynet.fork(function()
+			local ret = skynet.callmulti {
+				{ victim, "lua", "sleep", 1000 },
+				{ shard[i], "lua", "echo", i },
+				{ victim, "lua", "sleep", 1000 },
+			}
+			assert(ret[1][1] == false and ret[2][2] == i and ret[3][1] == false)
+			done()
+		end)
+		skynet.fork(function()
+			assert(not pcall(skynet.call, victim, "lua", "sleep", 1000))
+			done()
+		end)
+	end
+	skynet.timeout(300, function()
+		if n > 0 then
+			print("callmulti hangs after the callee is killed")
+			skynet.abort()
+		end
+	end)
+	skynet.sleep(10)	-- the echo requests are done, the sleep requests are in flight
+	skynet.kill(victim)
+	skynet.term(victim)
+	skynet.wait()
+	print("callmulti killed callee ok")
+
+	local reqs = {}
+	for i = 1, FANOUT do
+		reqs[i] = { shard[i % SHARDS + 1], "lua", "echo", i }
+	end
+	bench("callmulti", skynet.callmulti, reqs)
+	bench("fork+call", fork_call, reqs)
+	skynet.sleep(500)	-- wait the timeout request (sleep 500)
+	assert(skynet.task() == 0)
+	print("done")
+	skynet.abort()
+end)
+
+end
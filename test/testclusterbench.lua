@@ -0,0 +1,74 @@
+local skynet = require "skynet"
+local cluster = require "cluster"
+require "skynet.manager"	-- import skynet.abort
+
+-- testclusterbench
+-- Run with examples/config.c1 and start = "testclusterbench", it listens on node "db" and calls itself on it.
+-- Several clients call the echo service with messages of different size (throughput of cluster.call),
+-- and one client calls it one by one (rtt).
+-- Set bench_node (a node in the cluster config, "db" by default) to bench another transport.
+
+local NODE = skynet.getenv "bench_node" or "db"
+local SIZES = { 16, 256, 4096, 65536 }
+local BYTES = 32 * 1024 * 1024	-- bytes of each size
+local MAXN = 200000
+local CLIENTS = 16
+local CALLS = 10000
+
+local mode = ...
+
+if mode == "echo" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, _, data)
+		skynet.ret(skynet.pack(data))
+	end)
+end)
+
+else
+
+local function bench(addr, size)
+	local data = string.rep("x", size)
+	local n = math.min(MAXN, BYTES // size)
+	local each = n // CLIENTS
+	local ti = skynet.now()
+	local done = 0
+	local co = coroutine.running()
+	for i = 1, CLIENTS do
+		skynet.fork(function()
+			for j = 1, each do
+				assert(cluster.call(NODE, addr, data) == data)
+			end
+			done = done + 1
+			if done == CLIENTS then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait()
+	n = each * CLIENTS
+	ti = math.max(skynet.now() - ti, 1) / 100
+	print(string.format("call %5d bytes x %6d : %.2fs %8d req/s %7.1f MB/s", size, n, ti, math.floor(n / ti), n * size / ti / 1e6))
+end
+
+skynet.start(function()
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	cluster.register("echo", echo)
+	cluster.open(NODE)
+	skynet.fork(function()
+		local addr = cluster.query(NODE, "echo")
+		assert(addr == echo)
+		for _, size in ipairs(SIZES) do
+			bench(addr, size)
+		end
+		local ti = skynet.now()
+		for i = 1, CALLS do
+			assert(cluster.call(NODE, addr, i) == i)
+		end
+		ti = math.max(skynet.now() - ti, 1) / 100
+		print(string.format("call x %d : %.2fs %.1f us/call", CALLS, ti, ti * 1e6 / CALLS))
+		skynet.abort()
+	end)
+end)
+
+end
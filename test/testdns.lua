@@ -1,5 +1,73 @@
 local skynet = require "skynet"
 local dns = require "dns"
+local socket = require "socket"
+require "skynet.manager"	-- import skynet.abort
+
+local mode = ...
+
+-- testdns stub : use a local stub resolver, so the test doesn't need network
+-- socket.open resolves the host names by getaddrinfo in the resolver threads of socket server (C),
+-- which can't use the stub, so it connects to "localhost" (/etc/hosts) and an invalid name rejected without query.
+local STUB_PORT = 8953
+local ECHO_PORT = 8954
+
+if mode == "stubserver" then
+
+-- answer every A query with 127.0.0.1
+local function answer(req)
+	local tid, flags, qdcount = string.unpack(">HHH", req)
+	local question = req:sub(13)
+	local header = string.pack(">HHHHHH", tid, 0x8180, qdcount, 1, 0, 0)
+	local rr = string.pack(">HHHI4s2", 0xc00c, 1, 1, 60, string.pack("BBBB", 127,0,0,1))
+	return header .. question .. rr
+end
+
+skynet.start(function()
+	local host
+	host = socket.udp(function(str, from)
+		socket.sendto(host, from, answer(str))
+	end, "127.0.0.1", STUB_PORT)
+	skynet.dispatch("lua", function()
+		skynet.ret()
+	end)
+end)
+
+elseif mode == "stub" then
+
+skynet.start(function()
+	skynet.call(skynet.newservice(SERVICE_NAME, "stubserver"), "lua")
+	dns.server("127.0.0.1", STUB_PORT)
+	local ip, ips = dns.resolve "skynet.test"
+	print("skynet.test", ip, #ips)
+	assert(ip == "127.0.0.1")
+
+	local lid = socket.listen("127.0.0.1", ECHO_PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		socket.write(id, "hello")
+		socket.close(id)
+	end)
+	-- literal ip connects directly, host name is resolved by the resolver thread of socket server
+	local hosts = { ip, "localhost" }
+	for i = 1, 8 do
+		table.insert(hosts, "localhost")	-- more than one resolver thread
+	end
+	for _, host in ipairs(hosts) do
+		local fd = assert(socket.open(host, ECHO_PORT))
+		assert(socket.read(fd, 5) == "hello")
+		socket.close(fd)
+	end
+	print("connect", table.concat(hosts, " "), "ok")
+	-- the resolver fails, the connect fails
+	local fd, err = socket.open("bad_host!", ECHO_PORT)
+	print("connect", "bad_host!", fd, err)
+	assert(fd == nil)
+	socket.close(lid)
+	-- socket server is released with the resolver threads alive
+	skynet.abort()
+end)
+
+else
 
 skynet.start(function()
 	print("nameserver:", dns.server())	-- set nameserver
@@ -9,3 +77,5 @@ skynet.start(function()
 		print("github.com",v)
 	end
 end)
+
+end
@@ -0,0 +1,184 @@
+local skynet = require "skynet"
+local socket = require "socket"
+local driver = require "socketdriver"
+local netpack = require "netpack"
+require "skynet.manager"	-- import skynet.launch
+
+-- testframing [round] [count]
+-- For each framing (read service-src/framing.h), both the lua gate (service/gate.lua) and the C gate (service_gate.c)
+-- forward packages to an echo agent.
+-- fuzz : send random packages in random pieces, the echo should be the same ; an invalid header should close the connection.
+-- bench : count packages (32 bytes) per write, the packages per second.
+
+local mode = ...
+
+local FRAMINGS = { "be16", "be32", "le16", "le32", "varint", "type16" }
+local LUA_PORT = 8960
+local C_PORT = 8961
+
+if mode == "agent" then
+
+local _, name = ...
+local framing = netpack.framing(name)
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = skynet.tostring,
+}
+
+skynet.start(function()
+	skynet.dispatch("client", function(_, fd, msg)
+		socket.write(fd, netpack.header(framing, #msg) .. msg)
+	end)
+end)
+
+else
+
+local round, count = ...
+round = tonumber(round) or 200
+count = tonumber(count) or 1000
+
+local function gate_open(name, port, cgate)
+	local agent = skynet.newservice(SERVICE_NAME, "agent", name)
+	if cgate then
+		-- the framing name (with max) is the first parameter of C gate, watchdog is self
+		local gate = skynet.launch("gate", name, skynet.address(skynet.self()), "127.0.0.1:" .. port, 0, 64)
+		return function(fd)
+			driver.nodelay(fd)
+			skynet.send(gate, "text", string.format("forward %d :%08x :%08x", fd, agent, fd))
+			skynet.send(gate, "text", "start " .. fd)
+		end, function()
+			skynet.send(gate, "text", "close")
+		end
+	else
+		local gate = skynet.newservice("gate")
+		skynet.call(gate, "lua", "open", {
+			address = "127.0.0.1",
+			port = port,
+			maxclient = 64,
+			nodelay = true,
+			framing = name,
+			watchdog = skynet.self(),
+		})
+		return function(fd)
+			skynet.call(gate, "lua", "forward", fd, fd, agent)
+		end, function()
+			skynet.call(gate, "lua", "close")
+		end
+	end
+end
+
+local forward	-- current gate
+
+local function watchdog_open(fd)
+	if forward then
+		forward(fd)
+	end
+end
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(text) return text end,
+	unpack = skynet.tostring,
+	dispatch = function(_, _, msg)
+		local fd, cmd = msg:match "(%d+) (%a+)"
+		if cmd == "open" then
+			watchdog_open(tonumber(fd))
+		end
+	end
+}
+
+local function random_package(min, max)
+	local r = math.random()
+	local sz
+	if r < 0.05 then
+		sz = min
+	elseif r < 0.9 then
+		sz = math.random(1, math.min(max, 300))
+	else
+		sz = math.random(1, math.min(max, 100000))
+	end
+	return string.rep(string.char(math.random(0, 255)), sz)
+end
+
+local function fuzz(name, port, cgate)
+	local f = netpack.framing(name)
+	local max = select(2, name:match "^(%w+):?(%d*)$")
+	max = tonumber(max) or 0xffff
+	local fd = assert(socket.open("127.0.0.1", port))
+	driver.nodelay(fd)
+	for i = 1, round do
+		local packs = {}
+		for j = 1, math.random(1, 8) do
+			-- C gate ignores empty packages, type16 has a type byte at least
+			local msg = random_package((cgate or name:find "^type16") and 1 or 0, max)
+			packs[j] = netpack.header(f, #msg) .. msg
+		end
+		local stream = table.concat(packs)
+		-- write in random pieces (split the headers)
+		local pos = 1
+		while pos <= #stream do
+			local n = math.random(1, 8) == 1 and math.random(1, 3) or math.random(1, #stream)
+			socket.write(fd, stream:sub(pos, pos + n - 1))
+			pos = pos + n
+			if math.random(1, 4) == 1 then
+				skynet.sleep(0)
+			end
+		end
+		assert(socket.read(fd, #stream) == stream, name)
+	end
+	socket.close(fd)
+	-- a header larger than max should close the connection
+	fd = assert(socket.open("127.0.0.1", port))
+	local big = netpack.header(netpack.framing(name:match "^%w+"), max + 1)
+	socket.write(fd, big .. "x")
+	assert(socket.read(fd) == false, "invalid header should close the connection")
+	socket.close(fd)
+end
+
+local function bench(name, port)
+	local f = netpack.framing(name)
+	local msg = string.rep("x", 32)
+	local packs = string.rep(netpack.header(f, #msg) .. msg, count)
+	local fd = assert(socket.open("127.0.0.1", port))
+	local n = 0
+	local ti = skynet.now()
+	while skynet.now() - ti < 100 do
+		socket.write(fd, packs)
+		assert(socket.read(fd, #packs) == packs)
+		n = n + count
+	end
+	ti = (skynet.now() - ti) / 100
+	socket.close(fd)
+	return math.floor(n / ti)
+end
+
+local function test(gate, port, cgate)
+	for _, name in ipairs(FRAMINGS) do
+		-- limit the max of package to test the invalid header
+		local fname = name .. ":" .. (name:find "16" and 60000 or 200000)
+		local close
+		forward, close = gate_open(fname, port, cgate)
+		fuzz(fname, port, cgate)
+		local qps = bench(fname, port)
+		close()
+		forward = nil
+		port = port + 2
+		print(string.format("%s %s : fuzz %d rounds ok, %d packages/s", gate, name, round, qps))
+	end
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, subcmd, fd)
+		if cmd == "socket" and subcmd == "open" then
+			skynet.fork(watchdog_open, fd)
+		end
+	end)
+	math.randomseed(os.time())
+	test("lua gate", LUA_PORT)
+	test("C gate", C_PORT, true)
+end)
+
+end
@@ -0,0 +1,195 @@
+local skynet = require "skynet"
+local socket = require "socket"
+local driver = require "socketdriver"
+local netpack = require "netpack"
+require "skynet.manager"	-- import skynet.launch
+
+-- testgatelimit
+-- The rate limit of C gate (service_gate.c, the text command "limit") : drop / pause / close,
+-- per connection and per listener. An agent counts the packages forwarded by gate.
+
+local mode = ...
+
+local PORT = 8980
+local RATE = 100	-- packages per second
+local N = 500
+
+if mode == "agent" then
+
+local count = 0
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = skynet.tostring,
+}
+
+skynet.start(function()
+	skynet.dispatch("client", function()
+		count = count + 1
+	end)
+	skynet.dispatch("lua", function()
+		local n = count
+		count = 0
+		skynet.ret(skynet.pack(n))
+	end)
+end)
+
+else
+
+local agent
+local gate
+local report = {}	-- fd -> the last "limit" report
+local stat
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(text) return text end,
+	unpack = skynet.tostring,
+	dispatch = function(_, _, msg)
+		local fd, cmd, args = msg:match "(%-?%d+) (%a+) ?(.*)"
+		fd = tonumber(fd)
+		if cmd == "open" then
+			driver.nodelay(fd)
+			skynet.send(gate, "text", string.format("forward %d :%08x :%08x", fd, agent, fd))
+			skynet.send(gate, "text", "start " .. fd)
+		elseif cmd == "limit" then
+			report[fd] = args
+		elseif cmd == "stat" then
+			stat = args
+		end
+	end
+}
+
+local function packages(n)
+	local f = netpack.framing "be16"
+	return string.rep(netpack.header(f, 8) .. "limit!!!", n)
+end
+
+local function connect(n)
+	local fd = assert(socket.open("127.0.0.1", PORT))
+	socket.write(fd, packages(n))
+	return fd
+end
+
+local function count()
+	return skynet.call(agent, "lua")
+end
+
+local function wait_stat()
+	stat = nil
+	skynet.send(gate, "text", "stat")
+	while not stat do
+		skynet.sleep(1)
+	end
+	return stat
+end
+
+local function test_drop()
+	skynet.send(gate, "text", string.format("limit 0 %d 0 0 drop", RATE))
+	local fd = connect(N)
+	skynet.sleep(50)
+	local n = count()
+	-- the bucket is full at first (one second)
+	assert(n >= RATE and n < RATE * 2, n)
+	-- stat : connections, dropped packages, dropped bytes, paused, closed
+	local drop = wait_stat():match "%d+ (%d+)"
+	assert(tonumber(drop) == N - n, drop)
+	socket.close(fd)
+	print(string.format("drop : %d of %d packages forwarded, %s dropped", n, N, drop))
+end
+
+local function test_bytes()
+	-- 8 bytes per package
+	skynet.send(gate, "text", string.format("limit %d 0 0 0 drop", RATE * 8))
+	local fd = connect(N)
+	skynet.sleep(50)
+	local n = count()
+	assert(n >= RATE and n < RATE * 2, n)
+	socket.close(fd)
+	print(string.format("drop by bytes : %d of %d packages forwarded", n, N))
+end
+
+local function test_pause()
+	skynet.send(gate, "text", string.format("limit 0 %d 0 0 pause", RATE))
+	-- the bucket of a new connection is full, the rest are delayed.
+	-- the packages already read are forwarded (in debt), so write them in small pieces
+	local n = RATE * 3
+	local ti = skynet.now()
+	local fd = connect(0)
+	skynet.fork(function()
+		for i = 1, n // 10 do
+			socket.write(fd, packages(10))
+			skynet.sleep(1)
+		end
+	end)
+	local total = 0
+	while total < n do
+		skynet.sleep(10)
+		total = total + count()
+		assert(skynet.now() - ti < 1000, "timeout")
+	end
+	ti = (skynet.now() - ti) / 100
+	assert(total == n)
+	assert(ti >= 1.5, ti)
+	socket.close(fd)
+	print(string.format("pause : %d packages forwarded in %.2fs", n, ti))
+end
+
+local function test_close()
+	skynet.send(gate, "text", string.format("limit 0 %d 0 0 close", RATE))
+	local fd = connect(N)
+	assert(socket.read(fd) == false, "should be closed")
+	socket.close(fd)
+	skynet.sleep(10)
+	local n = count()
+	assert(n >= RATE and n < RATE * 2, n)
+	print(string.format("close : %d of %d packages forwarded before closed", n, N))
+end
+
+local function test_listen()
+	skynet.send(gate, "text", string.format("limit 0 0 0 %d drop", RATE))
+	local fds = {}
+	for i = 1, 4 do
+		fds[i] = connect(N // 4)
+	end
+	skynet.sleep(50)
+	local n = count()
+	assert(n >= RATE and n < RATE * 2, n)
+	for _, fd in ipairs(fds) do
+		socket.close(fd)
+	end
+	print(string.format("listen drop : %d of %d packages forwarded", n, N))
+end
+
+local function test_unlimited()
+	skynet.send(gate, "text", "limit 0 0 0 0")
+	local fd = connect(N)
+	local total = 0
+	while total < N do
+		skynet.sleep(1)
+		total = total + count()
+	end
+	socket.close(fd)
+	print(string.format("unlimited : %d packages forwarded", total))
+end
+
+skynet.start(function()
+	agent = skynet.newservice(SERVICE_NAME, "agent")
+	gate = skynet.launch("gate", "S", skynet.address(skynet.self()), "127.0.0.1:" .. PORT, 0, 64)
+	test_drop()
+	test_bytes()
+	test_pause()
+	test_close()
+	test_listen()
+	test_unlimited()
+	local action = {}
+	for _, v in pairs(report) do
+		action[v] = true
+	end
+	assert(action.drop and action.pause and action.close)
+	print("stat : " .. wait_stat())
+end)
+
+end
@@ -0,0 +1,96 @@
+local skynet = require "skynet"
+local harbor = require "skynet.harbor"
+require "skynet.manager"	-- import skynet.register
+
+-- testharborbench
+-- Run two nodes with start = "testharborbench" : harbor 1 (the master, examples/config) and harbor 2 (examples/config_log).
+-- Harbor 2 registers a global name, harbor 1 sends messages of different size to it (throughput), and calls it (rtt).
+-- The payload is packed records (compressible), set harbor_compress = 1024 and harbor_flags = 1 in both configs to compare the bytes on wire.
+-- Set address = "shm:/path" in both configs to compare the shared memory link.
+
+local NAME = "HARBORBENCH"
+local SIZES = { 16, 256, 4096, 65536 }
+local BYTES = 64 * 1024 * 1024	-- bytes of each size
+local MAXN = 200000
+local CALLS = 10000
+
+local function responder()
+	local count = 0
+	skynet.dispatch("lua", function(_, _, cmd, data)
+		if cmd == "push" then
+			count = count + 1
+		elseif cmd == "echo" then
+			skynet.ret(skynet.pack(data))
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count))
+			count = 0
+		elseif cmd == "exit" then
+			skynet.ret()
+			skynet.timeout(10, skynet.abort)
+		end
+	end)
+	skynet.register(NAME)
+end
+
+-- received bytes of loopback (both nodes are on the same host), nil if not linux
+local function wire_bytes()
+	local f = io.open "/proc/net/dev"
+	if not f then
+		return
+	end
+	for line in f:lines() do
+		local rx = line:match "^%s*lo:%s*(%d+)"
+		if rx then
+			f:close()
+			return tonumber(rx)
+		end
+	end
+	f:close()
+end
+
+local function payload(size)
+	local records = {}
+	local sz = 0
+	local i = 0
+	while sz < size do
+		i = i + 1
+		local r = skynet.packstring { uid = i, name = "player" .. i, level = i % 60, pos = { x = i * 1.5, y = i * 2 } }
+		records[i] = r
+		sz = sz + #r
+	end
+	return table.concat(records):sub(1, size)
+end
+
+local function bench()
+	harbor.connect(2)
+	local addr = harbor.queryname(NAME)
+	for _, size in ipairs(SIZES) do
+		local data = payload(size)
+		local n = math.min(MAXN, BYTES // size)
+		local bytes = wire_bytes()
+		local ti = skynet.now()
+		for i = 1, n do
+			skynet.send(addr, "lua", "push", data)
+		end
+		assert(skynet.call(addr, "lua", "count") == n)
+		ti = math.max(skynet.now() - ti, 1) / 100
+		local wire = bytes and string.format(" wire %.2fx", (wire_bytes() - bytes) / (n * size)) or ""
+		print(string.format("send %5d bytes x %6d : %.2fs %8d msg/s %7.1f MB/s%s", size, n, ti, math.floor(n / ti), n * size / ti / 1e6, wire))
+	end
+	local ti = skynet.now()
+	for i = 1, CALLS do
+		assert(skynet.call(addr, "lua", "echo", i) == i)
+	end
+	ti = math.max(skynet.now() - ti, 1) / 100
+	print(string.format("call x %d : %.2fs %.1f us/call", CALLS, ti, ti * 1e6 / CALLS))
+	skynet.call(addr, "lua", "exit")
+	skynet.abort()
+end
+
+skynet.start(function()
+	if tonumber(skynet.getenv "harbor") == 2 then
+		responder()
+	else
+		skynet.fork(bench)
+	end
+end)
@@ -1,12 +1,31 @@
 local skynet = require "skynet"
 local harbor = require "skynet.harbor"
 
+-- Set harbor_timeout (and harbor_heartbeat, harbor_flags = 1) in the config, and stop harbor 2 (kill -STOP) to test the timeout.
+
+local function stat(id)
+	local s = harbor.stat(id)
+	return string.format("status = %s rtt = %dus srtt = %dus send = %d recv = %d queue = %d drop = %d",
+		s.status, s.rtt, s.srtt, s.send, s.recv, s.queue, s.drop)
+end
+
 skynet.start(function()
 	print("wait for harbor 2")
 	print("run skynet examples/config_log please")
 	harbor.connect(2)
 	print("harbor 2 connected")
-	print("LOG =", skynet.address(harbor.queryname "LOG"))
+	local log = harbor.queryname "LOG"
+	print("LOG =", skynet.address(log))
+	local linked = true
+	skynet.fork(function()
+		while linked do
+			print(stat(2))
+			skynet.sleep(100)
+		end
+	end)
 	harbor.link(2)
-	print("disconnected")
+	linked = false
+	print("disconnected", stat(2))
+	local ti = skynet.now()
+	print("call LOG :", pcall(skynet.call, log, "lua", "ping"), (skynet.now() - ti) * 10 .. "ms")
 end)
@@ -0,0 +1,271 @@
+local skynet = require "skynet"
+local core = require "cluster.core"
+require "skynet.manager"	-- import skynet.abort
+
+-- testlz4
+-- 3rd/lz4 (harbor_compress, cluster_compress) is checked against the upstream LZ4 : the blocks below are compressed
+-- by liblz4 1.9.4 (LZ4_compress_default, and LZ4_compress_HC level 12 if it's different), they should be decompressed
+-- to the same data. The malformed blocks (truncated, wrong size, bad offset, long length, random bytes) should be rejected.
+-- The blocks compressed by 3rd/lz4 are checked by liblz4 1.9.4 in the other direction (LOCAL).
+-- The blocks are decompressed by cluster.core.unpackresponse, a compressed response is DWORD size + lz4 block.
+-- Run the fuzz target 3rd/lz4/lz4_fuzz.c (make lz4fuzz) for the random inputs, it checks both directions by liblz4.
+
+local function rand(n, seed)
+	local x = seed
+	local tmp = {}
+	for i = 1, n do
+		x = (x * 1103515245 + 12345) & 0x7fffffff
+		tmp[i] = string.char((x >> 16) & 0xff)
+	end
+	return table.concat(tmp)
+end
+
+local function records(n)
+	local tmp = {}
+	for i = 1, n do
+		tmp[i] = string.format("player%d level %d\n", i, i % 60)
+	end
+	return table.concat(tmp)
+end
+
+local DATA = {
+	text = string.rep("skynet cluster ", 200),
+	rle = string.rep("a", 1000),
+	records = records(100),
+	random = rand(300, 1),
+	mixed = rand(300, 2) .. string.rep("skynet cluster ", 20) .. rand(50, 3) .. string.rep("ab", 500),
+	short = "hello",
+	far = rand(100, 4) .. string.rep("z", 65000) .. rand(100, 4),
+}
+
+-- name, compressor, hex of the block
+local UPSTREAM = {
+	{ "text", "default", [[
+		ff00736b796e657420636c7573746572200f00ffffffffffffffffffffff9c507374657220
+]] },
+	{ "rle", "default", [[
+		1f610100ffffffd2506161616161
+]] },
+	{ "records", "default", [[
+		f201706c6179657231206c6576656c20310a100013321000133210001333100013331000133410001334100013351000
+		1335100013361000133610001337100013371000133810001338100013391000133910002331301100243130120005a3
+		0004a4001431a5001431a6001431a7001431a8001431a9001431aa001431ab001431ac001431ad001431ae001431af00
+		1431b0001431b1001431b2001431b3001431b4001432b4001432b4001432b4001432b4001432b4001432b4001432b400
+		1432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b400
+		1432b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b400
+		1433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001434b4001434b4001434b400
+		1434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b400
+		1434b4001434b4001434b4001434b4001434b4001435b4001435b4001435b4001435b4001435b4001435b4001435b400
+		1435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b400
+		1435b4001436b40004b3001436b30004b2001436b20004b1001436b10004b0001436b00004af001536af0003d8031436
+		ae0004ad001436ad0004ac001436ac0004ab001436ab0004aa001437aa00052e041537ab0004ac001437ac00052e0414
+		37ad00052e041437ae00052e041437af00052e041437b000052e041437b100052e041437b200052e041437b300052e04
+		1438b400052e041438b400052e041438b400052e041438b400052e041438b400052e041438b400052e041438b400052e
+		041438b400052e041438b400052e041438b400052e041439b400052e041439b400052e041439b400052e041439b40005
+		2e041439b400052e041439b400052e041439b400052e041439b400052e041439b400052e041439b400052e04d0313030
+		206c6576656c2034300a
+]] },
+	{ "records", "hc", [[
+		f201706c6179657231206c6576656c20310a100013321000133210001333100013331000133410001334100013351000
+		133510001336100013361000133710001337100013381000133810001339100023390a9000143091001430120005a300
+		143112001432120014321200143312001433120014341200143412001435120014351200143612001436120014371200
+		143712001438120014381200143912001439340114303501143012001431120005580105590114321200143312001433
+		120014341200143412001435120014351200143612001436120014371200143712001438120014381200143912001439
+		d8011430d90114301200143112001431120014321200050e02050f021433120014341200143412001435120014351200
+		1436120014361200143712001437120014381200143812001439120014397c0214307d02143012001431120014311200
+		14321200143212001433120005c40205c502143412001435120014351200143612001436120014371200143712001438
+		120014381200143912001439200314302103143012001431120014311200143212001432120014331200143312001434
+		1200057a03057b0314351200143612001436120014371200143712001438120014381200143912001439c40304b40014
+		3011000c26041c3627041c3628041c3629041d362a040c2b041c362c041c362d041c362e041d372e041d372e041d372e
+		041d372e041d372e041d372e041d372e041d372e041d372e041d372e041d382e041d382e041d382e041d382e041d382e
+		041d382e041d382e041d382e041d382e041d382e041d392e041d392e041d392e041d392e041d392e041d392e041d392e
+		041d392e041d392e041d392e04d0313030206c6576656c2034300a
+]] },
+	{ "random", "default", [[
+		f0ff1ec67e816b4bfbe2fb54f6bddf7c1ce18701bf31de56720f4767668759aa883c59ea56137bd285a1d83c54552f37
+		ae655bda027998cce31a768e5fd9998f1f3f36ee43784d0dfabea6dae4868edc296d4eff56e17020fb8fb1580590c509
+		dc53cdaa3b489952d3529d069feab5c206139849b2011eac3288319c52469571368f57f6391d16fa8874f5987c175c41
+		bb6d718e0f7059c7011b2f333d91c01da50d0dab338d7e5e8f3ee66874a63ab1c39311a864c7dbcae060e1f3bf090067
+		a2e325a0213187d562c5a84f7e2e096b949fb06da99e5a0b467080b6cf470ca6a52ad8acfba0ebb779247223924880c5
+		a6a785b7d78c90e4ab63445266e39c3325f95eaaba73605d4b717ebea98c571971c3ca5ee52a33ac885166a17b756764
+		9a69ef6f5642a01d51c502f7bb9245
+]] },
+	{ "mixed", "default", [[
+		ffff2d8c21ff72edd718d94e139513dc1b63fc9306f6bf9ce506e06db00a059ff275878e34b3bcb32be202c0a1518c80
+		23b9ec6d6f3d640e9c23ec170750033f018536df3a5c714fec000900c7af8559a0f13053d8955fd38d7082ca83d5ed0f
+		d1d364f74b3168bab32b44859ee9d65e28c31ebc573788e250a6f9ff3cd19c07f717694f7f6c7aeb17190dc73e365888
+		53e710200559b8337c7baa2d497de6200e099e5eed447ddab183bb3fbfcde2cebb155df8f934c5bfaaa8ebcdc30fa551
+		ac61599daef04b811921a66538e84c28f6055dbc4c00897d72e51656c1c0b0926ad7f483d9aabbd5e7ab26afc2bd6e8f
+		9c6e69e216f5db666bea82405dc7dfdde023c68987a8a5d0b2d99498758620fa470ad7e56f4b93712e6f8704ad5e0b27
+		a5fc2726d023e1691363479568793b736b796e657420636c7573746572200f00ff0bff2553c37d788eb44db7482f6d46
+		3d19e570244cbba0e358fc7874fa8cb1955cafb5321253fe93d1232c45ed4ce9c9990d7dffdc61620200ffffffd15062
+		61626162
+]] },
+	{ "short", "default", [[
+		5068656c6c6f
+]] },
+	{ "far", "default", [[
+		ff571966fb7f2f908295424b45799d1767e5b593808129caf3107a430f5d8ac7e8e3d6f0f33f73766456ca394846130e
+		610e924ac5fc940f35da28593ed79ec71237c12a24bad3cf85cd4d8c0173538df8f2f9dcfe3d38b13225ae7f5f3e19bb
+		d492926a03087a7a0200ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffffd10f4cfe4c5092926a0308
+]] },
+	{ "far", "hc", [[
+		ff561966fb7f2f908295424b45799d1767e5b593808129caf3107a430f5d8ac7e8e3d6f0f33f73766456ca394846130e
+		610e924ac5fc940f35da28593ed79ec71237c12a24bad3cf85cd4d8c0173538df8f2f9dcfe3d38b13225ae7f5f3e19bb
+		d492926a03087a0100ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff
+		ffffffffffffffffffffffffffffffffffffffffffffffd20f4cfe4c5092926a0308
+]] },
+}
+
+-- the blocks compressed by 3rd/lz4 (LZ4_compress_default), they are decoded to the same data by liblz4 1.9.4.
+-- 3rd/lz4 should compress to the same blocks, or check the new blocks by liblz4 again (read 3rd/lz4/lz4_fuzz.c).
+local LOCAL = {
+	{ "text", [[
+		ff00736b796e657420636c7573746572200f00ffffffffffffffffffffff9c507374657220
+]] },
+	{ "rle", [[
+		1f610100ffffffd2506161616161
+]] },
+	{ "records", [[
+		f201706c6179657231206c6576656c20310a100013321000133210001333100013331000133410001334100013351000
+		1335100013361000133610001337100013371000133810001338100013391000133910002331301100243130120005a3
+		0004a4001431a5001431a6001431a7001431a8001431a9001431aa001431ab001431ac001431ad001431ae001431af00
+		1431b0001431b1001431b2001431b3001431b4001432b4001432b4001432b4001432b4001432b4001432b4001432b400
+		1432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b4001432b400
+		1432b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b400
+		1433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001433b4001434b4001434b4001434b400
+		1434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b4001434b400
+		1434b4001434b4001434b4001434b4001434b4001435b4001435b4001435b4001435b4001435b4001435b4001435b400
+		1435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b4001435b400
+		1435b4001436b40004b3001436b30004b2001436b20004b1001436b10004b0001436b00004af001536af0003d8031436
+		ae0004ad001436ad0004ac001436ac0004ab001436ab0004aa001437aa00052e041537ab0004ac001437ac00052e0414
+		37ad00052e041437ae00052e041437af00052e041437b000052e041437b100052e041437b200052e041437b300052e04
+		1438b400052e041438b400052e041438b400052e041438b400052e041438b400052e041438b400052e041438b400052e
+		041438b400052e041438b400052e041438b400052e041439b400052e041439b400052e041439b400052e041439b40005
+		2e041439b400052e041439b400052e041439b400052e041439b400052e041439b400052e041439b400052e04d0313030
+		206c6576656c2034300a
+]] },
+	{ "mixed", [[
+		ffff2d8c21ff72edd718d94e139513dc1b63fc9306f6bf9ce506e06db00a059ff275878e34b3bcb32be202c0a1518c80
+		23b9ec6d6f3d640e9c23ec170750033f018536df3a5c714fec000900c7af8559a0f13053d8955fd38d7082ca83d5ed0f
+		d1d364f74b3168bab32b44859ee9d65e28c31ebc573788e250a6f9ff3cd19c07f717694f7f6c7aeb17190dc73e365888
+		53e710200559b8337c7baa2d497de6200e099e5eed447ddab183bb3fbfcde2cebb155df8f934c5bfaaa8ebcdc30fa551
+		ac61599daef04b811921a66538e84c28f6055dbc4c00897d72e51656c1c0b0926ad7f483d9aabbd5e7ab26afc2bd6e8f
+		9c6e69e216f5db666bea82405dc7dfdde023c68987a8a5d0b2d99498758620fa470ad7e56f4b93712e6f8704ad5e0b27
+		a5fc2726d023e1691363479568793b736b796e657420636c7573746572200f00ff0bff2553c37d788eb44db7482f6d46
+		3d19e570244cbba0e358fc7874fa8cb1955cafb5321253fe93d1232c45ed4ce9c9990d7dffdc61620200ffffffd15062
+		61626162
+]] },
+}
+
+local function decompress(size, block)
+	local ok, _, succ, msg = pcall(core.unpackresponse, string.pack("<I4BI4", 1, 0x41, size) .. block)
+	if ok then
+		assert(succ and #msg == size)
+		return msg
+	end
+end
+
+local function unhex(hex)
+	return (hex:gsub("%s", ""):gsub("%x%x", function(c) return string.char(tonumber(c, 16)) end))
+end
+
+local function test_upstream()
+	for _, v in ipairs(UPSTREAM) do
+		local name, compressor, block = v[1], v[2], unhex(v[3])
+		local data = DATA[name]
+		assert(decompress(#data, block) == data, name)
+		-- truncated or wrong size
+		for i = 0, #block - 1 do
+			assert(decompress(#data, block:sub(1, i)) == nil, name)
+		end
+		assert(decompress(#data - 1, block) == nil)
+		assert(decompress(#data + 1, block) == nil)
+		print(string.format("upstream %-8s %-8s %5d -> %5d ok", name, compressor, #block, #data))
+	end
+end
+
+-- the blocks of 3rd/lz4 are the packed responses : WORD sz + session (4 bytes) + type (1 byte) + DWORD size + block
+local function test_local()
+	for _, v in ipairs(LOCAL) do
+		local name, block = v[1], unhex(v[2])
+		local data = DATA[name]
+		local msg = core.packresponse(1, true, data, nil, 1)
+		assert(msg:byte(7) == 0x41 and msg:sub(12) == block, name)
+		assert(decompress(#data, block) == data, name)
+		print(string.format("local    %-8s %5d -> %5d ok", name, #data, #block))
+	end
+end
+
+local function test_roundtrip()
+	for name, data in pairs(DATA) do
+		if #data <= 0x8000 then
+			-- the packed response is WORD sz + response
+			local msg = core.packresponse(1, true, data, nil, 1):sub(3)
+			local _, ok, r = core.unpackresponse(msg)
+			assert(ok and r == data, name)
+		end
+	end
+	print("roundtrip ok")
+end
+
+local function test_malformed()
+	local BAD = {
+		-- offset 0
+		{ 5, "\x10a\x00\x00" },
+		-- offset before the output
+		{ 5, "\x10a\x02\x00" },
+		-- the literals are out of the input
+		{ 20, "\xf0\x05abc" },
+		{ 300, "\xf0\xff\xff" },
+		-- the match is larger than the output
+		{ 5, "\x1fa\x01\x00\xff\x00" },
+		-- the match length is out of the input
+		{ 300, "\x1fa\x01\x00\xff\xff" },
+		-- no last literals
+		{ 5, "\x10a\x01\x00" },
+		-- empty block
+		{ 0, "" },
+		-- the empty block is a zero token only
+		{ 0, "\x01" },
+	}
+	for i, v in ipairs(BAD) do
+		assert(decompress(v[1], v[2]) == nil, i)
+	end
+	-- random bytes, and the upstream blocks with random bytes changed
+	local n = 0
+	for i = 1, 10000 do
+		local block
+		if i % 2 == 0 then
+			block = rand(math.random(1, 64), i)
+		else
+			local v = UPSTREAM[math.random(#UPSTREAM)]
+			local tmp = { unhex(v[3]):byte(1, -1) }
+			for j = 1, math.random(1, 4) do
+				tmp[math.random(#tmp)] = math.random(0, 255)
+			end
+			block = string.char(table.unpack(tmp))
+		end
+		if decompress(math.random(0, 2000), block) then
+			n = n + 1
+		end
+	end
+	print("malformed ok", n .. " of 10000 random blocks decoded")
+end
+
+skynet.start(function()
+	test_upstream()
+	test_local()
+	test_roundtrip()
+	test_malformed()
+	skynet.abort()
+end)
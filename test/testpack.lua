@@ -0,0 +1,248 @@
+local skynet = require "skynet"
+
+-- testpack [times]
+-- Check skynet.pack / skynet.unpack round trip, then benchmark them with different shapes of payload.
+
+local times = tonumber((...)) or 1
+
+local function equal(a, b)
+	if type(a) ~= type(b) then
+		return false
+	end
+	if type(a) ~= "table" then
+		if a ~= a then
+			return b ~= b	-- nan
+		end
+		return a == b and math.type(a) == math.type(b)
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function check(...)
+	local args = table.pack(...)
+	local msg, sz = skynet.pack(...)
+	local ret = table.pack(skynet.unpack(msg, sz))
+	skynet.trash(msg, sz)
+	assert(equal(args, ret), "pack/unpack mismatch")
+	local str = skynet.packstring(...)
+	assert(#str == sz)
+	ret = table.pack(skynet.unpack(str))
+	assert(equal(args, ret), "packstring/unpack mismatch")
+end
+
+local function test_roundtrip()
+	check()
+	check(nil, true, false, 0, 1, -1, 255, 256, 65535, 65536, -65536, 0x7fffffff, -0x80000000,
+		0x80000000, math.maxinteger, math.mininteger, 0.5, -1.5, 1/0, -1/0, 0/0)
+	check("", "short", string.rep("x", 31), string.rep("y", 32), string.rep("z", 65535), string.rep("w", 65536))
+	check({}, { 1, 2, 3 }, { a = 1, b = { c = { d = "e" } } }, { 1, 2, nil, 4, x = "y" })
+	local array = {}
+	for i = 1, 1000 do
+		array[i] = i * 3
+	end
+	check(array)
+	local mixed = {}
+	for i = 1, 100 do
+		mixed[i] = i % 3 == 0 and tostring(i) or (i % 3 == 1 and i or i + 0.5)
+	end
+	check(mixed)
+	-- typed arrays (homogeneous array part), with or without hash part
+	local function range(from, n, step, f)
+		local r = {}
+		for i = 1, n do
+			local v = from + (i - 1) * step
+			r[i] = f and f(v) or v
+		end
+		return r
+	end
+	check(range(-128, 10, 25), range(-32768, 10, 7000), range(-0x80000000, 10, 0x1000000), range(math.mininteger, 10, 0x1000000000000000))
+	check(range(1, 8, 1), range(1, 7, 1), range(1, 100, 0.5), range(0, 20, 1, tostring), range(0, 9, 1, function(v) return string.rep("s", v * 40) end))
+	check(range(0, 8, 1, function(v) return string.rep("L", 70000 + v) end))
+	local t = range(1, 20, 1)
+	t.x = "hash"
+	t[0] = 0
+	check(t)
+	local m = range(1, 20, 1)
+	m[10] = 1.5	-- integer and real
+	check(m)
+	m[10] = "10"
+	check(m)
+	local f = range(1, 20, 0.5)
+	f[3] = 2	-- integer in reals
+	check(f, { 0/0, -0.0, 1/0, -1/0, 1, 2, 3, 4 }, { 0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0 })
+	assert(math.type(select(3, skynet.unpack(skynet.packstring(nil, nil, { 0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0 })))[1]) == "float")
+	-- large table crosses the stack buffer
+	local large = {}
+	for i = 1, 2000 do
+		large[i] = { uid = i, name = "player" .. i }
+	end
+	check(large, "tail")
+	-- __pairs
+	local proxy = setmetatable({}, { __pairs = function(t)
+		return next, { x = 1, y = 2 }, nil
+	end })
+	local msg, sz = skynet.pack(proxy)
+	assert(equal(skynet.unpack(msg, sz), { x = 1, y = 2 }))
+	skynet.trash(msg, sz)
+	-- too deep
+	local deep = {}
+	local t = deep
+	for i = 1, 40 do
+		t[1] = {}
+		t = t[1]
+	end
+	assert(not pcall(skynet.pack, deep))
+	assert(not pcall(skynet.pack, print))
+	print("roundtrip ok")
+end
+
+local KEYS = { "uid", "name", "level", "hp", "mp", "pos", "x", "y", "z", "id", "tag", "left", "right" }
+
+local function test_dictionary()
+	local dict = skynet.dictionary(KEYS)
+	local function dcheck(...)
+		local args = table.pack(...)
+		local msg, sz = dict.pack(...)
+		local ret = table.pack(dict.unpack(msg, sz))
+		skynet.trash(msg, sz)
+		assert(equal(args, ret), "dictionary pack/unpack mismatch")
+		local str = dict.packstring(...)
+		assert(#str == sz)
+		ret = table.pack(dict.unpack(str))
+		assert(equal(args, ret), "dictionary packstring/unpack mismatch")
+		return sz
+	end
+	local record = { uid = 10001, name = "player", level = 30, pos = { x = 1, y = 2, z = 3 }, [("u"):rep(2) .. "id"] = "uid" }
+	local sz = dcheck(record, "x", "hp", "not in dictionary", { 1, 2, 3, tag = "id" })
+	assert(sz < #skynet.packstring(record, "x", "hp", "not in dictionary", { 1, 2, 3, tag = "id" }))
+	-- a key built at runtime is the same (interned) string
+	assert(#dict.packstring("u" .. ("i"):rep(1) .. "d") == 2)
+	-- without dictionary
+	assert(not pcall(skynet.unpack, dict.packstring("uid")))
+	assert(skynet.unpack(dict.packstring("player")) == "player")
+	-- uint16 index
+	local keys = {}
+	for i = 1, 1000 do
+		keys[i] = "key" .. i
+	end
+	local big = skynet.dictionary(keys)
+	local t = {}
+	for i = 1, 1000, 7 do
+		t[keys[i]] = i
+	end
+	local str = big.packstring(t, keys[1000])
+	assert(equal({ big.unpack(str) }, { t, keys[1000] }))
+	assert(not pcall(dict.unpack, str))
+	assert(not pcall(skynet.dictionary, { "a", "a" }))
+	assert(not pcall(skynet.dictionary, { string.rep("x", 41) }))
+	assert(not pcall(skynet.dictionary, { 1 }))
+	print("dictionary ok")
+end
+
+local SHAPES = {}
+
+SHAPES.small = { 1000000, function()
+	return "lua", "call", 1001, true
+end }
+
+SHAPES.record = { 200000, function()
+	return { uid = 10001, name = "player", level = 30, hp = 1000, mp = 500, pos = { x = 1.5, y = 2.5, z = 0 } }
+end }
+
+SHAPES.nested = { 20000, function()
+	local function tree(depth)
+		if depth == 0 then
+			return { id = depth, tag = "leaf" }
+		end
+		return { id = depth, left = tree(depth - 1), right = tree(depth - 1) }
+	end
+	return tree(6)
+end }
+
+SHAPES.records = { 2000, function()
+	local list = {}
+	for i = 1, 100 do
+		list[i] = { uid = i, name = "player" .. i, hp = i * 10, pos = { x = i, y = i * 2 } }
+	end
+	return list
+end }
+
+SHAPES.intarray = { 2000, function()
+	local list = {}
+	for i = 1, 1000 do
+		list[i] = i * 1000
+	end
+	return list
+end }
+
+SHAPES.realarray = { 2000, function()
+	local list = {}
+	for i = 1, 1000 do
+		list[i] = i * 0.25
+	end
+	return list
+end }
+
+SHAPES.strarray = { 2000, function()
+	local list = {}
+	for i = 1, 1000 do
+		list[i] = "item" .. i
+	end
+	return list
+end }
+
+SHAPES.large = { 100, function()
+	return string.rep("x", 1024 * 1024)
+end }
+
+local ORDER = { "small", "record", "nested", "records", "intarray", "realarray", "strarray", "large" }
+
+local function bench(name, dict)
+	local n, gen = table.unpack(SHAPES[name])
+	n = math.max(1, math.floor(n * times))
+	local args = table.pack(gen())
+	local pack, unpack, trash = skynet.pack, skynet.unpack, skynet.trash
+	if dict then
+		pack, unpack = dict.pack, dict.unpack
+		name = name .. "+dict"
+	end
+	local msg, sz = pack(table.unpack(args, 1, args.n))
+	trash(msg, sz)
+	local t = os.clock()
+	for i = 1, n do
+		trash(pack(table.unpack(args, 1, args.n)))
+	end
+	local tpack = os.clock() - t
+	msg, sz = pack(table.unpack(args, 1, args.n))
+	t = os.clock()
+	for i = 1, n do
+		unpack(msg, sz)
+	end
+	local tunpack = os.clock() - t
+	trash(msg, sz)
+	print(string.format("%-12s %8d bytes x %7d : pack %7.3fs (%6.0f MB/s) unpack %7.3fs (%6.0f MB/s)",
+		name, sz, n, tpack, sz * n / tpack / 1e6, tunpack, sz * n / tunpack / 1e6))
+end
+
+skynet.start(function()
+	test_roundtrip()
+	test_dictionary()
+	for _, name in ipairs(ORDER) do
+		bench(name)
+	end
+	local dict = skynet.dictionary(KEYS)
+	for _, name in ipairs { "record", "nested", "records" } do
+		bench(name, dict)
+	end
+	skynet.exit()
+end)
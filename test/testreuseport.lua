@@ -0,0 +1,104 @@
+local skynet = require "skynet"
+local socket = require "socket"
+
+-- Connection rate benchmark of one listener vs K SO_REUSEPORT listeners.
+-- Each listener is a service which accepts, does some work (like a gate for a login),
+-- writes a byte and closes. With K listeners the kernel shards the accepts among K services.
+--
+-- testreuseport [K] [client] [seconds] [work]
+
+local mode = ...
+
+if mode == "listener" then
+
+local _, port, reuseport, work = ...
+port = tonumber(port)
+work = tonumber(work)
+
+skynet.start(function()
+	local accepted = 0
+	local id = socket.listen("127.0.0.1", port, nil, reuseport == "true")
+	socket.start(id, function(fd)
+		local x = 0
+		for i=1,work do
+			x = x + i
+		end
+		accepted = accepted + 1
+		socket.start(fd)
+		socket.write(fd, "x")
+		socket.close(fd)
+	end)
+	skynet.dispatch("lua", function()
+		socket.close(id)
+		skynet.ret(skynet.pack(accepted))
+		skynet.exit()
+	end)
+end)
+
+elseif mode == "client" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, port, seconds)
+		local n = 0
+		local stop = skynet.now() + seconds * 100
+		while skynet.now() < stop do
+			local fd = socket.open("127.0.0.1", port)
+			if fd then
+				if socket.read(fd, 1) then
+					n = n + 1
+				end
+				socket.close(fd)
+			end
+		end
+		skynet.ret(skynet.pack(n))
+		skynet.exit()
+	end)
+end)
+
+else
+
+local K, client, seconds, work = ...
+K = tonumber(K) or 4
+client = tonumber(client) or 16
+seconds = tonumber(seconds) or 3
+work = tonumber(work) or 20000
+
+local function bench(k, port)
+	local listeners = {}
+	for i=1,k do
+		listeners[i] = skynet.newservice(SERVICE_NAME, "listener", port, tostring(k > 1), work)
+	end
+	local clients = {}
+	for i=1,client do
+		clients[i] = skynet.newservice(SERVICE_NAME, "client")
+	end
+	local total = 0
+	local done = 0
+	local co = coroutine.running()
+	for _, c in ipairs(clients) do
+		skynet.fork(function()
+			local n = skynet.call(c, "lua", port, seconds)
+			total = total + n
+			done = done + 1
+			if done == client then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait()
+	local shard = {}
+	for i, l in ipairs(listeners) do
+		shard[i] = skynet.call(l, "lua")
+	end
+	print(string.format("%d listener(s) : %d connections in %ds, %d conn/s, accepts per listener %s",
+		k, total, seconds, total // seconds, table.concat(shard, " ")))
+end
+
+skynet.start(function()
+	skynet.fork(function()
+		bench(1, 8910)
+		bench(K, 8911)
+	end)
+end)
+
+end
@@ -0,0 +1,108 @@
+local skynet = require "skynet"
+local socket = require "socket"
+local httpd = require "http.httpd"
+local sockethelper = require "http.sockethelper"
+
+-- testsendfile [size(M)] [round]
+-- send a file by socket.sendfile between two socket.write, check the order and content,
+-- and a file as the body of httpd.write_response (by sendfile, or by a user writefunc),
+-- then compare the time of sendfile and io.read + socket.write
+
+local size, round = ...
+size = (tonumber(size) or 16) * 1024 * 1024
+round = tonumber(round) or 8
+
+local PORT = 8930
+local FILENAME = os.tmpname()
+
+local function makefile()
+	local f = assert(io.open(FILENAME, "wb"))
+	local block = {}
+	for i = 0, 255 do
+		block[#block+1] = string.char(i)
+	end
+	block = string.rep(table.concat(block), 4096)	-- 1M
+	local n = 0
+	while n < size do
+		local s = block:sub(1, size - n)
+		f:write(s)
+		n = n + #s
+	end
+	f:close()
+end
+
+local function reader(fd, expect)
+	local n = 0
+	while n < expect do
+		local s = assert(socket.read(fd))
+		n = n + #s
+	end
+end
+
+skynet.start(function()
+	makefile()
+	local content = io.open(FILENAME, "rb"):read "a"
+	local sender
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		sender = id
+	end)
+	local fd = assert(socket.open("127.0.0.1", PORT))
+	while not sender do
+		skynet.sleep(1)
+	end
+
+	-- order : high list (write) and file are sent in order
+	socket.write(sender, "head")
+	assert(socket.sendfile(sender, FILENAME))
+	local f = io.open(FILENAME, "rb")
+	assert(socket.sendfile(sender, f, 10, 100))	-- part of file by file handle
+	f:close()
+	socket.write(sender, "tail")
+	assert(socket.read(fd, 4) == "head")
+	assert(socket.read(fd, size) == content)
+	assert(socket.read(fd, 100) == content:sub(11, 110))
+	assert(socket.read(fd, 4) == "tail")
+	print("sendfile order ok")
+
+	-- httpd : sockethelper.writefunc sends the file body by sendfile, other writefunc gets strings
+	local header = string.format("HTTP/1.1 200 OK\r\ncontent-length: %d\r\n\r\n", size)
+	f = io.open(FILENAME, "rb")
+	assert(httpd.write_response(sockethelper.writefunc(sender), 200, f))
+	f:close()
+	assert(socket.read(fd, #header + size) == header .. content)
+	local output = {}
+	f = io.open(FILENAME, "rb")
+	assert(httpd.write_response(function(s)
+		assert(type(s) == "string")
+		table.insert(output, s)
+	end, 200, f))
+	f:close()
+	assert(table.concat(output) == header .. content)
+	print("httpd file body ok")
+
+	local function bench(name, send)
+		local ti = skynet.now()
+		for i = 1, round do
+			send()
+		end
+		reader(fd, size * round)
+		ti = (skynet.now() - ti) / 100
+		print(string.format("%s : %d M * %d, %.2fs, %.1f M/s", name, size // (1024 * 1024), round, ti, size * round / (1024 * 1024) / (ti > 0 and ti or 0.01)))
+	end
+
+	bench("sendfile", function()
+		socket.sendfile(sender, FILENAME)
+	end)
+	bench("read+write", function()
+		local f = io.open(FILENAME, "rb")
+		socket.write(sender, f:read "a")
+		f:close()
+	end)
+
+	socket.close(fd)
+	socket.close(sender)
+	socket.close(lid)
+	os.remove(FILENAME)
+end)
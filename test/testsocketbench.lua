@@ -0,0 +1,208 @@
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"	-- import skynet.launch, skynet.abort
+local driver = require "socketdriver"
+
+-- Round trip benchmark of the socket server. Build skynet with and without the socket server options
+-- (-DEPOLL_EDGE_TRIGGER for example) and compare the qps and the syscalls per round trip :
+-- rw is the read/write syscalls of the process (syscr + syscw in /proc/self/io, includes the clients).
+-- Count the syscalls of the poll backend with strace, for example : strace -f -c -e trace=epoll_wait,epoll_ctl
+--
+-- testsocketbench [echo|gate|cgate] [client] [round] [size] [batch]
+--   echo : socket.lua echo server
+--   gate : gate service (2 bytes header) forward packages to an echo agent
+--   cgate : the C gate (service_gate.c) forward packages to an echo agent
+--   gate and cgate send one package per write and then 8 packages per write (pipeline),
+--   batch : the gate forwards the packages of one read in one PTYPE_CLIENT_BATCH message
+
+local mode, client, round, size, batch = ...
+batch = batch == "batch"
+client = tonumber(client) or 20
+round = tonumber(round) or 1000
+size = tonumber(size) or 64
+
+local ECHO_PORT = 8901
+local GATE_PORT = 8902
+local CGATE_PORT = 8903
+
+local function echo(id)
+	socket.start(id)
+	while true do
+		local str = socket.read(id)
+		if str then
+			socket.write(id, str)
+		else
+			socket.close(id)
+			return
+		end
+	end
+end
+
+if mode == "echoserver" then
+
+skynet.start(function()
+	local id = socket.listen("127.0.0.1", ECHO_PORT)
+	socket.start(id, function(id, addr)
+		skynet.fork(echo, id)
+	end)
+	skynet.dispatch("lua", function()
+		skynet.ret()
+	end)
+end)
+
+elseif mode == "agent" then
+
+local netpack = require "netpack"
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = skynet.tostring,
+}
+
+skynet.register_protocol {
+	name = "client_batch",
+	id = skynet.PTYPE_CLIENT_BATCH,
+	unpack = netpack.unbatch,
+}
+
+skynet.start(function()
+	-- gate redirect package with source = fd (see watchdog below)
+	skynet.dispatch("client", function(_, fd, msg)
+		socket.write(fd, string.pack(">s2", msg))
+	end)
+	skynet.dispatch("client_batch", function(_, fd, msgs)
+		for i, msg in ipairs(msgs) do
+			msgs[i] = string.pack(">s2", msg)
+		end
+		socket.write(fd, table.concat(msgs))
+	end)
+end)
+
+else
+
+local function syscalls()
+	local f = io.open "/proc/self/io"
+	local rw = 0
+	if f then
+		local s = f:read "a"
+		f:close()
+		rw = tonumber(s:match "syscr: (%d+)") + tonumber(s:match "syscw: (%d+)")
+	end
+	return rw
+end
+
+local function bench(name, port, request)
+	local finish = 0
+	local co = coroutine.running()
+	local rw = syscalls()
+	local start = skynet.now()
+	for i=1,client do
+		skynet.fork(function()
+			local fd = assert(socket.open("127.0.0.1", port))
+			request(fd)
+			socket.close(fd)
+			finish = finish + 1
+			if finish == client then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait()
+	local ti = (skynet.now() - start) / 100
+	local n = client * round
+	local rw2 = syscalls()
+	print(string.format("%s : %d clients * %d rounds (%d bytes), %.2fs, %d qps, syscalls/op rw %.2f",
+		name, client, round, size, ti, math.floor(n / (ti > 0 and ti or 0.01)), (rw2 - rw) / n))
+end
+
+local function echo_test()
+	local server = skynet.newservice(SERVICE_NAME, "echoserver")
+	skynet.call(server, "lua")
+	local msg = string.rep("x", size)
+	bench("echo", ECHO_PORT, function(fd)
+		for i=1,round do
+			socket.write(fd, msg)
+			assert(socket.read(fd, size) == msg)
+		end
+	end)
+end
+
+local function gate_bench(name, port)
+	if batch then
+		name = name .. " (batch)"
+	end
+	local msg = string.rep("x", size)
+	local pack = string.pack(">s2", msg)
+	bench(name, port, function(fd)
+		for i=1,round do
+			socket.write(fd, pack)
+			assert(socket.read(fd, 2 + size) == pack)
+		end
+	end)
+	local pipeline = 8
+	local packs = {}
+	for i=1,pipeline do
+		packs[i] = string.pack(">s2", string.rep(string.char(64+i), size))
+	end
+	packs = table.concat(packs)
+	bench(name .. " pipeline x" .. pipeline, port, function(fd)
+		for i=1,round // pipeline do
+			socket.write(fd, packs)
+			assert(socket.read(fd, #packs) == packs)
+		end
+	end)
+end
+
+local function gate_test()
+	local agent = skynet.newservice(SERVICE_NAME, "agent")
+	local gate = skynet.newservice("gate")
+	skynet.dispatch("lua", function(_,_, cmd, subcmd, fd)
+		if cmd == "socket" and subcmd == "open" then
+			skynet.call(gate, "lua", "forward", fd, fd, agent)
+		end
+	end)
+	skynet.call(gate, "lua", "open", {
+		address = "127.0.0.1",
+		port = GATE_PORT,
+		maxclient = client,
+		nodelay = true,
+		batch = batch,
+		watchdog = skynet.self(),
+	})
+	gate_bench("gate", GATE_PORT)
+end
+
+local function cgate_test()
+	local agent = skynet.newservice(SERVICE_NAME, "agent")
+	local gate = skynet.launch("gate", "S", skynet.address(skynet.self()), "127.0.0.1:" .. CGATE_PORT, 0, client, 0, batch and 1 or 0)
+	-- watchdog : "fd open ...", forward the packages of fd to the agent with source = fd
+	skynet.register_protocol {
+		name = "text",
+		id = skynet.PTYPE_TEXT,
+		pack = function(text) return text end,
+		unpack = skynet.tostring,
+		dispatch = function(_, _, msg)
+			local fd, cmd = msg:match "(%d+) (%a+)"
+			if cmd == "open" then
+				driver.nodelay(tonumber(fd))
+				skynet.send(gate, "text", string.format("forward %s :%08x :%08x", fd, agent, fd))
+				skynet.send(gate, "text", "start " .. fd)
+			end
+		end
+	}
+	gate_bench("cgate", CGATE_PORT)
+end
+
+skynet.start(function()
+	if mode == "gate" then
+		gate_test()
+	elseif mode == "cgate" then
+		cgate_test()
+	else
+		echo_test()
+	end
+	skynet.abort()
+end)
+
+end
@@ -1,6 +1,8 @@
 local skynet = require "skynet"
 local socket = require "socket"
 
+local mode, count, size = ...
+
 local function server()
 	local host
 	host = socket.udp(function(str, from)
@@ -19,7 +21,48 @@ local function client()
 	end
 end
 
+-- testudp bench [count] [size] : pps of udp echo, compare the syscalls with `strace -c -f`
+local function bench()
+	count = tonumber(count) or 100000
+	size = tonumber(size) or 32
+	local window = 256	-- datagrams in flight, more would overflow the kernel buffer
+	local host
+	host = socket.udp(function(str, from)
+		socket.sendto(host, from, str)
+	end, "127.0.0.1", 8766)
+	local msg = string.rep("x", size)
+	local sent, recv = 0, 0
+	local c
+	c = socket.udp(function(str, from)
+		recv = recv + 1
+		if sent < count then
+			sent = sent + 1
+			socket.write(c, msg)
+		end
+	end)
+	socket.udp_connect(c, "127.0.0.1", 8766)
+	local start = skynet.now()
+	for i=1,math.min(window, count) do
+		sent = sent + 1
+		socket.write(c, msg)
+	end
+	local last
+	repeat
+		last = recv
+		skynet.sleep(50)
+	until last == recv	-- finished or lost
+	local ti = (skynet.now() - start - 50) / 100
+	print(string.format("udp echo : %d datagrams (%d bytes), recv %d, %.2fs, %d pps",
+		count, size, recv, ti, math.floor(recv * 2 / (ti > 0 and ti or 0.01))))
+	socket.close(c)
+	socket.close(host)
+end
+
 skynet.start(function()
-	skynet.fork(server)
-	skynet.fork(client)
+	if mode == "bench" then
+		skynet.fork(bench)
+	else
+		skynet.fork(server)
+		skynet.fork(client)
+	end
 end)
@@ -0,0 +1,69 @@
+local skynet = require "skynet"
+local socket = require "socket"
+
+-- testunix [round] [size]
+-- ping-pong and bulk transfer over loopback tcp and unix domain socket ("unix:/path"),
+-- the path of a listening unix socket can't be taken over, and it's removed when the socket closes
+
+local round, size = ...
+round = tonumber(round) or 20000
+size = tonumber(size) or 64
+
+local TCP = "127.0.0.1:8950"
+local UNIX = "unix:/tmp/skynet_testunix.sock"
+local BULK = 256	-- M
+
+local function echo(id, addr)
+	socket.start(id)
+	while true do
+		local str = socket.read(id)
+		if str then
+			socket.write(id, str)
+		else
+			socket.close(id)
+			return
+		end
+	end
+end
+
+local function bench(name, address)
+	local lid = socket.listen(address)
+	socket.start(lid, function(id, addr)
+		skynet.fork(echo, id, addr)
+	end)
+	if address == UNIX then
+		assert(not pcall(socket.listen, address), "listen the same path again")
+	end
+	local fd = assert(socket.open(address))
+	local msg = string.rep("x", size)
+	local ti = skynet.now()
+	for i = 1, round do
+		socket.write(fd, msg)
+		assert(socket.read(fd, size) == msg)
+	end
+	ti = (skynet.now() - ti) / 100
+	print(string.format("%s ping-pong : %d rounds of %d bytes, %.2fs, %d rtt/s", name, round, size, ti, math.floor(round / (ti > 0 and ti or 0.01))))
+
+	local block = string.rep("x", 1024 * 1024)
+	ti = skynet.now()
+	skynet.fork(function()
+		for i = 1, BULK do
+			socket.write(fd, block)
+		end
+	end)
+	local n = 0
+	while n < BULK * #block do
+		n = n + #assert(socket.read(fd))
+	end
+	ti = (skynet.now() - ti) / 100
+	print(string.format("%s echo : %d M, %.2fs, %.1f M/s", name, BULK, ti, BULK / (ti > 0 and ti or 0.01)))
+	socket.close(fd)
+	socket.close(lid)
+end
+
+skynet.start(function()
+	bench("tcp", TCP)
+	bench("unix", UNIX)
+	assert(io.open(UNIX:sub(6)) == nil, "unlink the path")
+	print("unix path ok")
+end)
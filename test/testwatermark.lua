@@ -0,0 +1,115 @@
+local skynet = require "skynet"
+local socket = require "socket"
+
+-- The client doesn't read, so the send buffer of the server side grows up.
+-- pause : the server should get a pause warning (size > 0) above the high watermark,
+--	and a resume warning (size == 0) after the client reads all.
+-- drop : the low priority packages (socket.lwrite) above the limit are dropped.
+-- close : the socket is closed when the send buffer reaches the limit.
+
+local PORT = 8955
+local CHUNK = string.rep("x", 64 * 1024)
+local TOTAL = 256	-- 256 * 64K = 16M, more than the kernel buffer
+local LIMIT = 1024 * 1024
+
+local server = {}
+
+function server.pause(id, state)
+	socket.watermark(id, 256 * 1024, 1024 * 1024)
+	socket.warning(id, function(id, size)
+		print("warning", id, size)
+		if size > 0 then
+			state.paused = true
+		elseif state.paused then
+			state.resumed = true
+		end
+	end)
+	for i=1,TOTAL do
+		socket.write(id, CHUNK)
+	end
+	-- the resume warning is not sent if the socket is closed when the buffer drains
+	while not state.resumed do
+		skynet.sleep(10)
+	end
+	socket.close(id)
+end
+
+function server.drop(id, state)
+	socket.watermark(id, 0, 0, LIMIT, "drop")
+	for i=1,TOTAL do
+		socket.lwrite(id, CHUNK)
+	end
+	state.done = true
+	socket.close(id)
+end
+
+function server.close(id, state)
+	socket.watermark(id, 0, 0, LIMIT, "close")
+	for i=1,TOTAL do
+		socket.write(id, CHUNK)
+	end
+	state.done = true
+	-- closed by the socket thread, socket.block returns false at once if the close message comes first
+	state.closed = not socket.block(id)
+	socket.close(id)
+end
+
+local function test_pause(fd, state)
+	while not state.paused do
+		skynet.sleep(10)
+	end
+	print("paused")
+	local n = 0
+	while n < TOTAL * #CHUNK do
+		local s = assert(socket.read(fd))
+		n = n + #s
+	end
+	while not state.resumed do
+		skynet.sleep(10)
+	end
+	print("resumed, read", n)
+end
+
+local function test_drop(fd, state)
+	while not state.done do
+		skynet.sleep(10)
+	end
+	local s = socket.readall(fd)
+	-- whole packages are dropped, the kernel buffer and the limit keep the others
+	assert(#s < TOTAL * #CHUNK and #s % #CHUNK == 0, #s)
+	print("drop, read", #s)
+end
+
+local function test_close(fd, state)
+	while not state.done do
+		skynet.sleep(10)
+	end
+	local s = socket.readall(fd)
+	assert(#s < TOTAL * #CHUNK, #s)
+	while state.closed == nil do
+		skynet.sleep(10)
+	end
+	assert(state.closed)
+	print("closed, read", #s)
+end
+
+skynet.start(function()
+	local mode, state
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		server[mode](id, state)
+	end)
+
+	local function run(name, f)
+		mode, state = name, {}
+		local fd = assert(socket.open("127.0.0.1", PORT))
+		f(fd, state)
+		socket.close(fd)
+	end
+
+	run("pause", test_pause)
+	run("drop", test_drop)
+	run("close", test_close)
+	socket.close(lid)
+end)
@@ -0,0 +1,71 @@
+local skynet = require "skynet"
+local socket = require "socket"
+
+-- testzerocopy [package size(M)] [total(M)]
+-- Send total M by packages with and without socket.zerocopy, print the cpu time (os.clock of the process) per G.
+-- The sender closes the socket right after writing, so the socket server must keep the buffers until sent.
+-- Note : loopback copies the zerocopy pages when the receiver reads, test it across machines for the real cost.
+
+local size, total = ...
+size = (tonumber(size) or 4) * 1024 * 1024
+total = (tonumber(total) or 1024) * 1024 * 1024
+
+local PORT = 8940
+
+local function package(i)
+	local head = string.format("%08d", i)
+	return head .. string.rep(string.char(i % 256), size - #head)
+end
+
+local function bench(name, zerocopy)
+	local n = total // size
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id)
+		socket.start(id)
+		if zerocopy then
+			socket.zerocopy(id)
+		end
+		-- pause when there are 8 packages in send buffer
+		local paused
+		socket.watermark(id, size * 2, size * 8)
+		socket.warning(id, function(id, sz)
+			paused = sz > 0
+		end)
+		local p = package(0)
+		for i = 1, n - 1 do
+			socket.write(id, p)
+			while paused do
+				skynet.sleep(1)
+			end
+		end
+		socket.write(id, package(n))
+		socket.close(id)
+	end)
+	local fd = assert(socket.open("127.0.0.1", PORT))
+	local ti = skynet.now()
+	local cpu = os.clock()
+	local recv = 0
+	local last
+	while true do
+		local s = socket.read(fd)
+		if not s then
+			break
+		end
+		recv = recv + #s
+		last = s
+	end
+	cpu = os.clock() - cpu
+	ti = (skynet.now() - ti) / 100
+	socket.close(fd)
+	socket.close(lid)
+	assert(recv == n * size, recv)
+	assert(last:sub(-1) == string.char(n % 256))
+	local g = recv / (1024 * 1024 * 1024)
+	print(string.format("%s : %d M, %.2fs, %.1f M/s, cpu %.2fs per G",
+		name, recv // (1024 * 1024), ti, recv / (1024 * 1024) / (ti > 0 and ti or 0.01), cpu / g))
+end
+
+skynet.start(function()
+	bench("copy", false)
+	bench("zerocopy", true)
+end)